@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <glm/glm.hpp>
+#include "MappedFile.h"
+#include "PBFComputeSystem.h"
+
+// Binary checkpoint of the full simulator state, for resuming long runs.
+//
+//   [CheckpointHeader, 320 bytes][zero padding][numParticles x Particle][zero padding]
+//
+// Everything is stored little-endian in the in-memory layout, the particle records
+// start at a 64-byte aligned offset and are byte for byte the particle SSBO, so a
+// mapped file is uploaded straight to the solver without parsing or copying.
+// Readers reject files of another version or byte order instead of converting them.
+
+constexpr uint32_t CHECKPOINT_VERSION = 2;
+constexpr uint32_t CHECKPOINT_ENDIAN_TAG = 0x01020304u;
+constexpr size_t CHECKPOINT_ALIGNMENT = 64;
+
+struct CheckpointHeader {
+    char magic[8];                  // "PBFCKPT" and a terminating zero
+    uint32_t version;
+    uint32_t endianTag;             // CHECKPOINT_ENDIAN_TAG as written by the host
+    uint32_t headerBytes;           // sizeof(CheckpointHeader)
+    uint32_t particleStride;        // sizeof(Particle)
+    uint64_t numParticles;
+    uint64_t particleOffset;        // multiple of CHECKPOINT_ALIGNMENT
+    uint64_t fileBytes;
+
+    // PBFSystem state
+    int32_t frameCount;
+    int32_t warmupFrames;
+    uint32_t sceneType;             // SceneType
+    uint32_t waveModeActive;
+    float waveTime;
+    float waveAmplitude;
+    float waveFrequency;
+    glm::vec4 originalMinBoundary;  // wave mode moves minBoundary.z away from this
+    SimParams params;               // unscaled gravity, minBoundary as of the checkpoint
+
+    // Grid configuration
+    glm::ivec3 gridDim;             // ceil((maxBoundary - minBoundary) / cellSize)
+    uint32_t reorderInterval;
+    glm::vec4 gridOrigin;           // minBoundary
+    uint32_t neighborListCapacity;
+    uint32_t gridMode;              // GridMode, 0 (dense) in files written before it existed
+
+    // Adaptive substeps (PBFSystem::cflNumber), all 0 in files written before them
+    float cflNumber;
+    float minSubstepDt;
+    float maxSubstepDt;
+
+    // Density solver (PBFSystem::solverSettings) and grid build, since version 2
+    uint32_t solver;                // ConstraintSolver
+    uint32_t minIterations;
+    uint32_t maxIterations;
+    float tolerance;
+    float maxErrorTolerance;
+    uint32_t chebyshev;
+    float spectralRadius;
+    uint32_t chebyshevDelay;
+    float lambdaWarmStart;
+    uint32_t multigridCycles;
+    float coarseCellSize;
+    float maxCoarseDisplacement;
+    float estimatedSpectralRadius;  // running estimate of the solver when spectralRadius is 0
+    uint32_t gridEpochStamping;
+    uint32_t lambdaSumsValid;       // Particle::lambdaSum holds the last step's lambda, 0 = restart the warm start
+    uint32_t reserved;              // zero
+};
+
+static_assert(sizeof(CheckpointHeader) == 320, "the checkpoint header layout is part of the file format");
+static_assert(sizeof(CheckpointHeader) % CHECKPOINT_ALIGNMENT == 0, "particle records must start aligned");
+static_assert(sizeof(Particle) == 80, "the checkpoint stores raw particle SSBO records");
+
+// Fills the magic, version and layout fields; the state fields are left zero
+CheckpointHeader makeCheckpointHeader(size_t numParticles);
+
+// Writes header and particles to path + ".tmp" and renames it over path, so a run
+// preempted while writing keeps its previous checkpoint. False on I/O errors
+bool writeCheckpoint(const std::string& path, const CheckpointHeader& header, const Particle* particles);
+
+// A mapped checkpoint; the particles stay valid until close() or destruction
+class CheckpointFile {
+public:
+    // Maps and validates the file, false with a message when it is not a readable checkpoint
+    bool open(const std::string& path);
+    void close() { file.close(); }
+
+    const CheckpointHeader& getHeader() const { return *reinterpret_cast<const CheckpointHeader*>(file.getData()); }
+    const Particle* getParticles() const { return reinterpret_cast<const Particle*>(file.getData() + getHeader().particleOffset); }
+    size_t getNumParticles() const { return (size_t)getHeader().numParticles; }
+
+private:
+    MappedFile file;
+};
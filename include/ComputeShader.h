@@ -21,7 +21,11 @@ public:
 
     void setBool(const std::string& name, bool value) const;
     void setInt(const std::string& name, int value) const;
+    // uint uniforms need glUniform1ui, glUniform1i on them is GL_INVALID_OPERATION
+    void setUInt(const std::string& name, unsigned int value) const;
     void setFloat(const std::string& name, float value) const;
     void setVec3(const std::string& name, float x, float y, float z) const;
+    void setIVec3(const std::string& name, int x, int y, int z) const;
+    void setVec4(const std::string& name, float x, float y, float z, float w) const;
     void setMat4(const std::string& name, const glm::mat4& mat) const;
 };
\ No newline at end of file
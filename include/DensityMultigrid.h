@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Coarse-grid density correction shared by both backends.
+//
+// The particles' compression error max(density / restDensity - 1, 0) is restricted to a
+// cell-centred lattice over the boundary box by averaging it per cell. On that lattice
+//
+//   laplace(phi) = error,   phi = 0 in cells without particles (free surface),
+//                           d phi / dn = 0 at the box walls
+//
+// is solved with geometric multigrid V-cycles: red-black Gauss-Seidel smoothing, the
+// residual averaged over 2x2x2 children onto the next level and its correction added
+// back to the children. A cell of a coarser level only holds fluid when all its
+// children do; counting partly filled cells as fluid moves the free surface outwards
+// on every level and the cycles diverge.
+// The displacement grad(phi) spreads each cell's excess volume towards the surface
+// in one solve, however many particle layers lie in between; it is interpolated
+// trilinearly back to the particles (prolongation), and the local Jacobi passes that
+// follow clean up what the coarse lattice cannot resolve.
+//
+// The lattice is small (a few cells per smoothing length), so it is solved on one
+// thread; the GPU backend only reads the per-cell sums back and uploads the gradients.
+class DensityMultigrid {
+public:
+    // Lattice of cellSize cells covering the box, rebuilt only when the box or cell changes
+    void configure(const glm::vec3& minBoundary, const glm::vec3& maxBoundary, float cellSize);
+
+    const glm::ivec3& getDims() const { return levels[0].dims; }
+    const glm::vec3& getOrigin() const { return origin; }
+    float getCellSize() const { return levels[0].cellSize; }
+    size_t getNumCells() const { return levels[0].fluid.size(); }
+    size_t getNumLevels() const { return levels.size(); }
+
+    // Cell of a position, clamped to the lattice; the same mapping as coarse_restrict.comp
+    unsigned int getCellIndex(const glm::vec3& pos) const;
+
+    // Solves for the restricted error: errorSums[c] / counts[c] is the mean error of the
+    // particles binned into cell c. Returns the residual after the cycles relative to the
+    // right-hand side, 0 when no cell is compressed
+    float solve(const float* errorSums, const unsigned int* counts, unsigned int vCycles);
+
+    // grad(phi) at the cell centres, xyz; zero until the first solve
+    const std::vector<glm::vec4>& getGradients() const { return gradients; }
+    // Trilinear interpolation of the cell gradients, mirrored in coarse_correction.comp
+    glm::vec3 sampleGradient(const glm::vec3& pos) const;
+
+private:
+    struct Level {
+        glm::ivec3 dims;
+        float cellSize;
+        std::vector<uint8_t> fluid;
+        std::vector<float> phi;
+        std::vector<float> rhs;
+        std::vector<float> residual;
+    };
+
+    void vCycle(size_t level);
+    // Red-black Gauss-Seidel, the two colours in the given order
+    void smooth(Level& level, unsigned int sweeps, bool redFirst);
+    void computeResidual(Level& level);
+    void restrictResidual(const Level& fine, Level& coarse);
+    void prolongCorrection(const Level& coarse, Level& fine);
+    void computeGradients();
+
+    std::vector<Level> levels;
+    std::vector<glm::vec4> gradients;
+    glm::vec3 origin = glm::vec3(0.0f);
+    glm::vec3 boxSize = glm::vec3(0.0f);
+};
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <glm/glm.hpp>
+#include "MappedFile.h"
+#include "PBFComputeSystem.h"
+
+// Per-frame particle cache for offline rendering and replay.
+//
+//   [FrameCacheHeader][frame record]...[frame record][FrameCacheIndexEntry x numFrames]
+//
+// A frame record is a FrameRecordHeader, the LZ compressed colours when the frame
+// carries them, and the LZ compressed payload: positions quantised to 16 bits inside
+// the frame's boundary box and, optionally, velocities quantised to 16 bits of the
+// frame's largest component, one plane per axis. Codes are stored as the difference
+// to the previous frame (to zero on keyframes) and byte shuffled, so particles that
+// barely move cost little after LZ. Colours are written with the first frame and
+// again only when the particle count changes, which also forces a keyframe.
+// The index at the end is written on close; a cache cut short by a crash is still
+// readable, the reader then rebuilds the index by walking the records.
+
+constexpr uint32_t FRAME_CACHE_VERSION = 1;
+constexpr uint32_t FRAME_CACHE_ENDIAN_TAG = 0x01020304u;
+
+struct FrameCacheHeader {
+    char magic[8];                  // "PBFCACHE", not terminated
+    uint32_t version;
+    uint32_t endianTag;             // FRAME_CACHE_ENDIAN_TAG as written by the host
+    uint32_t flags;                 // FRAME_CACHE_VELOCITIES
+    uint32_t keyframeInterval;
+    uint64_t numFrames;             // 0 until the index is written
+    uint64_t indexOffset;           // 0 until the index is written
+    float particleRadius;           // for replay, 0 when unknown
+    float dt;                       // simulated time between frames, 0 when unknown
+    uint32_t reserved[4];
+};
+
+struct FrameRecordHeader {
+    uint32_t magic;                 // FRAME_RECORD_MAGIC
+    uint32_t flags;                 // FRAME_RECORD_KEYFRAME, FRAME_RECORD_COLORS
+    int32_t frame;                  // simulation frame number
+    uint32_t numParticles;
+    glm::vec3 boxMin;               // quantisation box of the positions
+    glm::vec3 boxMax;
+    float velocityScale;            // largest velocity component, 0 without velocities
+    uint32_t colorBytes;            // compressed colours following this header, 0 if none
+    uint32_t payloadBytes;          // compressed payload following the colours
+    uint32_t payloadRawBytes;
+    uint32_t recordBytes;           // header, colours, payload and padding to the next record
+    uint32_t reserved;
+};
+
+struct FrameCacheIndexEntry {
+    int32_t frame;
+    uint32_t keyframe;              // index of the keyframe this frame's deltas start from
+    uint64_t offset;                // of the FrameRecordHeader
+    uint64_t colorOffset;           // of the record whose colours apply to this frame
+    uint32_t recordBytes;
+    uint32_t reserved;
+};
+
+constexpr size_t FRAME_RECORD_ALIGNMENT = 64;    // records start on cache lines of the mapping
+constexpr uint32_t FRAME_CACHE_VELOCITIES = 1u;
+constexpr uint32_t FRAME_RECORD_MAGIC = 0x46464250u;   // "PBFF"
+constexpr uint32_t FRAME_RECORD_KEYFRAME = 1u;
+constexpr uint32_t FRAME_RECORD_COLORS = 2u;
+
+static_assert(sizeof(FrameCacheHeader) == 64, "the cache header layout is part of the file format");
+static_assert(sizeof(FrameRecordHeader) == 64, "the record header layout is part of the file format");
+static_assert(sizeof(FrameCacheIndexEntry) == 32, "the index layout is part of the file format");
+
+struct FrameCacheOptions {
+    bool velocities = false;
+    unsigned int keyframeInterval = 16;    // frames between keyframes, bounds the cost of a seek
+    float particleRadius = 0.0f;            // stored for replay
+    float dt = 0.0f;
+};
+
+// Streams frames to a cache file. submitFrame quantises the particles into one of
+// two frame buffers and returns; a background thread delta encodes, compresses
+// and writes them in submission order. The caller only waits when both buffers are
+// still queued, i.e. when the disk cannot keep up with the simulation.
+class FrameCacheWriter {
+public:
+    FrameCacheWriter() = default;
+    ~FrameCacheWriter();
+
+    FrameCacheWriter(const FrameCacheWriter&) = delete;
+    FrameCacheWriter& operator=(const FrameCacheWriter&) = delete;
+
+    // Truncates path, writes the header and starts the writer thread
+    bool open(const std::string& path, const FrameCacheOptions& options = FrameCacheOptions());
+    // Writes the queued frames and the index, patches the header and joins the writer.
+    // False when any write failed
+    bool close();
+    bool isOpen() const { return writer.joinable(); }
+    const std::string& getPath() const { return path; }
+
+    // Producer side, one thread. Positions outside [minBoundary, maxBoundary] are clamped
+    void submitFrame(int frame, const Particle* particles, size_t count, const glm::vec4& minBoundary, const glm::vec4& maxBoundary);
+
+    uint64_t getFramesWritten() const { return framesWritten.load(std::memory_order_relaxed); }
+    uint64_t getBytesWritten() const { return bytesWritten.load(std::memory_order_relaxed); }
+    uint64_t getRawBytes() const { return rawBytes.load(std::memory_order_relaxed); }    // as 80-byte Particle records
+    uint64_t getStalls() const { return stalls; }     // submits that waited for a free buffer
+
+private:
+    struct FrameBuffer {
+        FrameRecordHeader header;
+        std::vector<uint16_t> codes;        // 3 or 6 planes of numParticles codes
+        std::vector<glm::vec3> colors;      // only when header.flags has FRAME_RECORD_COLORS
+        bool queued = false;
+    };
+
+    void writerLoop();
+    bool writeFrame(FrameBuffer& buffer);
+
+    FrameCacheOptions options;
+    std::string path;
+    std::ofstream file;
+
+    FrameBuffer buffers[2];
+    unsigned int nextSubmit = 0;            //producer's next buffer
+    unsigned int nextWrite = 0;             //writer's next buffer
+    uint32_t lastCount = 0;                 //particle count of the previous submit
+
+    //writer thread state
+    std::vector<uint16_t> previousCodes;
+    std::vector<uint8_t> shuffled;
+    std::vector<uint8_t> compressedColors;
+    std::vector<uint8_t> compressed;
+    std::vector<uint32_t> hashTable;        //of the LZ matcher
+    std::vector<FrameCacheIndexEntry> index;
+    uint64_t fileOffset = 0;
+    uint64_t colorOffset = 0;
+    uint32_t keyframe = 0;
+    bool failed = false;
+
+    std::thread writer;
+    std::mutex mutex;
+    std::condition_variable queueCondition;     //a buffer was queued or stop requested
+    std::condition_variable freeCondition;      //a buffer was written
+    bool stopping = false;
+
+    std::atomic<uint64_t> framesWritten{ 0 };
+    std::atomic<uint64_t> bytesWritten{ 0 };
+    std::atomic<uint64_t> rawBytes{ 0 };
+    uint64_t stalls = 0;
+};
+
+// Random access to a mapped cache. Not thread safe, one decoder state per reader.
+class FrameCacheReader {
+public:
+    // Maps the file and loads or rebuilds the index, false when it is not a readable cache
+    bool open(const std::string& path);
+    void close();
+    bool isOpen() const { return file.isOpen(); }
+
+    size_t getNumFrames() const { return index.size(); }
+    const FrameCacheIndexEntry& getEntry(size_t i) const { return index[i]; }
+    const FrameRecordHeader& getRecord(size_t i) const;
+    bool hasVelocities() const { return (header.flags & FRAME_CACHE_VELOCITIES) != 0; }
+    const FrameCacheHeader& getHeader() const { return header; }
+
+    // Decodes frame i into particles: position, predictedPosition = position, velocity
+    // (zero without velocities) and color; density and lambda are zero. The next frame
+    // decodes from the previous one, any other frame from its keyframe.
+    bool decodeFrame(size_t i, std::vector<Particle>& particles);
+
+    // Asks the OS to read frame i's record ahead of decodeFrame
+    void prefetch(size_t i) const;
+
+private:
+    bool rebuildIndex();
+    bool decodeCodes(size_t i);
+
+    MappedFile file;
+    FrameCacheHeader header;
+    std::vector<FrameCacheIndexEntry> index;
+
+    std::vector<uint16_t> codes;            //of frame decoded
+    std::vector<uint8_t> shuffled;
+    std::vector<glm::vec3> colors;
+    size_t decoded = SIZE_MAX;
+    uint64_t colorsOffset = 0;              //record the colors were read from
+};
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Read-only memory mapping of a whole file (mmap, or a file mapping on Windows).
+// The pages are loaded by the OS on first touch, so opening costs nothing per byte.
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // False when the file cannot be opened or is empty
+    bool open(const std::string& path);
+    void close();
+
+    bool isOpen() const { return data != nullptr; }
+    const uint8_t* getData() const { return data; }
+    size_t getSize() const { return size; }
+
+    // Asks the OS to read [offset, offset + bytes) ahead of use, a hint only
+    void prefetch(size_t offset, size_t bytes) const;
+
+private:
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+#if defined(_WIN32)
+    void* fileHandle = nullptr;
+    void* mappingHandle = nullptr;
+#endif
+};
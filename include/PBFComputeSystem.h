@@ -4,6 +4,13 @@
 #include <glm/glm.hpp>
 #include <vector>
 #include "ComputeShader.h"
+#include "DensityMultigrid.h"
+#include "SphKernels.h"
+#include "StageProfiler.h"
+#include "ThreadPool.h"
+#include "UniformGrid.h"
+
+class PBFCpuSolver;
 
 // This struct must exactly match the GPU shader struct layout
 struct Particle {
@@ -17,7 +24,8 @@ struct Particle {
     float padding4;      // 60-63 bytes
     float density;       
     float lambda;        
-    glm::vec2 padding5;
+    float lambdaSum;     // lambda applied over the last step, warm starts the next one
+    float padding5;
 };
 
 //struct must match the layout in your compute shader
@@ -54,22 +62,104 @@ struct SimParams {
     float _pad6;
 };
 
+// Layout of the GridParams block in pbf_grid.glsl (uniform binding 1)
+struct GridParams {
+    glm::vec4 origin;           // corner of lattice cell (0,0,0), minBoundary
+    glm::ivec4 offset;          // first lattice cell of a fitted grid
+    glm::ivec4 dimMode;         // cells per axis (dense, fitted), w = GridMode
+    unsigned int numCells;      // cellStart/cellEnd entries: dense cells or hash slots
+    unsigned int slotMask;      // numCells - 1 when hashed
+    unsigned int epoch;         // 1..255 stamps the counts of a build, 0 clears them first
+    unsigned int _pad1;
+};
+
+// How applyPositionUpdate passes read their neighbours. Jacobi corrects every particle from
+// the positions of the previous pass. ColoredGaussSeidel sweeps the grid cells one parity
+// colour at a time (UniformGrid::getCellColor), so corrections see the neighbours already
+// moved in the same pass without two writers of one colour sharing a neighbour
+enum class ConstraintSolver {
+    Jacobi = 0,
+    ColoredGaussSeidel = 1
+};
+
+// "jacobi" or "gauss-seidel"
+const char* constraintSolverName(ConstraintSolver solver);
+bool parseConstraintSolver(const char* name, ConstraintSolver& solver);
+
+// Density constraint loop of step(). With tolerance 0 every step runs maxIterations.
+// Otherwise the compression error max(rho / rho0 - 1, 0) of the current positions is
+// reduced after every density pass, and the loop stops before the position update once
+// its average is below tolerance (and its maximum below maxErrorTolerance when that is set).
+// With chebyshev the position updates after the first chebyshevDelay local passes (at least 1,
+// not counting a coarse correction) are extrapolated by the Chebyshev semi-iterative weights of
+// Wang 2015 for the given Jacobi spectral radius; 0 estimates it from the error ratio of the
+// plain iterations, averaged over steps. Jacobi solver only
+struct DensitySolverSettings {
+    ConstraintSolver solver = ConstraintSolver::Jacobi;
+    unsigned int minIterations = 1;
+    unsigned int maxIterations = 4;
+    float tolerance = 0.0f;
+    float maxErrorTolerance = 0.0f;
+    bool chebyshev = false;
+    float spectralRadius = 0.0f;
+    unsigned int chebyshevDelay = 2;
+    // Share of the lambda each particle had applied over the previous step that is added to its
+    // lambda in the first iteration, where it is still compressed (Particle::lambdaSum). 0 = off
+    float lambdaWarmStart = 0.0f;
+    // V-cycles of a coarse-grid correction (DensityMultigrid) that takes the place of the
+    // first position update of a step, 0 = off. The lattice cells are coarseCellSize smoothing
+    // lengths wide, and no particle moves further than maxCoarseDisplacement particle radii
+    unsigned int multigridCycles = 0;
+    float coarseCellSize = 2.0f;
+    float maxCoarseDisplacement = 1.0f;
+};
+
+// Position updates of the last step and the error at its last check, 0 when not measured
+struct DensitySolverStats {
+    unsigned int iterations = 0;
+    float maxError = 0.0f;
+    float averageError = 0.0f;
+    float spectralRadius = 0.0f;        //used by the Chebyshev weights, 0 without acceleration
+    float coarseResidual = 0.0f;        //relative residual of the coarse solve, 0 without one
+};
+
+// Where the solver stages run. GPU dispatches the .comp files, CPU runs the
+// equivalent multithreaded C++ in PBFCpuSolver and needs no GL context.
+enum class SolverBackend {
+    GPU = 0,
+    CPU = 1
+};
+
 class PBFComputeSystem {
 public:
-    PBFComputeSystem();
+    // numThreads and pinThreads are only used by the CPU backend (0 = all cores)
+    PBFComputeSystem(SolverBackend backend = SolverBackend::GPU, unsigned int numThreads = 0, bool pinThreads = false);
     ~PBFComputeSystem();
 
     bool initialize(unsigned int maxParticles, float dt, const glm::vec4& gravity, float particleRadius, float smoothingLength, const glm::vec4& minBoundary, const glm::vec4& maxBoundary, float cellSize,unsigned int maxParticlesPerCell,float restDensity, float vorticityEpsilon, float xsphViscosityCoeff);
     void uploadParticles(const std::vector<Particle>& particles);
+    // Same from any array of particle records, e.g. a mapped checkpoint
+    void uploadParticles(const Particle* particles, size_t count);
     void downloadParticles(std::vector<Particle>& particles);
     void step();
 
 	bool checkComputeShaderSupport();
 
     void applyExternalForces();
+    void reorderParticles();
     void findNeighbors();
-	void calculateDensity();
-    void applyPositionUpdate();
+    // lambdaWarmStart > 0 adds that share of Particle::lambdaSum to lambda (first iteration of a step)
+    void calculateDensity(float lambdaWarmStart = 0.0f);
+    // Particle::lambdaSum += lambda after a position update, restart on the first one of a step
+    void accumulateLambdaSums(bool restart);
+    // chebyshevOmega as in PBFCpuSolver::applyPositionUpdate, 0 for a plain Jacobi pass
+    void applyPositionUpdate(float chebyshevOmega = 0.0f);
+    // Gauss-Seidel pass of ConstraintSolver::ColoredGaussSeidel: eight dispatches on the GPU
+    void applyPositionUpdateColored();
+    // Coarse-grid correction under solverSettings: restricts the compression error of the last
+    // calculateDensity, solves on the CPU and moves the particles by the interpolated gradient.
+    // The GPU backend reads two words per lattice cell back. Returns the relative residual
+    float applyCoarseCorrection();
     void applyVorticityViscosity();
     void updateVelocity();
 
@@ -77,34 +167,192 @@ public:
     void updateSimulationParams(float dt,const glm::vec4& gravity,float particleRadius,float smoothingLength,const glm::vec4& minBoundary,const glm::vec4& maxBoundary, float cellSize, unsigned int maxParticlesPerCell, float restDensity, float vorticityEpsilon, float xsphViscosityCoeff);
 
     void recordDensityStatistics(const std::string& filename = "density_log.csv");
-    void setFrameCount(int count);
-    void logTimingData(const std::string& stage, float timeMs, int frameCount, int numParticles);
+    // Frame stamped on the timing samples of the following steps; substep goes in the
+    // Iteration column of the whole-step row
+    void setFrameCount(int count, unsigned int substep = 0);
+
+    // Largest particle speed, for choosing the step size. Reads back from the GPU
+    float computeMaxSpeed();
+    // Max and mean of max(density / restDensity - 1, 0) from the last calculateDensity.
+    // Reads back one partial sum per 256 particles from the GPU
+    void computeDensityError(float& maxError, float& averageError);
+
+    void setSolverSettings(const DensitySolverSettings& settings) { solverSettings = settings; }
+    const DensitySolverSettings& getSolverSettings() const { return solverSettings; }
+    const DensitySolverStats& getSolverStats() const { return solverStats; }
+    // Spectral radius that --chebyshev estimates over the steps when none is given, kept in checkpoints
+    void setEstimatedSpectralRadius(float rho) { estimatedSpectralRadius = rho; }
+    float getEstimatedSpectralRadius() const { return estimatedSpectralRadius; }
+    // Whether Particle::lambdaSum holds the last step's lambda; --warm-start skips it otherwise
+    void setLambdaSumsValid(bool valid) { lambdaSumsValid = valid; }
+    bool getLambdaSumsValid() const { return lambdaSumsValid; }
+
+    // Streams per-stage timings of every step() to path (.json for JSON, CSV otherwise) from a
+    // background thread. GPU stages are timed with timer queries, CPU work with steady_clock
+    bool openTimingLog(const std::string& path);
+    void closeTimingLog();
+    const TimingLog& getTimingLog() const { return timingLog; }
+    // Keeps the ms of every stage of the last step() in memory, summed over the solver
+    // iterations. Stages timed with GPU queries go to the log only and read 0
+    void setKeepStageTimes(bool keep) { profiler.setKeepFrameTotals(keep); }
+    double getStageTime(TimingStage stage) const { return profiler.getFrameTotal(stage); }
 
     GLuint getParticleBufferId() const { return particleSSBO; }
     unsigned int getNumParticles() const { return numParticles; }   
+    SolverBackend getBackend() const { return backend; }
+
+    // step() sorts the particles along the Morton curve every n steps, 0 disables it
+    void setReorderInterval(unsigned int steps) { reorderInterval = steps; }
+    unsigned int getReorderInterval() const { return reorderInterval; }
+
+    // Dense grid over the boundary box, a hashed grid whose memory and clear cost follow
+    // the particle count instead of the box volume (large or unbounded domains), or the
+    // dense grid cut down every build to the particles' bounding box
+    void setGridMode(GridMode mode);
+    GridMode getGridMode() const { return gridMode; }
+
+    // Grid builds stamp each cell's count with an 8-bit build epoch and treat older stamps
+    // as empty, so the cells are not cleared before every build; one build in 256 still
+    // clears. A hashed grid still resets its key table. On by default
+    void setGridEpochStamping(bool enabled);
+    bool getGridEpochStamping() const { return gridEpochStamping; }
+
+    // findNeighbors caches up to capacity neighbours per particle for the later stages of
+    // the step, 0 walks the grid every time. Memory is (capacity + 1) * 4 bytes per particle
+    void setNeighborListCapacity(unsigned int capacity);
+    unsigned int getNeighborListCapacity() const { return neighborListCapacity; }
+    // Particles that fell back to the grid in the last build (CPU backend only)
+    unsigned int getNeighborListOverflows() const;
+    unsigned int getNumThreads() const;
+
+    // Items per chunk of the CPU work-stealing pool, 0 lets the pool pick
+    void setGrainSize(size_t grainSize);
+    // Chunks, steals and busy time of the CPU pool since the last reset (zero on the GPU backend)
+    ThreadPoolStats getThreadPoolStats() const;
+    void resetThreadPoolStats();
+
+    // Batched kernel implementation of the CPU backend, clamped to what the CPU supports
+    void setSimdLevel(SimdLevel level);
+    SimdLevel getSimdLevel() const;
+    // nullptr on the GPU backend
+    const PBFCpuSolver* getCpuSolver() const { return cpuSolver; }
+
+    // Bins the current positions into the GL grid buffers (pbf_grid.glsl layout), so render
+    // passes can look up neighbours closer than getCellSize(). Call between steps; the CPU
+    // backend uploads its own grid. False without a GL context
+    bool buildRenderGrid();
+    // GPU backend: builds the grid of the current positions, reads cellStart/cellEnd back and
+    // compares them with a UniformGrid of the same positions; also fails on a GL error during
+    // the build. Call between steps, it waits for the GPU. Always true on the CPU backend
+    bool checkGpuGrid();
+    // Binds the params UBOs (0, 1), the particles (1) and the grid (2-4, 12) as the solver shaders see them
+    void bindRenderGrid();
+    float getCellSize() const { return params.cellSize; }
 
 private:
     void createBuffers(unsigned int maxParticles);
     void initializeGrid();
+    // Grid layout for the current params, mode and particle count; grows the cell buffers
+    // when needed and uploads the GridParams block
+    void updateGridParams();
+    void readParticleCellBounds(glm::ivec3& lo, glm::ivec3& hi);
+    void resizeCellBuffers(size_t cells, size_t keySlots);
+    // buildGrid in three parts so findNeighbors can time the clear on its own
+    void buildGrid();
+    void prepareGrid();
+    void clearGrid(bool clearKeys);
+    void sortGrid();
+    void uploadCpuGrid();
+    void bindGridBuffers();
+    void runGridPrefixSum(unsigned int cellGroups);
+    void createNeighborListBuffer();
+    void bindNeighborLists(ComputeShader* shader);
     //void bindBuffersForGridConstruction();
 
     void cleanup();
+    void syncRenderBuffer();
+    // calculateDensity / applyPositionUpdate iterations of step() under solverSettings
+    void solveDensityConstraints();
 
     ComputeShader* externalForcesShader;
     ComputeShader* constructGridShader;
     ComputeShader* clearGridShader;
+    ComputeShader* prefixSumShader;
+    ComputeShader* scatterGridShader;
+    ComputeShader* gridBoundsShader;
+    ComputeShader* maxSpeedShader;
+    ComputeShader* densityErrorShader;
+    ComputeShader* accumulateLambdaShader;
+    ComputeShader* coarseRestrictShader;
+    ComputeShader* coarseCorrectionShader;
+    ComputeShader* reorderShader;
+    ComputeShader* neighborListShader;
     ComputeShader* densityShader;
     ComputeShader* positionUpdateShader;
     ComputeShader* vorticityViscosityShader;
     ComputeShader* velocityUpdateShader;
 
     GLuint simParamsUBO;
+    GLuint gridParamsUBO;
     GLuint particleSSBO;
-    GLuint cellCountsBuffer; 
-	GLuint cellParticlesBuffer;
+    // Counting-sort grid: particles of cell c are cellParticles[cellStart[c] .. cellEnd[c])
+    GLuint cellStartBuffer;
+    GLuint cellEndBuffer;           //per cell counts while the grid is being built
+	GLuint cellParticlesBuffer;     //particle indices sorted by cell, maxParticles entries
+    GLuint particleCellsBuffer;     //(cell, rank in cell) per particle
+    GLuint scanBlockSumsBuffer;
+    GLuint cellKeysBuffer;          //hashed grid only, one entry otherwise
+    GLuint gridBoundsBuffer;        //particle cell range of a fitted build
+    GLuint maxSpeedBuffer;          //result of max_speed.comp as float bits
+    GLuint densityErrorBuffer;      //(sum, max) per work group of density_error.comp
+    std::vector<glm::vec2> densityErrorPartials;
+    GLuint chebyshevPreviousBuffer; //positions before the last position update, vec4 per particle
+    GLuint coarseCellsBuffer;       //(count, error sum in COARSE_ERROR_SCALE units) per lattice cell
+    GLuint coarseGradientBuffer;    //DensityMultigrid::getGradients, vec4 per lattice cell
+    size_t coarseCellCapacity;
+    DensityMultigrid multigrid;
+    std::vector<float> coarseErrorSums;
+    std::vector<unsigned int> coarseCounts;
+    std::vector<glm::uvec2> coarseCells;
+    GridMode gridMode;
+    bool gridEpochStamping;
+    GridParams gridParams;
+    size_t cellCapacity;            //entries allocated in cellStart/cellEnd
+    size_t keyCapacity;             //entries allocated in cellKeys
+
+    // Morton reordering: particleIdBuffer holds the upload index of the particle in each slot
+    GLuint particleIdBuffer;
+    GLuint reorderedParticleBuffer;
+    GLuint reorderedIdBuffer;
+    GLuint cellMortonRankBuffer;
+    glm::ivec3 mortonGridDim;
+    glm::ivec3 mortonGridOffset;
+    bool particlesReordered;
+    unsigned int reorderInterval;
+    unsigned int stepsSinceReorder;
+
+    GLuint neighborListBuffer;      //per particle [count, ids...], see pbf_grid.glsl
+    unsigned int neighborListCapacity;
     unsigned int numParticles;
     unsigned int maxParticles;
     SimParams params;
 
+    DensitySolverSettings solverSettings;
+    DensitySolverStats solverStats;
+    float estimatedSpectralRadius = 0.0f;
+    bool lambdaSumsValid = true;    //Particle::lambdaSum holds the last step's lambda (zero from the scenes)
+
     int currentFrame;
+    unsigned int currentSubstep;
+    TimingLog timingLog;
+    StageProfiler profiler;
+
+    SolverBackend backend;
+    unsigned int cpuThreads;
+    bool cpuPinThreads;
+    size_t cpuGrainSize;
+    SimdLevel cpuSimdLevel;
+    PBFCpuSolver* cpuSolver;
+    std::vector<Particle> renderStaging;    //AoS copy of the CPU particles for the mirror
+    bool mirrorToGL;    //CPU backend with a live GL context keeps particleSSBO updated for the renderers
 };
\ No newline at end of file
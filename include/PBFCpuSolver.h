@@ -0,0 +1,152 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "DensityMultigrid.h"
+#include "PBFComputeSystem.h"
+#include "ParticleStore.h"
+#include "SphKernels.h"
+#include "ThreadPool.h"
+#include "UniformGrid.h"
+
+// Native C++ implementation of the PBF solver stages.
+// Each stage mirrors the math of the matching .comp file so the CPU and GPU
+// backends can be swapped behind PBFComputeSystem without changing results.
+// No OpenGL calls are made here, so it runs on machines without a GL context.
+
+// Modelled bytes moved between memory and the cores by one step
+struct StepTraffic {
+    double soaBytes;    // ParticleStore arrays, what the solver actually touches
+    double aosBytes;    // the same loops over 80-byte Particle records, one cache line per neighbour
+};
+
+class PBFCpuSolver {
+public:
+    explicit PBFCpuSolver(unsigned int numThreads = 0, bool pinThreads = false);
+
+    void setParams(const SimParams& params);
+    void uploadParticles(const Particle* particles, unsigned int count);
+    void downloadParticles(std::vector<Particle>& particles) const;
+    // Storage order, without undoing reordering (render mirror)
+    void copyParticles(std::vector<Particle>& particles) const;
+
+    void applyExternalForces();
+    // Sorts particles along the Morton curve of their grid cell, see PBFComputeSystem::reorderParticles
+    void reorderParticles();
+    void findNeighbors();
+    // lambdaWarmStart > 0 adds that share of lambdaSum to the lambda of compressed particles
+    void calculateDensity(float lambdaWarmStart = 0.0f);
+    // lambdaSum += lambda after a position update, restart begins a new step's sum
+    void accumulateLambdaSums(bool restart);
+    // Jacobi position correction. chebyshevOmega > 0 keeps the positions it started from
+    // for the next call and, above 1, extrapolates the result past the ones kept by the last
+    // call: p = omega * (p - previous) + previous
+    void applyPositionUpdate(float chebyshevOmega = 0.0f);
+    // Gauss-Seidel position correction over the grid cells coloured by UniformGrid::getCellColor.
+    // One colour after the other; the particles of a cell are corrected in place in cell order
+    void applyPositionUpdateColored();
+    // Restriction for DensityMultigrid: per lattice cell the summed compression error of the
+    // last calculateDensity and the number of particles in it
+    void restrictDensityError(const DensityMultigrid& multigrid, std::vector<float>& errorSums, std::vector<unsigned int>& counts);
+    // Prolongation: moves every particle by the gradient of the last solve interpolated at its
+    // position, at most maxDisplacement, then clamps it to the box. The position at the start of the
+    // step moves by the same amount, so the correction changes where a particle is but not its velocity
+    void applyCoarseCorrection(const DensityMultigrid& multigrid, float maxDisplacement);
+    void updateVelocity();
+    void applyVorticityViscosity();
+    // Largest particle speed, a parallel max over the pool
+    float computeMaxSpeed();
+    // Max and mean compression error max(density / restDensity - 1, 0) of the last calculateDensity
+    void computeDensityError(float& maxError, float& averageError);
+
+    // Max neighbours cached per particle by findNeighbors, 0 walks the grid in every stage
+    void setNeighborListCapacity(unsigned int capacity);
+    unsigned int getNeighborListCapacity() const { return neighborListCapacity; }
+    // Particles whose neighbours did not fit in the last build, they fall back to the grid
+    unsigned int getNeighborListOverflows() const { return neighborListOverflows; }
+
+    // Dense grid over the boundary box, a hashed grid sized to the particle count, or the
+    // dense grid cut down to the particles' bounding box
+    void setGridMode(GridMode mode) { gridMode = mode; }
+    GridMode getGridMode() const { return gridMode; }
+    // Epoch-stamped grid counts instead of a clear before every build (UniformGrid)
+    void setGridEpochStamping(bool enabled) { grid.setEpochStamping(enabled); }
+
+    // Kernel implementation of the density and position update loops, clamped to what the
+    // CPU supports; the constructor picks preferredSimdLevel()
+    void setSimdLevel(SimdLevel level);
+    SimdLevel getSimdLevel() const { return kernels->level; }
+
+    // Counts the neighbour visits of the current grid/lists and prices every stage of a
+    // step for both layouts; call after a step so lambda and the lists are populated
+    StepTraffic estimateStepTraffic(int solverIterations) const;
+
+    unsigned int getNumParticles() const { return (unsigned int)store.size(); }
+    unsigned int getNumThreads() const { return pool.getNumThreads(); }
+    // Particles (or cells) per chunk handed to a thread, 0 lets the pool pick
+    void setGrainSize(size_t grainSize) { pool.setGrainSize(grainSize); }
+    ThreadPoolStats getPoolStats() const { return pool.getStats(); }
+    void resetPoolStats() { pool.resetStats(); }
+    const ParticleStore& getStore() const { return store; }
+    const std::vector<unsigned int>& getParticleIds() const { return particleIds; }
+
+    // Bins position (not predictedPosition) into the grid, for passes that run between steps
+    void rebuildGrid();
+    const UniformGrid& getGrid() const { return grid; }
+
+private:
+    // positions are the ones about to be binned, a fitted grid is sized around them
+    void configureGrid(const std::vector<glm::vec3>& positions);
+    void buildNeighborLists();
+
+    // Calls fn(neighborId) for the cached neighbours of id, or for every grid
+    // candidate around position when lists are off or the particle overflowed
+    template <typename Fn>
+    void forEachNeighbor(size_t id, const glm::vec3& position, Fn&& fn) const;
+
+    // Neighbours of id for the batch kernels: its cached list, or the grid candidates
+    // around cellPos (without id itself) copied into candidates
+    NeighborBatch getNeighborBatch(size_t id, const glm::ivec3& cellPos, std::vector<unsigned int>& candidates) const;
+    // pos moved by the density constraint and wall repulsion of particle id, not yet clamped;
+    // cellPos centres the grid walk when id has no neighbour list
+    glm::vec3 correctPosition(size_t id, const glm::vec3& pos, const glm::ivec3& cellPos, const SphKernelConstants& kernel, std::vector<unsigned int>& candidates) const;
+
+    ThreadPool pool;
+    SimParams params;
+
+    ParticleStore store;
+    std::vector<glm::vec3> scratch;   //per particle results, swapped in once the stage is done (Jacobi style)
+    std::vector<glm::vec3> chebyshevPrevious;    //positions before the last applyPositionUpdate, within a step only
+
+    // Same counting-sort layout as the GPU grid buffers
+    UniformGrid grid;
+    GridMode gridMode;
+
+    // External id of the particle stored in each slot, identity until the first reorder
+    std::vector<unsigned int> particleIds;
+    bool reordered;
+
+    glm::ivec3 mortonGridDim;
+    glm::ivec3 mortonGridOffset;
+    std::vector<unsigned int> mortonCellOrder;
+    std::vector<unsigned int> reorderIndices;
+    ParticleStore reorderBuffer;
+    std::vector<unsigned int> reorderIds;
+
+    // capacity entries per particle, neighbourCounts[id] == NEIGHBOR_LIST_OVERFLOW means use the grid
+    unsigned int neighborListCapacity;
+    unsigned int neighborListOverflows;
+    std::vector<unsigned int> neighborCounts;
+    std::vector<unsigned int> neighborLists;
+
+    // Occupied cells by colour for applyPositionUpdateColored, from the first call after a grid build
+    std::vector<unsigned int> colorCells;
+    unsigned int colorStarts[9];
+    bool cellColorsValid;
+
+    // Per-chunk lattices of restrictDensityError beyond the first
+    std::vector<float> coarseErrorPartials;
+    std::vector<unsigned int> coarseCountPartials;
+
+    const SphKernelTable* kernels;
+};
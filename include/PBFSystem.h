@@ -1,10 +1,12 @@
 ﻿#pragma once
 
+#include <string>
 #include <vector>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <Camera.h> 
 #include "PBFComputeSystem.h"
+#include "FrameCache.h"
 
 enum class SceneType {
     DamBreak = 0,            
@@ -32,6 +34,45 @@ public:
     bool computeSystemInitialized;
     PBFComputeSystem* computeSystem;
 
+    //Solver backend used when the compute system is created - Should be set before initScene()
+    SolverBackend solverBackend;
+    unsigned int solverThreads;
+    bool solverPinThreads;      //bind worker i to core i
+    unsigned int solverGrainSize;   //particles per work-stealing chunk, 0 = automatic
+    unsigned int maxParticles;
+
+    //Steps between Morton reorders of the particle storage, 0 keeps generation order
+    unsigned int reorderInterval;
+
+    //Neighbours cached per particle each step (memory budget), 0 walks the grid in every stage
+    unsigned int neighborListCapacity;
+
+    //Dense grid over the boundary box, hashed cells sized to the particle count, or the
+    //dense grid fitted to the particles every build
+    GridMode gridMode;
+
+    //Stamp grid counts with the build epoch instead of clearing every cell each build
+    bool gridEpochStamping;
+
+    //Kernel implementation of the CPU backend, defaults to preferredSimdLevel()
+    SimdLevel cpuSimdLevel;
+
+    //Adaptive substeps: every frame of dt is split into the fewest equal substeps in which the
+    //fastest particle moves at most cflNumber * particleRadius, with the substep length kept in
+    //[minSubstepDt, maxSubstepDt]. 0 runs one step of dt per frame
+    float cflNumber;
+    float minSubstepDt;
+    float maxSubstepDt;
+
+    //Density constraint iterations per step: fixed, or stopped early at a density error tolerance
+    DensitySolverSettings solverSettings;
+
+    //Per-stage timings of every step are streamed here (.json or CSV), empty = off
+    std::string timingLogPath;
+
+    //Seed for the scene jitter, 0 draws one from std::random_device
+    unsigned int randomSeed;
+
     glm::vec4 originalMinBoundary;
 
     std::vector<Particle> particles;
@@ -40,10 +81,18 @@ public:
     ~PBFSystem();
 
     void initScene(SceneType sceneType = SceneType::DamBreak);
+
+    //Changes the particle resolution of the scenes: h, cellSize and restDensity are rescaled
+    //so the same fluid volume is sampled with more or fewer particles. Call before initScene()
+    void setParticleRadius(float radius);
+
     void createDamBreakScene();
     void createWaterContainerScene();
     void dropWaterBlock();
 
+    //Switches backend at runtime, carrying the current particle state across
+    void setSolverBackend(SolverBackend backend);
+
     void toggleWaveMode();
     bool isWaveModeActive() const { return waveModeActive; }
 
@@ -54,9 +103,36 @@ public:
 
     void step();
 
+    //Writes particles, parameters, frame count, wave phase and grid configuration to a
+    //binary checkpoint (Checkpoint.h). False on I/O errors
+    bool saveCheckpoint(const std::string& path);
+    //Resumes from a checkpoint, creating the compute system if needed. The particles are
+    //uploaded straight from the mapped file and the particles vector is cleared
+    bool loadCheckpoint(const std::string& path);
+
+    int getFrameCount() const { return frameCount; }
+
+    //Substep count, substep length and the max particle speed they were picked from, of the last frame
+    int getLastSubsteps() const { return lastSubsteps; }
+    float getLastSubstepDt() const { return lastSubstepDt; }
+    float getLastMaxSpeed() const { return lastMaxSpeed; }
+    //Density constraint iterations of the last frame, summed over its substeps
+    unsigned int getLastSolverIterations() const { return lastSolverIterations; }
+
+    //Records every following step to a frame cache (FrameCache.h) until closeFrameCache().
+    //Encoding and disk writes run on the cache's own thread
+    bool openFrameCache(const std::string& path, const FrameCacheOptions& options = FrameCacheOptions());
+    bool closeFrameCache();
+    const FrameCacheWriter& getFrameCache() const { return frameCache; }
+
+    //Replaces the simulated particles by recorded ones (ReplayPlayer) without stepping,
+    //renderParticlesGPU and WaterRenderer then draw them unchanged
+    bool showParticles(const Particle* data, size_t count);
+
 private:
     void initializeComputeSystem();
     void initializeGPURendering();
+    unsigned int nextSceneSeed();
 
     unsigned int lastRenderedParticleCount = 0;
 
@@ -65,11 +141,19 @@ private:
     int frameCount;
     int warmupFrames;
 
+    int lastSubsteps = 1;
+    float lastSubstepDt = 0.0f;
+    float lastMaxSpeed = 0.0f;
+    unsigned int lastSolverIterations = 0;
+
     bool waveModeActive;
     float waveTime;
     float waveAmplitude;
     float waveFrequency;
 
+    FrameCacheWriter frameCache;
+    std::vector<Particle> cacheFrame;   //download staging, reused every step
+
     bool useGPURendering = false;
     unsigned int gpuRenderVAO = 0;
     unsigned int gpuRenderVBO = 0;
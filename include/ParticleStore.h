@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include <glm/glm.hpp>
+#include "PBFComputeSystem.h"
+
+// Structure-of-arrays particle storage for the CPU solver.
+// The solver loops only pull the arrays they use instead of whole 80-byte
+// Particle records; colour is cold data that is touched on upload, download
+// and reordering only.
+class ParticleStore {
+public:
+    // hot, read or written by the solver stages
+    std::vector<glm::vec3> position;
+    std::vector<glm::vec3> predictedPosition;
+    std::vector<glm::vec3> velocity;
+    std::vector<float> density;
+    std::vector<float> lambda;
+    std::vector<float> lambdaSum;     //lambda applied over the last step, for the warm start
+
+    // cold
+    std::vector<glm::vec3> color;
+
+    size_t size() const { return position.size(); }
+    void resize(size_t count);
+    void swap(ParticleStore& other);
+
+    void fromParticles(const Particle* particles, size_t count);
+    void storeParticle(size_t index, const Particle& particle);
+    Particle loadParticle(size_t index) const;
+
+    // dst[i] = this[order[i]] for every attribute
+    void gather(const std::vector<unsigned int>& order, size_t begin, size_t end, ParticleStore& dst) const;
+
+    // Bytes of one particle across all arrays, against sizeof(Particle) for the AoS layout
+    static size_t bytesPerParticle();
+};
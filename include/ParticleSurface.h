@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "ThreadPool.h"
+#include "UniformGrid.h"
+
+// CPU counterparts of the WaterRenderer compute passes, for checking the GPU
+// results and for processing cached frames on machines without a GL context.
+// Every query walks the 3x3x3 cells around a point, so the grid must be built
+// over the same positions with a cell size of at least the query radius.
+
+// Constants of the smoothing and WPCA anisotropy passes (Yu & Turk), defaults as in WaterRenderer
+struct AnisotropyParams {
+    float particleRadius;
+    float smoothingRadius;      // support of the (1 - d/R)^3 weights, 2.5 r
+    float lambda;               // blend towards the weighted neighbour mean when smoothing
+    float kr;                   // largest ratio between the principal axes
+    float ks;                   // covariance scale
+    float kn;                   // isotropic scale of particles with few neighbours
+    int neighborThreshold;      // neighbours needed for the WPCA (N_eps)
+
+    explicit AnisotropyParams(float particleRadius)
+        : particleRadius(particleRadius), smoothingRadius(particleRadius * 2.5f), lambda(0.9f), kr(4.0f), ks(1400.0f), kn(0.5f), neighborThreshold(25) {}
+};
+
+// Bins positions into a grid spanning their bounding box
+void buildSurfaceGrid(ThreadPool& pool, const std::vector<glm::vec3>& positions, float cellSize, UniformGrid& grid);
+
+// flags[i] = 1 when particle i has fewer than threshold other particles closer than radius,
+// the test of surface_detection.comp. False when radius exceeds the grid cell size
+bool detectSurfaceParticles(ThreadPool& pool, const UniformGrid& grid, const std::vector<glm::vec3>& positions, float radius, int threshold, std::vector<int>& flags);
+
+// Laplacian smoothing of the surface particles (smooth_centers.comp), interior ones keep their position
+bool smoothParticleCenters(ThreadPool& pool, const UniformGrid& grid, const std::vector<glm::vec3>& positions, const std::vector<int>& flags, const AnisotropyParams& params, std::vector<glm::vec3>& centers);
+
+// Kernel matrix G of every particle from the weighted PCA of its neighbours around the
+// smoothed center (anisotropy.comp); interior particles get the isotropic 1/r
+bool computeAnisotropyMatrices(ThreadPool& pool, const UniformGrid& grid, const std::vector<glm::vec3>& positions, const std::vector<int>& flags, const std::vector<glm::vec3>& centers, const AnisotropyParams& params, std::vector<glm::mat3>& matrices);
+
+// Symmetric 3x3 eigen decomposition by a fixed number of cyclic Jacobi sweeps, the same
+// rotations as anisotropy.comp. Eigenvalues descending, eigenvectors as matching columns
+void symmetricEigen3(const glm::mat3& m, glm::vec3& eigenvalues, glm::mat3& eigenvectors);
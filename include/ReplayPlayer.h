@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "FrameCache.h"
+
+// Plays a recorded frame cache back without simulating. A background thread decodes
+// the requested frame and the next prefetchFrames frames from the mapped cache into a
+// small ring of particle buffers, so sequential playback only hands out ready frames
+// and can run faster than the simulation did. Seeking looks the frame up in the cache
+// index and decodes from its keyframe, at most FrameCacheOptions::keyframeInterval frames.
+class ReplayPlayer {
+public:
+    ReplayPlayer() = default;
+    ~ReplayPlayer();
+
+    ReplayPlayer(const ReplayPlayer&) = delete;
+    ReplayPlayer& operator=(const ReplayPlayer&) = delete;
+
+    bool open(const std::string& path, unsigned int prefetchFrames = 4);
+    void close();
+    bool isOpen() const { return decoder.joinable(); }
+
+    size_t getNumFrames() const { return numFrames; }
+    // Simulation frame number of frame i
+    int getFrameNumber(size_t i) const { return reader.getEntry(i).frame; }
+    const FrameCacheHeader& getHeader() const { return reader.getHeader(); }
+
+    // Makes frame i current and moves the prefetch window to i+1..i+prefetchFrames.
+    // Returns its particles once decoded; with wait false nullptr while it is still
+    // being decoded. The pointer stays valid until the next getFrame call
+    const std::vector<Particle>* getFrame(size_t i, bool wait = true);
+
+    uint64_t getDecodedFrames() const { return decodedFrames.load(std::memory_order_relaxed); }
+    uint64_t getMisses() const { return misses.load(std::memory_order_relaxed); }     // requests that were not prefetched
+
+private:
+    struct Slot {
+        std::vector<Particle> particles;
+        size_t frame = SIZE_MAX;        //decoded frame, SIZE_MAX while free or being written
+    };
+
+    void decoderLoop();
+    // Next frame of the window that no slot holds, and a slot outside the window for it
+    bool findWork(size_t& frame, size_t& slot) const;
+    bool inWindow(size_t frame) const { return frame >= current && frame - current <= prefetch; }
+
+    FrameCacheReader reader;            //decoder thread only after open
+    size_t numFrames = 0;
+    size_t prefetch = 0;
+
+    std::vector<Slot> slots;
+    size_t current = 0;                 //frame the window starts at
+    size_t heldSlot = SIZE_MAX;         //slot last handed out by getFrame
+
+    std::thread decoder;
+    std::mutex mutex;
+    std::condition_variable workCondition;      //window moved or stop requested
+    std::condition_variable readyCondition;     //a frame was decoded
+    bool stopping = false;
+    bool failed = false;
+
+    std::atomic<uint64_t> decodedFrames{ 0 };
+    std::atomic<uint64_t> misses{ 0 };
+};
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+#include "TimingLog.h"
+
+// Times the stages of PBFComputeSystem::step into a TimingLog. CPU work is measured
+// with steady_clock. With GPU queries on, stages are bracketed by GL_TIME_ELAPSED
+// queries whose results are collected a few steps later, once the driver reports them
+// available, so timing never stalls the pipeline. Does nothing while neither a log is
+// set nor frame totals are kept.
+class StageProfiler {
+public:
+    // One timed scope, filled by begin() and consumed by end()
+    struct Scope {
+        TimingStage stage;
+        uint8_t iteration;
+        GLuint query;       //0 when measured on the CPU clock
+        std::chrono::steady_clock::time_point start;
+    };
+
+    StageProfiler();
+    ~StageProfiler();
+
+    StageProfiler(const StageProfiler&) = delete;
+    StageProfiler& operator=(const StageProfiler&) = delete;
+
+    // nullptr turns timing off. gpuQueries needs a current GL context for as long as it is on
+    void setLog(TimingLog* log, bool gpuQueries);
+    bool isEnabled() const { return log != nullptr || keepTotals; }
+
+    // Sums the CPU-clock samples of each stage since the last beginFrame, for callers that
+    // read the times of a step in process (pbf_bench) instead of from a log
+    void setKeepFrameTotals(bool keep);
+    double getFrameTotal(TimingStage stage) const { return frameTotals[(size_t)stage]; }
+
+    // Frame and particle count stamped on the following samples, also collects finished queries
+    void beginFrame(uint32_t frame, uint32_t numParticles);
+
+    // cpuClock forces steady_clock, for scopes that enclose other GPU-timed scopes
+    void begin(Scope& scope, TimingStage stage, unsigned int iteration, bool cpuClock);
+    void end(Scope& scope);
+
+    // Moves available query results into the log; wait blocks until all are in
+    void collect(bool wait);
+    // Collects what is pending and deletes the query objects, needs the GL context
+    void releaseQueries();
+
+private:
+    struct PendingQuery {
+        GLuint query;
+        TimingSample sample;
+    };
+
+    TimingLog* log;
+    bool keepTotals;
+    double frameTotals[(size_t)TimingStage::Count];
+    bool gpuQueries;
+    bool queryActive;       //GL_TIME_ELAPSED queries cannot nest
+    uint32_t frame;
+    uint32_t numParticles;
+
+    // In-flight queries in issue order, a ring over the preallocated query objects
+    std::vector<PendingQuery> pending;
+    size_t firstPending;
+    size_t numPending;
+};
+
+// Times its own lifetime as one stage of the step
+class ScopedStageTimer {
+public:
+    ScopedStageTimer(StageProfiler& profiler, TimingStage stage, unsigned int iteration = 0, bool cpuClock = false) : profiler(profiler), enabled(profiler.isEnabled()) {
+        if (enabled) profiler.begin(scope, stage, iteration, cpuClock);
+    }
+
+    ~ScopedStageTimer() {
+        if (enabled) profiler.end(scope);
+    }
+
+    ScopedStageTimer(const ScopedStageTimer&) = delete;
+    ScopedStageTimer& operator=(const ScopedStageTimer&) = delete;
+
+private:
+    StageProfiler& profiler;
+    StageProfiler::Scope scope;
+    bool enabled;
+};
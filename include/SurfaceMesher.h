@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include <glm/glm.hpp>
+#include "ThreadPool.h"
+
+// Indexed triangle mesh, counter-clockwise seen from outside the fluid
+struct SurfaceMesh {
+    std::vector<glm::vec3> vertices;
+    std::vector<glm::vec3> normals;     // unit, pointing out of the fluid
+    std::vector<unsigned int> indices;
+};
+
+struct SurfaceMesherParams {
+    float particleRadius;
+    float voxelSize;        // spacing of the density samples, 0.5 r
+    float kernelRadius;     // support of an isotropic splat, 2.5 r like the smoothing passes
+    float isoValue;         // of the density field, a lone particle has 1 at its center
+
+    explicit SurfaceMesherParams(float particleRadius)
+        : particleRadius(particleRadius), voxelSize(particleRadius * 0.5f), kernelRadius(particleRadius * 2.5f), isoValue(0.5f) {}
+};
+
+// Counters of the last SurfaceMesher::extract
+struct SurfaceMesherStats {
+    size_t occupiedBlocks;  // blocks some splat reaches
+    size_t activeBlocks;    // of those, the narrow band that is sampled and meshed
+    size_t splats;          // particle-block pairs
+    double setupMs;         // kernels, band and per-block particle lists
+    double meshMs;          // splatting and marching cubes
+    double stitchMs;        // merging the block meshes
+};
+
+// Marching cubes over a sparse density field on the CPU, for meshing cached frames.
+// Particles are splatted with (1 - q^2)^3 kernels into blocks of BLOCK_SIZE^3 cells
+// that only exist where a splat reaches; with surface flags only the blocks that a
+// surface particle reaches are sampled, so the interior of the fluid costs nothing.
+// Every block is splatted and meshed independently on the pool, its samples on the
+// shared faces are recomputed rather than exchanged, bit for bit the same, and the
+// block meshes are then stitched into one mesh: a vertex on a cube edge that several
+// blocks hold is taken from the first of those blocks.
+class SurfaceMesher {
+public:
+    static constexpr int BLOCK_SIZE = 8;
+
+    explicit SurfaceMesher(const SurfaceMesherParams& params);
+
+    // centers and matrices are the outputs of smoothParticleCenters and
+    // computeAnisotropyMatrices; when empty every particle is an isotropic splat
+    // around its position. surfaceFlags (detectSurfaceParticles) restricts the
+    // field to the narrow band around the surface particles, empty samples every
+    // occupied block. False when the domain is too large for the block directory.
+    bool extract(ThreadPool& pool, const std::vector<glm::vec3>& positions, const std::vector<glm::vec3>& centers,
+        const std::vector<glm::mat3>& matrices, const std::vector<int>& surfaceFlags, SurfaceMesh& mesh);
+
+    const SurfaceMesherParams& getParams() const { return params; }
+    const SurfaceMesherStats& getStats() const { return stats; }
+
+private:
+    // Splat of one particle: weight scale * (1 - |transform (x - center)|^2)^3,
+    // nonzero inside the sample box [lo, hi]
+    struct Splat {
+        glm::mat3 transform;
+        glm::vec3 center;
+        float scale;
+        glm::ivec3 lo, hi;
+    };
+
+    struct BlockMesh {
+        std::vector<glm::vec3> vertices;
+        std::vector<glm::vec3> normals;
+        std::vector<unsigned int> indices;              //into vertices
+        std::vector<std::pair<unsigned int, unsigned int>> shared;  //edge slot, vertex on a block face, sorted
+    };
+
+    void setupSplats(ThreadPool& pool, const std::vector<glm::vec3>& positions, const std::vector<glm::vec3>& centers, const std::vector<glm::mat3>& matrices);
+    void meshBlock(size_t block, std::vector<float>& samples, std::vector<int>& edgeVertices);
+    void stitch(ThreadPool& pool, SurfaceMesh& mesh);
+
+    SurfaceMesherParams params;
+    SurfaceMesherStats stats;
+
+    glm::vec3 origin;                       //of sample (0, 0, 0)
+    glm::ivec3 blockDim;                    //of the dense block directory
+    std::vector<uint32_t> blockIndex;       //directory entry -> active block, ~0u if inactive
+    std::vector<Splat> splats;
+    std::vector<glm::ivec3> activeBlocks;   //block coordinates, directory order
+    std::vector<unsigned int> blockStart;   //into blockParticles, activeBlocks.size() + 1 entries
+    std::vector<unsigned int> blockParticles;
+    std::vector<BlockMesh> blockMeshes;
+};
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Counters accumulated by ThreadPool::parallelFor since the last resetStats()
+struct ThreadPoolStats {
+    uint64_t jobs;          // parallelFor calls, including the ones run inline
+    uint64_t chunks;        // grain-sized pieces executed
+    uint64_t steals;        // ranges taken from another thread's queue
+    double busySeconds;     // inside fn, summed over threads
+    double wallSeconds;     // parallelFor calls from start to finish
+
+    // Fraction of the threads' time inside parallelFor that was spent running chunks
+    double utilisation(unsigned int numThreads) const {
+        return wallSeconds > 0.0 ? busySeconds / (wallSeconds * numThreads) : 0.0;
+    }
+};
+
+// Persistent work-stealing pool used by the CPU solver backend.
+// parallelFor hands every thread one contiguous share of [begin, end), which the
+// owner consumes grain by grain from the front. A thread that runs dry steals the
+// back half of another thread's remaining range, so dense and empty regions of the
+// domain still balance while particles that are close in memory stay on one core.
+class ThreadPool {
+public:
+    // numThreads counts the calling thread; 0 means std::thread::hardware_concurrency().
+    // pinThreads binds thread i (the caller is thread 0) to logical core i
+    explicit ThreadPool(unsigned int numThreads = 0, bool pinThreads = false);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned int getNumThreads() const { return (unsigned int)workers.size() + 1; }
+    bool isPinned() const { return pinned; }
+
+    // Calls fn(chunkBegin, chunkEnd) over [begin, end) and blocks until every chunk is done.
+    // grainSize of 0 uses setGrainSize(), whose 0 picks a chunk size that gives each thread
+    // several chunks. Ranges are limited to 2^32 items.
+    void parallelFor(size_t begin, size_t end, const std::function<void(size_t, size_t)>& fn, size_t grainSize = 0);
+
+    void setGrainSize(size_t grainSize) { defaultGrain = grainSize; }
+    size_t getGrainSize() const { return defaultGrain; }
+
+    // Only meaningful between parallelFor calls
+    ThreadPoolStats getStats() const;
+    void resetStats();
+
+private:
+    // Range still owned by one thread, [lo, hi) relative to the job begin packed as lo | hi << 32,
+    // so the owner taking from the front and thieves taking from the back agree through one CAS
+    struct alignas(64) Queue {
+        std::atomic<uint64_t> range;
+        uint64_t chunks;
+        uint64_t steals;
+        uint64_t busyNanos;
+    };
+
+    void workerLoop(unsigned int index);
+    void runQueue(unsigned int self);
+    bool takeChunk(Queue& queue, uint32_t& lo, uint32_t& hi);
+    bool steal(unsigned int self);
+
+    std::vector<std::thread> workers;
+    std::unique_ptr<Queue[]> queues;    //getNumThreads() entries, 0 belongs to the calling thread
+    bool pinned;
+    size_t defaultGrain;
+
+    std::mutex mutex;
+    std::condition_variable wakeCondition;
+    std::condition_variable doneCondition;
+
+    const std::function<void(size_t, size_t)>* job;
+    size_t jobBegin;
+    uint32_t jobGrain;
+    unsigned int jobGeneration;
+    unsigned int busyWorkers;
+    bool stopping;
+
+    uint64_t statJobs;
+    uint64_t statWallNanos;
+};
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Stages of PBFComputeSystem::step that get their own timing sample
+enum class TimingStage : uint8_t {
+    Step = 0,           //whole step, always on the CPU clock
+    ExternalForces,
+    Reorder,
+    GridClear,          //GPU backend, empty while the grid counts are epoch stamped
+    GridBuild,          //GPU backend, count, scan and scatter of the grid
+    FindNeighbors,      //neighbour lists on the GPU, grid and lists on the CPU
+    Density,
+    PositionUpdate,
+    UpdateVelocity,
+    VorticityViscosity,
+    SyncRender,
+    CoarseCorrection,   //restriction, multigrid solve and prolongation (DensitySolverSettings::multigridCycles)
+    Count
+};
+
+// What measured a sample: steady_clock on the calling thread, or a GL_TIME_ELAPSED query
+enum class TimingClock : uint8_t {
+    CPU = 0,
+    GPU = 1
+};
+
+const char* timingStageName(TimingStage stage);
+const char* timingClockName(TimingClock clock);
+
+struct TimingSample {
+    uint32_t frame;
+    uint32_t numParticles;
+    float ms;
+    TimingStage stage;
+    uint8_t iteration;      //solver iteration for Density / PositionUpdate, substep of the frame for Step, 0 otherwise
+    TimingClock clock;
+};
+
+// Fixed-capacity single-producer single-consumer queue. push and pop never block
+// or allocate, head and tail live on separate cache lines.
+template <typename T>
+class SpscRing {
+public:
+    // capacity is rounded up to a power of two
+    void allocate(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) size <<= 1;
+        slots.reset(new T[size]);
+        mask = size - 1;
+        head.store(0);
+        tail.store(0);
+    }
+
+    size_t capacity() const { return slots ? mask + 1 : 0; }
+
+    bool push(const T& value) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) > mask) return false;
+        slots[h & mask] = value;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& value) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire)) return false;
+        value = slots[t & mask];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::unique_ptr<T[]> slots;
+    size_t mask = 0;
+    alignas(64) std::atomic<size_t> head{ 0 };
+    alignas(64) std::atomic<size_t> tail{ 0 };
+};
+
+// Timing samples from the simulation thread, written to disk by a background thread.
+// record() only copies the sample into a preallocated ring, so logging can stay on
+// in normal runs; when the writer falls behind samples are dropped, never waited on.
+class TimingLog {
+public:
+    // capacity is the number of samples the ring holds between two drains
+    explicit TimingLog(size_t capacity = 1 << 16);
+    ~TimingLog();
+
+    TimingLog(const TimingLog&) = delete;
+    TimingLog& operator=(const TimingLog&) = delete;
+
+    // Truncates path and starts the writer. A .json path gets a JSON array of sample
+    // objects, anything else CSV (Frame,Stage,Iteration,Clock,TimeMs,NumParticles)
+    bool open(const std::string& path);
+    // Writes what is still queued, finishes the file and joins the writer
+    void close();
+    bool isOpen() const { return writer.joinable(); }
+    const std::string& getPath() const { return path; }
+
+    // Producer side, one thread at a time
+    void record(const TimingSample& sample) {
+        if (!ring.push(sample)) dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint64_t getWritten() const { return written.load(std::memory_order_relaxed); }
+    uint64_t getDropped() const { return dropped.load(std::memory_order_relaxed); }
+
+private:
+    void writerLoop();
+    void drain();
+    void writeSample(const TimingSample& sample);
+
+    size_t ringCapacity;
+    SpscRing<TimingSample> ring;
+    std::ofstream file;
+    std::string path;
+    bool json;
+    bool firstSample;
+
+    std::thread writer;
+    std::mutex mutex;
+    std::condition_variable wakeCondition;
+    bool stopping;
+
+    std::atomic<uint64_t> written;
+    std::atomic<uint64_t> dropped;
+};
@@ -0,0 +1,276 @@
+#pragma once
+
+#include <algorithm>
+#include <cfloat>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#include "ThreadPool.h"
+
+// Dense: one cell per box of cellSize inside the configured dimensions.
+// Hashed: cells live in an open-addressing table keyed by their coordinates, sized to
+// the particle count, so memory and clear cost follow the occupied volume and
+// particles are never clamped to a border cell.
+// Fitted: the dense lattice cut down every build to the particles' bounding box plus
+// one cell, so a thin layer of water only clears and indexes the cells around it.
+enum class GridMode {
+    Dense = 0,
+    Hashed = 1,
+    Fitted = 2
+};
+
+const char* gridModeName(GridMode mode);
+// "dense", "hashed" or "fitted"
+bool parseGridMode(const char* name, GridMode& mode);
+
+// Smallest and largest cell of the lattice at origin holding one of count positions,
+// a parallel min/max over the pool. lo > hi when count is 0
+template <typename PositionFn>
+void computeCellBounds(ThreadPool& pool, size_t count, PositionFn&& position, const glm::vec3& origin, float cellSize, glm::ivec3& lo, glm::ivec3& hi);
+
+// Fitted grid inside a dense grid of dim cells: pads the particle cells [lo, hi] by one
+// cell and clamps them to the dense grid, so every particle keeps its dense cell
+void fitCellBounds(const glm::ivec3& dim, glm::ivec3& lo, glm::ivec3& hi);
+
+// Hashed grid helpers, mirrored in pbf_grid.glsl
+constexpr unsigned int EMPTY_CELL_KEY = 0xffffffffu;
+
+// Epoch-stamped counts keep the count in the low 24 bits and the build's epoch in the
+// top 8, so grids of more particles than this fall back to clearing every build
+constexpr unsigned int CELL_COUNT_MASK = 0x00ffffffu;
+
+// 10 bits per axis; cells 1024 apart share a key, which only adds candidates
+// that the distance tests of the neighbour search reject
+inline unsigned int packCellKey(const glm::ivec3& cellPos) {
+    return (unsigned int)(cellPos.x & 1023) | (unsigned int)(cellPos.y & 1023) << 10 | (unsigned int)(cellPos.z & 1023) << 20;
+}
+
+// Home slot of a key before masking. The 2x2x2 brick of the cell is hashed (murmur3
+// finaliser) and its eight cells take consecutive slots, so a 3x3x3 neighbour stencil
+// reads a few cache lines of the table instead of 27 scattered slots
+inline unsigned int hashCellKey(unsigned int key) {
+    unsigned int brick = key & 0x3feffbfeu;
+    unsigned int cell = (key & 1u) | (key >> 9 & 2u) | (key >> 18 & 4u);
+
+    brick ^= brick >> 16;
+    brick *= 0x85ebca6bu;
+    brick ^= brick >> 13;
+    brick *= 0xc2b2ae35u;
+    brick ^= brick >> 16;
+    return brick << 3 | cell;
+}
+
+// Slots for count particles: a power of two, at least twice the particle count
+// so the table is at most half full even with one particle per cell
+unsigned int getHashedGridSlots(size_t count);
+
+// Counting-sort uniform grid, the CPU counterpart of construct_grid.comp,
+// grid_prefix_sum.comp and scatter_grid.comp.
+// Particles of cell c are getSortedIndices()[cellStart[c] .. cellEnd[c]), so
+// memory grows with the particle count and a crowded cell never drops neighbours.
+// In hashed mode c is a table slot and getCellKeys()[c] the packed cell it holds.
+class UniformGrid {
+public:
+    UniformGrid();
+
+    // offset is the first cell of the grid in the lattice at origin (fitted grids): the cell
+    // of a position is computed on that lattice, so it does not move when the grid does
+    void configure(const glm::vec3& origin, const glm::ivec3& dim, float cellSize, const glm::ivec3& offset = glm::ivec3(0));
+    // Hashed mode with getHashedGridSlots(count) slots; the tables only grow
+    void configureHashed(const glm::vec3& origin, float cellSize, size_t count);
+
+    // Bins count particles; position(i) returns the position of particle i.
+    // Particles outside a dense grid go to the nearest border cell.
+    // With epoch stamping the counts are not cleared first: each build stamps the cells it
+    // fills and a cell with an older stamp counts as empty (see pbf_grid.glsl).
+    // Binning, clearing, the cell scan and the scatter run on the pool; counting the
+    // particles into their cells is serial
+    template <typename PositionFn>
+    void build(ThreadPool& pool, size_t count, PositionFn&& position);
+
+    glm::ivec3 getCellPos(const glm::vec3& position) const {
+        return glm::ivec3(glm::floor((position - origin) / cellSize)) - offset;
+    }
+
+    // Dense mode only
+    unsigned int getCellIndex(const glm::ivec3& cellPos) const {
+        return cellPos.x + cellPos.y * dim.x + cellPos.z * dim.x * dim.y;
+    }
+
+    unsigned int getClampedCellIndex(const glm::vec3& position) const {
+        return getCellIndex(glm::clamp(getCellPos(position), glm::ivec3(0), dim - glm::ivec3(1)));
+    }
+
+    // Slot holding a cell of a hashed grid, EMPTY_CELL_KEY when no particle is in it
+    unsigned int findHashedCell(const glm::ivec3& cellPos) const {
+        const unsigned int key = packCellKey(cellPos);
+        for (unsigned int slot = hashCellKey(key) & slotMask;; slot = (slot + 1) & slotMask) {
+            if (cellKeys[slot] == key) return slot;
+            if (cellKeys[slot] == EMPTY_CELL_KEY) return EMPTY_CELL_KEY;
+        }
+    }
+
+    // Range of getSortedIndices() entries for a cell, false when the cell lies outside
+    // the grid (dense) or holds no particle (hashed)
+    bool getCellRange(const glm::ivec3& cellPos, unsigned int& start, unsigned int& end) const {
+        unsigned int cellIndex;
+        if (mode == GridMode::Hashed) {
+            cellIndex = findHashedCell(cellPos);
+            if (cellIndex == EMPTY_CELL_KEY)
+                return false;
+        }
+        else {
+            if (glm::any(glm::lessThan(cellPos, glm::ivec3(0))) || glm::any(glm::greaterThanEqual(cellPos, dim)))
+                return false;
+            cellIndex = getCellIndex(cellPos);
+        }
+
+        start = cellStart[cellIndex];
+        end = cellEnd[cellIndex];
+        return true;
+    }
+
+    void getCellRange(unsigned int cellIndex, unsigned int& start, unsigned int& end) const {
+        start = cellStart[cellIndex];
+        end = cellEnd[cellIndex];
+    }
+
+    // Calls fn(particleId) for every particle stored in the 3x3x3 cells around position
+    template <typename Fn>
+    void forEachCandidate(const glm::vec3& position, Fn&& fn) const {
+        forEachCandidate(getCellPos(position), fn);
+    }
+    // Same around a cell, e.g. the one a particle was binned into by the last build
+    template <typename Fn>
+    void forEachCandidate(const glm::ivec3& cellPos, Fn&& fn) const;
+
+    // Cell of a cell index (dense) or occupied slot (hashed) in the coordinates of getCellPos;
+    // hashed cells come back modulo 1024 per axis, which getCellRange treats alike
+    glm::ivec3 getCellPosOfIndex(unsigned int cellIndex) const {
+        if (mode == GridMode::Hashed) {
+            const unsigned int key = cellKeys[cellIndex];
+            return glm::ivec3(key & 1023, (key >> 10) & 1023, (key >> 20) & 1023);
+        }
+        return glm::ivec3(cellIndex % dim.x, cellIndex / dim.x % dim.y, cellIndex / (dim.x * dim.y));
+    }
+
+    GridMode getMode() const { return mode; }
+    // Dense mode only
+    const glm::ivec3& getDim() const { return dim; }
+    // Cells, or table slots when hashed
+    size_t getNumCells() const { return mode == GridMode::Hashed ? (size_t)slotMask + 1 : (size_t)dim.x * dim.y * dim.z; }
+    float getCellSize() const { return cellSize; }
+    const glm::vec3& getOrigin() const { return origin; }
+    const glm::ivec3& getOffset() const { return offset; }
+    const std::vector<unsigned int>& getSortedIndices() const { return sortedIndices; }
+    // Per cell offsets into getSortedIndices(), the layout of cellStartBuffer / cellEndBuffer
+    const std::vector<unsigned int>& getCellStarts() const { return cellStart; }
+    const std::vector<unsigned int>& getCellEnds() const { return cellEnd; }
+    // Packed cell of every slot (EMPTY_CELL_KEY when free), the layout of cellKeysBuffer; hashed mode only
+    const std::vector<unsigned int>& getCellKeys() const { return cellKeys; }
+    size_t getMemoryBytes() const;
+
+    // On by default; off clears every cell before each build like clear_grid.comp used to
+    void setEpochStamping(bool enabled) { epochStamping = enabled; }
+    bool getEpochStamping() const { return epochStamping; }
+
+    // Colour 0..7 of a cell (or occupied slot) from the parity of its lattice coordinates.
+    // Two cells of one colour are two cells apart, so with cellSize >= h no particle of
+    // one is a neighbour of a particle in the other
+    unsigned int getCellColor(unsigned int cellIndex) const {
+        const glm::ivec3 cellPos = getCellPosOfIndex(cellIndex) + offset;
+        return (unsigned int)(cellPos.x & 1) | (unsigned int)(cellPos.y & 1) << 1 | (unsigned int)(cellPos.z & 1) << 2;
+    }
+    // Occupied cells of the last build grouped by colour, colour k being
+    // cells[starts[k] .. starts[k + 1]); a parallel count and scatter over the pool
+    void computeColorCells(ThreadPool& pool, std::vector<unsigned int>& cells, unsigned int starts[9]) const;
+
+    // Linear cell indices of a grid of the given size, sorted along the Morton (Z-order) curve.
+    // offset is the grid's first cell in a larger lattice, whose curve order is kept
+    static std::vector<unsigned int> computeMortonCellOrder(const glm::ivec3& dim, const glm::ivec3& offset = glm::ivec3(0));
+    // Occupied slots of a hashed grid sorted along the Morton curve of their cells
+    std::vector<unsigned int> computeMortonSlotOrder() const;
+
+private:
+    void sortByCell(ThreadPool& pool);
+    unsigned int insertHashedCell(unsigned int key);
+
+    GridMode mode;
+    glm::vec3 origin;
+    glm::ivec3 offset;
+    glm::ivec3 dim;
+    float cellSize;
+    unsigned int slotMask;                     //slots - 1 when hashed
+    bool epochStamping;
+    unsigned int epoch;                        //of the last build, 0 = it did not stamp the counts
+
+    std::vector<unsigned int> cellStart;
+    std::vector<unsigned int> cellEnd;         //holds the counts until the scan runs
+    std::vector<unsigned int> cellKeys;        //hashed mode only
+    std::vector<unsigned int> particleCells;   //cell index per particle, packed cell key while a hashed grid is built
+    std::vector<unsigned int> particleRanks;   //slot inside the cell per particle
+    std::vector<unsigned int> sortedIndices;
+};
+
+template <typename PositionFn>
+void computeCellBounds(ThreadPool& pool, size_t count, PositionFn&& position, const glm::vec3& origin, float cellSize, glm::ivec3& lo, glm::ivec3& hi) {
+    //a few chunks per thread, each reduced on its own and merged below
+    const size_t chunks = std::min<size_t>(count, (size_t)pool.getNumThreads() * 4);
+    std::vector<glm::ivec3> chunkLo(chunks, glm::ivec3(INT_MAX));
+    std::vector<glm::ivec3> chunkHi(chunks, glm::ivec3(INT_MIN));
+
+    pool.parallelFor(0, chunks, [&](size_t chunkBegin, size_t chunkEnd) {
+        for (size_t c = chunkBegin; c < chunkEnd; ++c) {
+            glm::vec3 pmin(FLT_MAX), pmax(-FLT_MAX);
+            for (size_t i = count * c / chunks; i < count * (c + 1) / chunks; ++i) {
+                glm::vec3 p = position(i);
+                pmin = glm::min(pmin, p);
+                pmax = glm::max(pmax, p);
+            }
+            chunkLo[c] = glm::ivec3(glm::floor((pmin - origin) / cellSize));
+            chunkHi[c] = glm::ivec3(glm::floor((pmax - origin) / cellSize));
+        }
+    }, 1);
+
+    lo = glm::ivec3(INT_MAX);
+    hi = glm::ivec3(INT_MIN);
+    for (size_t c = 0; c < chunks; ++c) {
+        lo = glm::min(lo, chunkLo[c]);
+        hi = glm::max(hi, chunkHi[c]);
+    }
+}
+
+template <typename PositionFn>
+void UniformGrid::build(ThreadPool& pool, size_t count, PositionFn&& position) {
+    particleCells.resize(count);
+    particleRanks.resize(count);
+    sortedIndices.resize(count);
+
+    const bool hashed = mode == GridMode::Hashed;
+    pool.parallelFor(0, count, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            particleCells[i] = hashed ? packCellKey(getCellPos(position(i))) : getClampedCellIndex(position(i));
+        }
+    });
+
+    sortByCell(pool);
+}
+
+template <typename Fn>
+void UniformGrid::forEachCandidate(const glm::ivec3& cellPos, Fn&& fn) const {
+    for (int x = -1; x <= 1; x++) {
+        for (int y = -1; y <= 1; y++) {
+            for (int z = -1; z <= 1; z++) {
+                unsigned int start, end;
+                if (!getCellRange(cellPos + glm::ivec3(x, y, z), start, end))
+                    continue;
+
+                for (unsigned int j = start; j < end; j++) {
+                    fn(sortedIndices[j]);
+                }
+            }
+        }
+    }
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <memory>
 #include <vector>
 #include <glm/glm.hpp>
 
@@ -9,6 +10,8 @@ class ComputeShader;
 class Shader;
 class EllipsoidalGridSearch;
 class AnisotropicSurfaceReconstruction;
+class ThreadPool;
+class SurfaceMesher;
 
 class WaterRenderer {
 public:
@@ -34,10 +37,10 @@ private:
     void computeAnisotropicParameters(const PBFSystem& pbf);
 
     // Surface rendering
-    //void createSurfaceVAO();
-    //void updateSurfaceBuffers();
+    void createSurfaceVAO();
+    void updateSurfaceBuffers();
     void renderSurface(const Camera& camera, const glm::vec3& lightPos);
-    //void reconstructFluidSurface(const PBFSystem& pbf);
+    void reconstructFluidSurface(const PBFSystem& pbf);
 
     // Dimensions and particle scale
     int screenWidth;
@@ -62,4 +65,8 @@ private:
     std::vector<unsigned int> surfaceIndices;
     unsigned int surfaceVertexCount;
     unsigned int surfaceIndexCount;
+
+    // Marching cubes on the CPU over the anisotropic kernels read back from the GPU
+    std::unique_ptr<ThreadPool> meshPool;
+    std::unique_ptr<SurfaceMesher> surfaceMesher;
 };
@@ -0,0 +1,48 @@
+// Declarations shared by the PBF solver compute shaders.
+// Pulled in with #include, which ComputeShader expands before compiling.
+
+struct Particle {
+    vec3 position;
+    float padding1;
+    vec3 velocity;
+    float padding2;
+    vec3 predictedPos;
+    float padding3;
+    vec3 color;
+    float padding4;
+    float density;
+    float lambda;
+    float lambdaSum;
+    float padding5;
+};
+
+layout(std140, binding = 0) uniform SimulationParams {
+    float dt;
+    float _pad0;
+    float _pad1;
+    float _pad2;
+
+    vec4 gravity;
+
+    float particleRadius;
+    float h;
+    float _pad3;
+    float _pad4;
+
+    vec4 minBoundary;
+    vec4 maxBoundary;
+
+    uint numParticles;
+    float cellSize;
+    uint maxParticlesPerCell;  //unused by the counting-sort grid, kept for the layout
+    float restDensity;
+
+    float vorticityEpsilon;
+    float xsphViscosityCoeff;
+    float _pad5;
+    float _pad6; 
+};
+
+layout(std430, binding = 1) buffer ParticleBuffer {
+    Particle particles[];
+};
@@ -0,0 +1,216 @@
+// Counting-sort uniform grid shared by the neighbour search shaders.
+// Particles of cell c are cellParticles[cellStart[c] .. cellEnd[c]).
+// A dense grid has one c per cell of the box, a fitted grid one per cell of the box
+// around the particles, a hashed grid one per slot of an open-addressing table keyed
+// by the cell coordinates (UniformGrid.h).
+// Requires pbf_common.glsl.
+
+const int GRID_DENSE = 0;
+const int GRID_HASHED = 1;
+const int GRID_FITTED = 2;
+
+//written by PBFComputeSystem::updateGridParams, or uploadCpuGrid on the CPU backend
+layout(std140, binding = 1) uniform GridParams {
+    vec4 gridOrigin;        //corner of lattice cell (0,0,0)
+    ivec4 gridOffset;       //first lattice cell of a fitted grid
+    ivec4 gridDimMode;      //cells per axis (dense, fitted), w = GRID_DENSE / GRID_HASHED / GRID_FITTED
+    uint gridCells;         //entries of cellStart/cellEnd: dense cells or hash slots
+    uint gridSlotMask;      //gridCells - 1 when hashed
+    uint gridEpoch;         //1..255 stamps the counts of this build, 0 when clear_grid.comp zeroes them
+    uint _gridPad1;
+};
+
+//while the grid is built (clear/construct) this holds the per-cell counts,
+//the prefix sum pass turns it into the end offset of each cell.
+//With gridEpoch set a count carries the epoch in its top 8 bits and a cell stamped
+//by an older build counts as empty, so the cells need no clear between builds
+layout(std430, binding = 2) buffer CellEnd {
+    uint cellEnd[];
+};
+
+//particle indices sorted by cell, one entry per particle
+layout(std430, binding = 3) buffer CellParticles {
+    uint cellParticles[];
+};
+
+layout(std430, binding = 4) buffer CellStart {
+    uint cellStart[];
+};
+
+//packed cell held by each slot of a hashed grid, EMPTY_CELL_KEY when free
+layout(std430, binding = 12) buffer CellKeys {
+    uint cellKeys[];
+};
+
+const uint EMPTY_CELL_KEY = 0xffffffffu;
+
+const uint CELL_COUNT_MASK = 0x00ffffffu;
+
+//adds one particle to a cell's count during construction and returns its rank.
+//End offsets left by the last scan and counts of older epochs are all below the
+//stamp, so atomicMax resets them on the first insert and keeps this build's counts
+uint addCellCount(uint cellIdx) {
+    if (gridEpoch == 0u) return atomicAdd(cellEnd[cellIdx], 1u);
+
+    atomicMax(cellEnd[cellIdx], gridEpoch << 24);
+    return atomicAdd(cellEnd[cellIdx], 1u) & CELL_COUNT_MASK;
+}
+
+//particles counted in a cell by this build, prefix sum pass only
+uint getCellCount(uint cellIdx) {
+    uint value = cellEnd[cellIdx];
+    if (gridEpoch == 0u) return value;
+    return (value >> 24) == gridEpoch ? value & CELL_COUNT_MASK : 0u;
+}
+
+bool isHashedGrid() {
+    return gridDimMode.w == GRID_HASHED;
+}
+
+ivec3 getGridDim() {
+    return gridDimMode.xyz;
+}
+
+uint getTotalCells() {
+    return gridCells;
+}
+
+ivec3 getCellPos(vec3 position) {
+    return ivec3(floor((position - gridOrigin.xyz) / cellSize)) - gridOffset.xyz;
+}
+
+//10 bits per axis, cells 1024 apart share a key and are told apart by the distance tests
+uint packCellKey(ivec3 cellPos) {
+    uvec3 c = uvec3(cellPos & ivec3(1023));
+    return c.x | (c.y << 10) | (c.z << 20);
+}
+
+//home slot of a key before masking: the cell's 2x2x2 brick is hashed (murmur3
+//finaliser) and its eight cells take consecutive slots
+uint hashCellKey(uint key) {
+    uint brick = key & 0x3feffbfeu;
+    uint cell = (key & 1u) | ((key >> 9) & 2u) | ((key >> 18) & 4u);
+
+    brick ^= brick >> 16;
+    brick *= 0x85ebca6bu;
+    brick ^= brick >> 13;
+    brick *= 0xc2b2ae35u;
+    brick ^= brick >> 16;
+    return (brick << 3) | cell;
+}
+
+//slot of a cell, claimed on first use; construction passes only, after clear_grid.comp
+uint insertHashedCell(ivec3 cellPos) {
+    uint key = packCellKey(cellPos);
+    uint slot = hashCellKey(key) & gridSlotMask;
+    for (uint probe = 0; probe < gridCells; probe++) {
+        uint previous = atomicCompSwap(cellKeys[slot], EMPTY_CELL_KEY, key);
+        if (previous == EMPTY_CELL_KEY || previous == key) return slot;
+        slot = (slot + 1) & gridSlotMask;
+    }
+    return 0;   //unreachable, the table is at most half full
+}
+
+//slot of a cell, EMPTY_CELL_KEY when no particle is in it
+uint findHashedCell(ivec3 cellPos) {
+    uint key = packCellKey(cellPos);
+    uint slot = hashCellKey(key) & gridSlotMask;
+    for (uint probe = 0; probe < gridCells; probe++) {
+        uint stored = cellKeys[slot];
+        if (stored == key) return slot;
+        if (stored == EMPTY_CELL_KEY) break;
+        slot = (slot + 1) & gridSlotMask;
+    }
+    return EMPTY_CELL_KEY;
+}
+
+uint getCellIndex(ivec3 cellPos, ivec3 gridDim) {
+    return uint(cellPos.x + cellPos.y * gridDim.x + cellPos.z * gridDim.x * gridDim.y);
+}
+
+//cell a particle is stored in, positions outside the box go to the border cells
+uint getClampedCellIndex(vec3 position) {
+    ivec3 gridDim = getGridDim();
+    ivec3 cellPos = clamp(getCellPos(position), ivec3(0), gridDim - ivec3(1));
+    return getCellIndex(cellPos, gridDim);
+}
+
+//getCellPos coordinates of a cell index or occupied slot, hashed cells modulo 1024 per axis
+ivec3 getCellPosOfIndex(uint cellIndex) {
+    if (isHashedGrid()) {
+        uint key = cellKeys[cellIndex];
+        return ivec3(key & 1023u, (key >> 10) & 1023u, (key >> 20) & 1023u);
+    }
+    ivec3 gridDim = getGridDim();
+    int c = int(cellIndex);
+    return ivec3(c % gridDim.x, (c / gridDim.x) % gridDim.y, c / (gridDim.x * gridDim.y));
+}
+
+//cell a particle is stored in while the grid is built
+uint getInsertCellIndex(vec3 position) {
+    return isHashedGrid() ? insertHashedCell(getCellPos(position)) : getClampedCellIndex(position);
+}
+
+//range of cellParticles entries for a cell, false when the cell lies outside the
+//grid (dense) or holds no particle (hashed)
+bool getCellRange(ivec3 cellPos, out uint start, out uint end) {
+    start = 0;
+    end = 0;
+
+    uint cellIndex;
+    if (isHashedGrid()) {
+        cellIndex = findHashedCell(cellPos);
+        if (cellIndex == EMPTY_CELL_KEY) return false;
+    }
+    else {
+        ivec3 gridDim = getGridDim();
+        if (any(lessThan(cellPos, ivec3(0))) || any(greaterThanEqual(cellPos, gridDim))) return false;
+        cellIndex = getCellIndex(cellPos, gridDim);
+    }
+
+    start = cellStart[cellIndex];
+    end = cellEnd[cellIndex];
+    return true;
+}
+
+//per particle neighbour lists written by build_neighbor_lists.comp,
+//neighborListCapacity + 1 entries each: [count, id0, id1, ...]
+layout(std430, binding = 11) buffer NeighborLists {
+    uint neighborLists[];
+};
+
+//0 = lists disabled, the stages walk the grid
+uniform int neighborListCapacity;
+
+const uint NEIGHBOR_LIST_OVERFLOW = 0xffffffffu;
+
+//lists keep neighbours a little beyond h, particles move during the solver iterations
+const float NEIGHBOR_LIST_SKIN = 1.1;
+
+//offset of stencil cell c (0..26), z varies fastest like nested x/y/z loops
+ivec3 getStencilOffset(int c) {
+    return ivec3(c / 9 - 1, (c / 3) % 3 - 1, c % 3 - 1);
+}
+
+bool hasNeighborList(uint id) {
+    return neighborListCapacity > 0 && neighborLists[id * uint(neighborListCapacity + 1)] != NEIGHBOR_LIST_OVERFLOW;
+}
+
+//candidate ranges to walk: the whole list, or the 27 stencil cells
+int getNeighborRangeCount(bool useList) {
+    return useList ? 1 : 27;
+}
+
+//range c of neighbour candidates of particle id, read them with getNeighborId
+bool getNeighborRange(uint id, ivec3 cellPos, int c, bool useList, out uint start, out uint end) {
+    if (useList) {
+        start = id * uint(neighborListCapacity + 1) + 1;
+        end = start + neighborLists[start - 1];
+        return true;
+    }
+    return getCellRange(cellPos + getStencilOffset(c), start, end);
+}
+
+uint getNeighborId(uint j, bool useList) {
+    return useList ? neighborLists[j] : cellParticles[j];
+}
@@ -0,0 +1,100 @@
+#include "Checkpoint.h"
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+namespace {
+
+const char CHECKPOINT_MAGIC[8] = "PBFCKPT";
+
+size_t alignUp(size_t bytes) {
+    return (bytes + CHECKPOINT_ALIGNMENT - 1) / CHECKPOINT_ALIGNMENT * CHECKPOINT_ALIGNMENT;
+}
+
+bool writeZeros(std::ofstream& out, size_t bytes) {
+    static const char zeros[CHECKPOINT_ALIGNMENT] = {};
+    return bytes == 0 || (bool)out.write(zeros, bytes);
+}
+
+}
+
+CheckpointHeader makeCheckpointHeader(size_t numParticles) {
+    CheckpointHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = CHECKPOINT_VERSION;
+    header.endianTag = CHECKPOINT_ENDIAN_TAG;
+    header.headerBytes = sizeof(CheckpointHeader);
+    header.particleStride = sizeof(Particle);
+    header.numParticles = numParticles;
+    header.particleOffset = alignUp(sizeof(CheckpointHeader));
+    header.fileBytes = header.particleOffset + alignUp(numParticles * sizeof(Particle));
+    return header;
+}
+
+bool writeCheckpoint(const std::string& path, const CheckpointHeader& header, const Particle* particles) {
+    //the format is defined little-endian, a big-endian host would write a file nobody can map
+    if (*reinterpret_cast<const uint8_t*>(&CHECKPOINT_ENDIAN_TAG) != 0x04) {
+        std::cerr << "[Checkpoint] Writing checkpoints needs a little-endian host\n";
+        return false;
+    }
+
+    const std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) {
+            std::cerr << "[Checkpoint] Failed to open " << tmpPath << "\n";
+            return false;
+        }
+
+        const size_t particleBytes = (size_t)header.numParticles * sizeof(Particle);
+        bool ok = (bool)out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        ok = ok && writeZeros(out, header.particleOffset - sizeof(header));
+        ok = ok && (bool)out.write(reinterpret_cast<const char*>(particles), particleBytes);
+        ok = ok && writeZeros(out, header.fileBytes - header.particleOffset - particleBytes);
+        ok = ok && (bool)out.flush();
+        if (!ok) {
+            std::cerr << "[Checkpoint] Failed to write " << tmpPath << "\n";
+            out.close();
+            std::remove(tmpPath.c_str());
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tmpPath, path, ec);
+    if (ec) {
+        std::cerr << "[Checkpoint] Failed to replace " << path << ": " << ec.message() << "\n";
+        std::remove(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool CheckpointFile::open(const std::string& path) {
+    if (!file.open(path)) return false;
+
+    const char* error = nullptr;
+    const CheckpointHeader& header = getHeader();
+    if (file.getSize() < sizeof(CheckpointHeader) || std::memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0)
+        error = "is not a checkpoint";
+    else if (header.endianTag != CHECKPOINT_ENDIAN_TAG)
+        error = "has a different byte order";
+    else if (header.version != CHECKPOINT_VERSION)
+        error = "has an unsupported version";
+    else if (header.headerBytes != sizeof(CheckpointHeader) || header.particleStride != sizeof(Particle))
+        error = "has a different record layout";
+    else if (header.particleOffset % CHECKPOINT_ALIGNMENT != 0 || header.particleOffset < sizeof(CheckpointHeader)
+        || header.fileBytes != file.getSize() || header.particleOffset > file.getSize()
+        || header.numParticles > (file.getSize() - header.particleOffset) / sizeof(Particle))
+        error = "is truncated";
+
+    if (error) {
+        std::cerr << "[Checkpoint] " << path << " " << error << "\n";
+        file.close();
+        return false;
+    }
+    return true;
+}
@@ -3,26 +3,90 @@
 #include <sstream>
 #include <iostream>
 
+namespace {
+
+std::string readShaderFile(const std::string& path) {
+    std::ifstream file;
+    file.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+    file.open(path);
+
+    std::stringstream stream;
+    stream << file.rdbuf();
+    std::string code = stream.str();
+
+    //drop a UTF-8 BOM, it is not valid in the middle of an expanded source
+    if (code.compare(0, 3, "\xEF\xBB\xBF") == 0) {
+        code.erase(0, 3);
+    }
+    return code;
+}
+
+//Expands #include "file" lines (relative to the including shader) so the
+//shared Particle/SimParams/grid declarations live in one place
+std::string expandIncludes(const std::string& code, const std::string& directory, int sourceNumber = 0, int depth = 0) {
+    if (depth > 8) {
+        throw std::runtime_error("Compute shader #include nesting too deep");
+    }
+
+    std::stringstream input(code);
+    std::stringstream output;
+    std::string line;
+    int lineNumber = 0;
+    static int includeCount = 0;    //#line source numbers only need to be distinct
+
+    while (std::getline(input, line)) {
+        lineNumber++;
+
+        size_t start = line.find_first_not_of(" \t");
+        if (start == std::string::npos || line.compare(start, 8, "#include") != 0) {
+            output << line << "\n";
+            continue;
+        }
+
+        size_t open = line.find('"', start);
+        size_t close = (open == std::string::npos) ? std::string::npos : line.find('"', open + 1);
+        if (close == std::string::npos) {
+            throw std::runtime_error("Malformed #include in compute shader: " + line);
+        }
+
+        std::string includePath = directory + line.substr(open + 1, close - open - 1);
+        std::string included;
+        try {
+            included = readShaderFile(includePath);
+        }
+        catch (std::ifstream::failure& e) {
+            std::cerr << "ERROR::SHADER::INCLUDE_NOT_SUCCESSFULLY_READ: " << includePath << " " << e.what() << std::endl;
+            throw std::runtime_error("Failed to read compute shader include");
+        }
+
+        int includeNumber = ++includeCount;
+        output << "#line 1 " << includeNumber << "\n";
+        output << expandIncludes(included, directory, includeNumber, depth + 1);
+        output << "#line " << (lineNumber + 1) << " " << sourceNumber << "\n";
+    }
+
+    return output.str();
+}
+
+}
+
 ComputeShader::ComputeShader(const char* computePath) {
     std::string computeCode;
-    std::ifstream cShaderFile;
 
     std::cout << "Loading compute shader from: " << computePath << std::endl;
-    cShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
 
     try {
-        cShaderFile.open(computePath);
-        std::stringstream cShaderStream;
-
-        cShaderStream << cShaderFile.rdbuf();
-        cShaderFile.close();
-        computeCode = cShaderStream.str();
+        computeCode = readShaderFile(computePath);
     }
     catch (std::ifstream::failure& e) {
         std::cerr << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << e.what() << std::endl;
         throw std::runtime_error("Failed to read compute shader file");
     }
 
+    std::string path(computePath);
+    size_t slash = path.find_last_of("/\\");
+    computeCode = expandIncludes(computeCode, slash == std::string::npos ? std::string() : path.substr(0, slash + 1));
+
     const char* cShaderCode = computeCode.c_str();
 
     unsigned int compute;
@@ -146,6 +210,10 @@ void ComputeShader::setInt(const std::string& name, int value) const {
     glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
 }
 
+void ComputeShader::setUInt(const std::string& name, unsigned int value) const {
+    glUniform1ui(glGetUniformLocation(ID, name.c_str()), value);
+}
+
 void ComputeShader::setFloat(const std::string& name, float value) const {
     glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
 }
@@ -154,6 +222,14 @@ void ComputeShader::setVec3(const std::string& name, float x, float y, float z)
     glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
 }
 
+void ComputeShader::setIVec3(const std::string& name, int x, int y, int z) const {
+    glUniform3i(glGetUniformLocation(ID, name.c_str()), x, y, z);
+}
+
+void ComputeShader::setVec4(const std::string& name, float x, float y, float z, float w) const {
+    glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+}
+
 void ComputeShader::setMat4(const std::string& name, const glm::mat4& mat) const {
     glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
 }
\ No newline at end of file
@@ -0,0 +1,235 @@
+#include "DensityMultigrid.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+//sweeps on the coarsest level, a handful of cells per axis
+const unsigned int COARSEST_SWEEPS = 32;
+const unsigned int PRE_SWEEPS = 2;
+const unsigned int POST_SWEEPS = 2;
+
+size_t cellIndex(const glm::ivec3& dims, int x, int y, int z) {
+    return ((size_t)z * dims.y + y) * dims.x + x;
+}
+
+}
+
+void DensityMultigrid::configure(const glm::vec3& minBoundary, const glm::vec3& maxBoundary, float cellSize) {
+    const glm::vec3 size = maxBoundary - minBoundary;
+    if (!levels.empty() && origin == minBoundary && boxSize == size && levels[0].cellSize == cellSize) return;
+
+    origin = minBoundary;
+    boxSize = size;
+    levels.clear();
+
+    Level level;
+    level.dims = glm::max(glm::ivec3(glm::ceil(size / cellSize)), glm::ivec3(1));
+    level.cellSize = cellSize;
+    for (;;) {
+        const size_t cells = (size_t)level.dims.x * level.dims.y * level.dims.z;
+        level.fluid.assign(cells, 0);
+        level.phi.assign(cells, 0.0f);
+        level.rhs.assign(cells, 0.0f);
+        level.residual.assign(cells, 0.0f);
+        levels.push_back(level);
+
+        //halve until an axis would drop below two cells
+        if (glm::min(level.dims.x, glm::min(level.dims.y, level.dims.z)) < 4) break;
+        level.dims = (level.dims + 1) / 2;
+        level.cellSize *= 2.0f;
+    }
+
+    gradients.assign(levels[0].fluid.size(), glm::vec4(0.0f));
+}
+
+unsigned int DensityMultigrid::getCellIndex(const glm::vec3& pos) const {
+    const glm::ivec3& dims = levels[0].dims;
+    glm::ivec3 cell = glm::clamp(glm::ivec3(glm::floor((pos - origin) / levels[0].cellSize)), glm::ivec3(0), dims - 1);
+    return (unsigned int)cellIndex(dims, cell.x, cell.y, cell.z);
+}
+
+float DensityMultigrid::solve(const float* errorSums, const unsigned int* counts, unsigned int vCycles) {
+    Level& top = levels[0];
+    double rhsNorm = 0.0;
+    for (size_t c = 0; c < top.fluid.size(); ++c) {
+        top.fluid[c] = counts[c] > 0;
+        top.rhs[c] = counts[c] > 0 ? errorSums[c] / counts[c] : 0.0f;
+        top.phi[c] = 0.0f;
+        rhsNorm += (double)top.rhs[c] * top.rhs[c];
+    }
+
+    if (rhsNorm == 0.0) {
+        std::fill(gradients.begin(), gradients.end(), glm::vec4(0.0f));
+        return 0.0f;
+    }
+
+    for (unsigned int cycle = 0; cycle < vCycles; ++cycle) {
+        vCycle(0);
+    }
+
+    computeResidual(top);
+    double residualNorm = 0.0;
+    for (float r : top.residual) residualNorm += (double)r * r;
+
+    computeGradients();
+    return (float)std::sqrt(residualNorm / rhsNorm);
+}
+
+void DensityMultigrid::vCycle(size_t l) {
+    Level& level = levels[l];
+    if (l + 1 == levels.size()) {
+        smooth(level, COARSEST_SWEEPS, true);
+        return;
+    }
+
+    smooth(level, PRE_SWEEPS, true);
+    computeResidual(level);
+
+    Level& coarse = levels[l + 1];
+    restrictResidual(level, coarse);
+    std::fill(coarse.phi.begin(), coarse.phi.end(), 0.0f);
+    vCycle(l + 1);
+    prolongCorrection(coarse, level);
+
+    //the colours in reverse, so the cycle treats both alike
+    smooth(level, POST_SWEEPS, false);
+}
+
+//phi of a fluid cell from its six neighbours: fluid ones by value, cells without particles
+//as 0 and none across a wall, (sum - k phi) / s^2 = rhs
+void DensityMultigrid::smooth(Level& level, unsigned int sweeps, bool redFirst) {
+    const glm::ivec3 dims = level.dims;
+    const float s2 = level.cellSize * level.cellSize;
+
+    for (unsigned int sweep = 0; sweep < sweeps; ++sweep) {
+        for (int pass = 0; pass < 2; ++pass) {
+            const int color = redFirst ? pass : 1 - pass;
+            for (int z = 0; z < dims.z; ++z) {
+                for (int y = 0; y < dims.y; ++y) {
+                    for (int x = (y + z + color) & 1; x < dims.x; x += 2) {
+                        const size_t c = cellIndex(dims, x, y, z);
+                        if (!level.fluid[c]) continue;
+
+                        float sum = 0.0f;
+                        int k = 0;
+                        if (x > 0) { sum += level.phi[c - 1]; k++; }
+                        if (x + 1 < dims.x) { sum += level.phi[c + 1]; k++; }
+                        if (y > 0) { sum += level.phi[c - dims.x]; k++; }
+                        if (y + 1 < dims.y) { sum += level.phi[c + dims.x]; k++; }
+                        if (z > 0) { sum += level.phi[c - (size_t)dims.x * dims.y]; k++; }
+                        if (z + 1 < dims.z) { sum += level.phi[c + (size_t)dims.x * dims.y]; k++; }
+                        if (k > 0) level.phi[c] = (sum - s2 * level.rhs[c]) / k;
+                    }
+                }
+            }
+        }
+    }
+}
+
+//phi stays 0 outside the fluid, so the neighbour sums need no fluid test
+void DensityMultigrid::computeResidual(Level& level) {
+    const glm::ivec3 dims = level.dims;
+    const float invS2 = 1.0f / (level.cellSize * level.cellSize);
+
+    for (int z = 0; z < dims.z; ++z) {
+        for (int y = 0; y < dims.y; ++y) {
+            for (int x = 0; x < dims.x; ++x) {
+                const size_t c = cellIndex(dims, x, y, z);
+                if (!level.fluid[c]) {
+                    level.residual[c] = 0.0f;
+                    continue;
+                }
+
+                float sum = 0.0f;
+                int k = 0;
+                if (x > 0) { sum += level.phi[c - 1]; k++; }
+                if (x + 1 < dims.x) { sum += level.phi[c + 1]; k++; }
+                if (y > 0) { sum += level.phi[c - dims.x]; k++; }
+                if (y + 1 < dims.y) { sum += level.phi[c + dims.x]; k++; }
+                if (z > 0) { sum += level.phi[c - (size_t)dims.x * dims.y]; k++; }
+                if (z + 1 < dims.z) { sum += level.phi[c + (size_t)dims.x * dims.y]; k++; }
+                level.residual[c] = level.rhs[c] - (sum - k * level.phi[c]) * invS2;
+            }
+        }
+    }
+}
+
+void DensityMultigrid::restrictResidual(const Level& fine, Level& coarse) {
+    const glm::ivec3 dims = coarse.dims;
+    for (int z = 0; z < dims.z; ++z) {
+        for (int y = 0; y < dims.y; ++y) {
+            for (int x = 0; x < dims.x; ++x) {
+                float sum = 0.0f;
+                int children = 0;
+                bool fluid = true;
+                for (int dz = 0; dz < 2; ++dz) {
+                    for (int dy = 0; dy < 2; ++dy) {
+                        for (int dx = 0; dx < 2; ++dx) {
+                            const glm::ivec3 child(2 * x + dx, 2 * y + dy, 2 * z + dz);
+                            if (child.x >= fine.dims.x || child.y >= fine.dims.y || child.z >= fine.dims.z) continue;
+                            const size_t f = cellIndex(fine.dims, child.x, child.y, child.z);
+                            sum += fine.residual[f];
+                            fluid = fluid && fine.fluid[f];
+                            children++;
+                        }
+                    }
+                }
+
+                const size_t c = cellIndex(dims, x, y, z);
+                coarse.fluid[c] = fluid;
+                coarse.rhs[c] = sum / children;
+            }
+        }
+    }
+}
+
+void DensityMultigrid::prolongCorrection(const Level& coarse, Level& fine) {
+    const glm::ivec3 dims = fine.dims;
+    for (int z = 0; z < dims.z; ++z) {
+        for (int y = 0; y < dims.y; ++y) {
+            for (int x = 0; x < dims.x; ++x) {
+                const size_t f = cellIndex(dims, x, y, z);
+                if (fine.fluid[f]) fine.phi[f] += coarse.phi[cellIndex(coarse.dims, x / 2, y / 2, z / 2)];
+            }
+        }
+    }
+}
+
+//central differences; a wall mirrors the cell (no flux), cells without particles are 0
+void DensityMultigrid::computeGradients() {
+    const Level& level = levels[0];
+    const glm::ivec3 dims = level.dims;
+    const float inv2S = 0.5f / level.cellSize;
+
+    for (int z = 0; z < dims.z; ++z) {
+        for (int y = 0; y < dims.y; ++y) {
+            for (int x = 0; x < dims.x; ++x) {
+                const size_t c = cellIndex(dims, x, y, z);
+                const float phi = level.phi[c];
+                const size_t sx = 1, sy = dims.x, sz = (size_t)dims.x * dims.y;
+
+                glm::vec3 g;
+                g.x = ((x + 1 < dims.x ? level.phi[c + sx] : phi) - (x > 0 ? level.phi[c - sx] : phi)) * inv2S;
+                g.y = ((y + 1 < dims.y ? level.phi[c + sy] : phi) - (y > 0 ? level.phi[c - sy] : phi)) * inv2S;
+                g.z = ((z + 1 < dims.z ? level.phi[c + sz] : phi) - (z > 0 ? level.phi[c - sz] : phi)) * inv2S;
+                gradients[c] = glm::vec4(g, 0.0f);
+            }
+        }
+    }
+}
+
+glm::vec3 DensityMultigrid::sampleGradient(const glm::vec3& pos) const {
+    const glm::ivec3& dims = levels[0].dims;
+    const glm::vec3 u = (pos - origin) / levels[0].cellSize - 0.5f;
+    const glm::ivec3 c0 = glm::clamp(glm::ivec3(glm::floor(u)), glm::ivec3(0), dims - 1);
+    const glm::ivec3 c1 = glm::min(c0 + 1, dims - 1);
+    const glm::vec3 t = glm::clamp(u - glm::vec3(c0), 0.0f, 1.0f);
+
+    auto at = [&](int x, int y, int z) { return glm::vec3(gradients[cellIndex(dims, x, y, z)]); };
+    const glm::vec3 x00 = glm::mix(at(c0.x, c0.y, c0.z), at(c1.x, c0.y, c0.z), t.x);
+    const glm::vec3 x10 = glm::mix(at(c0.x, c1.y, c0.z), at(c1.x, c1.y, c0.z), t.x);
+    const glm::vec3 x01 = glm::mix(at(c0.x, c0.y, c1.z), at(c1.x, c0.y, c1.z), t.x);
+    const glm::vec3 x11 = glm::mix(at(c0.x, c1.y, c1.z), at(c1.x, c1.y, c1.z), t.x);
+    return glm::mix(glm::mix(x00, x10, t.y), glm::mix(x01, x11, t.y), t.z);
+}
@@ -0,0 +1,518 @@
+#include "FrameCache.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+const char FRAME_CACHE_MAGIC[8] = { 'P', 'B', 'F', 'C', 'A', 'C', 'H', 'E' };
+
+//LZ77 with LZ4-style sequences: a token of literal / match length nibbles, the
+//literals, a 16-bit offset and length extension bytes for nibbles of 15
+constexpr size_t LZ_MIN_MATCH = 4;
+constexpr size_t LZ_LAST_LITERALS = 5;      //the tail is never matched, so the matcher can read 4 bytes ahead
+constexpr unsigned int LZ_HASH_BITS = 16;
+constexpr size_t LZ_MAX_OFFSET = 0xFFFF;
+
+uint32_t read32(const uint8_t* p) {
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+uint32_t lzHash(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+void writeLength(std::vector<uint8_t>& out, size_t length) {
+    for (length -= 15; length >= 255; length -= 255) {
+        out.push_back(255);
+    }
+    out.push_back((uint8_t)length);
+}
+
+bool readLength(const uint8_t* src, size_t size, size_t& ip, size_t& length) {
+    uint8_t byte;
+    do {
+        if (ip >= size) return false;
+        byte = src[ip++];
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+void writeSequence(std::vector<uint8_t>& out, const uint8_t* literals, size_t numLiterals, size_t offset, size_t matchLength) {
+    size_t extra = matchLength - LZ_MIN_MATCH;
+    out.push_back((uint8_t)((std::min<size_t>(numLiterals, 15) << 4) | std::min<size_t>(extra, 15)));
+    if (numLiterals >= 15) writeLength(out, numLiterals);
+    out.insert(out.end(), literals, literals + numLiterals);
+    out.push_back((uint8_t)offset);
+    out.push_back((uint8_t)(offset >> 8));
+    if (extra >= 15) writeLength(out, extra);
+}
+
+//greedy single-probe matcher, fast rather than tight
+void lzCompress(const uint8_t* src, size_t size, std::vector<uint8_t>& out, std::vector<uint32_t>& table) {
+    out.clear();
+    table.assign((size_t)1 << LZ_HASH_BITS, 0);
+
+    size_t ip = 0, anchor = 0;
+    const size_t matchLimit = size > LZ_LAST_LITERALS ? size - LZ_LAST_LITERALS : 0;
+    while (ip + LZ_MIN_MATCH <= matchLimit) {
+        uint32_t sequence = read32(src + ip);
+        uint32_t& slot = table[lzHash(sequence)];
+        size_t ref = slot;
+        slot = (uint32_t)ip;
+
+        if (ref < ip && ip - ref <= LZ_MAX_OFFSET && read32(src + ref) == sequence) {
+            size_t length = LZ_MIN_MATCH;
+            while (ip + length < matchLimit && src[ref + length] == src[ip + length]) ++length;
+
+            writeSequence(out, src + anchor, ip - anchor, ip - ref, length);
+            ip += length;
+            anchor = ip;
+        }
+        else {
+            //skip faster through data that does not compress
+            ip += 1 + ((ip - anchor) >> 6);
+        }
+    }
+
+    //last literals, no match
+    size_t numLiterals = size - anchor;
+    out.push_back((uint8_t)(std::min<size_t>(numLiterals, 15) << 4));
+    if (numLiterals >= 15) writeLength(out, numLiterals);
+    out.insert(out.end(), src + anchor, src + size);
+}
+
+bool lzDecompress(const uint8_t* src, size_t size, uint8_t* dst, size_t dstSize) {
+    size_t ip = 0, op = 0;
+    while (ip < size) {
+        uint8_t token = src[ip++];
+
+        size_t numLiterals = token >> 4;
+        if (numLiterals == 15 && !readLength(src, size, ip, numLiterals)) return false;
+        if (numLiterals > size - ip || numLiterals > dstSize - op) return false;
+        std::memcpy(dst + op, src + ip, numLiterals);
+        ip += numLiterals;
+        op += numLiterals;
+
+        //the last sequence has no match
+        if (ip == size) break;
+
+        if (size - ip < 2) return false;
+        size_t offset = (size_t)src[ip] | ((size_t)src[ip + 1] << 8);
+        ip += 2;
+        size_t length = (token & 15);
+        if (length == 15 && !readLength(src, size, ip, length)) return false;
+        length += LZ_MIN_MATCH;
+        if (offset == 0 || offset > op || length > dstSize - op) return false;
+
+        const uint8_t* match = dst + op - offset;
+        if (offset >= length) {
+            std::memcpy(dst + op, match, length);
+        }
+        else {
+            //overlapping, repeats the last offset bytes
+            for (size_t k = 0; k < length; ++k) dst[op + k] = match[k];
+        }
+        op += length;
+    }
+    return op == dstSize;
+}
+
+uint16_t quantise(float t) {
+    return (uint16_t)(std::min(std::max(t, 0.0f), 1.0f) * 65535.0f + 0.5f);
+}
+
+//signed difference folded to small unsigned values, -1 -> 1, 1 -> 2
+uint16_t zigzag(uint16_t delta) {
+    int16_t d = (int16_t)delta;
+    return (uint16_t)(((uint16_t)d << 1) ^ (uint16_t)(d >> 15));
+}
+
+uint16_t unzigzag(uint16_t z) {
+    return (uint16_t)((z >> 1) ^ (uint16_t)(-(int)(z & 1)));
+}
+
+//index fields stay zero until close
+FrameCacheHeader makeCacheHeader(const FrameCacheOptions& options) {
+    FrameCacheHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, FRAME_CACHE_MAGIC, sizeof(header.magic));
+    header.version = FRAME_CACHE_VERSION;
+    header.endianTag = FRAME_CACHE_ENDIAN_TAG;
+    header.flags = options.velocities ? FRAME_CACHE_VELOCITIES : 0;
+    header.keyframeInterval = options.keyframeInterval;
+    header.particleRadius = options.particleRadius;
+    header.dt = options.dt;
+    return header;
+}
+
+size_t alignRecord(size_t bytes) {
+    return (bytes + FRAME_RECORD_ALIGNMENT - 1) / FRAME_RECORD_ALIGNMENT * FRAME_RECORD_ALIGNMENT;
+}
+
+}
+
+FrameCacheWriter::~FrameCacheWriter() {
+    close();
+}
+
+bool FrameCacheWriter::open(const std::string& filename, const FrameCacheOptions& cacheOptions) {
+    close();
+
+    file.open(filename, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        std::cerr << "[FrameCacheWriter] Failed to open " << filename << "\n";
+        return false;
+    }
+
+    path = filename;
+    options = cacheOptions;
+    options.keyframeInterval = std::max(options.keyframeInterval, 1u);
+
+    FrameCacheHeader header = makeCacheHeader(options);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    for (FrameBuffer& buffer : buffers) buffer.queued = false;
+    nextSubmit = 0;
+    nextWrite = 0;
+    lastCount = 0;
+    index.clear();
+    fileOffset = sizeof(header);
+    colorOffset = 0;
+    keyframe = 0;
+    failed = !file.good();
+    stopping = false;
+    framesWritten = 0;
+    bytesWritten = sizeof(header);
+    rawBytes = 0;
+    stalls = 0;
+
+    writer = std::thread(&FrameCacheWriter::writerLoop, this);
+    return true;
+}
+
+bool FrameCacheWriter::close() {
+    if (!writer.joinable()) return !failed;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    queueCondition.notify_all();
+    writer.join();
+
+    FrameCacheHeader header = makeCacheHeader(options);
+    header.numFrames = index.size();
+    header.indexOffset = fileOffset;
+
+    file.write(reinterpret_cast<const char*>(index.data()), index.size() * sizeof(FrameCacheIndexEntry));
+    file.seekp(0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.close();
+    bytesWritten += index.size() * sizeof(FrameCacheIndexEntry);
+
+    if (failed || file.fail()) {
+        std::cerr << "[FrameCacheWriter] Writing " << path << " failed, the cache is incomplete\n";
+        failed = true;
+    }
+    return !failed;
+}
+
+void FrameCacheWriter::submitFrame(int frame, const Particle* particles, size_t count, const glm::vec4& minBoundary, const glm::vec4& maxBoundary) {
+    if (!isOpen()) return;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    FrameBuffer& buffer = buffers[nextSubmit];
+    if (buffer.queued) {
+        stalls++;
+        freeCondition.wait(lock, [&] { return !buffer.queued; });
+    }
+    lock.unlock();
+
+    const uint32_t n = (uint32_t)count;
+    const unsigned int planes = options.velocities ? 6 : 3;
+    FrameRecordHeader& header = buffer.header;
+    std::memset(&header, 0, sizeof(header));
+    header.magic = FRAME_RECORD_MAGIC;
+    header.frame = frame;
+    header.numParticles = n;
+    header.boxMin = glm::vec3(minBoundary);
+    header.boxMax = glm::vec3(maxBoundary);
+
+    //colours do not change during a run, they are stored again only when particles are added
+    if (n != lastCount) {
+        header.flags |= FRAME_RECORD_COLORS;
+        buffer.colors.resize(n);
+        for (uint32_t i = 0; i < n; ++i) buffer.colors[i] = particles[i].color;
+        lastCount = n;
+    }
+
+    buffer.codes.resize((size_t)n * planes);
+    uint16_t* codes = buffer.codes.data();
+
+    const glm::vec3 invExtent = 1.0f / glm::max(header.boxMax - header.boxMin, glm::vec3(1e-6f));
+    for (uint32_t i = 0; i < n; ++i) {
+        glm::vec3 t = (particles[i].position - header.boxMin) * invExtent;
+        codes[i] = quantise(t.x);
+        codes[n + i] = quantise(t.y);
+        codes[2 * n + i] = quantise(t.z);
+    }
+
+    if (options.velocities) {
+        float scale = 0.0f;
+        for (uint32_t i = 0; i < n; ++i) {
+            glm::vec3 v = glm::abs(particles[i].velocity);
+            scale = std::max(scale, std::max(v.x, std::max(v.y, v.z)));
+        }
+        header.velocityScale = scale;
+
+        //[-scale, scale] onto [0, 1]
+        const float toUnit = scale > 0.0f ? 0.5f / scale : 0.0f;
+        for (uint32_t i = 0; i < n; ++i) {
+            glm::vec3 t = particles[i].velocity * toUnit + glm::vec3(0.5f);
+            codes[3 * n + i] = quantise(t.x);
+            codes[4 * n + i] = quantise(t.y);
+            codes[5 * n + i] = quantise(t.z);
+        }
+    }
+
+    lock.lock();
+    buffer.queued = true;
+    nextSubmit ^= 1;
+    lock.unlock();
+    queueCondition.notify_one();
+}
+
+void FrameCacheWriter::writerLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        queueCondition.wait(lock, [this] { return stopping || buffers[nextWrite].queued; });
+        //frames still queued are written before stopping
+        FrameBuffer& buffer = buffers[nextWrite];
+        if (!buffer.queued) break;
+
+        lock.unlock();
+        if (!failed && !writeFrame(buffer)) failed = true;
+        lock.lock();
+
+        buffer.queued = false;
+        nextWrite ^= 1;
+        freeCondition.notify_one();
+    }
+}
+
+bool FrameCacheWriter::writeFrame(FrameBuffer& buffer) {
+    FrameRecordHeader& header = buffer.header;
+    const size_t numCodes = buffer.codes.size();
+    const uint32_t frameIndex = (uint32_t)index.size();
+
+    const bool hasColors = (header.flags & FRAME_RECORD_COLORS) != 0;
+    if (hasColors || frameIndex - keyframe >= options.keyframeInterval || previousCodes.size() != numCodes) {
+        header.flags |= FRAME_RECORD_KEYFRAME;
+        keyframe = frameIndex;
+        previousCodes.assign(numCodes, 0);
+    }
+
+    //temporal delta, then low bytes before high bytes so the mostly zero high bytes form runs
+    shuffled.resize(numCodes * 2);
+    for (size_t i = 0; i < numCodes; ++i) {
+        uint16_t z = zigzag((uint16_t)(buffer.codes[i] - previousCodes[i]));
+        shuffled[i] = (uint8_t)z;
+        shuffled[numCodes + i] = (uint8_t)(z >> 8);
+    }
+    previousCodes.swap(buffer.codes);
+
+    lzCompress(shuffled.data(), shuffled.size(), compressed, hashTable);
+    compressedColors.clear();
+    if (hasColors) {
+        lzCompress(reinterpret_cast<const uint8_t*>(buffer.colors.data()), buffer.colors.size() * sizeof(glm::vec3), compressedColors, hashTable);
+        colorOffset = fileOffset;
+    }
+
+    const size_t unpadded = sizeof(FrameRecordHeader) + compressedColors.size() + compressed.size();
+    header.colorBytes = (uint32_t)compressedColors.size();
+    header.payloadBytes = (uint32_t)compressed.size();
+    header.payloadRawBytes = (uint32_t)shuffled.size();
+    header.recordBytes = (uint32_t)alignRecord(unpadded);
+
+    static const char zeros[FRAME_RECORD_ALIGNMENT] = {};
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(compressedColors.data()), compressedColors.size());
+    file.write(reinterpret_cast<const char*>(compressed.data()), compressed.size());
+    file.write(zeros, header.recordBytes - unpadded);
+    if (!file.good()) return false;
+
+    FrameCacheIndexEntry entry;
+    std::memset(&entry, 0, sizeof(entry));
+    entry.frame = header.frame;
+    entry.keyframe = keyframe;
+    entry.offset = fileOffset;
+    entry.colorOffset = colorOffset;
+    entry.recordBytes = header.recordBytes;
+    index.push_back(entry);
+
+    fileOffset += header.recordBytes;
+    bytesWritten += header.recordBytes;
+    rawBytes += (uint64_t)header.numParticles * sizeof(Particle);
+    framesWritten++;
+    return true;
+}
+
+bool FrameCacheReader::open(const std::string& path) {
+    close();
+    if (!file.open(path)) return false;
+
+    const char* error = nullptr;
+    if (file.getSize() < sizeof(FrameCacheHeader)) {
+        error = "is not a frame cache";
+    }
+    else {
+        std::memcpy(&header, file.getData(), sizeof(header));
+        if (std::memcmp(header.magic, FRAME_CACHE_MAGIC, sizeof(header.magic)) != 0)
+            error = "is not a frame cache";
+        else if (header.endianTag != FRAME_CACHE_ENDIAN_TAG)
+            error = "has a different byte order";
+        else if (header.version != FRAME_CACHE_VERSION)
+            error = "has an unsupported version";
+    }
+    if (error) {
+        std::cerr << "[FrameCacheReader] " << path << " " << error << "\n";
+        close();
+        return false;
+    }
+
+    const uint64_t indexBytes = header.numFrames * sizeof(FrameCacheIndexEntry);
+    if (header.indexOffset != 0 && header.indexOffset <= file.getSize() && indexBytes <= file.getSize() - header.indexOffset) {
+        index.resize((size_t)header.numFrames);
+        std::memcpy(index.data(), file.getData() + header.indexOffset, (size_t)indexBytes);
+    }
+    else if (rebuildIndex()) {
+        std::cerr << "[FrameCacheReader] " << path << " was not closed, recovered " << index.size() << " frames\n";
+    }
+    else {
+        std::cerr << "[FrameCacheReader] " << path << " has no readable frames\n";
+        close();
+        return false;
+    }
+    return true;
+}
+
+void FrameCacheReader::close() {
+    file.close();
+    index.clear();
+    decoded = SIZE_MAX;
+    colorsOffset = 0;
+}
+
+bool FrameCacheReader::rebuildIndex() {
+    index.clear();
+
+    //records are self describing, walk them up to the first one that was not written completely
+    uint64_t offset = sizeof(FrameCacheHeader);
+    uint64_t colorOffset = 0;
+    uint32_t keyframe = 0;
+    while (offset + sizeof(FrameRecordHeader) <= file.getSize()) {
+        const FrameRecordHeader& record = *reinterpret_cast<const FrameRecordHeader*>(file.getData() + offset);
+        if (record.magic != FRAME_RECORD_MAGIC || record.recordBytes < sizeof(FrameRecordHeader) || record.recordBytes > file.getSize() - offset)
+            break;
+        if ((uint64_t)sizeof(FrameRecordHeader) + record.colorBytes + record.payloadBytes > record.recordBytes)
+            break;
+
+        if (record.flags & FRAME_RECORD_KEYFRAME) keyframe = (uint32_t)index.size();
+        if (record.flags & FRAME_RECORD_COLORS) colorOffset = offset;
+        if (colorOffset == 0) break;
+
+        FrameCacheIndexEntry entry;
+        std::memset(&entry, 0, sizeof(entry));
+        entry.frame = record.frame;
+        entry.keyframe = keyframe;
+        entry.offset = offset;
+        entry.colorOffset = colorOffset;
+        entry.recordBytes = record.recordBytes;
+        index.push_back(entry);
+
+        offset += record.recordBytes;
+    }
+    return !index.empty();
+}
+
+const FrameRecordHeader& FrameCacheReader::getRecord(size_t i) const {
+    return *reinterpret_cast<const FrameRecordHeader*>(file.getData() + index[i].offset);
+}
+
+void FrameCacheReader::prefetch(size_t i) const {
+    if (i < index.size()) file.prefetch((size_t)index[i].offset, index[i].recordBytes);
+}
+
+bool FrameCacheReader::decodeCodes(size_t i) {
+    if (decoded == i) return true;
+
+    //sequential playback continues from the last frame, a seek restarts at the keyframe
+    const bool continues = decoded != SIZE_MAX && decoded + 1 == i && !(getRecord(i).flags & FRAME_RECORD_KEYFRAME);
+    const size_t first = continues ? i : index[i].keyframe;
+    decoded = SIZE_MAX;
+
+    const size_t planes = hasVelocities() ? 6 : 3;
+    for (size_t j = first; j <= i; ++j) {
+        const FrameRecordHeader& record = getRecord(j);
+        const size_t numCodes = (size_t)record.numParticles * planes;
+        if (record.payloadRawBytes != numCodes * 2) return false;
+
+        if (record.flags & FRAME_RECORD_KEYFRAME) codes.assign(numCodes, 0);
+        else if (codes.size() != numCodes) return false;
+
+        shuffled.resize(numCodes * 2);
+        const uint8_t* payload = file.getData() + index[j].offset + sizeof(FrameRecordHeader) + record.colorBytes;
+        if (!lzDecompress(payload, record.payloadBytes, shuffled.data(), shuffled.size())) return false;
+
+        for (size_t k = 0; k < numCodes; ++k) {
+            codes[k] = (uint16_t)(codes[k] + unzigzag((uint16_t)(shuffled[k] | (shuffled[numCodes + k] << 8))));
+        }
+    }
+
+    decoded = i;
+    return true;
+}
+
+bool FrameCacheReader::decodeFrame(size_t i, std::vector<Particle>& particles) {
+    if (i >= index.size()) return false;
+
+    if (!decodeCodes(i)) {
+        std::cerr << "[FrameCacheReader] Frame " << index[i].frame << " is corrupt\n";
+        return false;
+    }
+
+    const FrameRecordHeader& record = getRecord(i);
+    const uint32_t n = record.numParticles;
+
+    if (colorsOffset != index[i].colorOffset) {
+        const FrameRecordHeader& colorRecord = *reinterpret_cast<const FrameRecordHeader*>(file.getData() + index[i].colorOffset);
+        colors.resize(colorRecord.numParticles);
+        if (colorRecord.numParticles != n || !lzDecompress(file.getData() + index[i].colorOffset + sizeof(FrameRecordHeader), colorRecord.colorBytes,
+            reinterpret_cast<uint8_t*>(colors.data()), colors.size() * sizeof(glm::vec3))) {
+            std::cerr << "[FrameCacheReader] Colours of frame " << index[i].frame << " are corrupt\n";
+            colorsOffset = 0;
+            return false;
+        }
+        colorsOffset = index[i].colorOffset;
+    }
+
+    particles.resize(n);
+    const glm::vec3 step = (record.boxMax - record.boxMin) / 65535.0f;
+    const float velocityStep = 2.0f * record.velocityScale / 65535.0f;
+    for (uint32_t p = 0; p < n; ++p) {
+        Particle& particle = particles[p];
+        std::memset(&particle, 0, sizeof(Particle));
+        particle.position = record.boxMin + glm::vec3(codes[p], codes[n + p], codes[2 * n + p]) * step;
+        particle.predictedPosition = particle.position;
+        if (hasVelocities()) {
+            particle.velocity = glm::vec3(codes[3 * n + p], codes[4 * n + p], codes[5 * n + p]) * velocityStep - glm::vec3(record.velocityScale);
+        }
+        particle.color = colors[p];
+    }
+    return true;
+}
@@ -0,0 +1,121 @@
+#include "MappedFile.h"
+#include <algorithm>
+#include <iostream>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+#if defined(_WIN32)
+
+bool MappedFile::open(const std::string& path) {
+    close();
+
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        std::cerr << "[MappedFile] Failed to open " << path << "\n";
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+        std::cerr << "[MappedFile] " << path << " is empty\n";
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    const void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (!view) {
+        std::cerr << "[MappedFile] Failed to map " << path << "\n";
+        if (mapping) CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    fileHandle = file;
+    mappingHandle = mapping;
+    data = static_cast<const uint8_t*>(view);
+    size = (size_t)fileSize.QuadPart;
+    return true;
+}
+
+void MappedFile::close() {
+    if (data) UnmapViewOfFile(data);
+    if (mappingHandle) CloseHandle((HANDLE)mappingHandle);
+    if (fileHandle) CloseHandle((HANDLE)fileHandle);
+    data = nullptr;
+    size = 0;
+    fileHandle = nullptr;
+    mappingHandle = nullptr;
+}
+
+void MappedFile::prefetch(size_t offset, size_t bytes) const {
+    if (!data || offset >= size) return;
+
+    WIN32_MEMORY_RANGE_ENTRY range;
+    range.VirtualAddress = const_cast<uint8_t*>(data + offset);
+    range.NumberOfBytes = std::min(bytes, size - offset);
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+}
+
+#else
+
+bool MappedFile::open(const std::string& path) {
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "[MappedFile] Failed to open " << path << "\n";
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        std::cerr << "[MappedFile] " << path << " is empty\n";
+        ::close(fd);
+        return false;
+    }
+
+    void* view = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    //the mapping keeps the file alive
+    ::close(fd);
+    if (view == MAP_FAILED) {
+        std::cerr << "[MappedFile] Failed to map " << path << "\n";
+        return false;
+    }
+
+    data = static_cast<const uint8_t*>(view);
+    size = (size_t)info.st_size;
+    return true;
+}
+
+void MappedFile::close() {
+    if (data) munmap(const_cast<uint8_t*>(data), size);
+    data = nullptr;
+    size = 0;
+}
+
+void MappedFile::prefetch(size_t offset, size_t bytes) const {
+    if (!data || offset >= size) return;
+
+    //madvise wants a page aligned start
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t begin = offset / page * page;
+    size_t end = std::min(offset + bytes, size);
+    madvise(const_cast<uint8_t*>(data + begin), end - begin, MADV_WILLNEED);
+}
+
+#endif
@@ -1,12 +1,30 @@
 ﻿#include "PBFComputeSystem.h"
+#include "PBFCpuSolver.h"
+#include "UniformGrid.h"
 #include <iostream>
 #include <iomanip>
 #include <sstream>
 #include <fstream>
 #include <algorithm>
 #include <chrono>
+#include <cstring>
 
-PBFComputeSystem::PBFComputeSystem(): externalForcesShader(nullptr), constructGridShader(nullptr), clearGridShader(nullptr), densityShader(nullptr), positionUpdateShader(nullptr), vorticityViscosityShader(nullptr), velocityUpdateShader(nullptr), simParamsUBO(0),particleSSBO(0),numParticles(0),maxParticles(0), currentFrame(0)
+const char* constraintSolverName(ConstraintSolver solver) {
+    switch (solver) {
+    case ConstraintSolver::Jacobi: return "jacobi";
+    case ConstraintSolver::ColoredGaussSeidel: return "gauss-seidel";
+    }
+    return "unknown";
+}
+
+bool parseConstraintSolver(const char* name, ConstraintSolver& solver) {
+    if (std::strcmp(name, "jacobi") == 0) solver = ConstraintSolver::Jacobi;
+    else if (std::strcmp(name, "gauss-seidel") == 0) solver = ConstraintSolver::ColoredGaussSeidel;
+    else return false;
+    return true;
+}
+
+PBFComputeSystem::PBFComputeSystem(SolverBackend backend, unsigned int numThreads, bool pinThreads): externalForcesShader(nullptr), constructGridShader(nullptr), clearGridShader(nullptr), prefixSumShader(nullptr), scatterGridShader(nullptr), gridBoundsShader(nullptr), maxSpeedShader(nullptr), densityErrorShader(nullptr), accumulateLambdaShader(nullptr), coarseRestrictShader(nullptr), coarseCorrectionShader(nullptr), reorderShader(nullptr), neighborListShader(nullptr), densityShader(nullptr), positionUpdateShader(nullptr), vorticityViscosityShader(nullptr), velocityUpdateShader(nullptr), simParamsUBO(0),gridParamsUBO(0),particleSSBO(0),cellStartBuffer(0),cellEndBuffer(0),cellParticlesBuffer(0),particleCellsBuffer(0),scanBlockSumsBuffer(0),cellKeysBuffer(0),gridBoundsBuffer(0),maxSpeedBuffer(0),densityErrorBuffer(0),chebyshevPreviousBuffer(0),coarseCellsBuffer(0),coarseGradientBuffer(0),coarseCellCapacity(0),gridMode(GridMode::Dense),gridEpochStamping(true),gridParams(),cellCapacity(0),keyCapacity(0),particleIdBuffer(0),reorderedParticleBuffer(0),reorderedIdBuffer(0),cellMortonRankBuffer(0),mortonGridDim(0),mortonGridOffset(0),particlesReordered(false),reorderInterval(0),stepsSinceReorder(0),neighborListBuffer(0),neighborListCapacity(0),numParticles(0),maxParticles(0), params(), currentFrame(0), currentSubstep(0), backend(backend), cpuThreads(numThreads), cpuPinThreads(pinThreads), cpuGrainSize(0), cpuSimdLevel(preferredSimdLevel()), cpuSolver(nullptr), mirrorToGL(false)
 {
 }
 
@@ -18,6 +36,38 @@ bool PBFComputeSystem::initialize(unsigned int maxParticles, float dt, const glm
     // Store the maximum number of particles
     this->maxParticles = maxParticles;
 
+    // Initialize simulation parameters
+    params.dt = dt;
+    params.gravity = gravity;
+    params.particleRadius = particleRadius;
+    params.h = smoothingLength;
+    params.minBoundary = minBoundary;
+    params.maxBoundary = maxBoundary;
+    params.cellSize = cellSize;
+    params.maxParticlesPerCell = maxParticlesPerCell;
+    params.restDensity = restDensity;
+    params.vorticityEpsilon = vorticityEpsilon;
+    params.xsphViscosityCoeff = xsphViscosityCoeff;
+
+    if (backend == SolverBackend::CPU) {
+        cpuSolver = new PBFCpuSolver(cpuThreads, cpuPinThreads);
+        cpuSolver->setGrainSize(cpuGrainSize);
+        cpuSolver->setParams(params);
+        cpuSolver->setNeighborListCapacity(neighborListCapacity);
+        cpuSolver->setSimdLevel(cpuSimdLevel);
+        cpuSolver->setGridMode(gridMode);
+        cpuSolver->setGridEpochStamping(gridEpochStamping);
+
+        //only touch GL when a context has been loaded (viewer), headless runs skip it
+        mirrorToGL = GLAD_GL_VERSION_4_3 != 0;
+        if (mirrorToGL) {
+            createBuffers(maxParticles);
+        }
+
+        std::cout << "[PBFComputeSystem] CPU backend initialized (" << cpuSolver->getNumThreads() << " threads, " << simdLevelName(cpuSolver->getSimdLevel()) << " kernels" << (mirrorToGL ? ", mirroring to GL" : ", headless") << ")\n";
+        return true;
+    }
+
 	//checkComputeShaderSupport();
 
     // Create externalForces compute shader
@@ -31,6 +81,36 @@ bool PBFComputeSystem::initialize(unsigned int maxParticles, float dt, const glm
         clearGridShader = new ComputeShader(RESOURCES_PATH"clear_grid.comp");
         std::cout << "[PBFComputeSystem] Clear grid shader loaded successfully (ID=" << constructGridShader->ID << ")\n";
 
+        prefixSumShader = new ComputeShader(RESOURCES_PATH"grid_prefix_sum.comp");
+        std::cout << "[PBFComputeSystem] Grid prefix sum shader loaded successfully (ID=" << prefixSumShader->ID << ")\n";
+
+        scatterGridShader = new ComputeShader(RESOURCES_PATH"scatter_grid.comp");
+        std::cout << "[PBFComputeSystem] Scatter grid shader loaded successfully (ID=" << scatterGridShader->ID << ")\n";
+
+        gridBoundsShader = new ComputeShader(RESOURCES_PATH"grid_bounds.comp");
+        std::cout << "[PBFComputeSystem] Grid bounds shader loaded successfully (ID=" << gridBoundsShader->ID << ")\n";
+
+        maxSpeedShader = new ComputeShader(RESOURCES_PATH"max_speed.comp");
+        std::cout << "[PBFComputeSystem] Max speed shader loaded successfully (ID=" << maxSpeedShader->ID << ")\n";
+
+        densityErrorShader = new ComputeShader(RESOURCES_PATH"density_error.comp");
+        std::cout << "[PBFComputeSystem] Density error shader loaded successfully (ID=" << densityErrorShader->ID << ")\n";
+
+        accumulateLambdaShader = new ComputeShader(RESOURCES_PATH"accumulate_lambda.comp");
+        std::cout << "[PBFComputeSystem] Accumulate lambda shader loaded successfully (ID=" << accumulateLambdaShader->ID << ")\n";
+
+        coarseRestrictShader = new ComputeShader(RESOURCES_PATH"coarse_restrict.comp");
+        std::cout << "[PBFComputeSystem] Coarse restriction shader loaded successfully (ID=" << coarseRestrictShader->ID << ")\n";
+
+        coarseCorrectionShader = new ComputeShader(RESOURCES_PATH"coarse_correction.comp");
+        std::cout << "[PBFComputeSystem] Coarse correction shader loaded successfully (ID=" << coarseCorrectionShader->ID << ")\n";
+
+        reorderShader = new ComputeShader(RESOURCES_PATH"reorder_particles.comp");
+        std::cout << "[PBFComputeSystem] Reorder shader loaded successfully (ID=" << reorderShader->ID << ")\n";
+
+        neighborListShader = new ComputeShader(RESOURCES_PATH"build_neighbor_lists.comp");
+        std::cout << "[PBFComputeSystem] Neighbor list shader loaded successfully (ID=" << neighborListShader->ID << ")\n";
+
         densityShader = new ComputeShader(RESOURCES_PATH"calculate_density.comp");
         std::cout << "[PBFComputeSystem] Density shader loaded successfully (ID=" << densityShader->ID << ")\n";
 
@@ -51,19 +131,6 @@ bool PBFComputeSystem::initialize(unsigned int maxParticles, float dt, const glm
     // Create GPU buffers
     createBuffers(maxParticles);
 
-	// Initialize simulation parameters
-	params.dt = dt;
-	params.gravity = gravity;
-	params.particleRadius = particleRadius;
-	params.h = smoothingLength;
-    params.minBoundary = minBoundary;
-    params.maxBoundary = maxBoundary;
-	params.cellSize = cellSize;
-	params.maxParticlesPerCell = maxParticlesPerCell;
-    params.restDensity = restDensity;
-    params.vorticityEpsilon = vorticityEpsilon;
-    params.xsphViscosityCoeff = xsphViscosityCoeff;
-
     initializeGrid();
 
     return true;
@@ -77,6 +144,11 @@ void PBFComputeSystem::createBuffers(unsigned int maxParticles) {
     glBindBuffer(GL_UNIFORM_BUFFER, 0);
     std::cout << "[PBFComputeSystem] Created simulation params UBO (ID="<< simParamsUBO << ")\n";
 
+    glGenBuffers(1, &gridParamsUBO);
+    glBindBuffer(GL_UNIFORM_BUFFER, gridParamsUBO);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(GridParams), &gridParams, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
     //Particle buffer
     glGenBuffers(1, &particleSSBO);
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleSSBO);
@@ -99,6 +171,10 @@ void PBFComputeSystem::updateSimulationParams(float dt,const glm::vec4& gravity,
 	params.vorticityEpsilon = vorticityEpsilon;
 	params.xsphViscosityCoeff = xsphViscosityCoeff;
 
+    if (cpuSolver) {
+        cpuSolver->setParams(params);
+        return;
+    }
     
     //Upload to GPU
     glBindBuffer(GL_UNIFORM_BUFFER, simParamsUBO);
@@ -107,21 +183,45 @@ void PBFComputeSystem::updateSimulationParams(float dt,const glm::vec4& gravity,
 }
 
 void PBFComputeSystem::uploadParticles(const std::vector<Particle>& particles) {
-    if (particles.empty()) {
+    uploadParticles(particles.data(), particles.size());
+}
+
+void PBFComputeSystem::uploadParticles(const Particle* particles, size_t count) {
+    if (count == 0) {
         std::cerr << "[PBFComputeSystem] Warning: Trying to upload empty particle array\n";
         return;
     }
 
-    if (particles.size() > maxParticles) {
-        std::cerr << "[PBFComputeSystem] Warning: Attempting to upload "<< particles.size() << " but max is " << maxParticles << "\n";
+    if (count > maxParticles) {
+        std::cerr << "[PBFComputeSystem] Warning: Attempting to upload "<< count << " but max is " << maxParticles << "\n";
         numParticles = maxParticles;
     }
     else {
-        numParticles = (unsigned int)particles.size();
+        numParticles = (unsigned int)count;
+    }
+
+    params.numParticles = numParticles;
+
+    if (cpuSolver) {
+        cpuSolver->uploadParticles(particles, numParticles);
+        syncRenderBuffer();
+        return;
     }
 
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleSSBO);
-    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, numParticles * sizeof(Particle), particles.data());
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, numParticles * sizeof(Particle), particles);
+
+    //upload order defines the external ids
+    std::vector<GLuint> ids(numParticles);
+    for (unsigned int i = 0; i < numParticles; ++i) {
+        ids[i] = i;
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleIdBuffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, numParticles * sizeof(GLuint), ids.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    particlesReordered = false;
+    stepsSinceReorder = 0;
 }
 
 void PBFComputeSystem::downloadParticles(std::vector<Particle>& particles) {
@@ -135,6 +235,11 @@ void PBFComputeSystem::downloadParticles(std::vector<Particle>& particles) {
         numParticles = maxParticles;
     }
 
+    if (cpuSolver) {
+        cpuSolver->downloadParticles(particles);
+        return;
+    }
+
     glFinish();
 
     try {
@@ -159,6 +264,19 @@ void PBFComputeSystem::downloadParticles(std::vector<Particle>& particles) {
     glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, numParticles * sizeof(Particle), particles.data());
   
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    //back to upload order so exports line up frame to frame
+    if (particlesReordered) {
+        std::vector<GLuint> ids(numParticles);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleIdBuffer);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, numParticles * sizeof(GLuint), ids.data());
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        std::vector<Particle> stored(particles);
+        for (unsigned int i = 0; i < numParticles; ++i) {
+            particles[ids[i]] = stored[i];
+        }
+    }
 }
 
 void PBFComputeSystem::step() {
@@ -167,21 +285,60 @@ void PBFComputeSystem::step() {
         return;
     }
 
-    applyExternalForces();
+    profiler.beginFrame((uint32_t)currentFrame, numParticles);
+    ScopedStageTimer stepTimer(profiler, TimingStage::Step, currentSubstep, true);
+
+    {
+        ScopedStageTimer timer(profiler, TimingStage::ExternalForces);
+        applyExternalForces();
+    }
+
+    if (reorderInterval > 0 && ++stepsSinceReorder >= reorderInterval) {
+        ScopedStageTimer timer(profiler, TimingStage::Reorder);
+        reorderParticles();
+        stepsSinceReorder = 0;
+    }
 
     findNeighbors();
 
-    const int solverIterations = 4;
-    for (int iter = 0; iter < solverIterations; iter++) {
-        calculateDensity();
-        applyPositionUpdate();
+    solveDensityConstraints();
+
+    {
+        ScopedStageTimer timer(profiler, TimingStage::UpdateVelocity);
+        updateVelocity();
     }
-    
-    updateVelocity();
-    applyVorticityViscosity();
+    {
+        ScopedStageTimer timer(profiler, TimingStage::VorticityViscosity);
+        applyVorticityViscosity();
+    }
+
+    //the CPU backend's copy into the GL buffer, empty on the GPU backend
+    if (cpuSolver && mirrorToGL) {
+        ScopedStageTimer timer(profiler, TimingStage::SyncRender);
+        syncRenderBuffer();
+    }
+}
+
+unsigned int PBFComputeSystem::getNumThreads() const {
+    return cpuSolver ? cpuSolver->getNumThreads() : 0;
+}
+
+void PBFComputeSystem::syncRenderBuffer() {
+    if (!cpuSolver || !mirrorToGL || numParticles == 0) return;
+
+    cpuSolver->copyParticles(renderStaging);
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleSSBO);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, numParticles * sizeof(Particle), renderStaging.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 }
 
 void PBFComputeSystem::applyExternalForces() {
+    if (cpuSolver) {
+        cpuSolver->applyExternalForces();
+        return;
+    }
+
     //work groups
     unsigned int numGroups = (numParticles + 255) / 256;
     if (numGroups == 0) numGroups = 1;
@@ -208,67 +365,606 @@ void PBFComputeSystem::applyExternalForces() {
 }
 
 void PBFComputeSystem::initializeGrid() {
+    //per cell buffers are sized by updateGridParams
+    glGenBuffers(1, &cellStartBuffer);
+    glGenBuffers(1, &cellEndBuffer);
+    glGenBuffers(1, &scanBlockSumsBuffer);
+    glGenBuffers(1, &cellKeysBuffer);
 
-    glm::vec3 domain = params.maxBoundary - params.minBoundary;
-    glm::ivec3 gridDim = glm::ivec3(glm::ceil(domain / params.cellSize));
-
-    int totalCells = gridDim.x * gridDim.y * gridDim.z;
-
-    std::cout << "[PBFComputeSystem] Grid dimensions: " << gridDim.x << "x"<< gridDim.y << "x" << gridDim.z << " (" << totalCells << " cells)\n";
+    glm::ivec4 bounds[2] = { glm::ivec4(INT_MAX), glm::ivec4(INT_MIN) };
+    glGenBuffers(1, &gridBoundsBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gridBoundsBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(bounds), bounds, GL_DYNAMIC_READ);
 
-    glGenBuffers(1, &cellCountsBuffer);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, cellCountsBuffer);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, totalCells * sizeof(GLuint), nullptr, GL_DYNAMIC_READ);
+    updateGridParams();
 
+    //one slot per particle, so a crowded cell can never drop neighbours
     glGenBuffers(1, &cellParticlesBuffer);
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, cellParticlesBuffer);
-    glBufferData(GL_SHADER_STORAGE_BUFFER,totalCells * params.maxParticlesPerCell * sizeof(GLuint),nullptr, GL_DYNAMIC_COPY);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, maxParticles * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+
+    glGenBuffers(1, &particleCellsBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleCellsBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, maxParticles * 2 * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+
+    glGenBuffers(1, &particleIdBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleIdBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, maxParticles * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+
+    glGenBuffers(1, &reorderedParticleBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, reorderedParticleBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, maxParticles * sizeof(Particle), nullptr, GL_DYNAMIC_COPY);
+
+    glGenBuffers(1, &reorderedIdBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, reorderedIdBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, maxParticles * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+
+    //filled by reorderParticles once the grid size is known
+    glGenBuffers(1, &cellMortonRankBuffer);
+
+    GLuint zero = 0;
+    glGenBuffers(1, &maxSpeedBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, maxSpeedBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), &zero, GL_DYNAMIC_READ);
+
+    glGenBuffers(1, &densityErrorBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, densityErrorBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, ((maxParticles + 255) / 256) * sizeof(glm::vec2), nullptr, GL_DYNAMIC_READ);
+
+    glGenBuffers(1, &chebyshevPreviousBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, chebyshevPreviousBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, maxParticles * sizeof(glm::vec4), nullptr, GL_DYNAMIC_COPY);
+
+    //sized to the multigrid lattice by the first coarse correction
+    glGenBuffers(1, &coarseCellsBuffer);
+    glGenBuffers(1, &coarseGradientBuffer);
+
+    createNeighborListBuffer();
 
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    size_t particleBytes = (size_t)maxParticles * 3 * sizeof(GLuint);
+    std::cout << "[PBFComputeSystem] Grid memory: " << particleBytes / (1024.0 * 1024.0) << " MB\n";
 }
 
-void PBFComputeSystem::findNeighbors() {
+void PBFComputeSystem::updateGridParams() {
     glm::vec3 domain = params.maxBoundary - params.minBoundary;
-    glm::ivec3 gridDim = glm::ivec3(glm::ceil(domain / params.cellSize));
-    int totalCells = gridDim.x * gridDim.y * gridDim.z;
+    glm::ivec3 gridDim = glm::max(glm::ivec3(glm::ceil(domain / params.cellSize)), glm::ivec3(1));
+
+    glm::ivec3 offset(0);
+    if (gridMode == GridMode::Fitted) {
+        glm::ivec3 lo, hi;
+        readParticleCellBounds(lo, hi);
+        fitCellBounds(gridDim, lo, hi);
+
+        offset = lo;
+        gridDim = hi - lo + glm::ivec3(1);
+    }
 
-    unsigned int clearGroups = (totalCells + 255) / 256;
-    if (clearGroups == 0) clearGroups = 1;
+    gridParams.origin = params.minBoundary;
+    gridParams.offset = glm::ivec4(offset, 0);
+    gridParams.dimMode = glm::ivec4(gridDim, (int)gridMode);
+    if (gridMode == GridMode::Hashed) {
+        gridParams.numCells = getHashedGridSlots(numParticles);
+        gridParams.slotMask = gridParams.numCells - 1;
+    }
+    else {
+        gridParams.numCells = (unsigned int)(gridDim.x * gridDim.y * gridDim.z);
+        gridParams.slotMask = 0;
+    }
+
+    //epochs 1..255 in turn, the scan leaves offsets below any stamp (see pbf_grid.glsl). Only
+    //after a build without stamps can they pass CELL_COUNT_MASK, so the first stamped build
+    //then zeroes the whole buffer, cells a fitted grid reaches later included
+    bool stamped = gridEpochStamping && numParticles <= CELL_COUNT_MASK;
+    bool clearStale = stamped && gridParams.epoch == 0;
+    gridParams.epoch = stamped ? gridParams.epoch % 255u + 1u : 0;
+
+    //grow only, with headroom: a fitted grid changes size every build, the wave mode moves the
+    //boundary every step and the particle count changes on upload
+    size_t keySlots = gridMode == GridMode::Hashed ? gridParams.numCells : 1;
+    if (gridParams.numCells > cellCapacity || keySlots > keyCapacity) {
+        size_t cells = gridParams.numCells > cellCapacity ? std::max<size_t>(gridParams.numCells, cellCapacity + cellCapacity / 2) : cellCapacity;
+        resizeCellBuffers(cells, std::max(keySlots, keyCapacity));
+    }
+    if (clearStale) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, cellEndBuffer);
+        glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    glBindBuffer(GL_UNIFORM_BUFFER, gridParamsUBO);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(GridParams), &gridParams);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+//Cell range of the predicted positions, reduced on the GPU by grid_bounds.comp. The fitted
+//grid needs its size on the CPU to allocate and dispatch, so this 32 byte read is where a
+//fitted build waits for the GPU; the other modes never read back during a step
+void PBFComputeSystem::readParticleCellBounds(glm::ivec3& lo, glm::ivec3& hi) {
+    glm::ivec4 bounds[2] = { glm::ivec4(INT_MAX), glm::ivec4(INT_MIN) };
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gridBoundsBuffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(bounds), bounds);
+
+    if (numParticles > 0) {
+        gridBoundsShader->use();
+        glBindBufferBase(GL_UNIFORM_BUFFER, 0, simParamsUBO);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, particleSSBO);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 13, gridBoundsBuffer);
+        glDispatchCompute((numParticles + 255) / 256, 1, 1);
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(bounds), bounds);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    lo = glm::ivec3(bounds[0]);
+    hi = glm::ivec3(bounds[1]);
+}
+
+void PBFComputeSystem::resizeCellBuffers(size_t cells, size_t keySlots) {
+    size_t scanBlocks = (cells + 255) / 256;
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, cellStartBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, cells * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, cellEndBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, cells * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+    //zero, which no epoch stamp matches; a fitted grid reaches cells past this build's later on
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, scanBlockSumsBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, scanBlocks * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, cellKeysBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, keySlots * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    cellCapacity = cells;
+    keyCapacity = keySlots;
+
+    const glm::ivec4& dim = gridParams.dimMode;
+    if (gridMode == GridMode::Hashed) {
+        std::cout << "[PBFComputeSystem] Hashed grid: " << gridParams.numCells << " slots";
+    }
+    else {
+        std::cout << "[PBFComputeSystem] " << (gridMode == GridMode::Fitted ? "Fitted grid" : "Grid dimensions") << ": " << dim.x << "x" << dim.y << "x" << dim.z << " (" << gridParams.numCells << " cells, " << cells << " allocated)";
+    }
+    size_t cellBytes = (cells * 2 + keySlots + scanBlocks) * sizeof(GLuint);
+    std::cout << ", cell memory " << cellBytes / (1024.0 * 1024.0) << " MB\n";
+}
+
+void PBFComputeSystem::createNeighborListBuffer() {
+    if (neighborListBuffer) glDeleteBuffers(1, &neighborListBuffer);
+    neighborListBuffer = 0;
+
+    if (neighborListCapacity == 0) return;
+
+    size_t listBytes = (size_t)maxParticles * (neighborListCapacity + 1) * sizeof(GLuint);
+    glGenBuffers(1, &neighborListBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, neighborListBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, listBytes, nullptr, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    std::cout << "[PBFComputeSystem] Neighbor lists: " << neighborListCapacity << " per particle, " << listBytes / (1024.0 * 1024.0) << " MB\n";
+}
+
+void PBFComputeSystem::setSimdLevel(SimdLevel level) {
+    cpuSimdLevel = level;
+
+    if (cpuSolver) {
+        cpuSolver->setSimdLevel(level);
+    }
+}
+
+SimdLevel PBFComputeSystem::getSimdLevel() const {
+    return cpuSolver ? cpuSolver->getSimdLevel() : cpuSimdLevel;
+}
+
+void PBFComputeSystem::setNeighborListCapacity(unsigned int capacity) {
+    neighborListCapacity = capacity;
+
+    if (cpuSolver) {
+        cpuSolver->setNeighborListCapacity(capacity);
+    }
+    else if (densityShader) {
+        createNeighborListBuffer();
+    }
+}
+
+void PBFComputeSystem::setGridMode(GridMode mode) {
+    gridMode = mode;
+
+    if (cpuSolver) {
+        cpuSolver->setGridMode(mode);
+    }
+}
+
+void PBFComputeSystem::setGridEpochStamping(bool enabled) {
+    gridEpochStamping = enabled;
+
+    if (cpuSolver) {
+        cpuSolver->setGridEpochStamping(enabled);
+    }
+}
+
+void PBFComputeSystem::setGrainSize(size_t grainSize) {
+    cpuGrainSize = grainSize;
+
+    if (cpuSolver) {
+        cpuSolver->setGrainSize(grainSize);
+    }
+}
+
+ThreadPoolStats PBFComputeSystem::getThreadPoolStats() const {
+    return cpuSolver ? cpuSolver->getPoolStats() : ThreadPoolStats{};
+}
+
+void PBFComputeSystem::resetThreadPoolStats() {
+    if (cpuSolver) {
+        cpuSolver->resetPoolStats();
+    }
+}
 
+unsigned int PBFComputeSystem::getNeighborListOverflows() const {
+    return cpuSolver ? cpuSolver->getNeighborListOverflows() : 0;
+}
+
+//Stages read the lists only when the capacity uniform is non-zero
+void PBFComputeSystem::bindNeighborLists(ComputeShader* shader) {
+    shader->setInt("neighborListCapacity", (int)neighborListCapacity);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 11, neighborListBuffer);
+}
+
+void PBFComputeSystem::bindGridBuffers() {
+    glBindBufferBase(GL_UNIFORM_BUFFER, 0, simParamsUBO);
+    glBindBufferBase(GL_UNIFORM_BUFFER, 1, gridParamsUBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, particleSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, cellEndBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, cellParticlesBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, cellStartBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, particleCellsBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, scanBlockSumsBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 12, cellKeysBuffer);
+}
+
+//Exclusive scan of the counts in cellEnd into cellStart/cellEnd
+void PBFComputeSystem::runGridPrefixSum(unsigned int cellGroups) {
+    prefixSumShader->use();
+    prefixSumShader->setUInt("scanPass", 0);
+    glDispatchCompute(cellGroups, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    prefixSumShader->setUInt("scanPass", 1);
+    glDispatchCompute(1, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    prefixSumShader->setUInt("scanPass", 2);
+    glDispatchCompute(cellGroups, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+//Sorts the particles along the Morton curve of their grid cell so particles that are
+//close in space are close in memory. It is the grid counting sort keyed by the cell's
+//Morton rank (a hashed grid uses the Morton code folded into its slot count); whole
+//Particle records move and particleIdBuffer keeps the upload index
+void PBFComputeSystem::reorderParticles() {
+    if (numParticles == 0) return;
+
+    if (cpuSolver) {
+        cpuSolver->reorderParticles();
+        return;
+    }
+
+    prepareGrid();
+    glm::ivec3 gridDim = glm::ivec3(gridParams.dimMode);
+    glm::ivec3 gridOffset = glm::ivec3(gridParams.offset);
+
+    unsigned int cellGroups = (gridParams.numCells + 255) / 256;
+    if (cellGroups == 0) cellGroups = 1;
     unsigned int particleGroups = (numParticles + 255) / 256;
-    if (particleGroups == 0) particleGroups = 1;
 
+    //ranked along the curve of the whole lattice, so a fitted grid sorts like the dense one
+    if (gridMode != GridMode::Hashed && (gridDim != mortonGridDim || gridOffset != mortonGridOffset)) {
+        std::vector<unsigned int> order = UniformGrid::computeMortonCellOrder(gridDim, gridOffset);
+        std::vector<GLuint> ranks(order.size());
+        for (size_t i = 0; i < order.size(); ++i) {
+            ranks[order[i]] = (GLuint)i;
+        }
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, cellMortonRankBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, ranks.size() * sizeof(GLuint), ranks.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        mortonGridDim = gridDim;
+        mortonGridOffset = gridOffset;
+    }
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, particleIdBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, reorderedParticleBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, reorderedIdBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, cellMortonRankBuffer);
+
+    //keyed by Morton code, the hash table is not used
+    clearGrid(false);
+
+    reorderShader->use();
+    reorderShader->setInt("reorderPass", 0);
+    glDispatchCompute(particleGroups, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    runGridPrefixSum(cellGroups);
+
+    reorderShader->use();
+    reorderShader->setInt("reorderPass", 1);
+    glDispatchCompute(particleGroups, 1, 1);
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    glBindBuffer(GL_COPY_READ_BUFFER, reorderedParticleBuffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, particleSSBO);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, numParticles * sizeof(Particle));
+
+    glBindBuffer(GL_COPY_READ_BUFFER, reorderedIdBuffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, particleIdBuffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, numParticles * sizeof(GLuint));
+
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    particlesReordered = true;
+}
+
+//Counting sort of the predicted positions into cellStart/cellEnd/cellParticles
+void PBFComputeSystem::buildGrid() {
+    prepareGrid();
+    clearGrid(true);
+    sortGrid();
+}
+
+//Uploads the particle count and the grid layout of this build and binds the grid buffers
+void PBFComputeSystem::prepareGrid() {
     params.numParticles = numParticles;
     glBindBuffer(GL_UNIFORM_BUFFER, simParamsUBO);
     glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(SimParams), &params);
 
-    clearGridShader->use();
+    updateGridParams();
+    bindGridBuffers();
+}
 
-    glBindBufferBase(GL_UNIFORM_BUFFER, 0, simParamsUBO);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, cellCountsBuffer);
+//clear_grid.comp, only needed when this build does not stamp its counts or, with
+//clearKeys, to empty a hashed grid's key table
+void PBFComputeSystem::clearGrid(bool clearKeys) {
+    if (gridParams.epoch != 0 && !(clearKeys && gridMode == GridMode::Hashed)) return;
 
-    glDispatchCompute(clearGroups, 1, 1);
+    unsigned int cellGroups = (gridParams.numCells + 255) / 256;
+    if (cellGroups == 0) cellGroups = 1;
 
+    clearGridShader->use();
+    glDispatchCompute(cellGroups, 1, 1);
     glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+//Count particles per cell, exclusive scan of the counts into cellStart/cellEnd,
+//then scatter every particle index into its cell's range
+void PBFComputeSystem::sortGrid() {
+    unsigned int cellGroups = (gridParams.numCells + 255) / 256;
+    if (cellGroups == 0) cellGroups = 1;
+
+    unsigned int particleGroups = (numParticles + 255) / 256;
+    if (particleGroups == 0) particleGroups = 1;
 
     constructGridShader->use();
+    glDispatchCompute(particleGroups, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    runGridPrefixSum(cellGroups);
+
+    scatterGridShader->use();
+    glDispatchCompute(particleGroups, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+bool PBFComputeSystem::buildRenderGrid() {
+    if (numParticles == 0) return false;
+
+    if (cpuSolver) {
+        if (!mirrorToGL) return false;
+
+        cpuSolver->rebuildGrid();
+        uploadCpuGrid();
+        return true;
+    }
+
+    //update_velocity leaves predictedPos == position, so this bins where the particles are drawn
+    buildGrid();
+    return true;
+}
+
+//Debug check of the GPU counting sort. The grid of the current predicted positions is
+//built again, read back and compared with a UniformGrid built from the same positions.
+//Dense and fitted grids must match cell for cell; a hashed grid may put a cell in another
+//slot (probe order), so there the particle count of every cell is compared instead
+bool PBFComputeSystem::checkGpuGrid() {
+    if (cpuSolver || numParticles == 0) return true;
+
+    //errors of earlier calls are not this build's
+    while (glGetError() != GL_NO_ERROR) {}
+
+    buildGrid();
+    GLenum err = glGetError();
+    if (err != GL_NO_ERROR) {
+        std::cerr << "[PBFComputeSystem] GL error 0x" << std::hex << err << std::dec << " while building the grid\n";
+        return false;
+    }
+
+    const size_t cells = gridParams.numCells;
+    const bool hashed = gridMode == GridMode::Hashed;
+    std::vector<Particle> gpuParticles(numParticles);
+    std::vector<GLuint> starts(cells), ends(cells), sorted(numParticles), keys;
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleSSBO);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, numParticles * sizeof(Particle), gpuParticles.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, cellStartBuffer);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, cells * sizeof(GLuint), starts.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, cellEndBuffer);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, cells * sizeof(GLuint), ends.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, cellParticlesBuffer);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, numParticles * sizeof(GLuint), sorted.data());
+    if (hashed) {
+        keys.resize(cells);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, cellKeysBuffer);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, cells * sizeof(GLuint), keys.data());
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    UniformGrid grid;
+    grid.setEpochStamping(false);
+    if (hashed) grid.configureHashed(glm::vec3(gridParams.origin), params.cellSize, numParticles);
+    else grid.configure(glm::vec3(gridParams.origin), glm::ivec3(gridParams.dimMode), params.cellSize, glm::ivec3(gridParams.offset));
+    ThreadPool pool(1);
+    grid.build(pool, numParticles, [&](size_t i) { return gpuParticles[i].predictedPosition; });
+
+    const std::vector<unsigned int>& cpuStarts = grid.getCellStarts();
+    const std::vector<unsigned int>& cpuEnds = grid.getCellEnds();
+    size_t mismatches = 0;
+    size_t firstMismatch = SIZE_MAX;
+    auto mismatch = [&](size_t c) {
+        if (mismatches++ == 0) firstMismatch = c;
+    };
+
+    if (hashed) {
+        const std::vector<unsigned int>& cpuKeys = grid.getCellKeys();
+        for (size_t c = 0; c < cells; ++c) {
+            if (cpuKeys[c] == EMPTY_CELL_KEY) continue;
+
+            //the GPU slot of the same cell, by the probe sequence of pbf_grid.glsl
+            unsigned int slot = hashCellKey(cpuKeys[c]) & gridParams.slotMask;
+            while (keys[slot] != cpuKeys[c] && keys[slot] != EMPTY_CELL_KEY) slot = (slot + 1) & gridParams.slotMask;
+            if (keys[slot] != cpuKeys[c] || ends[slot] - starts[slot] != cpuEnds[c] - cpuStarts[c]) mismatch(c);
+        }
+    }
+    else {
+        for (size_t c = 0; c < cells; ++c) {
+            if (starts[c] != cpuStarts[c] || ends[c] != cpuEnds[c]) {
+                mismatch(c);
+                continue;
+            }
+            //same ranges, the order inside a cell follows the GPU's atomics
+            for (unsigned int j = starts[c]; j < ends[c]; ++j) {
+                if (sorted[j] >= numParticles || grid.getClampedCellIndex(gpuParticles[sorted[j]].predictedPosition) != c) {
+                    mismatch(c);
+                    break;
+                }
+            }
+        }
+    }
+
+    if (mismatches > 0) {
+        std::cerr << "[PBFComputeSystem] GPU grid differs from UniformGrid in " << mismatches << " of " << cells
+            << " cells, first at " << firstMismatch << " (" << gridModeName(gridMode) << " grid)\n";
+        return false;
+    }
+
+    std::cout << "[PBFComputeSystem] GPU grid matches UniformGrid (" << cells << " cells, " << gridModeName(gridMode) << ")\n";
+    return true;
+}
+
+//The CPU grid indexes the storage order, which is also the order of the mirrored particleSSBO
+void PBFComputeSystem::uploadCpuGrid() {
+    const UniformGrid& grid = cpuSolver->getGrid();
+    const std::vector<unsigned int>& starts = grid.getCellStarts();
+    const std::vector<unsigned int>& ends = grid.getCellEnds();
+    const std::vector<unsigned int>& sorted = grid.getSortedIndices();
+    const bool hashed = grid.getMode() == GridMode::Hashed;
+
+    if (!cellStartBuffer) glGenBuffers(1, &cellStartBuffer);
+    if (!cellEndBuffer) glGenBuffers(1, &cellEndBuffer);
+    if (!cellParticlesBuffer) glGenBuffers(1, &cellParticlesBuffer);
+    if (!cellKeysBuffer) glGenBuffers(1, &cellKeysBuffer);
+
+    //sized on every upload, the CPU grid follows the boundary (wave mode)
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, cellStartBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, starts.size() * sizeof(GLuint), starts.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, cellEndBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, ends.size() * sizeof(GLuint), ends.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, cellParticlesBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sorted.size() * sizeof(GLuint), sorted.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, cellKeysBuffer);
+    if (hashed) {
+        const std::vector<unsigned int>& keys = grid.getCellKeys();
+        glBufferData(GL_SHADER_STORAGE_BUFFER, keys.size() * sizeof(GLuint), keys.data(), GL_STREAM_DRAW);
+    }
+    else {
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), nullptr, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
+    gridParams.origin = glm::vec4(grid.getOrigin(), 0.0f);
+    gridParams.offset = glm::ivec4(grid.getOffset(), 0);
+    gridParams.dimMode = glm::ivec4(grid.getDim(), (int)grid.getMode());
+    gridParams.numCells = (unsigned int)grid.getNumCells();
+    gridParams.slotMask = hashed ? gridParams.numCells - 1 : 0;
+    gridParams.epoch = 0;
+    glBindBuffer(GL_UNIFORM_BUFFER, gridParamsUBO);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(GridParams), &gridParams);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    params.numParticles = numParticles;
+    glBindBuffer(GL_UNIFORM_BUFFER, simParamsUBO);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(SimParams), &params);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void PBFComputeSystem::bindRenderGrid() {
     glBindBufferBase(GL_UNIFORM_BUFFER, 0, simParamsUBO);
+    glBindBufferBase(GL_UNIFORM_BUFFER, 1, gridParamsUBO);
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, particleSSBO);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, cellCountsBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, cellEndBuffer);
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, cellParticlesBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, cellStartBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 12, cellKeysBuffer);
+}
 
-    glDispatchCompute(particleGroups, 1, 1);
+//Times its own stages: the GPU grid clear and the rest of the build separately, so
+//skipping the clear shows up in the timing log, and find_neighbors for the lists.
+//The CPU backend reports grid and lists together as find_neighbors
+void PBFComputeSystem::findNeighbors() {
+    if (cpuSolver) {
+        ScopedStageTimer timer(profiler, TimingStage::FindNeighbors);
+        cpuSolver->findNeighbors();
+        return;
+    }
 
-    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    prepareGrid();
+    {
+        ScopedStageTimer timer(profiler, TimingStage::GridClear);
+        clearGrid(true);
+    }
+    {
+        ScopedStageTimer timer(profiler, TimingStage::GridBuild);
+        sortGrid();
+    }
+
+    unsigned int particleGroups = (numParticles + 255) / 256;
+    if (particleGroups == 0) particleGroups = 1;
+
+    if (neighborListCapacity > 0) {
+        ScopedStageTimer timer(profiler, TimingStage::FindNeighbors);
+        neighborListShader->use();
+        bindNeighborLists(neighborListShader);
+        glDispatchCompute(particleGroups, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
 }
 
-void PBFComputeSystem::calculateDensity() {
+void PBFComputeSystem::calculateDensity(float lambdaWarmStart) {
     if (numParticles == 0) {
         std::cerr << "[PBFComputeSystem] Warning: calculateDensity called with zero particles\n";
         return;
     }
 
+    if (cpuSolver) {
+        cpuSolver->calculateDensity(lambdaWarmStart);
+        return;
+    }
+
     unsigned int numGroups = (numParticles + 255) / 256;
     if (numGroups == 0) numGroups = 1;
 
@@ -279,16 +975,46 @@ void PBFComputeSystem::calculateDensity() {
     densityShader->use();
 
     glBindBufferBase(GL_UNIFORM_BUFFER, 0, simParamsUBO);
+    glBindBufferBase(GL_UNIFORM_BUFFER, 1, gridParamsUBO);
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, particleSSBO);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, cellCountsBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, cellEndBuffer);
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, cellParticlesBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, cellStartBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 12, cellKeysBuffer);
+    bindNeighborLists(densityShader);
+    densityShader->setFloat("lambdaWarmStart", lambdaWarmStart);
+
+    glDispatchCompute(numGroups, 1, 1);
+
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void PBFComputeSystem::accumulateLambdaSums(bool restart) {
+    if (cpuSolver) {
+        cpuSolver->accumulateLambdaSums(restart);
+        return;
+    }
+
+    unsigned int numGroups = (numParticles + 255) / 256;
+    if (numGroups == 0) numGroups = 1;
+
+    //the position update left SimParams current
+    accumulateLambdaShader->use();
+    glBindBufferBase(GL_UNIFORM_BUFFER, 0, simParamsUBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, particleSSBO);
+    accumulateLambdaShader->setInt("restartSum", restart ? 1 : 0);
 
     glDispatchCompute(numGroups, 1, 1);
 
     glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
 }
 
-void PBFComputeSystem::applyPositionUpdate() {
+void PBFComputeSystem::applyPositionUpdate(float chebyshevOmega) {
+    if (cpuSolver) {
+        cpuSolver->applyPositionUpdate(chebyshevOmega);
+        return;
+    }
+
     unsigned int numGroups = (numParticles + 255) / 256;
     if (numGroups == 0) numGroups = 1;
 
@@ -299,16 +1025,136 @@ void PBFComputeSystem::applyPositionUpdate() {
     positionUpdateShader->use();
 
     glBindBufferBase(GL_UNIFORM_BUFFER, 0, simParamsUBO);
+    glBindBufferBase(GL_UNIFORM_BUFFER, 1, gridParamsUBO);
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, particleSSBO);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, cellCountsBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, cellEndBuffer);
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, cellParticlesBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, cellStartBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 12, cellKeysBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 16, chebyshevPreviousBuffer);
+    bindNeighborLists(positionUpdateShader);
+    positionUpdateShader->setFloat("chebyshevOmega", chebyshevOmega);
+    positionUpdateShader->setInt("colorPass", -1);
 
     glDispatchCompute(numGroups, 1, 1);
 
     glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
 }
 
+void PBFComputeSystem::applyPositionUpdateColored() {
+    if (cpuSolver) {
+        cpuSolver->applyPositionUpdateColored();
+        return;
+    }
+
+    //one invocation per cell or hash slot, those of other colours return at once
+    unsigned int numGroups = (gridParams.numCells + 255) / 256;
+    if (numGroups == 0) numGroups = 1;
+
+    glBindBuffer(GL_UNIFORM_BUFFER, simParamsUBO);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(SimParams), &params);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    positionUpdateShader->use();
+
+    glBindBufferBase(GL_UNIFORM_BUFFER, 0, simParamsUBO);
+    glBindBufferBase(GL_UNIFORM_BUFFER, 1, gridParamsUBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, particleSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, cellEndBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, cellParticlesBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, cellStartBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 12, cellKeysBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 16, chebyshevPreviousBuffer);
+    bindNeighborLists(positionUpdateShader);
+    positionUpdateShader->setFloat("chebyshevOmega", 0.0f);
+
+    //each colour reads the positions the previous one wrote
+    for (int color = 0; color < 8; color++) {
+        positionUpdateShader->setInt("colorPass", color);
+        glDispatchCompute(numGroups, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+}
+
+//The lattice is solved on the CPU for both backends. On the GPU the restriction is binned
+//with atomics in fixed point, read back (two words per cell), and the gradients uploaded
+float PBFComputeSystem::applyCoarseCorrection() {
+    if (numParticles == 0) return 0.0f;
+
+    const DensitySolverSettings& settings = solverSettings;
+    multigrid.configure(glm::vec3(params.minBoundary), glm::vec3(params.maxBoundary), settings.coarseCellSize * params.h);
+    const float maxDisplacement = settings.maxCoarseDisplacement * params.particleRadius;
+    const size_t cells = multigrid.getNumCells();
+
+    if (cpuSolver) {
+        cpuSolver->restrictDensityError(multigrid, coarseErrorSums, coarseCounts);
+        float residual = multigrid.solve(coarseErrorSums.data(), coarseCounts.data(), settings.multigridCycles);
+        cpuSolver->applyCoarseCorrection(multigrid, maxDisplacement);
+        return residual;
+    }
+
+    if (cells > coarseCellCapacity) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, coarseCellsBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, cells * sizeof(glm::uvec2), nullptr, GL_DYNAMIC_READ);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, coarseGradientBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, cells * sizeof(glm::vec4), nullptr, GL_DYNAMIC_DRAW);
+        coarseCellCapacity = cells;
+    }
+
+    //fixed point for the atomic sums, 16 fractional bits
+    const float errorScale = 65536.0f;
+    const glm::vec3 origin = multigrid.getOrigin();
+    const glm::ivec3 dims = multigrid.getDims();
+    unsigned int numGroups = (numParticles + 255) / 256;
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, coarseCellsBuffer);
+    glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0, cells * sizeof(glm::uvec2), GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+
+    //calculateDensity left SimParams current
+    coarseRestrictShader->use();
+    glBindBufferBase(GL_UNIFORM_BUFFER, 0, simParamsUBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, particleSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 17, coarseCellsBuffer);
+    coarseRestrictShader->setVec4("coarseLattice", origin.x, origin.y, origin.z, multigrid.getCellSize());
+    coarseRestrictShader->setIVec3("coarseDims", dims.x, dims.y, dims.z);
+    coarseRestrictShader->setFloat("errorScale", errorScale);
+    glDispatchCompute(numGroups, 1, 1);
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    coarseCells.resize(cells);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, cells * sizeof(glm::uvec2), coarseCells.data());
+
+    coarseErrorSums.resize(cells);
+    coarseCounts.resize(cells);
+    for (size_t c = 0; c < cells; ++c) {
+        coarseCounts[c] = coarseCells[c].x;
+        coarseErrorSums[c] = coarseCells[c].y / errorScale;
+    }
+    float residual = multigrid.solve(coarseErrorSums.data(), coarseCounts.data(), settings.multigridCycles);
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, coarseGradientBuffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, cells * sizeof(glm::vec4), multigrid.getGradients().data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    coarseCorrectionShader->use();
+    glBindBufferBase(GL_UNIFORM_BUFFER, 0, simParamsUBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, particleSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 18, coarseGradientBuffer);
+    coarseCorrectionShader->setVec4("coarseLattice", origin.x, origin.y, origin.z, multigrid.getCellSize());
+    coarseCorrectionShader->setIVec3("coarseDims", dims.x, dims.y, dims.z);
+    coarseCorrectionShader->setFloat("maxDisplacement", maxDisplacement);
+    glDispatchCompute(numGroups, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    return residual;
+}
+
 void PBFComputeSystem::applyVorticityViscosity() {
+    if (cpuSolver) {
+        cpuSolver->applyVorticityViscosity();
+        return;
+    }
+
     unsigned int numGroups = (numParticles + 255) / 256;
     if (numGroups == 0) numGroups = 1;
 
@@ -319,9 +1165,13 @@ void PBFComputeSystem::applyVorticityViscosity() {
     vorticityViscosityShader->use();
 
     glBindBufferBase(GL_UNIFORM_BUFFER, 0, simParamsUBO);
+    glBindBufferBase(GL_UNIFORM_BUFFER, 1, gridParamsUBO);
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, particleSSBO);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, cellCountsBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, cellEndBuffer);
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, cellParticlesBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, cellStartBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 12, cellKeysBuffer);
+    bindNeighborLists(vorticityViscosityShader);
 
     glDispatchCompute(numGroups, 1, 1);
 
@@ -329,6 +1179,11 @@ void PBFComputeSystem::applyVorticityViscosity() {
 }
 
 void PBFComputeSystem::updateVelocity() {
+    if (cpuSolver) {
+        cpuSolver->updateVelocity();
+        return;
+    }
+
     unsigned int numGroups = (numParticles + 255) / 256;
     if (numGroups == 0) numGroups = 1;
 
@@ -420,9 +1275,7 @@ void PBFComputeSystem::recordDensityStatistics(const std::string& filename) {
 
     //Download particle density data
     std::vector<Particle> particles(numParticles);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleSSBO);
-    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, numParticles * sizeof(Particle), particles.data());
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    downloadParticles(particles);
 
     //Calculate average and maximum density
     float totalDensity = 0.0f;
@@ -465,33 +1318,171 @@ void PBFComputeSystem::recordDensityStatistics(const std::string& filename) {
     }
 }
 
-void PBFComputeSystem::setFrameCount(int count) {
+void PBFComputeSystem::setFrameCount(int count, unsigned int substep) {
     currentFrame = count;
+    currentSubstep = substep;
 }
 
-void PBFComputeSystem::logTimingData(const std::string& stage, float timeMs, int frameCount, int numParticles) {
-    static bool headerWritten = false;
+//Reduced by max_speed.comp; like the fitted grid bounds this small read waits for the
+//GPU to finish the previous step, so callers ask once per frame rather than per stage
+float PBFComputeSystem::computeMaxSpeed() {
+    if (numParticles == 0) return 0.0f;
+
+    if (cpuSolver) {
+        return cpuSolver->computeMaxSpeed();
+    }
+
+    GLuint bits = 0;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, maxSpeedBuffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(bits), &bits);
 
-    std::ofstream file("pbf_timings.csv", std::ios::app);
-    if (!file.is_open()) {
-        std::cerr << "[PBFComputeSystem] Failed to open timing log file\n";
+    params.numParticles = numParticles;
+    glBindBuffer(GL_UNIFORM_BUFFER, simParamsUBO);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(SimParams), &params);
+
+    maxSpeedShader->use();
+    glBindBufferBase(GL_UNIFORM_BUFFER, 0, simParamsUBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, particleSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 14, maxSpeedBuffer);
+    glDispatchCompute((numParticles + 255) / 256, 1, 1);
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(bits), &bits);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    float speed;
+    std::memcpy(&speed, &bits, sizeof(speed));
+    return speed;
+}
+
+void PBFComputeSystem::computeDensityError(float& maxError, float& averageError) {
+    maxError = 0.0f;
+    averageError = 0.0f;
+    if (numParticles == 0) return;
+
+    if (cpuSolver) {
+        cpuSolver->computeDensityError(maxError, averageError);
         return;
     }
 
-    if (!headerWritten) {
-        std::ifstream checkFile("pbf_timings.csv");
-        if (!checkFile.good() || checkFile.peek() == std::ifstream::traits_type::eof()) {
-            file << "Frame,Stage,TimeMs,NumParticles\n";
-            headerWritten = true;
+    //calculateDensity left SimParams current
+    unsigned int numGroups = (numParticles + 255) / 256;
+    densityErrorShader->use();
+    glBindBufferBase(GL_UNIFORM_BUFFER, 0, simParamsUBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, particleSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 15, densityErrorBuffer);
+    glDispatchCompute(numGroups, 1, 1);
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    densityErrorPartials.resize(numGroups);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, densityErrorBuffer);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, numGroups * sizeof(glm::vec2), densityErrorPartials.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    double sum = 0.0;
+    for (const glm::vec2& partial : densityErrorPartials) {
+        sum += partial.x;
+        maxError = std::max(maxError, partial.y);
+    }
+    averageError = (float)(sum / numParticles);
+}
+
+//With a tolerance every density pass is followed by an error reduction. That read waits
+//for the GPU, so the early exit pays off when it skips whole iterations
+void PBFComputeSystem::solveDensityConstraints() {
+    const DensitySolverSettings& settings = solverSettings;
+    const bool adaptive = settings.tolerance > 0.0f;
+    const bool colored = settings.solver == ConstraintSolver::ColoredGaussSeidel;
+    const bool chebyshev = settings.chebyshev && !colored;
+    const bool estimate = chebyshev && settings.spectralRadius <= 0.0f;
+    const float maxSpectralRadius = 0.99f;
+    solverStats = DensitySolverStats();
+
+    //the sums are only carried over from a step that kept them
+    const bool warmStart = settings.lambdaWarmStart > 0.0f;
+    const float firstWarmStart = warmStart && lambdaSumsValid ? settings.lambdaWarmStart : 0.0f;
+    //the coarse correction moves the whole column at once, the passes after it are local
+    const bool coarse = settings.multigridCycles > 0;
+    const unsigned int firstLocal = coarse ? 1 : 0;
+    bool restartSums = true;
+
+    //the delay counts local passes. The first is plain and only records the positions the next
+    //one extrapolates from; an estimate compares the errors after two of them, not the error the
+    //coarse correction left
+    const unsigned int delay = std::max(settings.chebyshevDelay, estimate && coarse ? 2u : 1u);
+    const unsigned int accelerationStart = firstLocal + delay;
+
+    float omega = 1.0f;
+    float previousError = 0.0f;
+    for (unsigned int iter = 0; iter < settings.maxIterations; iter++) {
+        {
+            ScopedStageTimer timer(profiler, TimingStage::Density, iter);
+            calculateDensity(iter == firstLocal ? firstWarmStart : 0.0f);
+        }
+
+        if (adaptive || (estimate && iter <= accelerationStart)) {
+            computeDensityError(solverStats.maxError, solverStats.averageError);
+
+            //up to here every pass was plain Jacobi, whose error shrinks by about the spectral radius per pass
+            if (estimate && iter == accelerationStart && previousError > 0.0f) {
+                float ratio = std::min(solverStats.averageError / previousError, maxSpectralRadius);
+                estimatedSpectralRadius = estimatedSpectralRadius > 0.0f ? 0.8f * estimatedSpectralRadius + 0.2f * ratio : ratio;
+            }
+            previousError = solverStats.averageError;
+
+            bool converged = solverStats.averageError <= settings.tolerance &&
+                (settings.maxErrorTolerance <= 0.0f || solverStats.maxError <= settings.maxErrorTolerance);
+            if (adaptive && converged && iter >= settings.minIterations) break;
         }
-        checkFile.close();
+
+        //Chebyshev weights (Wang 2015): 1 during the delay, then 2 / (2 - rho^2), then 4 / (4 - rho^2 omega)
+        if (chebyshev) {
+            float rho = estimate ? estimatedSpectralRadius : std::min(settings.spectralRadius, maxSpectralRadius);
+            solverStats.spectralRadius = rho;
+            if (iter == accelerationStart) omega = 2.0f / (2.0f - rho * rho);
+            else if (iter > accelerationStart) omega = 4.0f / (4.0f - rho * rho * omega);
+        }
+
+        if (iter < firstLocal) {
+            ScopedStageTimer timer(profiler, TimingStage::CoarseCorrection, iter);
+            solverStats.coarseResidual = applyCoarseCorrection();
+        }
+        else {
+            ScopedStageTimer timer(profiler, TimingStage::PositionUpdate, iter);
+            if (colored) applyPositionUpdateColored();
+            else applyPositionUpdate(chebyshev ? omega : 0.0f);
+            if (warmStart) accumulateLambdaSums(restartSums);
+            restartSums = false;
+        }
+        solverStats.iterations++;
     }
 
-    file << frameCount << "," << stage << "," << timeMs << "," << numParticles << "\n";
-    file.close();
+    lambdaSumsValid = warmStart && !restartSums;
+}
+
+bool PBFComputeSystem::openTimingLog(const std::string& path) {
+    if (timingLog.isOpen() && timingLog.getPath() == path) return true;
+
+    closeTimingLog();
+    if (!timingLog.open(path)) return false;
+
+    profiler.setLog(&timingLog, backend == SolverBackend::GPU);
+    std::cout << "[PBFComputeSystem] Logging stage timings to " << path << (backend == SolverBackend::GPU ? " (GPU timer queries)\n" : "\n");
+    return true;
+}
+
+void PBFComputeSystem::closeTimingLog() {
+    //pending GPU queries are collected into the log before it is closed
+    profiler.setLog(nullptr, false);
+    timingLog.close();
 }
 
 void PBFComputeSystem::cleanup() {
+    profiler.releaseQueries();
+
+    delete cpuSolver;
+    cpuSolver = nullptr;
+
     // Delete compute shaders
     delete externalForcesShader;
     externalForcesShader = nullptr;
@@ -502,6 +1493,36 @@ void PBFComputeSystem::cleanup() {
     delete clearGridShader;
     clearGridShader = nullptr;
 
+    delete prefixSumShader;
+    prefixSumShader = nullptr;
+
+    delete scatterGridShader;
+    scatterGridShader = nullptr;
+
+    delete gridBoundsShader;
+    gridBoundsShader = nullptr;
+
+    delete maxSpeedShader;
+    maxSpeedShader = nullptr;
+
+    delete densityErrorShader;
+    densityErrorShader = nullptr;
+
+    delete accumulateLambdaShader;
+    accumulateLambdaShader = nullptr;
+
+    delete coarseRestrictShader;
+    coarseRestrictShader = nullptr;
+
+    delete coarseCorrectionShader;
+    coarseCorrectionShader = nullptr;
+
+    delete reorderShader;
+    reorderShader = nullptr;
+
+    delete neighborListShader;
+    neighborListShader = nullptr;
+
     delete densityShader;
     densityShader = nullptr;
 
@@ -516,16 +1537,53 @@ void PBFComputeSystem::cleanup() {
 
     // Delete existing GPU buffers
     if (simParamsUBO) glDeleteBuffers(1, &simParamsUBO);
+    if (gridParamsUBO) glDeleteBuffers(1, &gridParamsUBO);
     if (particleSSBO) glDeleteBuffers(1, &particleSSBO);
 
     // Delete grid buffers
-    if (cellCountsBuffer) glDeleteBuffers(1, &cellCountsBuffer);
+    if (cellStartBuffer) glDeleteBuffers(1, &cellStartBuffer);
+    if (cellEndBuffer) glDeleteBuffers(1, &cellEndBuffer);
     if (cellParticlesBuffer) glDeleteBuffers(1, &cellParticlesBuffer);
+    if (particleCellsBuffer) glDeleteBuffers(1, &particleCellsBuffer);
+    if (scanBlockSumsBuffer) glDeleteBuffers(1, &scanBlockSumsBuffer);
+    if (cellKeysBuffer) glDeleteBuffers(1, &cellKeysBuffer);
+    if (gridBoundsBuffer) glDeleteBuffers(1, &gridBoundsBuffer);
+    if (maxSpeedBuffer) glDeleteBuffers(1, &maxSpeedBuffer);
+    if (densityErrorBuffer) glDeleteBuffers(1, &densityErrorBuffer);
+    if (chebyshevPreviousBuffer) glDeleteBuffers(1, &chebyshevPreviousBuffer);
+    if (coarseCellsBuffer) glDeleteBuffers(1, &coarseCellsBuffer);
+    if (coarseGradientBuffer) glDeleteBuffers(1, &coarseGradientBuffer);
+    if (particleIdBuffer) glDeleteBuffers(1, &particleIdBuffer);
+    if (reorderedParticleBuffer) glDeleteBuffers(1, &reorderedParticleBuffer);
+    if (reorderedIdBuffer) glDeleteBuffers(1, &reorderedIdBuffer);
+    if (cellMortonRankBuffer) glDeleteBuffers(1, &cellMortonRankBuffer);
+    if (neighborListBuffer) glDeleteBuffers(1, &neighborListBuffer);
 
     // Reset buffer IDs
     simParamsUBO = 0;
+    gridParamsUBO = 0;
     particleSSBO = 0;
-    cellCountsBuffer = 0;
+    cellStartBuffer = 0;
+    cellEndBuffer = 0;
     cellParticlesBuffer = 0;
+    particleCellsBuffer = 0;
+    scanBlockSumsBuffer = 0;
+    cellKeysBuffer = 0;
+    gridBoundsBuffer = 0;
+    maxSpeedBuffer = 0;
+    densityErrorBuffer = 0;
+    chebyshevPreviousBuffer = 0;
+    coarseCellsBuffer = 0;
+    coarseGradientBuffer = 0;
+    coarseCellCapacity = 0;
+    cellCapacity = 0;
+    keyCapacity = 0;
+    particleIdBuffer = 0;
+    reorderedParticleBuffer = 0;
+    reorderedIdBuffer = 0;
+    cellMortonRankBuffer = 0;
+    neighborListBuffer = 0;
+    mortonGridDim = glm::ivec3(0);
+    mortonGridOffset = glm::ivec3(0);
 }
 
@@ -0,0 +1,672 @@
+#include "PBFCpuSolver.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <glm/gtc/type_ptr.hpp>
+
+namespace {
+
+// Lists keep neighbours a little beyond h, particles move during the solver iterations
+const float NEIGHBOR_LIST_SKIN = 1.1f;
+const unsigned int NEIGHBOR_LIST_OVERFLOW = 0xffffffffu;
+
+float calculateBoundaryDensity(const glm::vec3& pos, const SimParams& params) {
+    const float h = params.h;
+    float boundaryDensity = 0.0f;
+
+    float distToBottom = pos.y - params.minBoundary.y;
+    float distToLeft = pos.x - params.minBoundary.x;
+    float distToRight = params.maxBoundary.x - pos.x;
+    float distToFront = pos.z - params.minBoundary.z;
+    float distToBack = params.maxBoundary.z - pos.z;
+
+    if (distToBottom < h) boundaryDensity += (1.0f - distToBottom / h) * 0.5f;
+    if (distToLeft < h) boundaryDensity += (1.0f - distToLeft / h) * 0.5f;
+    if (distToRight < h) boundaryDensity += (1.0f - distToRight / h) * 0.5f;
+    if (distToFront < h) boundaryDensity += (1.0f - distToFront / h) * 0.5f;
+    if (distToBack < h) boundaryDensity += (1.0f - distToBack / h) * 0.5f;
+
+    return boundaryDensity;
+}
+
+glm::vec3 calculateWallRepulsion(const glm::vec3& pos, const SimParams& params) {
+    glm::vec3 repulsion(0.0f);
+    const float wallRepulsionStrength = 1.0f;
+    const float maxInfluenceDistance = 1.5f * params.particleRadius;
+
+    float distToFloor = pos.y - (params.minBoundary.y + params.particleRadius);
+    if (distToFloor < maxInfluenceDistance) repulsion.y += (1.0f - distToFloor / maxInfluenceDistance) * wallRepulsionStrength;
+
+    float distToLeftWall = pos.x - (params.minBoundary.x + params.particleRadius);
+    if (distToLeftWall < maxInfluenceDistance) repulsion.x += (1.0f - distToLeftWall / maxInfluenceDistance) * wallRepulsionStrength;
+
+    float distToRightWall = (params.maxBoundary.x - params.particleRadius) - pos.x;
+    if (distToRightWall < maxInfluenceDistance) repulsion.x -= (1.0f - distToRightWall / maxInfluenceDistance) * wallRepulsionStrength;
+
+    float distToFrontWall = pos.z - (params.minBoundary.z + params.particleRadius);
+    if (distToFrontWall < maxInfluenceDistance) repulsion.z += (1.0f - distToFrontWall / maxInfluenceDistance) * wallRepulsionStrength;
+
+    float distToBackWall = (params.maxBoundary.z - params.particleRadius) - pos.z;
+    if (distToBackWall < maxInfluenceDistance) repulsion.z -= (1.0f - distToBackWall / maxInfluenceDistance) * wallRepulsionStrength;
+
+    return repulsion;
+}
+
+//keeps a corrected position a little inside the walls and above the floor
+glm::vec3 clampToBoundary(glm::vec3 pos, const SimParams& params) {
+    const float safetyMargin = 0.1f * params.particleRadius;
+
+    if (pos.y < params.minBoundary.y + params.particleRadius) pos.y = params.minBoundary.y + params.particleRadius + safetyMargin;
+    if (pos.x < params.minBoundary.x + params.particleRadius) pos.x = params.minBoundary.x + params.particleRadius + safetyMargin;
+    if (pos.x > params.maxBoundary.x - params.particleRadius) pos.x = params.maxBoundary.x - params.particleRadius - safetyMargin;
+    if (pos.z < params.minBoundary.z + params.particleRadius) pos.z = params.minBoundary.z + params.particleRadius + safetyMargin;
+    if (pos.z > params.maxBoundary.z - params.particleRadius) pos.z = params.maxBoundary.z - params.particleRadius - safetyMargin;
+    return pos;
+}
+
+}
+
+PBFCpuSolver::PBFCpuSolver(unsigned int numThreads, bool pinThreads) : pool(numThreads, pinThreads), params(), gridMode(GridMode::Dense), reordered(false), mortonGridDim(0), mortonGridOffset(0), neighborListCapacity(0), neighborListOverflows(0), colorStarts(), cellColorsValid(false), kernels(&getSphKernels(preferredSimdLevel()))
+{
+    std::cout << "[PBFCpuSolver] Using " << pool.getNumThreads() << " threads" << (pool.isPinned() ? ", pinned to cores" : "") << "\n";
+}
+
+void PBFCpuSolver::setParams(const SimParams& newParams) {
+    params = newParams;
+    params.numParticles = (unsigned int)store.size();
+}
+
+void PBFCpuSolver::uploadParticles(const Particle* source, unsigned int count) {
+    store.fromParticles(source, count);
+    scratch.resize(count);
+    chebyshevPrevious.resize(count);
+    params.numParticles = count;
+
+    //upload order defines the external ids
+    particleIds.resize(count);
+    for (unsigned int i = 0; i < count; ++i) {
+        particleIds[i] = i;
+    }
+    reordered = false;
+}
+
+void PBFCpuSolver::downloadParticles(std::vector<Particle>& destination) const {
+    //back to upload order so exports line up frame to frame
+    destination.resize(store.size());
+    for (size_t i = 0; i < store.size(); ++i) {
+        destination[reordered ? particleIds[i] : i] = store.loadParticle(i);
+    }
+}
+
+void PBFCpuSolver::copyParticles(std::vector<Particle>& destination) const {
+    destination.resize(store.size());
+    for (size_t i = 0; i < store.size(); ++i) {
+        destination[i] = store.loadParticle(i);
+    }
+}
+
+void PBFCpuSolver::configureGrid(const std::vector<glm::vec3>& positions) {
+    glm::vec3 origin(params.minBoundary);
+    if (gridMode == GridMode::Hashed) {
+        grid.configureHashed(origin, params.cellSize, store.size());
+        return;
+    }
+
+    glm::vec3 domain = glm::vec3(params.maxBoundary) - origin;
+    glm::ivec3 dim = glm::max(glm::ivec3(glm::ceil(domain / params.cellSize)), glm::ivec3(1));
+    glm::ivec3 offset(0);
+    if (gridMode == GridMode::Fitted) {
+        glm::ivec3 lo, hi;
+        computeCellBounds(pool, positions.size(), [&](size_t id) { return positions[id]; }, origin, params.cellSize, lo, hi);
+        fitCellBounds(dim, lo, hi);
+
+        offset = lo;
+        dim = hi - lo + glm::ivec3(1);
+    }
+    grid.configure(origin, dim, params.cellSize, offset);
+}
+
+void PBFCpuSolver::reorderParticles() {
+    const size_t count = store.size();
+    if (count == 0) return;
+
+    configureGrid(store.predictedPosition);
+    if (gridMode == GridMode::Hashed) {
+        //only the occupied cells are ordered, there is no fixed cell set to cache
+        grid.build(pool, count, [&](size_t id) { return store.predictedPosition[id]; });
+        mortonCellOrder = grid.computeMortonSlotOrder();
+        mortonGridDim = glm::ivec3(0);
+    }
+    else {
+        //ranked along the curve of the whole lattice, so a fitted grid sorts like the dense one
+        if (mortonCellOrder.size() != grid.getNumCells() || mortonGridDim != grid.getDim() || mortonGridOffset != grid.getOffset()) {
+            mortonCellOrder = UniformGrid::computeMortonCellOrder(grid.getDim(), grid.getOffset());
+            mortonGridDim = grid.getDim();
+            mortonGridOffset = grid.getOffset();
+        }
+
+        grid.build(pool, count, [&](size_t id) { return store.predictedPosition[id]; });
+    }
+
+    cellColorsValid = false;
+
+    //walk the cells along the Morton curve, particles inside a cell keep their relative order
+    const std::vector<unsigned int>& sorted = grid.getSortedIndices();
+    reorderIndices.resize(count);
+    size_t next = 0;
+    for (unsigned int cellIndex : mortonCellOrder) {
+        unsigned int start, end;
+        grid.getCellRange(cellIndex, start, end);
+        for (unsigned int j = start; j < end; ++j) {
+            reorderIndices[next++] = sorted[j];
+        }
+    }
+
+    reorderBuffer.resize(count);
+    reorderIds.resize(count);
+    pool.parallelFor(0, count, [&](size_t begin, size_t end) {
+        store.gather(reorderIndices, begin, end, reorderBuffer);
+        for (size_t i = begin; i < end; ++i) {
+            reorderIds[i] = particleIds[reorderIndices[i]];
+        }
+    });
+
+    store.swap(reorderBuffer);
+    particleIds.swap(reorderIds);
+    reordered = true;
+
+    //slots moved, the grid and lists are rebuilt by the next findNeighbors
+    neighborCounts.clear();
+}
+
+void PBFCpuSolver::applyExternalForces() {
+    const float dt = params.dt;
+    const glm::vec3 gravity(params.gravity);
+    const float boundaryDamping = 0.5f;
+
+    pool.parallelFor(0, store.size(), [&](size_t begin, size_t end) {
+        for (size_t id = begin; id < end; ++id) {
+            //gravity
+            glm::vec3 velocity = store.velocity[id] + gravity * dt;
+            glm::vec3 predicted = store.position[id] + velocity * dt;
+
+            //boundary checks
+            if (predicted.y < params.minBoundary.y + params.particleRadius) {
+                predicted.y = params.minBoundary.y + params.particleRadius;
+                velocity.y = -velocity.y * boundaryDamping;
+
+                //floor friction
+                velocity.x *= 0.9f;
+                velocity.z *= 0.9f;
+            }
+
+            if (predicted.x < params.minBoundary.x + params.particleRadius) {
+                predicted.x = params.minBoundary.x + params.particleRadius;
+                velocity.x = -velocity.x * boundaryDamping;
+            }
+            else if (predicted.x > params.maxBoundary.x - params.particleRadius) {
+                predicted.x = params.maxBoundary.x - params.particleRadius;
+                velocity.x = -velocity.x * boundaryDamping;
+            }
+
+            if (predicted.z < params.minBoundary.z + params.particleRadius) {
+                predicted.z = params.minBoundary.z + params.particleRadius;
+                velocity.z = -velocity.z * boundaryDamping;
+            }
+            else if (predicted.z > params.maxBoundary.z - params.particleRadius) {
+                predicted.z = params.maxBoundary.z - params.particleRadius;
+                velocity.z = -velocity.z * boundaryDamping;
+            }
+
+            store.velocity[id] = velocity;
+            store.predictedPosition[id] = predicted;
+        }
+    });
+}
+
+void PBFCpuSolver::findNeighbors() {
+    configureGrid(store.predictedPosition);
+    grid.build(pool, store.size(), [&](size_t id) { return store.predictedPosition[id]; });
+    cellColorsValid = false;
+
+    if (neighborListCapacity > 0) {
+        buildNeighborLists();
+    }
+}
+
+void PBFCpuSolver::rebuildGrid() {
+    configureGrid(store.position);
+    grid.build(pool, store.size(), [&](size_t id) { return store.position[id]; });
+    cellColorsValid = false;
+}
+
+void PBFCpuSolver::setNeighborListCapacity(unsigned int capacity) {
+    neighborListCapacity = capacity;
+    neighborListOverflows = 0;
+    neighborCounts.clear();
+    neighborLists.clear();
+    neighborCounts.shrink_to_fit();
+    neighborLists.shrink_to_fit();
+}
+
+void PBFCpuSolver::buildNeighborLists() {
+    const size_t count = store.size();
+    const unsigned int capacity = neighborListCapacity;
+    const float radius = params.h * NEIGHBOR_LIST_SKIN;
+    const float radius2 = radius * radius;
+
+    neighborCounts.resize(count);
+    neighborLists.resize(count * capacity);
+
+    //same candidate order as the grid walk, so sums are accumulated in the same order
+    pool.parallelFor(0, count, [&](size_t begin, size_t end) {
+        for (size_t id = begin; id < end; ++id) {
+            const glm::vec3 pos = store.predictedPosition[id];
+            unsigned int* list = &neighborLists[id * capacity];
+            unsigned int listed = 0;
+
+            grid.forEachCandidate(pos, [&](unsigned int neighborId) {
+                if (neighborId == id || listed == NEIGHBOR_LIST_OVERFLOW) return;
+
+                glm::vec3 diff = pos - store.predictedPosition[neighborId];
+                if (glm::dot(diff, diff) >= radius2) return;
+
+                if (listed == capacity) {
+                    listed = NEIGHBOR_LIST_OVERFLOW;
+                    return;
+                }
+                list[listed++] = neighborId;
+            });
+
+            neighborCounts[id] = listed;
+        }
+    });
+
+    neighborListOverflows = (unsigned int)std::count(neighborCounts.begin(), neighborCounts.end(), NEIGHBOR_LIST_OVERFLOW);
+}
+
+template <typename Fn>
+void PBFCpuSolver::forEachNeighbor(size_t id, const glm::vec3& position, Fn&& fn) const {
+    if (id >= neighborCounts.size() || neighborCounts[id] == NEIGHBOR_LIST_OVERFLOW) {
+        grid.forEachCandidate(position, fn);
+        return;
+    }
+
+    const unsigned int* list = &neighborLists[id * neighborListCapacity];
+    for (unsigned int n = 0; n < neighborCounts[id]; ++n) {
+        fn(list[n]);
+    }
+}
+
+NeighborBatch PBFCpuSolver::getNeighborBatch(size_t id, const glm::ivec3& cellPos, std::vector<unsigned int>& candidates) const {
+    static_assert(sizeof(glm::vec3) == 3 * sizeof(float), "batch kernels index predicted positions as packed floats");
+
+    NeighborBatch batch;
+    batch.positions = glm::value_ptr(store.predictedPosition[0]);
+    batch.lambda = store.lambda.data();
+
+    if (id < neighborCounts.size() && neighborCounts[id] != NEIGHBOR_LIST_OVERFLOW) {
+        batch.ids = &neighborLists[id * neighborListCapacity];
+        batch.count = neighborCounts[id];
+        return batch;
+    }
+
+    candidates.clear();
+    grid.forEachCandidate(cellPos, [&](unsigned int neighborId) {
+        if (neighborId != id) candidates.push_back(neighborId);
+    });
+    batch.ids = candidates.data();
+    batch.count = (unsigned int)candidates.size();
+    return batch;
+}
+
+void PBFCpuSolver::setSimdLevel(SimdLevel level) {
+    kernels = &getSphKernels(level);
+}
+
+void PBFCpuSolver::calculateDensity(float lambdaWarmStart) {
+    const SphKernelConstants kernel(params.h);
+    const float selfDensity = kernel.W_Poly6(0.0f);
+
+    pool.parallelFor(0, store.size(), [&](size_t begin, size_t end) {
+        std::vector<unsigned int> candidates;
+        for (size_t id = begin; id < end; ++id) {
+            const glm::vec3 pos = store.predictedPosition[id];
+
+            //Poly6 and Spiky gradient sums in one pass over the neighbours
+            float neighborDensity, gradientSum;
+            kernels->densityTerms(kernel, glm::value_ptr(pos), getNeighborBatch(id, grid.getCellPos(pos), candidates), &neighborDensity, &gradientSum);
+
+            float density = selfDensity + neighborDensity + calculateBoundaryDensity(pos, params);
+            store.density[id] = density;
+
+            //constraint value C_i (density/rest_density - 1)
+            float C = density / params.restDensity - 1.0f;
+
+            //if no pressure correction needed (slightly negative allowed)
+            if (C <= -0.1f) {
+                store.lambda[id] = 0.0f;
+                continue;
+            }
+
+            //small epsilon term for numerical stability (CFM)
+            const float epsilon = 0.1f;
+            store.lambda[id] = -C / (gradientSum + epsilon) + lambdaWarmStart * store.lambdaSum[id];
+        }
+    });
+}
+
+void PBFCpuSolver::accumulateLambdaSums(bool restart) {
+    pool.parallelFor(0, store.size(), [&](size_t begin, size_t end) {
+        for (size_t id = begin; id < end; ++id) {
+            store.lambdaSum[id] = (restart ? 0.0f : store.lambdaSum[id]) + store.lambda[id];
+        }
+    });
+}
+
+void PBFCpuSolver::applyPositionUpdate(float chebyshevOmega) {
+    //s_corr equation 13 (k = 0.1, deltaq = 0.2h) is folded into the kernel constants
+    const SphKernelConstants kernel(params.h);
+
+    //corrections are gathered first and applied afterwards, so every particle sees
+    //the same predicted positions regardless of thread scheduling
+    pool.parallelFor(0, store.size(), [&](size_t begin, size_t end) {
+        std::vector<unsigned int> candidates;
+        for (size_t id = begin; id < end; ++id) {
+            const glm::vec3 pos = store.predictedPosition[id];
+            glm::vec3 newPos = correctPosition(id, pos, grid.getCellPos(pos), kernel, candidates);
+
+            if (chebyshevOmega > 1.0f) {
+                newPos = chebyshevOmega * (newPos - chebyshevPrevious[id]) + chebyshevPrevious[id];
+            }
+            if (chebyshevOmega > 0.0f) {
+                chebyshevPrevious[id] = pos;
+            }
+
+            scratch[id] = clampToBoundary(newPos, params);
+        }
+    });
+
+    store.predictedPosition.swap(scratch);
+}
+
+void PBFCpuSolver::applyPositionUpdateColored() {
+    const SphKernelConstants kernel(params.h);
+
+    if (!cellColorsValid) {
+        grid.computeColorCells(pool, colorCells, colorStarts);
+        cellColorsValid = true;
+    }
+
+    //cells of one colour run in parallel, the particles of a cell one after another on one
+    //thread, so every correction reads the positions already moved by earlier ones in place.
+    //A particle whose list overflowed walks the stencil of the cell it was binned into, like
+    //colorPass in apply_position_update.comp: around its moved position the stencil could
+    //reach a cell of the same colour that another thread is moving
+    const std::vector<unsigned int>& sorted = grid.getSortedIndices();
+    for (unsigned int color = 0; color < 8; ++color) {
+        pool.parallelFor(colorStarts[color], colorStarts[color + 1], [&](size_t begin, size_t end) {
+            std::vector<unsigned int> candidates;
+            for (size_t c = begin; c < end; ++c) {
+                const glm::ivec3 cellPos = grid.getCellPosOfIndex(colorCells[c]);
+                unsigned int start, cellEnd;
+                grid.getCellRange(colorCells[c], start, cellEnd);
+                for (unsigned int j = start; j < cellEnd; ++j) {
+                    const unsigned int id = sorted[j];
+                    const glm::vec3 pos = store.predictedPosition[id];
+                    store.predictedPosition[id] = clampToBoundary(correctPosition(id, pos, cellPos, kernel, candidates), params);
+                }
+            }
+        });
+    }
+}
+
+void PBFCpuSolver::restrictDensityError(const DensityMultigrid& multigrid, std::vector<float>& errorSums, std::vector<unsigned int>& counts) {
+    const size_t count = store.size();
+    const size_t cells = multigrid.getNumCells();
+    const float invRestDensity = 1.0f / params.restDensity;
+    errorSums.assign(cells, 0.0f);
+    counts.assign(cells, 0);
+
+    //one lattice per chunk, the first chunk bins straight into the result
+    const size_t chunks = std::min<size_t>(count, pool.getNumThreads());
+    if (chunks == 0) return;
+    coarseErrorPartials.assign((chunks - 1) * cells, 0.0f);
+    coarseCountPartials.assign((chunks - 1) * cells, 0);
+
+    pool.parallelFor(0, chunks, [&](size_t chunkBegin, size_t chunkEnd) {
+        for (size_t c = chunkBegin; c < chunkEnd; ++c) {
+            float* sums = c == 0 ? errorSums.data() : &coarseErrorPartials[(c - 1) * cells];
+            unsigned int* binned = c == 0 ? counts.data() : &coarseCountPartials[(c - 1) * cells];
+            for (size_t id = count * c / chunks; id < count * (c + 1) / chunks; ++id) {
+                const unsigned int cell = multigrid.getCellIndex(store.predictedPosition[id]);
+                sums[cell] += std::max(store.density[id] * invRestDensity - 1.0f, 0.0f);
+                binned[cell]++;
+            }
+        }
+    }, 1);
+
+    if (chunks == 1) return;
+    pool.parallelFor(0, cells, [&](size_t begin, size_t end) {
+        for (size_t cell = begin; cell < end; ++cell) {
+            for (size_t c = 1; c < chunks; ++c) {
+                errorSums[cell] += coarseErrorPartials[(c - 1) * cells + cell];
+                counts[cell] += coarseCountPartials[(c - 1) * cells + cell];
+            }
+        }
+    });
+}
+
+void PBFCpuSolver::applyCoarseCorrection(const DensityMultigrid& multigrid, float maxDisplacement) {
+    pool.parallelFor(0, store.size(), [&](size_t begin, size_t end) {
+        for (size_t id = begin; id < end; ++id) {
+            const glm::vec3 pos = store.predictedPosition[id];
+            glm::vec3 delta = multigrid.sampleGradient(pos);
+
+            const float length = glm::length(delta);
+            if (length > maxDisplacement) delta *= maxDisplacement / length;
+            const glm::vec3 corrected = clampToBoundary(pos + delta, params);
+
+            //the start of the step moves along, so updateVelocity does not turn the push into speed
+            store.position[id] += corrected - pos;
+            store.predictedPosition[id] = corrected;
+        }
+    });
+}
+
+glm::vec3 PBFCpuSolver::correctPosition(size_t id, const glm::vec3& pos, const glm::ivec3& cellPos, const SphKernelConstants& kernel, std::vector<unsigned int>& candidates) const {
+    glm::vec3 deltaPos;
+    kernels->positionDelta(kernel, glm::value_ptr(pos), store.lambda[id], getNeighborBatch(id, cellPos, candidates), glm::value_ptr(deltaPos));
+
+    deltaPos /= params.restDensity;
+    deltaPos += calculateWallRepulsion(pos, params) * 0.010f;
+    return pos + deltaPos;
+}
+
+void PBFCpuSolver::updateVelocity() {
+    const float dt = params.dt;
+
+    pool.parallelFor(0, store.size(), [&](size_t begin, size_t end) {
+        for (size_t id = begin; id < end; ++id) {
+            store.velocity[id] = (store.predictedPosition[id] - store.position[id]) / dt;
+            store.position[id] = store.predictedPosition[id];
+        }
+    });
+}
+
+float PBFCpuSolver::computeMaxSpeed() {
+    //a few chunks per thread, each reduced on its own like computeCellBounds
+    const size_t count = store.size();
+    const size_t chunks = std::min<size_t>(count, (size_t)pool.getNumThreads() * 4);
+    std::vector<float> chunkMax(chunks, 0.0f);
+
+    pool.parallelFor(0, chunks, [&](size_t chunkBegin, size_t chunkEnd) {
+        for (size_t c = chunkBegin; c < chunkEnd; ++c) {
+            float maxSq = 0.0f;
+            for (size_t id = count * c / chunks; id < count * (c + 1) / chunks; ++id) {
+                maxSq = std::max(maxSq, glm::dot(store.velocity[id], store.velocity[id]));
+            }
+            chunkMax[c] = maxSq;
+        }
+    }, 1);
+
+    float maxSq = 0.0f;
+    for (float value : chunkMax) {
+        maxSq = std::max(maxSq, value);
+    }
+    return std::sqrt(maxSq);
+}
+
+void PBFCpuSolver::computeDensityError(float& maxError, float& averageError) {
+    const size_t count = store.size();
+    const size_t chunks = std::min<size_t>(count, (size_t)pool.getNumThreads() * 4);
+    std::vector<glm::dvec2> chunkError(chunks);     //(sum, max)
+    const float invRestDensity = 1.0f / params.restDensity;
+
+    pool.parallelFor(0, chunks, [&](size_t chunkBegin, size_t chunkEnd) {
+        for (size_t c = chunkBegin; c < chunkEnd; ++c) {
+            double sum = 0.0;
+            float maxC = 0.0f;
+            for (size_t id = count * c / chunks; id < count * (c + 1) / chunks; ++id) {
+                float C = std::max(store.density[id] * invRestDensity - 1.0f, 0.0f);
+                sum += C;
+                maxC = std::max(maxC, C);
+            }
+            chunkError[c] = glm::dvec2(sum, maxC);
+        }
+    }, 1);
+
+    double sum = 0.0;
+    maxError = 0.0f;
+    for (const glm::dvec2& error : chunkError) {
+        sum += error.x;
+        maxError = std::max(maxError, (float)error.y);
+    }
+    averageError = count > 0 ? (float)(sum / count) : 0.0f;
+}
+
+void PBFCpuSolver::applyVorticityViscosity() {
+    const SphKernelConstants kernel(params.h);
+    const float dt = params.dt;
+
+    pool.parallelFor(0, store.size(), [&](size_t begin, size_t end) {
+        for (size_t id = begin; id < end; ++id) {
+            const glm::vec3 pos = store.position[id];
+            const glm::vec3 vel = store.velocity[id];
+
+            //vorticity and XSPH
+            glm::vec3 vorticity(0.0f);
+            glm::vec3 xsphVelocityChange(0.0f);
+
+            forEachNeighbor(id, pos, [&](unsigned int neighborId) {
+                if (neighborId == id) return;
+
+                glm::vec3 r = pos - store.position[neighborId];
+                float rlen = glm::length(r);
+
+                if (rlen < kernel.h && rlen > 0.0001f) {
+                    glm::vec3 velDiff = store.velocity[neighborId] - vel;
+                    glm::vec3 gradW = kernel.gradW_Spiky(r, rlen);
+
+                    vorticity += glm::cross(velDiff, gradW);
+                    xsphVelocityChange += velDiff * kernel.W_Poly6(rlen);
+                }
+            });
+
+            //vorticity confinement force
+            glm::vec3 vorticityForce(0.0f);
+            float vorticityMagnitude = glm::length(vorticity);
+
+            if (vorticityMagnitude > 0.0001f) {
+                //eta (gradient of vorticity magnitude)
+                glm::vec3 eta(0.0f);
+
+                forEachNeighbor(id, pos, [&](unsigned int neighborId) {
+                    if (neighborId == id) return;
+
+                    glm::vec3 r = pos - store.position[neighborId];
+                    float rlen = glm::length(r);
+
+                    if (rlen < kernel.h && rlen > 0.0001f) {
+                        glm::vec3 gradW = kernel.gradW_Spiky(r, rlen);
+                        float falloff = std::max(0.0f, 1.0f - rlen / kernel.h);
+                        float estimatedVortMag = vorticityMagnitude * falloff;
+
+                        eta += gradW * (vorticityMagnitude - estimatedVortMag);
+                    }
+                });
+
+                float etaLength = glm::length(eta);
+                if (etaLength > 0.0001f) {
+                    glm::vec3 N = eta / etaLength;
+                    float amplifiedEpsilon = params.vorticityEpsilon * 10.0f;
+                    vorticityForce = amplifiedEpsilon * glm::cross(N, vorticity);
+                }
+            }
+
+            scratch[id] = vel + vorticityForce * dt + params.xsphViscosityCoeff * xsphVelocityChange;
+        }
+    });
+
+    store.velocity.swap(scratch);
+}
+
+StepTraffic PBFCpuSolver::estimateStepTraffic(int solverIterations) const {
+    const double line = 64.0;
+    const double aosRecord = sizeof(Particle);
+    const double vec3Bytes = sizeof(glm::vec3);
+    const double floatBytes = sizeof(float);
+
+    //neighbour visits per pass, and those of particles that also run the lambda gradient pass
+    double candidates = 0.0;
+    double visits = 0.0;
+    double lambdaVisits = 0.0;
+    for (size_t id = 0; id < store.size(); ++id) {
+        double particleCandidates = 0.0;
+        glm::ivec3 cellPos = grid.getCellPos(store.predictedPosition[id]);
+        for (int x = -1; x <= 1; x++) {
+            for (int y = -1; y <= 1; y++) {
+                for (int z = -1; z <= 1; z++) {
+                    unsigned int start, end;
+                    if (grid.getCellRange(cellPos + glm::ivec3(x, y, z), start, end)) particleCandidates += end - start;
+                }
+            }
+        }
+
+        bool listed = id < neighborCounts.size() && neighborCounts[id] != NEIGHBOR_LIST_OVERFLOW;
+        double particleVisits = listed ? neighborCounts[id] : particleCandidates;
+
+        candidates += particleCandidates;
+        visits += particleVisits;
+        if (store.lambda[id] != 0.0f) lambdaVisits += particleVisits;
+    }
+
+    const double n = (double)store.size();
+    const double iterations = solverIterations;
+    StepTraffic traffic = { 0.0, 0.0 };
+
+    //per particle: AoS streams whole records in (and out when the stage writes)
+    //applyExternalForces, findNeighbors, updateVelocity
+    traffic.soaBytes += n * (4 * vec3Bytes) + n * vec3Bytes + n * (4 * vec3Bytes);
+    traffic.aosBytes += n * 2 * aosRecord + n * aosRecord + n * 2 * aosRecord;
+
+    //neighbour list build walks every candidate once
+    if (neighborListCapacity > 0) {
+        traffic.soaBytes += n * vec3Bytes + candidates * vec3Bytes;
+        traffic.aosBytes += n * aosRecord + candidates * line;
+    }
+
+    //calculateDensity: predicted position in, density and lambda out
+    traffic.soaBytes += iterations * (n * (vec3Bytes + 2 * floatBytes) + (visits + lambdaVisits) * vec3Bytes);
+    traffic.aosBytes += iterations * (n * 2 * aosRecord + (visits + lambdaVisits) * line);
+
+    //applyPositionUpdate: predicted position and lambda of every neighbour
+    traffic.soaBytes += iterations * (n * (2 * vec3Bytes + floatBytes) + visits * (vec3Bytes + floatBytes));
+    traffic.aosBytes += iterations * (n * 2 * aosRecord + visits * line);
+
+    //applyVorticityViscosity: two neighbour passes, the eta pass counted for every particle
+    traffic.soaBytes += n * 3 * vec3Bytes + visits * (2 * vec3Bytes) + visits * vec3Bytes;
+    traffic.aosBytes += n * 2 * aosRecord + 2 * visits * line;
+
+    return traffic;
+}
@@ -1,9 +1,12 @@
 ﻿#include "PBFSystem.h"
 #include "PBFComputeSystem.h"
+#include "Checkpoint.h"
 #include "Shader.h"
 #include <glad/glad.h>
 #include <iostream>
 #include <random>
+#include <cmath>
+#include <algorithm>
 #include <glm/gtc/type_ptr.hpp>
 
 PBFSystem::PBFSystem()
@@ -30,6 +33,21 @@ PBFSystem::PBFSystem()
     computeSystem = nullptr;
     computeSystemInitialized = false;
 
+    solverBackend = SolverBackend::GPU;
+    solverThreads = 0;
+    solverPinThreads = false;
+    solverGrainSize = 0;
+    maxParticles = 1000000;
+    reorderInterval = 25;
+    neighborListCapacity = 48;
+    gridMode = GridMode::Dense;
+    gridEpochStamping = true;
+    cpuSimdLevel = preferredSimdLevel();
+    cflNumber = 0.0f;
+    minSubstepDt = 0.001f;
+    maxSubstepDt = 0.016f;
+    randomSeed = 0;
+
     frameCount = 0;
     warmupFrames = 0;
 
@@ -130,15 +148,30 @@ void PBFSystem::step()
         minBoundary.z = originalMinBoundary.z + zDisplacement;
     }
 
-    const int numSubsteps = 1;
-    const float subDt = dt / numSubsteps;
     float warmupProgress = std::min(1.0f, frameCount / (float)warmupFrames);
     glm::vec4 scaledGravity = gravity * warmupProgress;
 
+    int numSubsteps = 1;
+    if (cflNumber > 0.0f) {
+        //speed at the start of the frame plus what gravity can add during it
+        lastMaxSpeed = computeSystem->computeMaxSpeed();
+        float speed = lastMaxSpeed + glm::length(glm::vec3(scaledGravity)) * dt;
+        float targetDt = speed > 0.0f ? cflNumber * particleRadius / speed : maxSubstepDt;
+        targetDt = glm::clamp(targetDt, minSubstepDt, maxSubstepDt);
+
+        //equal substeps, so frames stay dt apart for rendering and the frame cache
+        numSubsteps = std::max(1, (int)std::ceil(dt / targetDt - 1e-4f));
+    }
+    const float subDt = dt / numSubsteps;
+    lastSubsteps = numSubsteps;
+    lastSubstepDt = subDt;
+    lastSolverIterations = 0;
+
     for (int subStep = 0; subStep < numSubsteps; ++subStep) {
-        computeSystem->setFrameCount(frameCount);
-        computeSystem->updateSimulationParams(dt, scaledGravity, particleRadius, h, minBoundary, maxBoundary, cellSize, maxParticlesPerCell, restDensity,vorticityEpsilon,xsphViscosityCoeff);
+        computeSystem->setFrameCount(frameCount, subStep);
+        computeSystem->updateSimulationParams(subDt, scaledGravity, particleRadius, h, minBoundary, maxBoundary, cellSize, maxParticlesPerCell, restDensity,vorticityEpsilon,xsphViscosityCoeff);
         computeSystem->step();
+        lastSolverIterations += computeSystem->getSolverStats().iterations;
     }
 
 	////Density logging
@@ -158,28 +191,261 @@ void PBFSystem::step()
     //computeSystem->downloadParticles(particles);
 
     frameCount++;
+
+    if (frameCache.isOpen()) {
+        computeSystem->downloadParticles(cacheFrame);
+        frameCache.submitFrame(frameCount, cacheFrame.data(), cacheFrame.size(), minBoundary, maxBoundary);
+    }
 }
 
 void PBFSystem::initializeComputeSystem()
 {
     if (!computeSystem) {
-        computeSystem = new PBFComputeSystem();
+        computeSystem = new PBFComputeSystem(solverBackend, solverThreads, solverPinThreads);
     }
+    computeSystem->setReorderInterval(reorderInterval);
+    computeSystem->setNeighborListCapacity(neighborListCapacity);
+    computeSystem->setGridMode(gridMode);
+    computeSystem->setGridEpochStamping(gridEpochStamping);
+    computeSystem->setSolverSettings(solverSettings);
+    computeSystem->setSimdLevel(cpuSimdLevel);
+    computeSystem->setGrainSize(solverGrainSize);
 
-    // Some max capacity
-    const unsigned int MAX_PARTICLES = 1000000;
-    bool success = computeSystem->initialize(MAX_PARTICLES,dt,gravity,particleRadius,h,minBoundary,maxBoundary,cellSize,maxParticlesPerCell,restDensity, vorticityEpsilon, xsphViscosityCoeff);
+    bool success = computeSystem->initialize(maxParticles,dt,gravity,particleRadius,h,minBoundary,maxBoundary,cellSize,maxParticlesPerCell,restDensity, vorticityEpsilon, xsphViscosityCoeff);
 
     if (success) {
         computeSystemInitialized = true;
-        std::cout << "[PBFSystem] GPU compute system initialized\n";
+        std::cout << "[PBFSystem] " << (solverBackend == SolverBackend::CPU ? "CPU" : "GPU") << " compute system initialized\n";
         computeSystem->updateSimulationParams(dt, gravity, particleRadius, h, minBoundary, maxBoundary, cellSize, maxParticlesPerCell,restDensity, vorticityEpsilon, xsphViscosityCoeff);
+        if (!timingLogPath.empty()) {
+            computeSystem->openTimingLog(timingLogPath);
+        }
     }
     else {
-        std::cerr << "[PBFSystem] Failed to initialize GPU compute system\n";
+        std::cerr << "[PBFSystem] Failed to initialize " << (solverBackend == SolverBackend::CPU ? "CPU" : "GPU") << " compute system\n";
     }
 }
 
+void PBFSystem::setSolverBackend(SolverBackend backend)
+{
+    if (backend == solverBackend && computeSystemInitialized) return;
+
+    //Keep the running state so the switch is seamless
+    if (computeSystemInitialized) {
+        computeSystem->downloadParticles(particles);
+    }
+
+    delete computeSystem;
+    computeSystem = nullptr;
+    computeSystemInitialized = false;
+
+    solverBackend = backend;
+    initializeComputeSystem();
+
+    if (computeSystemInitialized && !particles.empty()) {
+        computeSystem->uploadParticles(particles);
+    }
+
+    // Particle SSBO changed, rebuild the GPU rendering indices
+    gpuRenderVAO = 0;
+}
+
+bool PBFSystem::openFrameCache(const std::string& path, const FrameCacheOptions& options)
+{
+    FrameCacheOptions cacheOptions = options;
+    cacheOptions.particleRadius = particleRadius;
+    cacheOptions.dt = dt;
+    if (!frameCache.open(path, cacheOptions)) return false;
+
+    std::cout << "[PBFSystem] Recording frames to " << path << (options.velocities ? " with velocities\n" : "\n");
+    return true;
+}
+
+bool PBFSystem::closeFrameCache()
+{
+    if (!frameCache.isOpen()) return true;
+    return frameCache.close();
+}
+
+bool PBFSystem::showParticles(const Particle* data, size_t count)
+{
+    if (!computeSystemInitialized) {
+        initializeComputeSystem();
+        if (!computeSystemInitialized) return false;
+    }
+
+    computeSystem->uploadParticles(data, count);
+    return true;
+}
+
+bool PBFSystem::saveCheckpoint(const std::string& path)
+{
+    if (!computeSystemInitialized) {
+        std::cerr << "[PBFSystem] ERROR: no simulation to checkpoint\n";
+        return false;
+    }
+
+    computeSystem->downloadParticles(particles);
+
+    CheckpointHeader header = makeCheckpointHeader(particles.size());
+    header.frameCount = frameCount;
+    header.warmupFrames = warmupFrames;
+    header.sceneType = (uint32_t)currentScene;
+    header.waveModeActive = waveModeActive ? 1 : 0;
+    header.waveTime = waveTime;
+    header.waveAmplitude = waveAmplitude;
+    header.waveFrequency = waveFrequency;
+    header.originalMinBoundary = originalMinBoundary;
+
+    SimParams& params = header.params;
+    params.dt = dt;
+    params.gravity = gravity;
+    params.particleRadius = particleRadius;
+    params.h = h;
+    params.minBoundary = minBoundary;
+    params.maxBoundary = maxBoundary;
+    params.numParticles = (unsigned int)particles.size();
+    params.cellSize = cellSize;
+    params.maxParticlesPerCell = maxParticlesPerCell;
+    params.restDensity = restDensity;
+    params.vorticityEpsilon = vorticityEpsilon;
+    params.xsphViscosityCoeff = xsphViscosityCoeff;
+
+    header.gridDim = glm::ivec3(glm::ceil(glm::vec3(maxBoundary - minBoundary) / cellSize));
+    header.gridOrigin = minBoundary;
+    header.reorderInterval = reorderInterval;
+    header.neighborListCapacity = neighborListCapacity;
+    header.gridMode = (uint32_t)gridMode;
+    header.cflNumber = cflNumber;
+    header.minSubstepDt = minSubstepDt;
+    header.maxSubstepDt = maxSubstepDt;
+
+    header.solver = (uint32_t)solverSettings.solver;
+    header.minIterations = solverSettings.minIterations;
+    header.maxIterations = solverSettings.maxIterations;
+    header.tolerance = solverSettings.tolerance;
+    header.maxErrorTolerance = solverSettings.maxErrorTolerance;
+    header.chebyshev = solverSettings.chebyshev ? 1u : 0u;
+    header.spectralRadius = solverSettings.spectralRadius;
+    header.chebyshevDelay = solverSettings.chebyshevDelay;
+    header.lambdaWarmStart = solverSettings.lambdaWarmStart;
+    header.multigridCycles = solverSettings.multigridCycles;
+    header.coarseCellSize = solverSettings.coarseCellSize;
+    header.maxCoarseDisplacement = solverSettings.maxCoarseDisplacement;
+    header.estimatedSpectralRadius = computeSystem->getEstimatedSpectralRadius();
+    header.gridEpochStamping = gridEpochStamping ? 1u : 0u;
+    header.lambdaSumsValid = computeSystem->getLambdaSumsValid() ? 1u : 0u;
+
+    if (!writeCheckpoint(path, header, particles.data())) return false;
+
+    std::cout << "[PBFSystem] Checkpoint of frame " << frameCount << " (" << particles.size() << " particles) written to " << path << "\n";
+    return true;
+}
+
+bool PBFSystem::loadCheckpoint(const std::string& path)
+{
+    CheckpointFile file;
+    if (!file.open(path)) return false;
+
+    const CheckpointHeader& header = file.getHeader();
+    if (header.numParticles == 0 || header.numParticles > maxParticles) {
+        std::cerr << "[PBFSystem] ERROR: checkpoint holds " << header.numParticles << " particles, capacity is " << maxParticles << "\n";
+        return false;
+    }
+
+    const SimParams& params = header.params;
+    dt = params.dt;
+    gravity = params.gravity;
+    particleRadius = params.particleRadius;
+    h = params.h;
+    minBoundary = params.minBoundary;
+    maxBoundary = params.maxBoundary;
+    cellSize = params.cellSize;
+    maxParticlesPerCell = params.maxParticlesPerCell;
+    restDensity = params.restDensity;
+    vorticityEpsilon = params.vorticityEpsilon;
+    xsphViscosityCoeff = params.xsphViscosityCoeff;
+
+    frameCount = header.frameCount;
+    warmupFrames = header.warmupFrames;
+    currentScene = (SceneType)header.sceneType;
+    waveModeActive = header.waveModeActive != 0;
+    waveTime = header.waveTime;
+    waveAmplitude = header.waveAmplitude;
+    waveFrequency = header.waveFrequency;
+    originalMinBoundary = header.originalMinBoundary;
+    reorderInterval = header.reorderInterval;
+    neighborListCapacity = header.neighborListCapacity;
+    gridMode = header.gridMode <= (uint32_t)GridMode::Fitted ? (GridMode)header.gridMode : GridMode::Dense;
+    if (header.cflNumber > 0.0f) {
+        cflNumber = header.cflNumber;
+        minSubstepDt = header.minSubstepDt;
+        maxSubstepDt = header.maxSubstepDt;
+    }
+    else {
+        cflNumber = 0.0f;
+    }
+
+    solverSettings.solver = header.solver == (uint32_t)ConstraintSolver::ColoredGaussSeidel ? ConstraintSolver::ColoredGaussSeidel : ConstraintSolver::Jacobi;
+    solverSettings.minIterations = header.minIterations;
+    solverSettings.maxIterations = header.maxIterations;
+    solverSettings.tolerance = header.tolerance;
+    solverSettings.maxErrorTolerance = header.maxErrorTolerance;
+    solverSettings.chebyshev = header.chebyshev != 0;
+    solverSettings.spectralRadius = header.spectralRadius;
+    solverSettings.chebyshevDelay = header.chebyshevDelay;
+    solverSettings.lambdaWarmStart = header.lambdaWarmStart;
+    solverSettings.multigridCycles = header.multigridCycles;
+    solverSettings.coarseCellSize = header.coarseCellSize;
+    solverSettings.maxCoarseDisplacement = header.maxCoarseDisplacement;
+    gridEpochStamping = header.gridEpochStamping != 0;
+
+    if (!computeSystemInitialized) {
+        initializeComputeSystem();
+        if (!computeSystemInitialized) return false;
+    }
+    else {
+        computeSystem->setReorderInterval(reorderInterval);
+        computeSystem->setNeighborListCapacity(neighborListCapacity);
+        computeSystem->setGridMode(gridMode);
+        computeSystem->setGridEpochStamping(gridEpochStamping);
+        computeSystem->setSolverSettings(solverSettings);
+        computeSystem->updateSimulationParams(dt, gravity, particleRadius, h, minBoundary, maxBoundary, cellSize, maxParticlesPerCell, restDensity, vorticityEpsilon, xsphViscosityCoeff);
+    }
+
+    computeSystem->setEstimatedSpectralRadius(header.estimatedSpectralRadius);
+    computeSystem->setLambdaSumsValid(header.lambdaSumsValid != 0);
+
+    //no copy on the CPU side, the solver reads the mapped records
+    particles.clear();
+    computeSystem->setFrameCount(frameCount);
+    computeSystem->uploadParticles(file.getParticles(), file.getNumParticles());
+
+    // Particle count may have changed, rebuild the GPU rendering indices
+    gpuRenderVAO = 0;
+
+    std::cout << "[PBFSystem] Resumed frame " << frameCount << " (" << file.getNumParticles() << " particles) from " << path << "\n";
+    return true;
+}
+
+void PBFSystem::setParticleRadius(float radius)
+{
+    //density is a kernel sum with unit mass, so it grows with the cube of the sampling density
+    float scale = particleRadius / radius;
+    restDensity *= scale * scale * scale;
+
+    particleRadius = radius;
+    h = particleRadius * 2.5f;
+    cellSize = h;
+}
+
+unsigned int PBFSystem::nextSceneSeed()
+{
+    if (randomSeed != 0) return randomSeed;
+    std::random_device rd;
+    return rd();
+}
+
 void PBFSystem::toggleWaveMode()
 {
     waveModeActive = !waveModeActive;
@@ -212,8 +478,7 @@ void PBFSystem::createDamBreakScene()
     const int numY = static_cast<int>(damHeight / spacing);
     const int numZ = static_cast<int>(damDepth / spacing);
 
-    std::random_device rd;
-    std::mt19937 gen(rd());
+    std::mt19937 gen(nextSceneSeed());
     std::uniform_real_distribution<float> jitter(-0.001f, 0.001f);
 
     for (int x = 0; x < numX; ++x) {
@@ -237,6 +502,7 @@ void PBFSystem::createDamBreakScene()
                 float heightRatio = static_cast<float>(y) / numY;
                 p.color = glm::vec3(heightRatio, 0.2f, 1.0f - heightRatio);
                 p.padding4 = 0.0f;
+                p.lambdaSum = 0.0f;
                 particles.push_back(p);
             }
         }
@@ -264,8 +530,7 @@ void PBFSystem::createWaterContainerScene()
     const int containerNumY = static_cast<int>(containerHeight / spacing);
     const int containerNumZ = static_cast<int>(containerDepth / spacing);
 
-    std::random_device rd;
-    std::mt19937 gen(rd());
+    std::mt19937 gen(nextSceneSeed());
     std::uniform_real_distribution<float> jitter(-0.001f, 0.001f);
 
     //function to add a particle
@@ -284,6 +549,7 @@ void PBFSystem::createWaterContainerScene()
         p.padding3 = 0.0f;
         p.color = color;
         p.padding4 = 0.0f;
+        p.lambdaSum = 0.0f;
 
         particles.push_back(p);
         };
@@ -334,8 +600,7 @@ void PBFSystem::dropWaterBlock()
     const int dropNumZ = static_cast<int>(dropBlockDepth / spacing);
 
     //random jitter for breaking symmetry
-    std::random_device rd;
-    std::mt19937 gen(rd());
+    std::mt19937 gen(nextSceneSeed());
     std::uniform_real_distribution<float> jitter(-0.001f, 0.001f);
 
     //existing particles
@@ -363,6 +628,7 @@ void PBFSystem::dropWaterBlock()
                 float heightRatio = static_cast<float>(y) / dropNumY;
                 p.color = glm::vec3(0.8f + 0.2f * heightRatio, 0.4f - 0.2f * heightRatio,0.0f);
                 p.padding4 = 0.0f;
+                p.lambdaSum = 0.0f;
 
                 particles.push_back(p);
             }
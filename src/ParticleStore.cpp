@@ -0,0 +1,67 @@
+#include "ParticleStore.h"
+
+void ParticleStore::resize(size_t count) {
+    position.resize(count);
+    predictedPosition.resize(count);
+    velocity.resize(count);
+    density.resize(count);
+    lambda.resize(count);
+    lambdaSum.resize(count);
+    color.resize(count);
+}
+
+void ParticleStore::swap(ParticleStore& other) {
+    position.swap(other.position);
+    predictedPosition.swap(other.predictedPosition);
+    velocity.swap(other.velocity);
+    density.swap(other.density);
+    lambda.swap(other.lambda);
+    lambdaSum.swap(other.lambdaSum);
+    color.swap(other.color);
+}
+
+void ParticleStore::fromParticles(const Particle* particles, size_t count) {
+    resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        storeParticle(i, particles[i]);
+    }
+}
+
+void ParticleStore::storeParticle(size_t index, const Particle& particle) {
+    position[index] = particle.position;
+    predictedPosition[index] = particle.predictedPosition;
+    velocity[index] = particle.velocity;
+    density[index] = particle.density;
+    lambda[index] = particle.lambda;
+    lambdaSum[index] = particle.lambdaSum;
+    color[index] = particle.color;
+}
+
+Particle ParticleStore::loadParticle(size_t index) const {
+    Particle particle = {};
+    particle.position = position[index];
+    particle.predictedPosition = predictedPosition[index];
+    particle.velocity = velocity[index];
+    particle.density = density[index];
+    particle.lambda = lambda[index];
+    particle.lambdaSum = lambdaSum[index];
+    particle.color = color[index];
+    return particle;
+}
+
+void ParticleStore::gather(const std::vector<unsigned int>& order, size_t begin, size_t end, ParticleStore& dst) const {
+    for (size_t i = begin; i < end; ++i) {
+        unsigned int src = order[i];
+        dst.position[i] = position[src];
+        dst.predictedPosition[i] = predictedPosition[src];
+        dst.velocity[i] = velocity[src];
+        dst.density[i] = density[src];
+        dst.lambda[i] = lambda[src];
+        dst.lambdaSum[i] = lambdaSum[src];
+        dst.color[i] = color[src];
+    }
+}
+
+size_t ParticleStore::bytesPerParticle() {
+    return 4 * sizeof(glm::vec3) + 3 * sizeof(float);
+}
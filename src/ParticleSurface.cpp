@@ -0,0 +1,223 @@
+#include "ParticleSurface.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <utility>
+
+namespace {
+
+//a 3x3 matrix is diagonal to float precision after three or four sweeps
+constexpr int EIGEN_SWEEPS = 4;
+
+//(1 - d/R)^3 weight of the smoothing and WPCA passes
+float surfaceWeight(float dist, float radius) {
+    float x = 1.0f - dist / radius;
+    return x * x * x;
+}
+
+//zeroes a[p][q] with a Givens rotation, v accumulates the rotations
+void jacobiRotate(glm::mat3& a, glm::mat3& v, int p, int q) {
+    float apq = a[q][p];
+    if (apq == 0.0f) return;
+
+    float theta = (a[q][q] - a[p][p]) / (2.0f * apq);
+    float t = (theta >= 0.0f ? 1.0f : -1.0f) / (std::abs(theta) + std::sqrt(theta * theta + 1.0f));
+    float c = 1.0f / std::sqrt(t * t + 1.0f);
+    float s = t * c;
+
+    glm::mat3 rotation(1.0f);
+    rotation[p][p] = c;
+    rotation[q][q] = c;
+    rotation[q][p] = s;
+    rotation[p][q] = -s;
+
+    a = glm::transpose(rotation) * a * rotation;
+    v = v * rotation;
+}
+
+glm::mat3 isotropicKernel(float scale, float particleRadius) {
+    return glm::mat3(scale / particleRadius);
+}
+
+}
+
+void buildSurfaceGrid(ThreadPool& pool, const std::vector<glm::vec3>& positions, float cellSize, UniformGrid& grid) {
+    glm::vec3 lo(0.0f), hi(0.0f);
+    if (!positions.empty()) {
+        lo = hi = positions[0];
+        for (const glm::vec3& p : positions) {
+            lo = glm::min(lo, p);
+            hi = glm::max(hi, p);
+        }
+    }
+
+    glm::ivec3 dim = glm::ivec3(glm::floor((hi - lo) / cellSize)) + glm::ivec3(1);
+    grid.configure(lo, dim, cellSize);
+    grid.build(pool, positions.size(), [&](size_t id) { return positions[id]; });
+}
+
+bool detectSurfaceParticles(ThreadPool& pool, const UniformGrid& grid, const std::vector<glm::vec3>& positions, float radius, int threshold, std::vector<int>& flags) {
+    if (radius > grid.getCellSize()) {
+        std::cerr << "[ParticleSurface] Neighbour radius " << radius << " exceeds the grid cell size " << grid.getCellSize() << "\n";
+        return false;
+    }
+
+    const float radius2 = radius * radius;
+    flags.resize(positions.size());
+
+    pool.parallelFor(0, positions.size(), [&](size_t begin, size_t end) {
+        const std::vector<unsigned int>& sorted = grid.getSortedIndices();
+
+        for (size_t id = begin; id < end; ++id) {
+            const glm::vec3 pos = positions[id];
+            const glm::ivec3 cellPos = grid.getCellPos(pos);
+            int neighborCount = 0;
+
+            //past the threshold the answer can no longer change
+            for (int c = 0; c < 27 && neighborCount < threshold; ++c) {
+                unsigned int start, cellEnd;
+                if (!grid.getCellRange(cellPos + glm::ivec3(c / 9 - 1, (c / 3) % 3 - 1, c % 3 - 1), start, cellEnd))
+                    continue;
+
+                for (unsigned int j = start; j < cellEnd; ++j) {
+                    unsigned int neighborId = sorted[j];
+                    if (neighborId == id) continue;
+
+                    glm::vec3 diff = pos - positions[neighborId];
+                    if (glm::dot(diff, diff) < radius2) neighborCount++;
+                }
+            }
+
+            flags[id] = neighborCount < threshold ? 1 : 0;
+        }
+    });
+    return true;
+}
+
+void symmetricEigen3(const glm::mat3& m, glm::vec3& eigenvalues, glm::mat3& eigenvectors) {
+    glm::mat3 a = m;
+    eigenvectors = glm::mat3(1.0f);
+
+    for (int sweep = 0; sweep < EIGEN_SWEEPS; ++sweep) {
+        jacobiRotate(a, eigenvectors, 0, 1);
+        jacobiRotate(a, eigenvectors, 0, 2);
+        jacobiRotate(a, eigenvectors, 1, 2);
+    }
+
+    eigenvalues = glm::vec3(a[0][0], a[1][1], a[2][2]);
+
+    //descending, three compare-swaps
+    const int order[3][2] = { { 0, 1 }, { 1, 2 }, { 0, 1 } };
+    for (const auto& pair : order) {
+        int i = pair[0], j = pair[1];
+        if (eigenvalues[i] < eigenvalues[j]) {
+            std::swap(eigenvalues[i], eigenvalues[j]);
+            std::swap(eigenvectors[i], eigenvectors[j]);
+        }
+    }
+}
+
+bool smoothParticleCenters(ThreadPool& pool, const UniformGrid& grid, const std::vector<glm::vec3>& positions, const std::vector<int>& flags, const AnisotropyParams& params, std::vector<glm::vec3>& centers) {
+    const float radius = params.smoothingRadius;
+    if (radius > grid.getCellSize()) {
+        std::cerr << "[ParticleSurface] Smoothing radius " << radius << " exceeds the grid cell size " << grid.getCellSize() << "\n";
+        return false;
+    }
+
+    centers.resize(positions.size());
+
+    pool.parallelFor(0, positions.size(), [&](size_t begin, size_t end) {
+        for (size_t id = begin; id < end; ++id) {
+            const glm::vec3 pos = positions[id];
+            if (flags[id] == 0) {
+                centers[id] = pos;
+                continue;
+            }
+
+            glm::vec3 weightedSum(0.0f);
+            float totalWeight = 0.0f;
+            grid.forEachCandidate(pos, [&](unsigned int neighborId) {
+                if (neighborId == id) return;
+
+                float dist = glm::distance(pos, positions[neighborId]);
+                if (dist < radius) {
+                    float weight = surfaceWeight(dist, radius);
+                    weightedSum += weight * positions[neighborId];
+                    totalWeight += weight;
+                }
+            });
+
+            centers[id] = totalWeight > 0.0f ? (1.0f - params.lambda) * pos + params.lambda * (weightedSum / totalWeight) : pos;
+        }
+    });
+    return true;
+}
+
+bool computeAnisotropyMatrices(ThreadPool& pool, const UniformGrid& grid, const std::vector<glm::vec3>& positions, const std::vector<int>& flags, const std::vector<glm::vec3>& centers, const AnisotropyParams& params, std::vector<glm::mat3>& matrices) {
+    const float radius = params.smoothingRadius;
+    if (radius > grid.getCellSize()) {
+        std::cerr << "[ParticleSurface] Smoothing radius " << radius << " exceeds the grid cell size " << grid.getCellSize() << "\n";
+        return false;
+    }
+
+    matrices.resize(positions.size());
+
+    pool.parallelFor(0, positions.size(), [&](size_t begin, size_t end) {
+        for (size_t id = begin; id < end; ++id) {
+            if (flags[id] == 0) {
+                matrices[id] = isotropicKernel(1.0f, params.particleRadius);
+                continue;
+            }
+
+            //one pass: weighted first and second moments relative to the center
+            const glm::vec3 center = centers[id];
+            glm::vec3 firstMoment(0.0f);
+            glm::mat3 secondMoment(0.0f);
+            float totalWeight = 0.0f;
+            int neighborCount = 0;
+
+            grid.forEachCandidate(center, [&](unsigned int neighborId) {
+                if (neighborId == id) return;
+
+                glm::vec3 diff = positions[neighborId] - center;
+                float dist = glm::length(diff);
+                if (dist < radius) {
+                    float weight = surfaceWeight(dist, radius);
+                    firstMoment += weight * diff;
+                    secondMoment += weight * glm::outerProduct(diff, diff);
+                    totalWeight += weight;
+                    neighborCount++;
+                }
+            });
+
+            if (neighborCount < params.neighborThreshold || totalWeight <= 0.0f) {
+                matrices[id] = isotropicKernel(params.kn, params.particleRadius);
+                continue;
+            }
+
+            glm::vec3 mean = firstMoment / totalWeight;
+            glm::mat3 covariance = params.ks * (secondMoment / totalWeight - glm::outerProduct(mean, mean));
+
+            glm::vec3 eigenvalues;
+            glm::mat3 eigenvectors;
+            symmetricEigen3(covariance, eigenvalues, eigenvectors);
+
+            //all neighbours on one point, there is no principal axis
+            if (eigenvalues.x <= 0.0f) {
+                matrices[id] = isotropicKernel(params.kn, params.particleRadius);
+                continue;
+            }
+
+            eigenvalues.y = std::max(eigenvalues.y, eigenvalues.x / params.kr);
+            eigenvalues.z = std::max(eigenvalues.z, eigenvalues.x / params.kr);
+
+            glm::mat3 sigma(0.0f);
+            sigma[0][0] = 1.0f / std::sqrt(eigenvalues.x);
+            sigma[1][1] = 1.0f / std::sqrt(eigenvalues.y);
+            sigma[2][2] = 1.0f / std::sqrt(eigenvalues.z);
+
+            matrices[id] = (1.0f / params.particleRadius) * eigenvectors * sigma * glm::transpose(eigenvectors);
+        }
+    });
+    return true;
+}
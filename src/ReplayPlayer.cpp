@@ -0,0 +1,117 @@
+#include "ReplayPlayer.h"
+#include <algorithm>
+#include <iostream>
+
+ReplayPlayer::~ReplayPlayer() {
+    close();
+}
+
+bool ReplayPlayer::open(const std::string& path, unsigned int prefetchFrames) {
+    close();
+    if (!reader.open(path)) return false;
+
+    numFrames = reader.getNumFrames();
+    prefetch = std::max(prefetchFrames, 1u);
+
+    //the window, plus the frame last handed out which may already have left it
+    slots.assign(prefetch + 2, Slot());
+    current = 0;
+    heldSlot = SIZE_MAX;
+    stopping = false;
+    failed = false;
+    decodedFrames = 0;
+    misses = 0;
+
+    decoder = std::thread(&ReplayPlayer::decoderLoop, this);
+
+    std::cout << "[ReplayPlayer] " << path << ": " << numFrames << " frames, prefetching " << prefetch << "\n";
+    return true;
+}
+
+void ReplayPlayer::close() {
+    if (decoder.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        workCondition.notify_all();
+        readyCondition.notify_all();
+        decoder.join();
+    }
+
+    reader.close();
+    slots.clear();
+    numFrames = 0;
+}
+
+const std::vector<Particle>* ReplayPlayer::getFrame(size_t i, bool wait) {
+    if (!isOpen() || i >= numFrames) return nullptr;
+
+    auto findSlot = [&]() {
+        for (size_t s = 0; s < slots.size(); ++s) {
+            if (slots[s].frame == i) return s;
+        }
+        return SIZE_MAX;
+    };
+
+    std::unique_lock<std::mutex> lock(mutex);
+    size_t slot = findSlot();
+    if (current != i) {
+        current = i;
+        if (slot == SIZE_MAX) misses++;
+        workCondition.notify_one();
+    }
+
+    if (slot == SIZE_MAX) {
+        if (!wait) return nullptr;
+        readyCondition.wait(lock, [&] { return failed || stopping || (slot = findSlot()) != SIZE_MAX; });
+        if (slot == SIZE_MAX) return nullptr;
+    }
+
+    heldSlot = slot;
+    return &slots[slot].particles;
+}
+
+bool ReplayPlayer::findWork(size_t& frame, size_t& slot) const {
+    const size_t end = std::min(current + prefetch + 1, numFrames);
+    for (frame = current; frame < end; ++frame) {
+        bool held = false;
+        for (const Slot& s : slots) held = held || s.frame == frame;
+        if (held) continue;
+
+        //any slot that is not handed out and whose frame left the window
+        for (slot = 0; slot < slots.size(); ++slot) {
+            if (slot != heldSlot && (slots[slot].frame == SIZE_MAX || !inWindow(slots[slot].frame))) return true;
+        }
+        return false;
+    }
+    return false;
+}
+
+void ReplayPlayer::decoderLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping && !failed) {
+        size_t frame, slot;
+        if (!findWork(frame, slot)) {
+            workCondition.wait(lock);
+            continue;
+        }
+
+        slots[slot].frame = SIZE_MAX;
+        lock.unlock();
+
+        //the pages of the frames after this one are read by the OS while it decodes
+        for (size_t ahead = 1; ahead <= prefetch; ++ahead) reader.prefetch(frame + ahead);
+        bool ok = reader.decodeFrame(frame, slots[slot].particles);
+
+        lock.lock();
+        if (ok) {
+            slots[slot].frame = frame;
+            decodedFrames++;
+        }
+        else {
+            failed = true;
+        }
+        readyCondition.notify_all();
+    }
+}
@@ -0,0 +1,177 @@
+#include "SphKernels.h"
+#include <cmath>
+#include <cstring>
+
+#if defined(PBF_X86_SIMD)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+//defined in SphKernelsAVX2.cpp / SphKernelsAVX512.cpp, built with their own ISA flags
+const SphKernelTable& getSphKernelsAVX2();
+const SphKernelTable& getSphKernelsAVX512();
+#endif
+
+namespace {
+
+const float PI = 3.14159f;
+
+void densityTermsScalar(const SphKernelConstants& kernel, const float* position, const NeighborBatch& batch, float* density, float* gradientSquared) {
+    float densitySum = 0.0f;
+    float gradientSum = 0.0f;
+    for (unsigned int j = 0; j < batch.count; ++j) {
+        const float* neighbor = batch.positions + 3 * (size_t)batch.ids[j];
+        float dx = position[0] - neighbor[0];
+        float dy = position[1] - neighbor[1];
+        float dz = position[2] - neighbor[2];
+        float r2 = dx * dx + dy * dy + dz * dz;
+        float r = std::sqrt(r2);
+        if (r < kernel.h) {
+            float term = kernel.h2 - r * r;
+            densitySum += kernel.poly6 * term * term * term;
+
+            //|gradW|^2 = (spiky (h - r)^2 / r)^2 r^2
+            if (r >= 0.0001f) {
+                float hr = kernel.h - r;
+                float scale = kernel.spiky * hr * hr / r;
+                gradientSum += scale * scale * r2;
+            }
+        }
+    }
+    *density = densitySum;
+    *gradientSquared = gradientSum;
+}
+
+void positionDeltaScalar(const SphKernelConstants& kernel, const float* position, float lambda, const NeighborBatch& batch, float* delta) {
+    float sumX = 0.0f, sumY = 0.0f, sumZ = 0.0f;
+    for (unsigned int j = 0; j < batch.count; ++j) {
+        const unsigned int neighborId = batch.ids[j];
+        const float* neighbor = batch.positions + 3 * (size_t)neighborId;
+        float dx = position[0] - neighbor[0];
+        float dy = position[1] - neighbor[1];
+        float dz = position[2] - neighbor[2];
+        float r = std::sqrt(dx * dx + dy * dy + dz * dz);
+        if (r < kernel.h && r > 0.0001f) {
+            float hr = kernel.h - r;
+            float scale = kernel.spiky * hr * hr / r;
+
+            float term = kernel.h2 - r * r;
+            float ratio = kernel.scorrPoly6 * term * term * term;
+            float ratio2 = ratio * ratio;
+            float scorr = kernel.scorrK * ratio2 * ratio2;
+
+            float weight = (lambda + batch.lambda[neighborId] + scorr) * scale;
+            sumX += weight * dx;
+            sumY += weight * dy;
+            sumZ += weight * dz;
+        }
+    }
+    delta[0] = sumX;
+    delta[1] = sumY;
+    delta[2] = sumZ;
+}
+
+const SphKernelTable SCALAR_KERNELS = { SimdLevel::Scalar, densityTermsScalar, positionDeltaScalar };
+
+#if defined(PBF_X86_SIMD)
+void cpuid(unsigned int leaf, unsigned int subleaf, unsigned int regs[4]) {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuidex(info, (int)leaf, (int)subleaf);
+    for (int i = 0; i < 4; ++i) regs[i] = (unsigned int)info[i];
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+//register state the OS saves on context switches (XCR0)
+unsigned long long readXcr0() {
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    unsigned int eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((unsigned long long)edx << 32) | eax;
+#endif
+}
+#endif
+
+}
+
+SphKernelConstants::SphKernelConstants(float smoothingLength, float k, float deltaqFraction) {
+    h = smoothingLength;
+    h2 = h * h;
+    float h6 = h2 * h2 * h2;
+    poly6 = 315.0f / (64.0f * PI * h6 * h2 * h);
+    spiky = -45.0f / (PI * h6);
+
+    float wdeltaq = W_Poly6(deltaqFraction * h);
+    scorrPoly6 = wdeltaq > 0.0f ? poly6 / wdeltaq : 0.0f;
+    scorrK = -k;
+}
+
+SimdLevel detectSimdLevel() {
+#if defined(PBF_X86_SIMD)
+    unsigned int regs[4];
+    cpuid(0, 0, regs);
+    if (regs[0] < 7) return SimdLevel::Scalar;
+
+    cpuid(1, 0, regs);
+    bool fma = (regs[2] & (1u << 12)) != 0;
+    bool osxsave = (regs[2] & (1u << 27)) != 0;
+    bool avx = (regs[2] & (1u << 28)) != 0;
+    if (!osxsave || !avx || !fma) return SimdLevel::Scalar;
+
+    //XMM and YMM state, then opmask and both ZMM halves
+    unsigned long long xcr0 = readXcr0();
+    if ((xcr0 & 0x6) != 0x6) return SimdLevel::Scalar;
+
+    cpuid(7, 0, regs);
+    bool avx2 = (regs[1] & (1u << 5)) != 0;
+    bool avx512f = (regs[1] & (1u << 16)) != 0;
+    if (!avx2) return SimdLevel::Scalar;
+
+    if (avx512f && (xcr0 & 0xe6) == 0xe6) return SimdLevel::AVX512;
+    return SimdLevel::AVX2;
+#else
+    return SimdLevel::Scalar;
+#endif
+}
+
+SimdLevel preferredSimdLevel() {
+    SimdLevel level = detectSimdLevel();
+    return level > SimdLevel::AVX2 ? SimdLevel::AVX2 : level;
+}
+
+const char* simdLevelName(SimdLevel level) {
+    switch (level) {
+    case SimdLevel::Scalar: return "scalar";
+    case SimdLevel::AVX2: return "avx2";
+    case SimdLevel::AVX512: return "avx512";
+    }
+    return "unknown";
+}
+
+bool parseSimdLevel(const char* name, SimdLevel& level) {
+    if (std::strcmp(name, "auto") == 0) level = preferredSimdLevel();
+    else if (std::strcmp(name, "scalar") == 0) level = SimdLevel::Scalar;
+    else if (std::strcmp(name, "avx2") == 0) level = SimdLevel::AVX2;
+    else if (std::strcmp(name, "avx512") == 0) level = SimdLevel::AVX512;
+    else return false;
+    return true;
+}
+
+const SphKernelTable& getSphKernels(SimdLevel level) {
+#if defined(PBF_X86_SIMD)
+    SimdLevel supported = detectSimdLevel();
+    if (level > supported) level = supported;
+
+    if (level == SimdLevel::AVX512) return getSphKernelsAVX512();
+    if (level == SimdLevel::AVX2) return getSphKernelsAVX2();
+#else
+    (void)level;
+#endif
+    return SCALAR_KERNELS;
+}
@@ -0,0 +1,128 @@
+// Built with -mavx2 -mfma (/arch:AVX2), only called after detectSimdLevel() has
+// confirmed support. Keep this file to intrinsics: inline library code
+// instantiated here would be compiled for AVX2 too.
+#include "SphKernels.h"
+
+#if defined(PBF_X86_SIMD)
+#include <immintrin.h>
+
+namespace {
+
+float horizontalSum(__m256 v) {
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+    return _mm_cvtss_f32(sum);
+}
+
+//lanes [0, remaining) set
+__m256i tailMask(unsigned int remaining) {
+    return _mm256_cmpgt_epi32(_mm256_set1_epi32((int)remaining), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+}
+
+// Distances of 8 neighbours, masked-off lanes are zero and must be discarded by the caller
+struct Lanes {
+    __m256i ids;
+    __m256 dx, dy, dz, r2, r;
+};
+
+Lanes loadLanes(const float* position, const NeighborBatch& batch, unsigned int j, __m256i mask) {
+    Lanes lanes;
+    lanes.ids = _mm256_maskload_epi32((const int*)(batch.ids + j), mask);
+
+    //x, y, z are 3 floats apart in the position array
+    __m256i offsets = _mm256_add_epi32(lanes.ids, _mm256_add_epi32(lanes.ids, lanes.ids));
+    __m256 zero = _mm256_setzero_ps();
+    __m256 maskPs = _mm256_castsi256_ps(mask);
+    __m256 x = _mm256_mask_i32gather_ps(zero, batch.positions, offsets, maskPs, 4);
+    __m256 y = _mm256_mask_i32gather_ps(zero, batch.positions + 1, offsets, maskPs, 4);
+    __m256 z = _mm256_mask_i32gather_ps(zero, batch.positions + 2, offsets, maskPs, 4);
+
+    lanes.dx = _mm256_sub_ps(_mm256_set1_ps(position[0]), x);
+    lanes.dy = _mm256_sub_ps(_mm256_set1_ps(position[1]), y);
+    lanes.dz = _mm256_sub_ps(_mm256_set1_ps(position[2]), z);
+    lanes.r2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(lanes.dx, lanes.dx), _mm256_mul_ps(lanes.dy, lanes.dy)), _mm256_mul_ps(lanes.dz, lanes.dz));
+    lanes.r = _mm256_sqrt_ps(lanes.r2);
+    return lanes;
+}
+
+__m256 cube(__m256 v) {
+    return _mm256_mul_ps(_mm256_mul_ps(v, v), v);
+}
+
+void densityTermsAVX2(const SphKernelConstants& kernel, const float* position, const NeighborBatch& batch, float* density, float* gradientSquared) {
+    const __m256 h = _mm256_set1_ps(kernel.h);
+    const __m256 h2 = _mm256_set1_ps(kernel.h2);
+    const __m256 poly6 = _mm256_set1_ps(kernel.poly6);
+    const __m256 spiky = _mm256_set1_ps(kernel.spiky);
+    const __m256 minR = _mm256_set1_ps(0.0001f);
+
+    __m256 densitySum = _mm256_setzero_ps();
+    __m256 gradientSum = _mm256_setzero_ps();
+    for (unsigned int j = 0; j < batch.count; j += 8) {
+        __m256i mask = tailMask(batch.count - j);
+        Lanes lanes = loadLanes(position, batch, j, mask);
+
+        __m256 inside = _mm256_and_ps(_mm256_castsi256_ps(mask), _mm256_cmp_ps(lanes.r, h, _CMP_LT_OQ));
+        __m256 term = _mm256_sub_ps(h2, _mm256_mul_ps(lanes.r, lanes.r));
+        __m256 w = _mm256_mul_ps(poly6, cube(term));
+        densitySum = _mm256_add_ps(densitySum, _mm256_and_ps(inside, w));
+
+        //|gradW|^2 = (spiky (h - r)^2 / r)^2 r^2
+        __m256 hasGradient = _mm256_and_ps(inside, _mm256_cmp_ps(lanes.r, minR, _CMP_GE_OQ));
+        __m256 hr = _mm256_sub_ps(h, lanes.r);
+        __m256 scale = _mm256_div_ps(_mm256_mul_ps(_mm256_mul_ps(spiky, hr), hr), _mm256_max_ps(lanes.r, minR));
+        __m256 gradSquared = _mm256_mul_ps(_mm256_mul_ps(scale, scale), lanes.r2);
+        gradientSum = _mm256_add_ps(gradientSum, _mm256_and_ps(hasGradient, gradSquared));
+    }
+    *density = horizontalSum(densitySum);
+    *gradientSquared = horizontalSum(gradientSum);
+}
+
+void positionDeltaAVX2(const SphKernelConstants& kernel, const float* position, float lambda, const NeighborBatch& batch, float* delta) {
+    const __m256 h = _mm256_set1_ps(kernel.h);
+    const __m256 h2 = _mm256_set1_ps(kernel.h2);
+    const __m256 spiky = _mm256_set1_ps(kernel.spiky);
+    const __m256 scorrPoly6 = _mm256_set1_ps(kernel.scorrPoly6);
+    const __m256 scorrK = _mm256_set1_ps(kernel.scorrK);
+    const __m256 minR = _mm256_set1_ps(0.0001f);
+    const __m256 lambdaI = _mm256_set1_ps(lambda);
+
+    __m256 sumX = _mm256_setzero_ps();
+    __m256 sumY = _mm256_setzero_ps();
+    __m256 sumZ = _mm256_setzero_ps();
+    for (unsigned int j = 0; j < batch.count; j += 8) {
+        __m256i mask = tailMask(batch.count - j);
+        Lanes lanes = loadLanes(position, batch, j, mask);
+
+        __m256 valid = _mm256_and_ps(_mm256_castsi256_ps(mask),
+            _mm256_and_ps(_mm256_cmp_ps(lanes.r, h, _CMP_LT_OQ), _mm256_cmp_ps(lanes.r, minR, _CMP_GT_OQ)));
+        __m256 hr = _mm256_sub_ps(h, lanes.r);
+        __m256 scale = _mm256_div_ps(_mm256_mul_ps(_mm256_mul_ps(spiky, hr), hr), _mm256_max_ps(lanes.r, minR));
+
+        __m256 term = _mm256_sub_ps(h2, _mm256_mul_ps(lanes.r, lanes.r));
+        __m256 ratio = _mm256_mul_ps(scorrPoly6, cube(term));
+        __m256 ratio2 = _mm256_mul_ps(ratio, ratio);
+        __m256 scorr = _mm256_mul_ps(_mm256_mul_ps(scorrK, ratio2), ratio2);
+
+        __m256 lambdaJ = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), batch.lambda, lanes.ids, _mm256_castsi256_ps(mask), 4);
+        __m256 weight = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(lambdaI, lambdaJ), scorr), scale);
+        weight = _mm256_and_ps(valid, weight);
+
+        sumX = _mm256_add_ps(sumX, _mm256_mul_ps(weight, lanes.dx));
+        sumY = _mm256_add_ps(sumY, _mm256_mul_ps(weight, lanes.dy));
+        sumZ = _mm256_add_ps(sumZ, _mm256_mul_ps(weight, lanes.dz));
+    }
+    delta[0] = horizontalSum(sumX);
+    delta[1] = horizontalSum(sumY);
+    delta[2] = horizontalSum(sumZ);
+}
+
+const SphKernelTable AVX2_KERNELS = { SimdLevel::AVX2, densityTermsAVX2, positionDeltaAVX2 };
+
+}
+
+const SphKernelTable& getSphKernelsAVX2() {
+    return AVX2_KERNELS;
+}
+#endif
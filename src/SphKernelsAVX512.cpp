@@ -0,0 +1,133 @@
+// Built with -mavx512f -mfma (/arch:AVX512), only called after detectSimdLevel()
+// has confirmed support. Keep this file to intrinsics: inline library code
+// instantiated here would be compiled for AVX-512 too.
+// gcc 12 warns (-Wuninitialized) about the undefined pass-through operand of unmasked
+// intrinsics such as _mm512_sqrt_ps, _mm512_max_ps and _mm512_reduce_add_ps, so the
+// masked forms and reduceAdd below are used instead.
+#include "SphKernels.h"
+
+#if defined(PBF_X86_SIMD)
+#include <immintrin.h>
+
+namespace {
+
+//lanes [0, remaining) set
+__mmask16 tailMask(unsigned int remaining) {
+    return remaining >= 16 ? (__mmask16)0xffff : (__mmask16)((1u << remaining) - 1u);
+}
+
+// Horizontal sum in the order of _mm512_reduce_add_ps: halves, quarters, then pairs.
+// Both halves are taken with the zero-masked extract, gcc 12 implements the cast with
+// the unmasked one
+float reduceAdd(__m512 v) {
+    const __m512d bits = _mm512_castps_pd(v);
+    __m256 half = _mm256_add_ps(_mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xff, bits, 1)), _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xff, bits, 0)));
+    __m128 quarter = _mm_add_ps(_mm256_extractf128_ps(half, 1), _mm256_castps256_ps128(half));
+    __m128 pairs = _mm_add_ps(quarter, _mm_shuffle_ps(quarter, quarter, _MM_SHUFFLE(1, 0, 3, 2)));
+    return _mm_cvtss_f32(pairs) + _mm_cvtss_f32(_mm_shuffle_ps(pairs, pairs, _MM_SHUFFLE(1, 1, 1, 1)));
+}
+
+// Distances of 16 neighbours, masked-off lanes are zero and must be discarded by the caller
+struct Lanes {
+    __m512i ids;
+    __m512 dx, dy, dz, r2, r;
+};
+
+Lanes loadLanes(const float* position, const NeighborBatch& batch, unsigned int j, __mmask16 mask) {
+    Lanes lanes;
+    lanes.ids = _mm512_maskz_loadu_epi32(mask, batch.ids + j);
+
+    //x, y, z are 3 floats apart in the position array
+    __m512i offsets = _mm512_add_epi32(lanes.ids, _mm512_add_epi32(lanes.ids, lanes.ids));
+    __m512 zero = _mm512_setzero_ps();
+    __m512 x = _mm512_mask_i32gather_ps(zero, mask, offsets, batch.positions, 4);
+    __m512 y = _mm512_mask_i32gather_ps(zero, mask, offsets, batch.positions + 1, 4);
+    __m512 z = _mm512_mask_i32gather_ps(zero, mask, offsets, batch.positions + 2, 4);
+
+    lanes.dx = _mm512_sub_ps(_mm512_set1_ps(position[0]), x);
+    lanes.dy = _mm512_sub_ps(_mm512_set1_ps(position[1]), y);
+    lanes.dz = _mm512_sub_ps(_mm512_set1_ps(position[2]), z);
+    lanes.r2 = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(lanes.dx, lanes.dx), _mm512_mul_ps(lanes.dy, lanes.dy)), _mm512_mul_ps(lanes.dz, lanes.dz));
+    lanes.r = _mm512_maskz_sqrt_ps(mask, lanes.r2);
+    return lanes;
+}
+
+__m512 cube(__m512 v) {
+    return _mm512_mul_ps(_mm512_mul_ps(v, v), v);
+}
+
+void densityTermsAVX512(const SphKernelConstants& kernel, const float* position, const NeighborBatch& batch, float* density, float* gradientSquared) {
+    const __m512 h = _mm512_set1_ps(kernel.h);
+    const __m512 h2 = _mm512_set1_ps(kernel.h2);
+    const __m512 poly6 = _mm512_set1_ps(kernel.poly6);
+    const __m512 spiky = _mm512_set1_ps(kernel.spiky);
+    const __m512 minR = _mm512_set1_ps(0.0001f);
+
+    __m512 densitySum = _mm512_setzero_ps();
+    __m512 gradientSum = _mm512_setzero_ps();
+    for (unsigned int j = 0; j < batch.count; j += 16) {
+        __mmask16 mask = tailMask(batch.count - j);
+        Lanes lanes = loadLanes(position, batch, j, mask);
+
+        __mmask16 inside = _mm512_mask_cmp_ps_mask(mask, lanes.r, h, _CMP_LT_OQ);
+        __m512 term = _mm512_sub_ps(h2, _mm512_mul_ps(lanes.r, lanes.r));
+        __m512 w = _mm512_mul_ps(poly6, cube(term));
+        densitySum = _mm512_mask_add_ps(densitySum, inside, densitySum, w);
+
+        //|gradW|^2 = (spiky (h - r)^2 / r)^2 r^2
+        __mmask16 hasGradient = _mm512_mask_cmp_ps_mask(inside, lanes.r, minR, _CMP_GE_OQ);
+        __m512 hr = _mm512_sub_ps(h, lanes.r);
+        __m512 scale = _mm512_div_ps(_mm512_mul_ps(_mm512_mul_ps(spiky, hr), hr), _mm512_mask_max_ps(minR, mask, lanes.r, minR));
+        __m512 gradSquared = _mm512_mul_ps(_mm512_mul_ps(scale, scale), lanes.r2);
+        gradientSum = _mm512_mask_add_ps(gradientSum, hasGradient, gradientSum, gradSquared);
+    }
+    *density = reduceAdd(densitySum);
+    *gradientSquared = reduceAdd(gradientSum);
+}
+
+void positionDeltaAVX512(const SphKernelConstants& kernel, const float* position, float lambda, const NeighborBatch& batch, float* delta) {
+    const __m512 h = _mm512_set1_ps(kernel.h);
+    const __m512 h2 = _mm512_set1_ps(kernel.h2);
+    const __m512 spiky = _mm512_set1_ps(kernel.spiky);
+    const __m512 scorrPoly6 = _mm512_set1_ps(kernel.scorrPoly6);
+    const __m512 scorrK = _mm512_set1_ps(kernel.scorrK);
+    const __m512 minR = _mm512_set1_ps(0.0001f);
+    const __m512 lambdaI = _mm512_set1_ps(lambda);
+
+    __m512 sumX = _mm512_setzero_ps();
+    __m512 sumY = _mm512_setzero_ps();
+    __m512 sumZ = _mm512_setzero_ps();
+    for (unsigned int j = 0; j < batch.count; j += 16) {
+        __mmask16 mask = tailMask(batch.count - j);
+        Lanes lanes = loadLanes(position, batch, j, mask);
+
+        __mmask16 valid = _mm512_mask_cmp_ps_mask(mask, lanes.r, h, _CMP_LT_OQ);
+        valid = _mm512_mask_cmp_ps_mask(valid, lanes.r, minR, _CMP_GT_OQ);
+        __m512 hr = _mm512_sub_ps(h, lanes.r);
+        __m512 scale = _mm512_div_ps(_mm512_mul_ps(_mm512_mul_ps(spiky, hr), hr), _mm512_mask_max_ps(minR, mask, lanes.r, minR));
+
+        __m512 term = _mm512_sub_ps(h2, _mm512_mul_ps(lanes.r, lanes.r));
+        __m512 ratio = _mm512_mul_ps(scorrPoly6, cube(term));
+        __m512 ratio2 = _mm512_mul_ps(ratio, ratio);
+        __m512 scorr = _mm512_mul_ps(_mm512_mul_ps(scorrK, ratio2), ratio2);
+
+        __m512 lambdaJ = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, lanes.ids, batch.lambda, 4);
+        __m512 weight = _mm512_maskz_mul_ps(valid, _mm512_add_ps(_mm512_add_ps(lambdaI, lambdaJ), scorr), scale);
+
+        sumX = _mm512_add_ps(sumX, _mm512_mul_ps(weight, lanes.dx));
+        sumY = _mm512_add_ps(sumY, _mm512_mul_ps(weight, lanes.dy));
+        sumZ = _mm512_add_ps(sumZ, _mm512_mul_ps(weight, lanes.dz));
+    }
+    delta[0] = reduceAdd(sumX);
+    delta[1] = reduceAdd(sumY);
+    delta[2] = reduceAdd(sumZ);
+}
+
+const SphKernelTable AVX512_KERNELS = { SimdLevel::AVX512, densityTermsAVX512, positionDeltaAVX512 };
+
+}
+
+const SphKernelTable& getSphKernelsAVX512() {
+    return AVX512_KERNELS;
+}
+#endif
@@ -0,0 +1,135 @@
+#include "StageProfiler.h"
+#include <algorithm>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+//a step issues about a dozen queries, this covers several frames of driver latency
+constexpr size_t QUERY_POOL_SIZE = 128;
+
+}
+
+StageProfiler::StageProfiler() : log(nullptr), keepTotals(false), frameTotals(), gpuQueries(false), queryActive(false), frame(0), numParticles(0), firstPending(0), numPending(0)
+{
+}
+
+StageProfiler::~StageProfiler() {
+    //the query objects belong to the GL context, PBFComputeSystem::cleanup releases them
+}
+
+void StageProfiler::setLog(TimingLog* newLog, bool useGpuQueries) {
+    //results still in flight belong to the previous log
+    if (numPending > 0) collect(true);
+
+    log = newLog;
+    gpuQueries = useGpuQueries && newLog != nullptr;
+
+    if (gpuQueries && pending.empty()) {
+        std::vector<GLuint> queries(QUERY_POOL_SIZE);
+        glGenQueries((GLsizei)queries.size(), queries.data());
+
+        pending.resize(QUERY_POOL_SIZE);
+        for (size_t i = 0; i < QUERY_POOL_SIZE; ++i) {
+            pending[i].query = queries[i];
+        }
+        firstPending = 0;
+        numPending = 0;
+    }
+}
+
+void StageProfiler::setKeepFrameTotals(bool keep) {
+    keepTotals = keep;
+    std::fill(frameTotals, frameTotals + (size_t)TimingStage::Count, 0.0);
+}
+
+void StageProfiler::beginFrame(uint32_t frameIndex, uint32_t particles) {
+    frame = frameIndex;
+    numParticles = particles;
+    if (keepTotals) std::fill(frameTotals, frameTotals + (size_t)TimingStage::Count, 0.0);
+
+    if (numPending > 0) collect(false);
+}
+
+void StageProfiler::begin(Scope& scope, TimingStage stage, unsigned int iteration, bool cpuClock) {
+    scope.stage = stage;
+    scope.iteration = (uint8_t)iteration;
+    scope.query = 0;
+
+    if (gpuQueries && !cpuClock && !queryActive) {
+        if (numPending == pending.size()) collect(false);
+
+        //with every query still in flight this stage falls back to the CPU clock
+        if (numPending < pending.size()) {
+            scope.query = pending[(firstPending + numPending) % pending.size()].query;
+            glBeginQuery(GL_TIME_ELAPSED, scope.query);
+            queryActive = true;
+            return;
+        }
+    }
+
+    scope.start = Clock::now();
+}
+
+void StageProfiler::end(Scope& scope) {
+    TimingSample sample;
+    sample.frame = frame;
+    sample.numParticles = numParticles;
+    sample.stage = scope.stage;
+    sample.iteration = scope.iteration;
+
+    if (scope.query) {
+        glEndQuery(GL_TIME_ELAPSED);
+        queryActive = false;
+
+        //ms is filled in by collect() once the GPU has got this far
+        sample.ms = 0.0f;
+        sample.clock = TimingClock::GPU;
+        pending[(firstPending + numPending) % pending.size()].sample = sample;
+        numPending++;
+        return;
+    }
+
+    sample.ms = std::chrono::duration<float, std::milli>(Clock::now() - scope.start).count();
+    sample.clock = TimingClock::CPU;
+    if (keepTotals) frameTotals[(size_t)sample.stage] += sample.ms;
+    if (log) log->record(sample);
+}
+
+void StageProfiler::collect(bool wait) {
+    while (numPending > 0) {
+        PendingQuery& entry = pending[firstPending];
+
+        //results become available in issue order, so the oldest decides
+        if (!wait) {
+            GLuint available = 0;
+            glGetQueryObjectuiv(entry.query, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available) break;
+        }
+
+        GLuint64 nanos = 0;
+        glGetQueryObjectui64v(entry.query, GL_QUERY_RESULT, &nanos);
+        entry.sample.ms = (float)(nanos * 1e-6);
+        if (log) log->record(entry.sample);
+
+        firstPending = (firstPending + 1) % pending.size();
+        numPending--;
+    }
+}
+
+void StageProfiler::releaseQueries() {
+    if (pending.empty()) return;
+
+    collect(true);
+
+    std::vector<GLuint> queries;
+    for (const PendingQuery& entry : pending) {
+        queries.push_back(entry.query);
+    }
+    glDeleteQueries((GLsizei)queries.size(), queries.data());
+
+    pending.clear();
+    firstPending = 0;
+    numPending = 0;
+    gpuQueries = false;
+}
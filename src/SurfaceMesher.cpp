@@ -0,0 +1,535 @@
+#include "SurfaceMesher.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <memory>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int BLOCK = SurfaceMesher::BLOCK_SIZE;
+constexpr int BLOCK_SAMPLES = BLOCK + 1;            //per axis, the faces are shared with the neighbours
+constexpr uint32_t INACTIVE = 0xFFFFFFFFu;
+
+double msSince(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+int floorDiv(int a, int b) {
+    return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+//std::floor / std::ceil are library calls without SSE4.1, these run once per sample row
+int floorToInt(float x) {
+    int i = (int)x;
+    return i > x ? i - 1 : i;
+}
+
+int ceilToInt(float x) {
+    int i = (int)x;
+    return i < x ? i + 1 : i;
+}
+
+// Integers k with a k^2 + 2 b k + c < 0 for a > 0, false when there are none
+bool quadraticRange(float a, float b, float c, int& first, int& last) {
+    float disc = b * b - a * c;
+    if (disc <= 0.0f) return false;
+
+    float root = std::sqrt(disc);
+    first = ceilToInt((-b - root) / a);
+    last = floorToInt((-b + root) / a);
+    return first <= last;
+}
+
+// Cube corner c sits at (c & 1, (c >> 1) & 1, (c >> 2) & 1). Edge e runs along axis e / 4
+// from the (e % 4)-th corner, in ascending order, whose coordinate on that axis is 0
+int edgeCorner(int edge) {
+    int axis = edge / 4, k = edge % 4;
+    for (int c = 0; c < 8; ++c) {
+        if (!(c & (1 << axis)) && k-- == 0) return c;
+    }
+    return 0;
+}
+
+int edgeBetween(int c0, int c1) {
+    int bit = c0 ^ c1;
+    int axis = bit == 1 ? 0 : (bit == 2 ? 1 : 2);
+    int low = std::min(c0, c1), k = 0;
+    for (int c = 0; c < low; ++c) {
+        if (!(c & bit)) k++;
+    }
+    return axis * 4 + k;
+}
+
+// Triangles of the 256 corner cases as triples of cube edges. Instead of the usual
+// hand-written table the cases are derived from the faces: every face joins its edge
+// crossings by segments that cut off the inside corners (the same choice on both
+// cubes of an ambiguous face, so the mesh has no cracks), the segments of the six
+// faces chain into closed loops around the cube and each loop becomes a fan
+struct CaseTable {
+    std::vector<uint8_t> edges[256];
+};
+
+CaseTable buildCaseTable() {
+    //corners of each face, counter-clockwise seen from outside the cube
+    int faces[6][4];
+    for (int axis = 0; axis < 3; ++axis) {
+        int u = (axis + 1) % 3, w = (axis + 2) % 3;
+        for (int side = 0; side < 2; ++side) {
+            const int square[4][2] = { { 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 1 } };
+            int* face = faces[axis * 2 + side];
+            for (int k = 0; k < 4; ++k) {
+                face[side ? k : 3 - k] = (side << axis) | (square[k][0] << u) | (square[k][1] << w);
+            }
+        }
+    }
+
+    CaseTable table;
+    for (int mask = 0; mask < 256; ++mask) {
+        auto inside = [mask](int corner) { return ((mask >> corner) & 1) != 0; };
+
+        //next[e]: crossing that follows e on the loop, every crossing leaves one face inside-out
+        int next[12];
+        std::fill(next, next + 12, -1);
+        for (const auto& face : faces) {
+            for (int k = 0; k < 4; ++k) {
+                if (!inside(face[k]) || inside(face[(k + 1) % 4])) continue;
+
+                //the crossing before this one bounds the same inside corners
+                for (int j = 1; j < 4; ++j) {
+                    int m = (k + 4 - j) % 4;
+                    if (inside(face[m]) != inside(face[(m + 1) % 4])) {
+                        next[edgeBetween(face[k], face[(k + 1) % 4])] = edgeBetween(face[m], face[(m + 1) % 4]);
+                        break;
+                    }
+                }
+            }
+        }
+
+        bool visited[12] = {};
+        for (int start = 0; start < 12; ++start) {
+            if (next[start] < 0 || visited[start]) continue;
+
+            std::vector<int> loop;
+            for (int e = start; !visited[e]; e = next[e]) {
+                visited[e] = true;
+                loop.push_back(e);
+            }
+
+            for (size_t i = 1; i + 1 < loop.size(); ++i) {
+                table.edges[mask].push_back((uint8_t)loop[0]);
+                table.edges[mask].push_back((uint8_t)loop[i + 1]);
+                table.edges[mask].push_back((uint8_t)loop[i]);
+            }
+        }
+    }
+    return table;
+}
+
+const CaseTable& caseTable() {
+    static const CaseTable table = buildCaseTable();
+    return table;
+}
+
+}
+
+SurfaceMesher::SurfaceMesher(const SurfaceMesherParams& params)
+    : params(params), stats(), origin(0.0f), blockDim(0)
+{
+}
+
+void SurfaceMesher::setupSplats(ThreadPool& pool, const std::vector<glm::vec3>& positions, const std::vector<glm::vec3>& centers, const std::vector<glm::mat3>& matrices) {
+    const bool anisotropic = !matrices.empty();
+    const float r = params.particleRadius;
+    const float kernelRadius = params.kernelRadius;
+
+    splats.resize(positions.size());
+    std::vector<glm::vec3> extents(positions.size());
+
+    pool.parallelFor(0, positions.size(), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            Splat& splat = splats[i];
+            splat.center = centers.empty() ? positions[i] : centers[i];
+
+            if (!anisotropic) {
+                splat.transform = glm::mat3(1.0f / kernelRadius);
+                splat.scale = 1.0f;
+                extents[i] = glm::vec3(kernelRadius);
+                continue;
+            }
+
+            //G is 1/r for interior particles, so those get the isotropic splat; det(G) r^3
+            //keeps the volume of a stretched kernel
+            const glm::mat3& g = matrices[i];
+            splat.transform = g * (r / kernelRadius);
+            splat.scale = glm::determinant(g) * r * r * r;
+
+            //the support |T d| < 1 is the ellipsoid T^-1 u, |u| < 1, whose extent along
+            //each axis is the length of that row of T^-1
+            glm::mat3 inverse = glm::inverse(splat.transform);
+            for (int a = 0; a < 3; ++a) {
+                extents[i][a] = glm::length(glm::vec3(inverse[0][a], inverse[1][a], inverse[2][a]));
+            }
+        }
+    });
+
+    glm::vec3 lo = splats[0].center - extents[0];
+    glm::vec3 hi = splats[0].center + extents[0];
+    for (size_t i = 1; i < splats.size(); ++i) {
+        lo = glm::min(lo, splats[i].center - extents[i]);
+        hi = glm::max(hi, splats[i].center + extents[i]);
+    }
+
+    //a lattice on multiples of the voxel size stays put from frame to frame, one
+    //empty sample on each side closes the surface
+    const float voxel = params.voxelSize;
+    origin = (glm::floor(lo / voxel) - glm::vec3(1.0f)) * voxel;
+    glm::ivec3 maxSample = glm::ivec3(glm::floor((hi - origin) / voxel)) + glm::ivec3(1);
+    blockDim = (maxSample + glm::ivec3(BLOCK - 1)) / BLOCK;
+
+    const glm::ivec3 lastSample = blockDim * BLOCK;
+    pool.parallelFor(0, splats.size(), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            Splat& splat = splats[i];
+            splat.lo = glm::clamp(glm::ivec3(glm::ceil((splat.center - extents[i] - origin) / voxel)), glm::ivec3(0), lastSample);
+            splat.hi = glm::clamp(glm::ivec3(glm::floor((splat.center + extents[i] - origin) / voxel)), glm::ivec3(0), lastSample);
+        }
+    });
+}
+
+bool SurfaceMesher::extract(ThreadPool& pool, const std::vector<glm::vec3>& positions, const std::vector<glm::vec3>& centers,
+    const std::vector<glm::mat3>& matrices, const std::vector<int>& surfaceFlags, SurfaceMesh& mesh) {
+    stats = SurfaceMesherStats();
+    mesh.vertices.clear();
+    mesh.normals.clear();
+    mesh.indices.clear();
+    if (positions.empty()) return true;
+
+    if ((!centers.empty() && centers.size() != positions.size()) || (!matrices.empty() && matrices.size() != positions.size())
+        || (!surfaceFlags.empty() && surfaceFlags.size() != positions.size())) {
+        std::cerr << "[SurfaceMesher] Centers, matrices and flags must be empty or match the " << positions.size() << " particles\n";
+        return false;
+    }
+
+    auto start = Clock::now();
+    setupSplats(pool, positions, centers, matrices);
+
+    //dense directory of blocks, only the active ones get samples
+    const size_t numBlocks = (size_t)blockDim.x * blockDim.y * blockDim.z;
+    if (numBlocks >= INACTIVE) {
+        std::cerr << "[SurfaceMesher] Domain of " << blockDim.x << "x" << blockDim.y << "x" << blockDim.z
+            << " blocks exceeds the block directory, use a larger voxel size\n";
+        return false;
+    }
+    std::unique_ptr<std::atomic<uint32_t>[]> directory(new std::atomic<uint32_t>[numBlocks]());
+
+    auto forEachBlock = [&](const Splat& splat, auto&& fn) {
+        glm::ivec3 first(floorDiv(splat.lo.x - 1, BLOCK), floorDiv(splat.lo.y - 1, BLOCK), floorDiv(splat.lo.z - 1, BLOCK));
+        first = glm::max(first, glm::ivec3(0));
+        glm::ivec3 last = glm::min(splat.hi / BLOCK, blockDim - glm::ivec3(1));
+        for (int z = first.z; z <= last.z; ++z)
+            for (int y = first.y; y <= last.y; ++y)
+                for (int x = first.x; x <= last.x; ++x)
+                    fn((size_t)x + (size_t)blockDim.x * (y + (size_t)blockDim.y * z));
+    };
+
+    //bit 0: some splat reaches the block, bit 1: a surface particle does
+    pool.parallelFor(0, splats.size(), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            uint32_t bits = surfaceFlags.empty() || surfaceFlags[i] ? 3u : 1u;
+            forEachBlock(splats[i], [&](size_t b) { directory[b].fetch_or(bits, std::memory_order_relaxed); });
+        }
+    });
+
+    activeBlocks.clear();
+    blockIndex.resize(numBlocks);
+    for (size_t b = 0; b < numBlocks; ++b) {
+        uint32_t bits = directory[b].load(std::memory_order_relaxed);
+        if (bits) stats.occupiedBlocks++;
+        if (bits & 2u) {
+            blockIndex[b] = (uint32_t)activeBlocks.size();
+            activeBlocks.push_back(glm::ivec3((int)(b % blockDim.x), (int)((b / blockDim.x) % blockDim.y), (int)(b / ((size_t)blockDim.x * blockDim.y))));
+        }
+        else {
+            blockIndex[b] = INACTIVE;
+        }
+    }
+    stats.activeBlocks = activeBlocks.size();
+
+    //every particle, interior ones too, splats into the active blocks it reaches
+    const size_t numActive = activeBlocks.size();
+    std::unique_ptr<std::atomic<uint32_t>[]> cursor(new std::atomic<uint32_t>[numActive]());
+    pool.parallelFor(0, splats.size(), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            forEachBlock(splats[i], [&](size_t b) {
+                uint32_t block = blockIndex[b];
+                if (block != INACTIVE) cursor[block].fetch_add(1, std::memory_order_relaxed);
+            });
+        }
+    });
+
+    blockStart.resize(numActive + 1);
+    blockStart[0] = 0;
+    for (size_t b = 0; b < numActive; ++b) {
+        blockStart[b + 1] = blockStart[b] + cursor[b].load(std::memory_order_relaxed);
+        cursor[b].store(blockStart[b], std::memory_order_relaxed);
+    }
+    stats.splats = blockStart[numActive];
+
+    blockParticles.resize(stats.splats);
+    pool.parallelFor(0, splats.size(), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            forEachBlock(splats[i], [&](size_t b) {
+                uint32_t block = blockIndex[b];
+                if (block != INACTIVE) blockParticles[cursor[block].fetch_add(1, std::memory_order_relaxed)] = (unsigned int)i;
+            });
+        }
+    });
+
+    //particle order decides the float sums, two blocks must agree on their shared samples
+    pool.parallelFor(0, numActive, [&](size_t begin, size_t end) {
+        for (size_t b = begin; b < end; ++b) {
+            std::sort(blockParticles.begin() + blockStart[b], blockParticles.begin() + blockStart[b + 1]);
+        }
+    }, 16);
+    stats.setupMs = msSince(start);
+
+    start = Clock::now();
+    blockMeshes.resize(numActive);
+    pool.parallelFor(0, numActive, [&](size_t begin, size_t end) {
+        std::vector<float> samples(BLOCK_SAMPLES * BLOCK_SAMPLES * BLOCK_SAMPLES);
+        std::vector<int> edgeVertices(samples.size() * 3);
+        for (size_t b = begin; b < end; ++b) {
+            meshBlock(b, samples, edgeVertices);
+        }
+    }, 1);
+    stats.meshMs = msSince(start);
+
+    start = Clock::now();
+    stitch(pool, mesh);
+    stats.stitchMs = msSince(start);
+    return true;
+}
+
+void SurfaceMesher::meshBlock(size_t block, std::vector<float>& samples, std::vector<int>& edgeVertices) {
+    const int S = BLOCK_SAMPLES;
+    const float voxel = params.voxelSize;
+    const float iso = params.isoValue;
+    const glm::ivec3 base = activeBlocks[block] * BLOCK;
+
+    std::fill(samples.begin(), samples.end(), 0.0f);
+    for (unsigned int k = blockStart[block]; k < blockStart[block + 1]; ++k) {
+        const Splat& splat = splats[blockParticles[k]];
+        glm::ivec3 lo = glm::max(splat.lo, base);
+        glm::ivec3 hi = glm::min(splat.hi, base + glm::ivec3(BLOCK));
+
+        //u = T (x - center) is linear in the sample offset k from the splat's first sample and
+        //is evaluated the same way by every block that holds a sample. Only the planes and rows
+        //that cut the ellipsoid |u| < 1 are visited, both ranges are quadratics in the offset:
+        //planes by the distance to the plane of the x and y steps, rows by the distance to
+        //the line of the x step
+        const glm::vec3 u0 = splat.transform * (origin + voxel * glm::vec3(splat.lo) - splat.center);
+        const glm::vec3 stepX = voxel * splat.transform[0];
+        const glm::vec3 stepY = voxel * splat.transform[1];
+        const glm::vec3 stepZ = voxel * splat.transform[2];
+        const float a = glm::dot(stepX, stepX);
+
+        const glm::vec3 normal = glm::cross(stepX, stepY);
+        const float p = glm::dot(u0, normal), q = glm::dot(stepZ, normal);
+        int zFirst, zLast;
+        if (!quadraticRange(q * q, p * q, p * p - glm::dot(normal, normal), zFirst, zLast)) continue;
+        zFirst = std::max(lo.z, splat.lo.z + zFirst);
+        zLast = std::min(hi.z, splat.lo.z + zLast);
+
+        //y step without its x component
+        const glm::vec3 stepYPerp = stepY - (glm::dot(stepY, stepX) / a) * stepX;
+        const float aY = glm::dot(stepYPerp, stepYPerp);
+
+        for (int z = zFirst; z <= zLast; ++z) {
+            const glm::vec3 uPlane = u0 + (float)(z - splat.lo.z) * stepZ;
+            const glm::vec3 uPlanePerp = uPlane - (glm::dot(uPlane, stepX) / a) * stepX;
+            int yFirst, yLast;
+            if (!quadraticRange(aY, glm::dot(uPlanePerp, stepYPerp), glm::dot(uPlanePerp, uPlanePerp) - 1.0f, yFirst, yLast)) continue;
+            yFirst = std::max(lo.y, splat.lo.y + yFirst);
+            yLast = std::min(hi.y, splat.lo.y + yLast);
+
+            //a row is at most a block wide, a branch-free pass over it beats solving for its ends
+            for (int y = yFirst; y <= yLast; ++y) {
+                const glm::vec3 uRow = uPlane + (float)(y - splat.lo.y) * stepY;
+                float* row = &samples[(size_t)(y - base.y + (z - base.z) * S) * S];
+                for (int x = lo.x; x <= hi.x; ++x) {
+                    glm::vec3 u = uRow + (float)(x - splat.lo.x) * stepX;
+                    float w = std::max(1.0f - glm::dot(u, u), 0.0f);
+                    row[x - base.x] += splat.scale * w * w * w;
+                }
+            }
+        }
+    }
+
+    BlockMesh& out = blockMeshes[block];
+    out.vertices.clear();
+    out.normals.clear();
+    out.indices.clear();
+    out.shared.clear();
+
+    auto sampleAt = [&](const glm::ivec3& s) { return samples[s.x + (s.y + s.z * S) * S]; };
+
+    //central differences inside the block, one-sided on its faces
+    auto gradient = [&](const glm::ivec3& s) {
+        glm::vec3 g;
+        for (int a = 0; a < 3; ++a) {
+            glm::ivec3 minus = s, plus = s;
+            if (s[a] > 0) minus[a]--;
+            if (s[a] < BLOCK) plus[a]++;
+            g[a] = (sampleAt(plus) - sampleAt(minus)) / (float)(plus[a] - minus[a]);
+        }
+        return g;
+    };
+
+    auto edgeVertex = [&](const glm::ivec3& s0, int axis) {
+        const unsigned int edgeSlot = (s0.x + (s0.y + s0.z * S) * S) * 3 + axis;
+        int& slot = edgeVertices[edgeSlot];
+        if (slot >= 0) return (unsigned int)slot;
+
+        glm::ivec3 s1 = s0;
+        s1[axis]++;
+        float f0 = sampleAt(s0), f1 = sampleAt(s1);
+        float t = (iso - f0) / (f1 - f0);
+
+        glm::vec3 position = origin + voxel * glm::vec3(base + s0);
+        position[axis] += voxel * t;
+
+        //the density falls off outwards; on a flat gradient the edge itself points out
+        glm::vec3 normal = -glm::mix(gradient(s0), gradient(s1), t);
+        float length = glm::length(normal);
+        if (length > 0.0f) normal /= length;
+        else {
+            normal = glm::vec3(0.0f);
+            normal[axis] = f0 > f1 ? 1.0f : -1.0f;
+        }
+
+        slot = (int)out.vertices.size();
+        out.vertices.push_back(position);
+        out.normals.push_back(normal);
+
+        for (int a = 0; a < 3; ++a) {
+            if (a != axis && (s0[a] == 0 || s0[a] == BLOCK)) {
+                out.shared.emplace_back(edgeSlot, (unsigned int)slot);
+                break;
+            }
+        }
+        return (unsigned int)slot;
+    };
+
+    const CaseTable& table = caseTable();
+    std::fill(edgeVertices.begin(), edgeVertices.end(), -1);
+    for (int z = 0; z < BLOCK; ++z) {
+        for (int y = 0; y < BLOCK; ++y) {
+            for (int x = 0; x < BLOCK; ++x) {
+                int mask = 0;
+                for (int c = 0; c < 8; ++c) {
+                    if (sampleAt(glm::ivec3(x + (c & 1), y + ((c >> 1) & 1), z + ((c >> 2) & 1))) > iso) mask |= 1 << c;
+                }
+                if (mask == 0 || mask == 255) continue;
+
+                for (uint8_t edge : table.edges[mask]) {
+                    int c = edgeCorner(edge);
+                    out.indices.push_back(edgeVertex(glm::ivec3(x + (c & 1), y + ((c >> 1) & 1), z + ((c >> 2) & 1)), edge / 4));
+                }
+            }
+        }
+    }
+
+    //looked up by slot when the neighbours stitch
+    std::sort(out.shared.begin(), out.shared.end());
+}
+
+void SurfaceMesher::stitch(ThreadPool& pool, SurfaceMesh& mesh) {
+    const int S = BLOCK_SAMPLES;
+    const size_t numBlocks = blockMeshes.size();
+    std::vector<size_t> vertexStart(numBlocks + 1, 0), indexStart(numBlocks + 1, 0);
+    for (size_t b = 0; b < numBlocks; ++b) {
+        vertexStart[b + 1] = vertexStart[b] + blockMeshes[b].vertices.size();
+        indexStart[b + 1] = indexStart[b] + blockMeshes[b].indices.size();
+    }
+
+    //a vertex on a block face exists in every active block that holds its cube edge,
+    //the copy of the first of those blocks, in directory order, stands for all of them
+    const size_t numVertices = vertexStart[numBlocks];
+    std::vector<unsigned int> canonical(numVertices);
+    pool.parallelFor(0, numBlocks, [&](size_t begin, size_t end) {
+        for (size_t b = begin; b < end; ++b) {
+            for (size_t v = vertexStart[b]; v < vertexStart[b + 1]; ++v) canonical[v] = (unsigned int)v;
+
+            const glm::ivec3 base = activeBlocks[b] * BLOCK;
+            for (const auto& entry : blockMeshes[b].shared) {
+                const int axis = (int)(entry.first % 3);
+                const int local = (int)(entry.first / 3);
+                const glm::ivec3 sample = base + glm::ivec3(local % S, (local / S) % S, local / (S * S));
+
+                //off the edge axis a sample on a block face belongs to the blocks on both sides
+                glm::ivec3 first = sample / BLOCK, last = first;
+                for (int a = 0; a < 3; ++a) {
+                    if (a != axis && sample[a] % BLOCK == 0) first[a] = std::max(first[a] - 1, 0);
+                }
+                last = glm::min(last, blockDim - glm::ivec3(1));
+
+                uint32_t owner = INACTIVE;
+                for (int z = first.z; z <= last.z && owner == INACTIVE; ++z)
+                    for (int y = first.y; y <= last.y && owner == INACTIVE; ++y)
+                        for (int x = first.x; x <= last.x && owner == INACTIVE; ++x)
+                            owner = blockIndex[(size_t)x + (size_t)blockDim.x * (y + (size_t)blockDim.y * z)];
+                if (owner == b || owner == INACTIVE) continue;
+
+                const glm::ivec3 ownerLocal = sample - activeBlocks[owner] * BLOCK;
+                const unsigned int ownerSlot = (ownerLocal.x + (ownerLocal.y + ownerLocal.z * S) * S) * 3 + axis;
+                const auto& ownerShared = blockMeshes[owner].shared;
+                auto found = std::lower_bound(ownerShared.begin(), ownerShared.end(), std::make_pair(ownerSlot, 0u));
+                if (found != ownerShared.end() && found->first == ownerSlot) {
+                    canonical[vertexStart[b] + entry.second] = (unsigned int)(vertexStart[owner] + found->second);
+                }
+            }
+        }
+    }, 16);
+
+    std::vector<size_t> keptStart(numBlocks + 1, 0);
+    pool.parallelFor(0, numBlocks, [&](size_t begin, size_t end) {
+        for (size_t b = begin; b < end; ++b) {
+            size_t kept = 0;
+            for (size_t v = vertexStart[b]; v < vertexStart[b + 1]; ++v) {
+                if (canonical[v] == v) kept++;
+            }
+            keptStart[b + 1] = kept;
+        }
+    }, 16);
+    for (size_t b = 0; b < numBlocks; ++b) keptStart[b + 1] += keptStart[b];
+
+    mesh.vertices.resize(keptStart[numBlocks]);
+    mesh.normals.resize(keptStart[numBlocks]);
+    mesh.indices.resize(indexStart[numBlocks]);
+
+    std::vector<unsigned int> finalIndex(numVertices);
+    pool.parallelFor(0, numBlocks, [&](size_t begin, size_t end) {
+        for (size_t b = begin; b < end; ++b) {
+            size_t next = keptStart[b];
+            for (size_t v = vertexStart[b]; v < vertexStart[b + 1]; ++v) {
+                if (canonical[v] != v) continue;
+                mesh.vertices[next] = blockMeshes[b].vertices[v - vertexStart[b]];
+                mesh.normals[next] = blockMeshes[b].normals[v - vertexStart[b]];
+                finalIndex[v] = (unsigned int)next++;
+            }
+        }
+    }, 16);
+
+    pool.parallelFor(0, numBlocks, [&](size_t begin, size_t end) {
+        for (size_t b = begin; b < end; ++b) {
+            const std::vector<unsigned int>& indices = blockMeshes[b].indices;
+            for (size_t k = 0; k < indices.size(); ++k) {
+                mesh.indices[indexStart[b] + k] = finalIndex[canonical[vertexStart[b] + indices[k]]];
+            }
+        }
+    }, 16);
+}
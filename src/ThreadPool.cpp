@@ -0,0 +1,255 @@
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+uint64_t packRange(uint32_t lo, uint32_t hi) {
+    return (uint64_t)lo | ((uint64_t)hi << 32);
+}
+
+void unpackRange(uint64_t range, uint32_t& lo, uint32_t& hi) {
+    lo = (uint32_t)range;
+    hi = (uint32_t)(range >> 32);
+}
+
+uint64_t nanosSince(Clock::time_point start) {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+}
+
+bool pinToCore(std::thread::native_handle_type handle, unsigned int core) {
+#if defined(_WIN32)
+    if (core >= sizeof(DWORD_PTR) * 8) return false;
+    return SetThreadAffinityMask((HANDLE)handle, (DWORD_PTR)1 << core) != 0;
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core, &set);
+    return pthread_setaffinity_np(handle, sizeof(set), &set) == 0;
+#else
+    (void)handle;
+    (void)core;
+    return false;
+#endif
+}
+
+std::thread::native_handle_type currentThreadHandle() {
+#if defined(_WIN32)
+    return GetCurrentThread();
+#else
+    return pthread_self();
+#endif
+}
+
+}
+
+ThreadPool::ThreadPool(unsigned int numThreads, bool pinThreads) : pinned(false), defaultGrain(0), job(nullptr), jobBegin(0), jobGrain(1), jobGeneration(0), busyWorkers(0), stopping(false), statJobs(0), statWallNanos(0)
+{
+    if (numThreads == 0) {
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    queues.reset(new Queue[numThreads]);
+    for (unsigned int i = 0; i < numThreads; ++i) {
+        queues[i].range.store(0);
+        queues[i].chunks = 0;
+        queues[i].steals = 0;
+        queues[i].busyNanos = 0;
+    }
+
+    //the calling thread also runs chunks, so spawn one less
+    for (unsigned int i = 1; i < numThreads; ++i) {
+        workers.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+
+    if (pinThreads) {
+        unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+        pinned = pinToCore(currentThreadHandle(), 0);
+        for (size_t i = 0; i < workers.size(); ++i) {
+            pinned = pinToCore(workers[i].native_handle(), (unsigned int)(i + 1) % cores) && pinned;
+        }
+        if (!pinned) {
+            std::cerr << "[ThreadPool] Could not pin threads to cores on this platform\n";
+        }
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeCondition.notify_all();
+
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::parallelFor(size_t begin, size_t end, const std::function<void(size_t, size_t)>& fn, size_t grainSize) {
+    if (begin >= end) return;
+
+    auto start = Clock::now();
+    size_t count = end - begin;
+    const unsigned int numThreads = getNumThreads();
+
+    if (grainSize == 0) grainSize = defaultGrain;
+    if (grainSize == 0) {
+        //~8 chunks per thread keeps dense and empty regions balanced
+        grainSize = std::max<size_t>(64, count / (numThreads * 8));
+    }
+
+    //not worth waking anyone
+    if (workers.empty() || count <= grainSize || count > UINT32_MAX) {
+        fn(begin, end);
+
+        uint64_t nanos = nanosSince(start);
+        queues[0].chunks++;
+        queues[0].busyNanos += nanos;
+        statJobs++;
+        statWallNanos += nanos;
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = &fn;
+        jobBegin = begin;
+        jobGrain = (uint32_t)std::min<size_t>(grainSize, UINT32_MAX);
+
+        //contiguous shares, so each thread starts on its own stretch of memory
+        for (unsigned int i = 0; i < numThreads; ++i) {
+            uint32_t lo = (uint32_t)(count * i / numThreads);
+            uint32_t hi = (uint32_t)(count * (i + 1) / numThreads);
+            queues[i].range.store(packRange(lo, hi), std::memory_order_relaxed);
+        }
+
+        busyWorkers = (unsigned int)workers.size();
+        jobGeneration++;
+    }
+    wakeCondition.notify_all();
+
+    runQueue(0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    doneCondition.wait(lock, [this] { return busyWorkers == 0; });
+    job = nullptr;
+
+    statJobs++;
+    statWallNanos += nanosSince(start);
+}
+
+bool ThreadPool::takeChunk(Queue& queue, uint32_t& lo, uint32_t& hi) {
+    uint64_t range = queue.range.load(std::memory_order_acquire);
+    for (;;) {
+        uint32_t rangeLo, rangeHi;
+        unpackRange(range, rangeLo, rangeHi);
+        if (rangeLo >= rangeHi) return false;
+
+        uint32_t take = std::min(jobGrain, rangeHi - rangeLo);
+        if (queue.range.compare_exchange_weak(range, packRange(rangeLo + take, rangeHi), std::memory_order_acq_rel)) {
+            lo = rangeLo;
+            hi = rangeLo + take;
+            return true;
+        }
+    }
+}
+
+bool ThreadPool::steal(unsigned int self) {
+    const unsigned int numThreads = getNumThreads();
+
+    for (unsigned int offset = 1; offset < numThreads; ++offset) {
+        Queue& victim = queues[(self + offset) % numThreads];
+
+        uint64_t range = victim.range.load(std::memory_order_acquire);
+        for (;;) {
+            uint32_t lo, hi;
+            unpackRange(range, lo, hi);
+            if (lo >= hi) break;
+
+            //back half, the owner keeps working on the front
+            uint32_t take = (hi - lo + 1) / 2;
+            if (victim.range.compare_exchange_weak(range, packRange(lo, hi - take), std::memory_order_acq_rel)) {
+                queues[self].range.store(packRange(hi - take, hi), std::memory_order_release);
+                queues[self].steals++;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void ThreadPool::runQueue(unsigned int self) {
+    Queue& queue = queues[self];
+
+    for (;;) {
+        uint32_t lo, hi;
+        if (takeChunk(queue, lo, hi)) {
+            auto chunkStart = Clock::now();
+            (*job)(jobBegin + lo, jobBegin + hi);
+            queue.busyNanos += nanosSince(chunkStart);
+            queue.chunks++;
+            continue;
+        }
+
+        //every range is empty or claimed, what is left is already running
+        if (!steal(self)) break;
+    }
+}
+
+void ThreadPool::workerLoop(unsigned int index) {
+    unsigned int seenGeneration = 0;
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wakeCondition.wait(lock, [&] { return stopping || jobGeneration != seenGeneration; });
+            if (stopping) return;
+            seenGeneration = jobGeneration;
+        }
+
+        runQueue(index);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--busyWorkers == 0) doneCondition.notify_one();
+        }
+    }
+}
+
+ThreadPoolStats ThreadPool::getStats() const {
+    ThreadPoolStats stats = {};
+    stats.jobs = statJobs;
+    stats.wallSeconds = statWallNanos * 1e-9;
+
+    for (unsigned int i = 0; i < getNumThreads(); ++i) {
+        stats.chunks += queues[i].chunks;
+        stats.steals += queues[i].steals;
+        stats.busySeconds += queues[i].busyNanos * 1e-9;
+    }
+    return stats;
+}
+
+void ThreadPool::resetStats() {
+    statJobs = 0;
+    statWallNanos = 0;
+
+    for (unsigned int i = 0; i < getNumThreads(); ++i) {
+        queues[i].chunks = 0;
+        queues[i].steals = 0;
+        queues[i].busyNanos = 0;
+    }
+}
@@ -0,0 +1,128 @@
+#include "TimingLog.h"
+#include <chrono>
+#include <iostream>
+
+namespace {
+
+//how often the writer wakes up to empty the ring
+constexpr std::chrono::milliseconds DRAIN_INTERVAL(100);
+
+bool endsWith(const std::string& text, const std::string& suffix) {
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+}
+
+const char* timingStageName(TimingStage stage) {
+    switch (stage) {
+    case TimingStage::Step: return "step";
+    case TimingStage::ExternalForces: return "external_forces";
+    case TimingStage::Reorder: return "reorder";
+    case TimingStage::GridClear: return "grid_clear";
+    case TimingStage::GridBuild: return "grid_build";
+    case TimingStage::FindNeighbors: return "find_neighbors";
+    case TimingStage::Density: return "density";
+    case TimingStage::PositionUpdate: return "position_update";
+    case TimingStage::UpdateVelocity: return "update_velocity";
+    case TimingStage::VorticityViscosity: return "vorticity_viscosity";
+    case TimingStage::SyncRender: return "sync_render";
+    case TimingStage::CoarseCorrection: return "coarse_correction";
+    default: return "unknown";
+    }
+}
+
+const char* timingClockName(TimingClock clock) {
+    return clock == TimingClock::GPU ? "gpu" : "cpu";
+}
+
+TimingLog::TimingLog(size_t capacity) : ringCapacity(capacity), json(false), firstSample(true), stopping(false), written(0), dropped(0)
+{
+}
+
+TimingLog::~TimingLog() {
+    close();
+}
+
+bool TimingLog::open(const std::string& filename) {
+    close();
+
+    file.open(filename, std::ios::trunc);
+    if (!file.is_open()) {
+        std::cerr << "[TimingLog] Failed to open " << filename << "\n";
+        return false;
+    }
+
+    //the ring is allocated once and reused by later logs
+    if (ring.capacity() == 0) ring.allocate(ringCapacity);
+
+    path = filename;
+    json = endsWith(filename, ".json");
+    firstSample = true;
+    stopping = false;
+    written = 0;
+    dropped = 0;
+
+    if (json) file << "[\n";
+    else file << "Frame,Stage,Iteration,Clock,TimeMs,NumParticles\n";
+
+    writer = std::thread(&TimingLog::writerLoop, this);
+    return true;
+}
+
+void TimingLog::close() {
+    if (!writer.joinable()) return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeCondition.notify_all();
+    writer.join();
+
+    //samples recorded after the writer's last drain
+    drain();
+
+    if (json) file << (firstSample ? "]\n" : "\n]\n");
+    file.close();
+
+    if (dropped > 0) {
+        std::cerr << "[TimingLog] " << dropped << " samples dropped, the writer could not keep up with " << path << "\n";
+    }
+}
+
+void TimingLog::writerLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping) {
+        wakeCondition.wait_for(lock, DRAIN_INTERVAL, [this] { return stopping; });
+
+        lock.unlock();
+        drain();
+        file.flush();
+        lock.lock();
+    }
+}
+
+void TimingLog::drain() {
+    TimingSample sample;
+    while (ring.pop(sample)) {
+        writeSample(sample);
+        written.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void TimingLog::writeSample(const TimingSample& sample) {
+    if (json) {
+        file << (firstSample ? "  " : ",\n  ")
+            << "{\"frame\": " << sample.frame
+            << ", \"stage\": \"" << timingStageName(sample.stage) << "\""
+            << ", \"iteration\": " << (unsigned int)sample.iteration
+            << ", \"clock\": \"" << timingClockName(sample.clock) << "\""
+            << ", \"ms\": " << sample.ms
+            << ", \"particles\": " << sample.numParticles << "}";
+    }
+    else {
+        file << sample.frame << "," << timingStageName(sample.stage) << "," << (unsigned int)sample.iteration << ","
+            << timingClockName(sample.clock) << "," << sample.ms << "," << sample.numParticles << "\n";
+    }
+    firstSample = false;
+}
@@ -0,0 +1,260 @@
+#include "UniformGrid.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+namespace {
+
+// Spreads the low 21 bits of v so there are two zero bits between each
+uint64_t splitBy3(uint64_t v) {
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffffULL;
+    v = (v | v << 16) & 0x1f0000ff0000ffULL;
+    v = (v | v << 8) & 0x100f00f00f00f00fULL;
+    v = (v | v << 4) & 0x10c30c30c30c30c3ULL;
+    v = (v | v << 2) & 0x1249249249249249ULL;
+    return v;
+}
+
+uint64_t mortonCode(unsigned int x, unsigned int y, unsigned int z) {
+    return splitBy3(x) | (splitBy3(y) << 1) | (splitBy3(z) << 2);
+}
+
+}
+
+const char* gridModeName(GridMode mode) {
+    switch (mode) {
+    case GridMode::Dense: return "dense";
+    case GridMode::Hashed: return "hashed";
+    case GridMode::Fitted: return "fitted";
+    }
+    return "unknown";
+}
+
+bool parseGridMode(const char* name, GridMode& mode) {
+    if (std::strcmp(name, "dense") == 0) mode = GridMode::Dense;
+    else if (std::strcmp(name, "hashed") == 0) mode = GridMode::Hashed;
+    else if (std::strcmp(name, "fitted") == 0) mode = GridMode::Fitted;
+    else return false;
+    return true;
+}
+
+unsigned int getHashedGridSlots(size_t count) {
+    unsigned int slots = 1024;
+    while (slots < 2 * count && slots < 0x80000000u) slots <<= 1;
+    return slots;
+}
+
+void fitCellBounds(const glm::ivec3& dim, glm::ivec3& lo, glm::ivec3& hi) {
+    if (glm::any(glm::greaterThan(lo, hi))) {
+        lo = hi = glm::ivec3(0);
+        return;
+    }
+    lo = glm::clamp(lo - glm::ivec3(1), glm::ivec3(0), dim - glm::ivec3(1));
+    hi = glm::clamp(hi + glm::ivec3(1), lo, dim - glm::ivec3(1));
+}
+
+UniformGrid::UniformGrid() : mode(GridMode::Dense), origin(0.0f), offset(0), dim(0), cellSize(1.0f), slotMask(0), epochStamping(true), epoch(0)
+{
+}
+
+void UniformGrid::configure(const glm::vec3& newOrigin, const glm::ivec3& newDim, float newCellSize, const glm::ivec3& newOffset) {
+    mode = GridMode::Dense;
+    origin = newOrigin;
+    offset = newOffset;
+    dim = glm::max(newDim, glm::ivec3(1));
+    cellSize = newCellSize;
+
+    //a fitted grid changes size every build, grow with headroom so it rarely reallocates
+    size_t totalCells = getNumCells();
+    if (totalCells > cellStart.capacity()) {
+        cellStart.reserve(totalCells + totalCells / 2);
+        cellEnd.reserve(totalCells + totalCells / 2);
+    }
+    cellStart.resize(totalCells);
+    cellEnd.resize(totalCells);
+}
+
+void UniformGrid::configureHashed(const glm::vec3& newOrigin, float newCellSize, size_t count) {
+    mode = GridMode::Hashed;
+    origin = newOrigin;
+    offset = glm::ivec3(0);
+    dim = glm::ivec3(0);
+    cellSize = newCellSize;
+
+    //the table only grows, so a shrinking particle count keeps its slots
+    size_t slots = std::max<size_t>(getHashedGridSlots(count), cellKeys.size());
+    slotMask = (unsigned int)(slots - 1);
+    cellStart.resize(slots);
+    cellEnd.resize(slots);
+    cellKeys.resize(slots);
+}
+
+//Serial like the count loop that calls it; the table is at most half full, so probing ends
+unsigned int UniformGrid::insertHashedCell(unsigned int key) {
+    for (unsigned int slot = hashCellKey(key) & slotMask;; slot = (slot + 1) & slotMask) {
+        if (cellKeys[slot] == key) return slot;
+        if (cellKeys[slot] == EMPTY_CELL_KEY) {
+            cellKeys[slot] = key;
+            return slot;
+        }
+    }
+}
+
+void UniformGrid::sortByCell(ThreadPool& pool) {
+    const size_t totalCells = getNumCells();
+    const size_t count = particleCells.size();
+
+    const bool hashed = mode == GridMode::Hashed;
+
+    //epochs 1..255 in turn. The scan rewrites every cell with its end offset, at most the
+    //particle count and so below any stamp, and resized cells start at zero, so stamped builds
+    //never clear the counts. Only a build without stamps (epoch 0) clears them, and so does the
+    //first stamped build after it, whose offsets may have passed CELL_COUNT_MASK
+    const bool clearCounts = epoch == 0;
+    epoch = epochStamping && count <= CELL_COUNT_MASK ? epoch % 255u + 1u : 0;
+    const unsigned int stamp = epoch << 24;
+
+    //clear_grid.comp - the key table of a hashed grid is not stamped and is reset every build
+    if (clearCounts || epoch == 0 || hashed) {
+        pool.parallelFor(0, totalCells, [&](size_t begin, size_t end) {
+            if (clearCounts || epoch == 0) std::fill(cellEnd.begin() + begin, cellEnd.begin() + end, 0u);
+            if (hashed) std::fill(cellKeys.begin() + begin, cellKeys.begin() + end, EMPTY_CELL_KEY);
+        });
+    }
+
+    //construct_grid.comp - the one serial pass of the build. It keeps the order inside a cell
+    //the particle order without atomics on the counts or the hashed key table; a parallel
+    //count with that order would need a count of every cell per chunk
+    for (size_t i = 0; i < count; ++i) {
+        if (hashed) particleCells[i] = insertHashedCell(particleCells[i]);
+        unsigned int& cell = cellEnd[particleCells[i]];
+        cell = std::max(cell, stamp);
+        particleRanks[i] = cell++ & (epoch ? CELL_COUNT_MASK : ~0u);
+    }
+
+    //grid_prefix_sum.comp as a chunked scan: the particles of each chunk of cells, the chunks'
+    //offsets, then every chunk scanned from its offset
+    const size_t chunks = std::min<size_t>(totalCells, (size_t)pool.getNumThreads() * 4);
+    std::vector<unsigned int> chunkOffsets(chunks, 0u);
+    auto cellCount = [&](size_t c) {
+        unsigned int stamped = cellEnd[c];
+        if (epoch) return stamped >> 24 == epoch ? stamped & CELL_COUNT_MASK : 0u;
+        return stamped;
+    };
+
+    pool.parallelFor(0, chunks, [&](size_t chunkBegin, size_t chunkEnd) {
+        for (size_t k = chunkBegin; k < chunkEnd; ++k) {
+            for (size_t c = totalCells * k / chunks; c < totalCells * (k + 1) / chunks; ++c) {
+                chunkOffsets[k] += cellCount(c);
+            }
+        }
+    }, 1);
+
+    unsigned int offset = 0;
+    for (size_t k = 0; k < chunks; ++k) {
+        unsigned int chunkCount = chunkOffsets[k];
+        chunkOffsets[k] = offset;
+        offset += chunkCount;
+    }
+
+    pool.parallelFor(0, chunks, [&](size_t chunkBegin, size_t chunkEnd) {
+        for (size_t k = chunkBegin; k < chunkEnd; ++k) {
+            unsigned int cellOffset = chunkOffsets[k];
+            for (size_t c = totalCells * k / chunks; c < totalCells * (k + 1) / chunks; ++c) {
+                const unsigned int particles = cellCount(c);
+                cellStart[c] = cellOffset;
+                cellOffset += particles;
+                cellEnd[c] = cellOffset;
+            }
+        }
+    }, 1);
+
+    //scatter_grid.comp
+    pool.parallelFor(0, count, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            sortedIndices[cellStart[particleCells[i]] + particleRanks[i]] = (unsigned int)i;
+        }
+    });
+}
+
+size_t UniformGrid::getMemoryBytes() const {
+    return (cellStart.capacity() + cellEnd.capacity() + cellKeys.capacity() + particleCells.capacity() + particleRanks.capacity() + sortedIndices.capacity()) * sizeof(unsigned int);
+}
+
+void UniformGrid::computeColorCells(ThreadPool& pool, std::vector<unsigned int>& cells, unsigned int starts[9]) const {
+    //a few chunks per thread: count per chunk and colour, then scatter at the chunk's offsets
+    const size_t totalCells = getNumCells();
+    const size_t chunks = std::min<size_t>(totalCells, (size_t)pool.getNumThreads() * 4);
+    std::vector<unsigned int> chunkCounts(chunks * 8, 0u);
+
+    auto forEachCell = [&](size_t c, auto&& fn) {
+        for (size_t cell = totalCells * c / chunks; cell < totalCells * (c + 1) / chunks; ++cell) {
+            if (cellEnd[cell] != cellStart[cell]) fn((unsigned int)cell, getCellColor((unsigned int)cell));
+        }
+    };
+
+    pool.parallelFor(0, chunks, [&](size_t chunkBegin, size_t chunkEnd) {
+        for (size_t c = chunkBegin; c < chunkEnd; ++c) {
+            forEachCell(c, [&](unsigned int, unsigned int color) { chunkCounts[c * 8 + color]++; });
+        }
+    }, 1);
+
+    //colour-major offsets, chunks in cell order inside each colour
+    unsigned int offset = 0;
+    for (unsigned int color = 0; color < 8; ++color) {
+        starts[color] = offset;
+        for (size_t c = 0; c < chunks; ++c) {
+            unsigned int chunkCount = chunkCounts[c * 8 + color];
+            chunkCounts[c * 8 + color] = offset;
+            offset += chunkCount;
+        }
+    }
+    starts[8] = offset;
+    cells.resize(offset);
+
+    pool.parallelFor(0, chunks, [&](size_t chunkBegin, size_t chunkEnd) {
+        for (size_t c = chunkBegin; c < chunkEnd; ++c) {
+            forEachCell(c, [&](unsigned int cell, unsigned int color) { cells[chunkCounts[c * 8 + color]++] = cell; });
+        }
+    }, 1);
+}
+
+std::vector<unsigned int> UniformGrid::computeMortonCellOrder(const glm::ivec3& dim, const glm::ivec3& offset) {
+    std::vector<std::pair<uint64_t, unsigned int>> keyed;
+    keyed.reserve((size_t)dim.x * dim.y * dim.z);
+
+    for (int z = 0; z < dim.z; z++) {
+        for (int y = 0; y < dim.y; y++) {
+            for (int x = 0; x < dim.x; x++) {
+                unsigned int cellIndex = x + y * dim.x + z * dim.x * dim.y;
+                keyed.emplace_back(mortonCode(x + offset.x, y + offset.y, z + offset.z), cellIndex);
+            }
+        }
+    }
+    std::sort(keyed.begin(), keyed.end());
+
+    std::vector<unsigned int> order(keyed.size());
+    for (size_t i = 0; i < keyed.size(); ++i) {
+        order[i] = keyed[i].second;
+    }
+    return order;
+}
+
+std::vector<unsigned int> UniformGrid::computeMortonSlotOrder() const {
+    std::vector<std::pair<uint64_t, unsigned int>> keyed;
+
+    for (unsigned int slot = 0; slot < (unsigned int)cellKeys.size(); ++slot) {
+        unsigned int key = cellKeys[slot];
+        if (key == EMPTY_CELL_KEY) continue;
+        keyed.emplace_back(mortonCode(key & 1023, (key >> 10) & 1023, (key >> 20) & 1023), slot);
+    }
+    std::sort(keyed.begin(), keyed.end());
+
+    std::vector<unsigned int> order(keyed.size());
+    for (size_t i = 0; i < keyed.size(); ++i) {
+        order[i] = keyed[i].second;
+    }
+    return order;
+}
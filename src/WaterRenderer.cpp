@@ -1,5 +1,6 @@
 #define GLM_ENABLE_EXPERIMENTAL
 #include "WaterRenderer.h"
+#include <algorithm>
 #include <iostream>
 #include <vector>
 #include <glad/glad.h>
@@ -8,6 +9,9 @@
 #include "Shader.h"
 #include "ComputeShader.h"
 #include "PBFSystem.h"
+#include "ParticleSurface.h"
+#include "SurfaceMesher.h"
+#include "ThreadPool.h"
 
 WaterRenderer::WaterRenderer()
     : screenWidth(0), screenHeight(0), particleRadius(0.0f),
@@ -52,7 +56,11 @@ bool WaterRenderer::initialize(int width, int height, float particleRadius) {
     }
 
     createParticleVAO();
-    //createSurfaceVAO();
+    createSurfaceVAO();
+
+    // Surface modes mesh on every core, splats of the same support as the smoothing pass
+    meshPool = std::make_unique<ThreadPool>();
+    surfaceMesher = std::make_unique<SurfaceMesher>(SurfaceMesherParams(particleRadius));
 
     // Create shader storage buffers
     glGenBuffers(1, &surfaceParticleBuffer);
@@ -96,6 +104,54 @@ void WaterRenderer::renderFluid(const PBFSystem& pbf, const Camera& camera, cons
         renderAnisotropicParticles(pbf, camera, lightPos);
 
     }
+
+    if (renderMode == RenderMode::SURFACE_ONLY ||
+        renderMode == RenderMode::PARTICLES_AND_SURFACE) {
+
+        // The mesh is built from the smoothed centers and kernels of the compute passes
+        if (renderMode == RenderMode::SURFACE_ONLY) computeAnisotropicParameters(pbf);
+
+        reconstructFluidSurface(pbf);
+        renderSurface(camera, lightPos);
+    }
+}
+
+void WaterRenderer::reconstructFluidSurface(const PBFSystem& pbf) {
+    unsigned int numParticles = pbf.computeSystem->getNumParticles();
+    if (numParticles == 0 || numParticles > maxParticles || !surfaceMesher) return;
+
+    // Read back the flags, centers and kernel matrices the compute passes left behind
+    std::vector<GLint> flags(numParticles);
+    std::vector<glm::vec4> paddedCenters(numParticles);
+    std::vector<glm::mat4> paddedMatrices(numParticles);
+
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, surfaceParticleBuffer);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, numParticles * sizeof(GLint), flags.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, smoothedCentersBuffer);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, numParticles * sizeof(glm::vec4), paddedCenters.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, anisotropyBuffer);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, numParticles * sizeof(glm::mat4), paddedMatrices.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    std::vector<glm::vec3> centers(numParticles);
+    std::vector<glm::mat3> matrices(numParticles);
+    for (unsigned int i = 0; i < numParticles; i++) {
+        centers[i] = glm::vec3(paddedCenters[i]);
+        matrices[i] = glm::mat3(paddedMatrices[i]);
+    }
+
+    // Interior particles keep their position as center, so the centers stand in for the positions
+    SurfaceMesh mesh;
+    if (!surfaceMesher->extract(*meshPool, centers, centers, matrices, flags, mesh)) {
+        surfaceIndexCount = 0;
+        return;
+    }
+
+    surfaceVertices = std::move(mesh.vertices);
+    surfaceNormals = std::move(mesh.normals);
+    surfaceIndices = std::move(mesh.indices);
+    updateSurfaceBuffers();
 }
 
 void WaterRenderer::computeAnisotropicParameters(const PBFSystem& pbf) {
@@ -113,23 +169,13 @@ void WaterRenderer::computeAnisotropicParameters(const PBFSystem& pbf) {
         << ", centers=" << smoothedCentersBuffer
         << ", anisotropy=" << anisotropyBuffer << std::endl;
 
-    // Initialize all buffers with proper data to avoid undefined behavior
-    // Surface flags buffer (int)
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, surfaceParticleBuffer);
-    std::vector<GLint> initialFlags(numParticles, 0);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, numParticles * sizeof(GLint), initialFlags.data(), GL_DYNAMIC_COPY);
-
-    // Smoothed centers buffer (vec4)
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, smoothedCentersBuffer);
-    std::vector<glm::vec4> initialCenters(numParticles, glm::vec4(0.0f));
-    glBufferData(GL_SHADER_STORAGE_BUFFER, numParticles * sizeof(glm::vec4), initialCenters.data(), GL_DYNAMIC_COPY);
-
-    // Anisotropy buffer (mat4)
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, anisotropyBuffer);
-    std::vector<glm::mat4> initialMatrices(numParticles, glm::mat4(1.0f));
-    glBufferData(GL_SHADER_STORAGE_BUFFER, numParticles * sizeof(glm::mat4), initialMatrices.data(), GL_DYNAMIC_COPY);
+    // Every pass writes all numParticles entries, the buffers only need to be large enough
+    if (numParticles > maxParticles) {
+        std::cerr << "[WaterRenderer] " << numParticles << " particles exceed the " << maxParticles << " the buffers hold" << std::endl;
+        return;
+    }
 
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    const AnisotropyParams anisotropy(particleRadius);
 
     // STEP 1: Surface Detection
     if (!surfaceDetectionShader) {
@@ -137,31 +183,29 @@ void WaterRenderer::computeAnisotropicParameters(const PBFSystem& pbf) {
         return;
     }
 
+    // Neighbours come from the solver's uniform grid, rebuilt over the current positions
+    if (!pbf.computeSystem->buildRenderGrid()) {
+        std::cerr << "[WaterRenderer] Could not build the render grid" << std::endl;
+        return;
+    }
+
     surfaceDetectionShader->use();
 
     // Get uniform locations for debugging
     GLuint shaderProgram = surfaceDetectionShader->ID;
-    GLint numParticlesLoc = glGetUniformLocation(shaderProgram, "numParticles");
     GLint neighborRadiusLoc = glGetUniformLocation(shaderProgram, "neighborRadius");
     GLint neighborThresholdLoc = glGetUniformLocation(shaderProgram, "neighborThreshold");
 
-    std::cout << "[DEBUG] Surface Detection: numParticles location=" << numParticlesLoc
-        << ", neighborRadius location=" << neighborRadiusLoc
+    std::cout << "[DEBUG] Surface Detection: neighborRadius location=" << neighborRadiusLoc
         << ", neighborThreshold location=" << neighborThresholdLoc << std::endl;
 
-    // Use direct uniform setting for uint type
-    if (numParticlesLoc != -1) {
-        // Use glUniform1ui for uint type
-        glUniform1ui(numParticlesLoc, numParticles);
-    }
-
-    // Set other uniforms
-    surfaceDetectionShader->setFloat("neighborRadius", particleRadius * 2.0f);
+    // The 3x3x3 cell search only sees neighbours up to one cell away
+    surfaceDetectionShader->setFloat("neighborRadius", std::min(particleRadius * 2.0f, pbf.computeSystem->getCellSize()));
     surfaceDetectionShader->setInt("neighborThreshold", 25);
 
-    // Bind buffers with explicit binding points
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, particleBufferId);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, surfaceParticleBuffer);
+    // Params, particles and grid at the solver bindings (0-4), flags at 5
+    pbf.computeSystem->bindRenderGrid();
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, surfaceParticleBuffer);
 
     // Check for errors before dispatch
     GLenum err = glGetError();
@@ -191,28 +235,20 @@ void WaterRenderer::computeAnisotropicParameters(const PBFSystem& pbf) {
 
     // Get uniform locations for debugging
     shaderProgram = smoothCenterShader->ID;
-    numParticlesLoc = glGetUniformLocation(shaderProgram, "numParticles");
     GLint smoothingRadiusLoc = glGetUniformLocation(shaderProgram, "smoothingRadius");
     GLint lambdaLoc = glGetUniformLocation(shaderProgram, "lambda");
 
-    std::cout << "[DEBUG] Smooth Centers: numParticles location=" << numParticlesLoc
-        << ", smoothingRadius location=" << smoothingRadiusLoc
+    std::cout << "[DEBUG] Smooth Centers: smoothingRadius location=" << smoothingRadiusLoc
         << ", lambda location=" << lambdaLoc << std::endl;
 
-    // Use direct uniform setting for uint type
-    if (numParticlesLoc != -1) {
-        // Use glUniform1ui for uint type
-        glUniform1ui(numParticlesLoc, numParticles);
-    }
-
-    // Set other uniforms
-    smoothCenterShader->setFloat("smoothingRadius", particleRadius * 2.5f);
-    smoothCenterShader->setFloat("lambda", 0.9f);
+    // Same neighbour search as surface detection, so the radius is capped at one cell
+    const float smoothingRadius = std::min(anisotropy.smoothingRadius, pbf.computeSystem->getCellSize());
+    smoothCenterShader->setFloat("smoothingRadius", smoothingRadius);
+    smoothCenterShader->setFloat("lambda", anisotropy.lambda);
 
-    // Bind buffers with explicit binding points
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, particleBufferId);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, surfaceParticleBuffer);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, smoothedCentersBuffer);
+    // Params, particles and grid stay bound at 0-4 from surface detection
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, surfaceParticleBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, smoothedCentersBuffer);
 
     // Check for errors before dispatch
     err = glGetError();
@@ -241,46 +277,23 @@ void WaterRenderer::computeAnisotropicParameters(const PBFSystem& pbf) {
 
     // Get uniform locations for debugging
     shaderProgram = anisotropyShader->ID;
-    numParticlesLoc = glGetUniformLocation(shaderProgram, "numParticles");
     smoothingRadiusLoc = glGetUniformLocation(shaderProgram, "smoothingRadius");
     GLint krLoc = glGetUniformLocation(shaderProgram, "kr");
     GLint ksLoc = glGetUniformLocation(shaderProgram, "ks");
 
-    std::cout << "[DEBUG] Anisotropy: numParticles location=" << numParticlesLoc
-        << ", smoothingRadius location=" << smoothingRadiusLoc
+    std::cout << "[DEBUG] Anisotropy: smoothingRadius location=" << smoothingRadiusLoc
         << ", kr location=" << krLoc
         << ", ks location=" << ksLoc << std::endl;
 
-    // Use direct uniform setting for uint type
-    if (numParticlesLoc != -1) {
-        // Use glUniform1ui for uint type
-        glUniform1ui(numParticlesLoc, numParticles);
-    }
+    // particleRadius comes from the simulation params UBO
+    anisotropyShader->setFloat("smoothingRadius", smoothingRadius);
+    anisotropyShader->setFloat("kr", anisotropy.kr);
+    anisotropyShader->setFloat("ks", anisotropy.ks);
+    anisotropyShader->setFloat("kn", anisotropy.kn);
+    anisotropyShader->setInt("Neps", anisotropy.neighborThreshold);
 
-    // Set other uniforms
-    anisotropyShader->setFloat("smoothingRadius", particleRadius * 2.5f);
-    anisotropyShader->setFloat("particleRadius", particleRadius);
-    anisotropyShader->setFloat("kr", 4.0f);
-    anisotropyShader->setFloat("ks", 1400.0f);
-    anisotropyShader->setFloat("kn", 0.5f);
-    anisotropyShader->setInt("Neps", 25);
-
-    // Bind buffers with explicit binding points
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, particleBufferId);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, surfaceParticleBuffer);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, smoothedCentersBuffer);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, anisotropyBuffer);
-
-    // Check buffer bindings
-    GLint binding0 = 0, binding1 = 0, binding2 = 0, binding3 = 0;
-    glGetIntegeri_v(GL_SHADER_STORAGE_BUFFER_BINDING, 0, &binding0);
-    glGetIntegeri_v(GL_SHADER_STORAGE_BUFFER_BINDING, 1, &binding1);
-    glGetIntegeri_v(GL_SHADER_STORAGE_BUFFER_BINDING, 2, &binding2);
-    glGetIntegeri_v(GL_SHADER_STORAGE_BUFFER_BINDING, 3, &binding3);
-
-    std::cout << "[DEBUG] SSBO bindings: [0]=" << binding0
-        << ", [1]=" << binding1 << ", [2]=" << binding2
-        << ", [3]=" << binding3 << std::endl;
+    // Flags (5) and centers (6) are still bound from the smoothing pass
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, anisotropyBuffer);
 
     // Check for errors before dispatch
     err = glGetError();
@@ -366,6 +379,43 @@ void WaterRenderer::createParticleVAO() {
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
+void WaterRenderer::createSurfaceVAO() {
+    glGenVertexArrays(1, &surfaceVAO);
+    glGenBuffers(1, &surfaceVBO);
+    glGenBuffers(1, &surfaceEBO);
+
+    // The element buffer binding is VAO state, the attribute offsets follow the vertex count
+    glBindVertexArray(surfaceVAO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, surfaceEBO);
+    glBindVertexArray(0);
+}
+
+void WaterRenderer::updateSurfaceBuffers() {
+    surfaceVertexCount = (unsigned int)surfaceVertices.size();
+    surfaceIndexCount = (unsigned int)surfaceIndices.size();
+    if (surfaceIndexCount == 0) return;
+
+    // Positions followed by normals in one buffer
+    GLsizeiptr attributeBytes = surfaceVertexCount * sizeof(glm::vec3);
+
+    glBindVertexArray(surfaceVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, surfaceVBO);
+    glBufferData(GL_ARRAY_BUFFER, 2 * attributeBytes, nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, attributeBytes, surfaceVertices.data());
+    glBufferSubData(GL_ARRAY_BUFFER, attributeBytes, attributeBytes, surfaceNormals.data());
+
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)attributeBytes);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, surfaceEBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, surfaceIndexCount * sizeof(unsigned int), surfaceIndices.data(), GL_STREAM_DRAW);
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
 void WaterRenderer::renderSurface(const Camera& camera, const glm::vec3& lightPos) {
     if (surfaceIndexCount == 0) return;
 
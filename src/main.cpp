@@ -2,6 +2,9 @@
 #define GLFW_INCLUDE_NONE
 #include <GLFW/glfw3.h>
 #include <openglDebug.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <iostream>
 
 #include <glm/gtc/type_ptr.hpp>
@@ -11,6 +14,7 @@
 
 #include "PBFSystem.h"
 #include "WaterRenderer.h"
+#include "ReplayPlayer.h"
 
 void processInput(GLFWwindow* window);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
@@ -18,6 +22,7 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void initParticleBuffers();
 void drawParticles(const PBFSystem& pbf, Shader& shader);
+void advanceReplay(float elapsed);
 
 // Ground plane functions
 void initGroundPlane();
@@ -58,6 +63,18 @@ Shader* directShader;
 WaterRenderer* waterRenderer = nullptr;
 bool useScreenSpaceWater = false;
 
+//Playback of a recorded frame cache (--replay <path>) instead of simulating
+ReplayPlayer replay;
+bool replaying = false;
+bool replayPaused = false;
+float replaySpeed = 1.0f;
+float replayFrameDt = 0.016f;
+double replayPosition = 0.0;        //in frames of the recording
+size_t replayShown = SIZE_MAX;      //frame currently in the particle buffer
+
+//--check-grid: compare the GPU grid with UniformGrid after the next step (G checks again)
+bool checkGridPending = false;
+
 #define USE_GPU_ENGINE 0
 extern "C"
 {
@@ -70,6 +87,36 @@ static void key_callback(GLFWwindow* window, int key, int scancode, int action,
     if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
         glfwSetWindowShouldClose(window, GLFW_TRUE);
 
+    if (replaying && action != GLFW_RELEASE) {
+        switch (key) {
+        case GLFW_KEY_P:
+            if (action == GLFW_PRESS) replayPaused = !replayPaused;
+            break;
+        case GLFW_KEY_RIGHT:
+            replayPaused = true;
+            replayPosition = std::floor(replayPosition) + 1.0;
+            break;
+        case GLFW_KEY_LEFT:
+            replayPaused = true;
+            replayPosition = std::max(std::floor(replayPosition) - 1.0, 0.0);
+            break;
+        case GLFW_KEY_UP:
+            replaySpeed = std::min(replaySpeed * 2.0f, 64.0f);
+            std::cout << "Replay speed " << replaySpeed << "x" << std::endl;
+            break;
+        case GLFW_KEY_DOWN:
+            replaySpeed = std::max(replaySpeed * 0.5f, 1.0f / 16.0f);
+            std::cout << "Replay speed " << replaySpeed << "x" << std::endl;
+            break;
+        case GLFW_KEY_HOME:
+            replayPosition = 0.0;
+            break;
+        }
+
+        //scene, wave and backend keys have no simulation to act on
+        if (key != GLFW_KEY_SPACE) return;
+    }
+
     if (action == GLFW_PRESS) {
         switch (key) {
         case GLFW_KEY_1: {
@@ -96,6 +143,16 @@ static void key_callback(GLFWwindow* window, int key, int scancode, int action,
             pbf.initScene(pbf.currentScene);
             break;
         }
+        case GLFW_KEY_C: {
+            bool toCPU = pbf.solverBackend == SolverBackend::GPU;
+            std::cout << "Switching solver backend to " << (toCPU ? "CPU" : "GPU") << std::endl;
+            pbf.setSolverBackend(toCPU ? SolverBackend::CPU : SolverBackend::GPU);
+            break;
+        }
+        case GLFW_KEY_G: {
+            checkGridPending = true;
+            break;
+        }
         case GLFW_KEY_SPACE: {
             useScreenSpaceWater = !useScreenSpaceWater;
             std::cout << "Rendering mode: " << (useScreenSpaceWater ? "Screen Space Water" : "Points") << std::endl;
@@ -105,8 +162,22 @@ static void key_callback(GLFWwindow* window, int key, int scancode, int action,
     }
 }
 
-int main(void)
+int main(int argc, char** argv)
 {
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            if (!replay.open(argv[++i])) return -1;
+            replaying = true;
+        }
+        else if (std::strcmp(argv[i], "--check-grid") == 0) {
+            checkGridPending = true;
+        }
+        else {
+            std::cerr << "Usage: " << argv[0] << " [--replay <frame cache>] [--check-grid]" << std::endl;
+            return -1;
+        }
+    }
+
     if (!glfwInit())
         return -1;
 
@@ -154,7 +225,22 @@ int main(void)
     //particle buffers and the PBF system
     initParticleBuffers();
     initGroundPlane();
-    pbf.initScene(SceneType::DamBreak);
+    if (replaying) {
+        const FrameCacheHeader& cache = replay.getHeader();
+        if (cache.particleRadius > 0.0f) pbf.setParticleRadius(cache.particleRadius);
+        if (cache.dt > 0.0f) replayFrameDt = cache.dt;
+
+        const std::vector<Particle>* first = replay.getFrame(0);
+        if (!first || !pbf.showParticles(first->data(), first->size())) {
+            std::cerr << "Failed to start the replay" << std::endl;
+            return -1;
+        }
+        replayShown = 0;
+        std::cout << "Replaying " << replay.getNumFrames() << " frames: P pause, Left/Right step, Up/Down speed, Home restart" << std::endl;
+    }
+    else {
+        pbf.initScene(SceneType::DamBreak);
+    }
 
     glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
 
@@ -180,6 +266,18 @@ int main(void)
             float fps = frameCount / deltaFrameTime;
             std::cout << "FPS: " << fps << " (" << (deltaTime * 1000.0f) << " ms/frame)" << std::endl;
 
+            if (pbf.computeSystemInitialized && pbf.solverBackend == SolverBackend::CPU) {
+                unsigned int threads = pbf.computeSystem->getNumThreads();
+                ThreadPoolStats poolStats = pbf.computeSystem->getThreadPoolStats();
+                std::cout << "CPU pool: " << threads << " threads, " << 100.0 * poolStats.utilisation(threads) << "% utilisation, "
+                    << poolStats.steals << " steals / " << poolStats.chunks << " chunks" << std::endl;
+                pbf.computeSystem->resetThreadPoolStats();
+            }
+            if (replaying) {
+                std::cout << "Replay frame " << replayShown << "/" << replay.getNumFrames() << " (simulation frame " << replay.getFrameNumber(replayShown)
+                    << "), " << replaySpeed << "x, " << replay.getMisses() << " frames not prefetched" << std::endl;
+            }
+
             // Reset counters
             frameCount = 0;
             deltaFrameTime = 0.0f;
@@ -189,7 +287,17 @@ int main(void)
         processInput(window);
 
         //Update simulation
-        pbf.step();
+        if (replaying) {
+            advanceReplay(deltaTime);
+        }
+        else {
+            pbf.step();
+            if (checkGridPending && pbf.computeSystemInitialized) {
+                checkGridPending = false;
+                if (pbf.solverBackend != SolverBackend::GPU) std::cout << "The grid check needs the GPU backend\n";
+                else if (!pbf.computeSystem->checkGpuGrid()) std::cerr << "GPU grid check failed" << std::endl;
+            }
+        }
 
         
         glClearColor(0.15f, 0.15f, 0.15f, 1.0f);
@@ -259,6 +367,29 @@ int main(void)
 }
 
 
+void advanceReplay(float elapsed)
+{
+    if (!replayPaused) {
+        replayPosition += elapsed * replaySpeed / replayFrameDt;
+    }
+
+    //loops at the end of the recording
+    double numFrames = (double)replay.getNumFrames();
+    if (replayPosition >= numFrames) {
+        replayPosition = std::fmod(replayPosition, numFrames);
+    }
+
+    size_t frame = (size_t)replayPosition;
+    if (frame == replayShown) return;
+
+    //the previous frame stays on screen until this one is decoded
+    const std::vector<Particle>* particles = replay.getFrame(frame, false);
+    if (particles) {
+        pbf.showParticles(particles->data(), particles->size());
+        replayShown = frame;
+    }
+}
+
 void processInput(GLFWwindow* window)
 {
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
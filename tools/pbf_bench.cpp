@@ -0,0 +1,529 @@
+// Reproducible CPU benchmark of the PBF solver stages.
+//
+// Builds the DamBreak / WaterContainer scenes at several particle counts (the
+// particle radius is shrunk so the same fluid volume is sampled more finely),
+// runs warm-up frames, then times every stage of PBFComputeSystem::step over the
+// measured frames through its stage profiler and writes median/p95/p99 per stage as JSON.
+//
+//   pbf_bench --scenes DamBreak,WaterContainer --counts 10000,100000,1000000 --frames 50 --json bench.json
+//
+// Every case runs once per --reorder interval, so the default "0,25" compares
+// generation order against periodic Morton reordering of the particle storage.
+//
+// The timed frames run with the density solver settings of the command line (iterations,
+// tolerance, Chebyshev, warm start, coarse correction), the same flags as pbf_headless.
+//
+// After the measured frames each case also records the mean density error after
+// 0..--error-curve position updates of one step, from the same state for the Jacobi
+// and the coloured Gauss-Seidel solver, so their convergence can be compared per sweep.
+//
+#include "PBFCpuSolver.h"
+#include "PBFSystem.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Options {
+    std::vector<SceneType> scenes = { SceneType::DamBreak, SceneType::WaterContainer };
+    std::vector<unsigned int> counts = { 10000, 50000, 100000, 500000, 1000000, 2000000 };
+    int frames = 30;
+    int warmup = 5;
+    unsigned int threads = 0;
+    unsigned int grain = 0;
+    bool pin = false;
+    unsigned int seed = 1;
+    std::vector<unsigned int> reorderIntervals = { 0, 25 };
+    unsigned int neighborListCapacity = 48;
+    SimdLevel simd = preferredSimdLevel();
+    DensitySolverSettings solver;       //of the timed frames
+    int errorCurveIterations = 8;
+    std::string jsonPath = "pbf_bench.json";
+};
+
+// Solvers compared by the error curves
+const ConstraintSolver CURVE_SOLVERS[] = { ConstraintSolver::Jacobi, ConstraintSolver::ColoredGaussSeidel };
+const int CURVE_SOLVER_COUNT = 2;
+
+// One entry per solver stage, in the order PBFComputeSystem::step runs them
+enum Stage {
+    STAGE_EXTERNAL_FORCES,
+    STAGE_REORDER,
+    STAGE_FIND_NEIGHBORS,
+    STAGE_DENSITY,
+    STAGE_POSITION_UPDATE,
+    STAGE_COARSE_CORRECTION,
+    STAGE_UPDATE_VELOCITY,
+    STAGE_VORTICITY_VISCOSITY,
+    STAGE_TOTAL,
+    STAGE_COUNT
+};
+
+const char* STAGE_NAMES[STAGE_COUNT] = {
+    "applyExternalForces",
+    "reorderParticles",
+    "findNeighbors",
+    "calculateDensity",
+    "applyPositionUpdate",
+    "applyCoarseCorrection",
+    "updateVelocity",
+    "applyVorticityViscosity",
+    "total"
+};
+
+// Profiler stage each entry is read from
+const TimingStage STAGE_SOURCES[STAGE_COUNT] = {
+    TimingStage::ExternalForces,
+    TimingStage::Reorder,
+    TimingStage::FindNeighbors,
+    TimingStage::Density,
+    TimingStage::PositionUpdate,
+    TimingStage::CoarseCorrection,
+    TimingStage::UpdateVelocity,
+    TimingStage::VorticityViscosity,
+    TimingStage::Step
+};
+
+struct CaseResult {
+    SceneType scene;
+    unsigned int requestedParticles;
+    unsigned int reorderInterval;
+    unsigned int particles;
+    float particleRadius;
+    unsigned int neighborListOverflows;     //after the last frame
+    double meanIterations;                  //density iterations per measured frame
+    DensitySolverStats solverStats;         //of the last frame
+    StepTraffic traffic;                    //modelled bytes of one step at the last frame
+    ThreadPoolStats pool;                   //over the measured frames
+    std::vector<double> samples[STAGE_COUNT];   //ms per measured frame
+    std::vector<float> errorCurves[CURVE_SOLVER_COUNT];     //mean density error after 0, 1, ... position updates
+};
+
+const char* sceneName(SceneType scene) {
+    switch (scene) {
+    case SceneType::DamBreak: return "DamBreak";
+    case SceneType::WaterContainer: return "WaterContainer";
+    case SceneType::DropBlock: return "DropBlock";
+    }
+    return "Unknown";
+}
+
+template <typename T, typename Parse>
+bool parseList(const char* text, std::vector<T>& out, Parse parse) {
+    out.clear();
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        T value;
+        if (!parse(item, value)) return false;
+        out.push_back(value);
+    }
+    return !out.empty();
+}
+
+void printUsage() {
+    std::cout << "Usage: pbf_bench [options]\n"
+        << "  --scenes <list>     comma separated DamBreak,WaterContainer (default both)\n"
+        << "  --counts <list>     comma separated particle counts (default 10000,50000,100000,500000,1000000,2000000)\n"
+        << "  --frames <n>        measured frames per case (default 30)\n"
+        << "  --warmup <n>        frames run before measuring (default 5)\n"
+        << "  --threads <n>       worker threads, 0 = all cores (default 0)\n"
+        << "  --grain <n>         particles per work-stealing chunk, 0 = automatic (default 0)\n"
+        << "  --pin               pin worker threads to cores\n"
+        << "  --seed <n>          scene jitter seed (default 1)\n"
+        << "  --reorder <list>    comma separated Morton reorder intervals, 0 = off (default 0,25)\n"
+        << "  --neighbor-list <n> neighbours cached per particle, 0 = walk the grid (default 48)\n"
+        << "  --simd <level>      auto|scalar|avx2|avx512 kernels, clamped to the CPU (default auto)\n"
+        << "  --solver <name>     jacobi|gauss-seidel position updates in the timed frames (default jacobi)\n"
+        << "  --iterations <n>    most density constraint iterations per step (default 4)\n"
+        << "  --min-iterations <n>  fewest iterations before the tolerance may stop the loop (default 1)\n"
+        << "  --tolerance <e>     stop once the mean compression error is below e, 0 = always --iterations (default 0)\n"
+        << "  --max-error <e>     with --tolerance, also require the largest compression error below e (default off)\n"
+        << "  --warm-start <w>    add w times each particle's lambda of the last step to its first iteration, 0 = off (default 0)\n"
+        << "  --chebyshev         Chebyshev acceleration of the density iterations, jacobi only\n"
+        << "  --spectral-radius <r>  for --chebyshev, 0 = estimated while running (default 0)\n"
+        << "  --chebyshev-delay <n>  plain iterations per step before the acceleration starts, at least 1 (default 2)\n"
+        << "  --multigrid <n>     replace the first iteration with a coarse-grid correction of n V-cycles, 0 = off (default 0)\n"
+        << "  --coarse-cell <s>   coarse lattice cell in smoothing lengths (default 2)\n"
+        << "  --max-coarse-move <r>  largest coarse correction of a particle in radii (default 1)\n"
+        << "  --error-curve <n>   density error after up to n position updates per solver, 0 = off (default 8)\n"
+        << "  --json <path>       output file (default pbf_bench.json)\n";
+}
+
+bool parseArgs(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (std::strcmp(arg, "--help") == 0 || std::strcmp(arg, "-h") == 0) {
+            return false;
+        }
+        else if (std::strcmp(arg, "--scenes") == 0 && hasValue) {
+            bool ok = parseList<SceneType>(argv[++i], options.scenes, [](const std::string& s, SceneType& scene) {
+                if (s == "DamBreak") scene = SceneType::DamBreak;
+                else if (s == "WaterContainer") scene = SceneType::WaterContainer;
+                else return false;
+                return true;
+            });
+            if (!ok) {
+                std::cerr << "Invalid scene list: " << argv[i] << "\n";
+                return false;
+            }
+        }
+        else if (std::strcmp(arg, "--counts") == 0 && hasValue) {
+            bool ok = parseList<unsigned int>(argv[++i], options.counts, [](const std::string& s, unsigned int& count) {
+                count = (unsigned int)std::strtoul(s.c_str(), nullptr, 10);
+                return count > 0;
+            });
+            if (!ok) {
+                std::cerr << "Invalid count list: " << argv[i] << "\n";
+                return false;
+            }
+        }
+        else if (std::strcmp(arg, "--reorder") == 0 && hasValue) {
+            bool ok = parseList<unsigned int>(argv[++i], options.reorderIntervals, [](const std::string& s, unsigned int& interval) {
+                char* end = nullptr;
+                interval = (unsigned int)std::strtoul(s.c_str(), &end, 10);
+                return end != s.c_str();
+            });
+            if (!ok) {
+                std::cerr << "Invalid reorder list: " << argv[i] << "\n";
+                return false;
+            }
+        }
+        else if (std::strcmp(arg, "--neighbor-list") == 0 && hasValue) options.neighborListCapacity = (unsigned int)std::atoi(argv[++i]);
+        else if (std::strcmp(arg, "--simd") == 0 && hasValue) {
+            if (!parseSimdLevel(argv[++i], options.simd)) {
+                std::cerr << "Unknown SIMD level: " << argv[i] << "\n";
+                return false;
+            }
+        }
+        else if (std::strcmp(arg, "--solver") == 0 && hasValue) {
+            if (!parseConstraintSolver(argv[++i], options.solver.solver)) {
+                std::cerr << "Unknown solver: " << argv[i] << "\n";
+                return false;
+            }
+        }
+        else if (std::strcmp(arg, "--iterations") == 0 && hasValue) options.solver.maxIterations = (unsigned int)std::atoi(argv[++i]);
+        else if (std::strcmp(arg, "--min-iterations") == 0 && hasValue) options.solver.minIterations = (unsigned int)std::atoi(argv[++i]);
+        else if (std::strcmp(arg, "--tolerance") == 0 && hasValue) options.solver.tolerance = (float)std::atof(argv[++i]);
+        else if (std::strcmp(arg, "--max-error") == 0 && hasValue) options.solver.maxErrorTolerance = (float)std::atof(argv[++i]);
+        else if (std::strcmp(arg, "--warm-start") == 0 && hasValue) options.solver.lambdaWarmStart = (float)std::atof(argv[++i]);
+        else if (std::strcmp(arg, "--chebyshev") == 0) options.solver.chebyshev = true;
+        else if (std::strcmp(arg, "--spectral-radius") == 0 && hasValue) options.solver.spectralRadius = (float)std::atof(argv[++i]);
+        else if (std::strcmp(arg, "--chebyshev-delay") == 0 && hasValue) options.solver.chebyshevDelay = (unsigned int)std::atoi(argv[++i]);
+        else if (std::strcmp(arg, "--multigrid") == 0 && hasValue) options.solver.multigridCycles = (unsigned int)std::atoi(argv[++i]);
+        else if (std::strcmp(arg, "--coarse-cell") == 0 && hasValue) options.solver.coarseCellSize = (float)std::atof(argv[++i]);
+        else if (std::strcmp(arg, "--max-coarse-move") == 0 && hasValue) options.solver.maxCoarseDisplacement = (float)std::atof(argv[++i]);
+        else if (std::strcmp(arg, "--error-curve") == 0 && hasValue) options.errorCurveIterations = std::atoi(argv[++i]);
+        else if (std::strcmp(arg, "--frames") == 0 && hasValue) options.frames = std::atoi(argv[++i]);
+        else if (std::strcmp(arg, "--warmup") == 0 && hasValue) options.warmup = std::atoi(argv[++i]);
+        else if (std::strcmp(arg, "--threads") == 0 && hasValue) options.threads = (unsigned int)std::atoi(argv[++i]);
+        else if (std::strcmp(arg, "--grain") == 0 && hasValue) options.grain = (unsigned int)std::atoi(argv[++i]);
+        else if (std::strcmp(arg, "--pin") == 0) options.pin = true;
+        else if (std::strcmp(arg, "--seed") == 0 && hasValue) options.seed = (unsigned int)std::strtoul(argv[++i], nullptr, 10);
+        else if (std::strcmp(arg, "--json") == 0 && hasValue) options.jsonPath = argv[++i];
+        else {
+            std::cerr << "Unknown or incomplete argument: " << arg << "\n";
+            return false;
+        }
+    }
+
+    if (options.frames <= 0 || options.warmup < 0 || options.errorCurveIterations < 0) {
+        std::cerr << "--frames must be positive, --warmup and --error-curve non-negative\n";
+        return false;
+    }
+    if (options.solver.maxIterations == 0 || options.solver.minIterations > options.solver.maxIterations) {
+        std::cerr << "--iterations must be positive and at least --min-iterations\n";
+        return false;
+    }
+    if (options.solver.lambdaWarmStart < 0.0f || options.solver.lambdaWarmStart >= 1.0f) {
+        std::cerr << "--warm-start must be in [0, 1)\n";
+        return false;
+    }
+    if (options.solver.chebyshev && options.solver.solver != ConstraintSolver::Jacobi) {
+        std::cerr << "--chebyshev needs --solver jacobi\n";
+        return false;
+    }
+    if (options.solver.spectralRadius < 0.0f || options.solver.spectralRadius >= 1.0f) {
+        std::cerr << "--spectral-radius must be in [0, 1)\n";
+        return false;
+    }
+    if (options.solver.chebyshevDelay < 1) {
+        std::cerr << "--chebyshev-delay must be at least 1\n";
+        return false;
+    }
+    if (options.solver.coarseCellSize <= 0.0f || options.solver.maxCoarseDisplacement <= 0.0f) {
+        std::cerr << "--coarse-cell and --max-coarse-move must be positive\n";
+        return false;
+    }
+    return true;
+}
+
+unsigned int buildScene(PBFSystem& pbf, SceneType scene) {
+    pbf.particles.clear();
+    if (scene == SceneType::WaterContainer) pbf.createWaterContainerScene();
+    else pbf.createDamBreakScene();
+    return (unsigned int)pbf.particles.size();
+}
+
+// Scene volume is fixed, so the count goes with 1/r^3; a few refinements absorb the lattice rounding
+void fitParticleRadius(PBFSystem& pbf, SceneType scene, unsigned int target) {
+    for (int attempt = 0; attempt < 4; ++attempt) {
+        unsigned int count = buildScene(pbf, scene);
+        float ratio = (float)count / (float)target;
+        if (std::abs(ratio - 1.0f) < 0.02f) break;
+        pbf.setParticleRadius(pbf.particleRadius * std::cbrt(ratio));
+    }
+    pbf.particles.clear();
+}
+
+// One PBFComputeSystem::step, each stage's ms read back from its stage profiler
+void runFrame(PBFComputeSystem& system, double stageMs[STAGE_COUNT]) {
+    system.step();
+    for (int stage = 0; stage < STAGE_COUNT; ++stage) {
+        stageMs[stage] = system.getStageTime(STAGE_SOURCES[stage]);
+    }
+}
+
+// One step from snapshot up to the constraint loop, then the mean density error before the
+// first and after every position update
+std::vector<float> measureErrorCurve(PBFComputeSystem& system, const std::vector<Particle>& snapshot, ConstraintSolver solver, int iterations) {
+    system.uploadParticles(snapshot);
+    system.applyExternalForces();
+    system.findNeighbors();
+
+    std::vector<float> curve;
+    for (int iter = 0; iter <= iterations; iter++) {
+        if (iter > 0) {
+            if (solver == ConstraintSolver::ColoredGaussSeidel) system.applyPositionUpdateColored();
+            else system.applyPositionUpdate();
+        }
+        system.calculateDensity();
+
+        float maxError, averageError;
+        system.computeDensityError(maxError, averageError);
+        curve.push_back(averageError);
+    }
+    return curve;
+}
+
+CaseResult runCase(const Options& options, SceneType scene, unsigned int target, unsigned int reorderInterval, unsigned int& threads) {
+    CaseResult result;
+    result.scene = scene;
+    result.requestedParticles = target;
+    result.reorderInterval = reorderInterval;
+
+    PBFSystem pbf;
+    pbf.solverBackend = SolverBackend::CPU;
+    pbf.solverThreads = options.threads;
+    pbf.solverPinThreads = options.pin;
+    pbf.solverGrainSize = options.grain;
+    pbf.randomSeed = options.seed;
+    pbf.reorderInterval = reorderInterval;
+    pbf.neighborListCapacity = options.neighborListCapacity;
+    pbf.cpuSimdLevel = options.simd;
+    pbf.solverSettings = options.solver;
+
+    fitParticleRadius(pbf, scene, target);
+    pbf.maxParticles = std::max(pbf.maxParticles, target * 2);
+    pbf.initScene(scene);
+
+    result.particles = pbf.computeSystem->getNumParticles();
+    result.particleRadius = pbf.particleRadius;
+    threads = pbf.computeSystem->getNumThreads();
+    pbf.computeSystem->setKeepStageTimes(true);
+
+    double stageMs[STAGE_COUNT];
+    for (int frame = 0; frame < options.warmup; ++frame) {
+        runFrame(*pbf.computeSystem, stageMs);
+    }
+    pbf.computeSystem->resetThreadPoolStats();
+    unsigned int totalIterations = 0;
+    for (int frame = 0; frame < options.frames; ++frame) {
+        runFrame(*pbf.computeSystem, stageMs);
+        totalIterations += pbf.computeSystem->getSolverStats().iterations;
+        for (int stage = 0; stage < STAGE_COUNT; ++stage) {
+            result.samples[stage].push_back(stageMs[stage]);
+        }
+    }
+    result.neighborListOverflows = pbf.computeSystem->getNeighborListOverflows();
+    result.meanIterations = (double)totalIterations / options.frames;
+    result.solverStats = pbf.computeSystem->getSolverStats();
+    result.pool = pbf.computeSystem->getThreadPoolStats();
+    result.traffic = pbf.computeSystem->getCpuSolver()->estimateStepTraffic((int)pbf.computeSystem->getSolverStats().iterations);
+
+    if (options.errorCurveIterations > 0) {
+        std::vector<Particle> snapshot;
+        pbf.computeSystem->downloadParticles(snapshot);
+        for (int s = 0; s < CURVE_SOLVER_COUNT; ++s) {
+            result.errorCurves[s] = measureErrorCurve(*pbf.computeSystem, snapshot, CURVE_SOLVERS[s], options.errorCurveIterations);
+        }
+    }
+    return result;
+}
+
+// Nearest-rank percentile of an already sorted sample set
+double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0.0;
+    size_t rank = (size_t)std::ceil(p / 100.0 * sorted.size());
+    return sorted[std::min(sorted.size() - 1, rank > 0 ? rank - 1 : 0)];
+}
+
+void writeStageStats(std::ostream& out, std::vector<double> samples) {
+    std::sort(samples.begin(), samples.end());
+    double mean = 0.0;
+    for (double s : samples) mean += s;
+    mean /= std::max<size_t>(1, samples.size());
+
+    out << "{\"median_ms\": " << percentile(samples, 50.0)
+        << ", \"p95_ms\": " << percentile(samples, 95.0)
+        << ", \"p99_ms\": " << percentile(samples, 99.0)
+        << ", \"mean_ms\": " << mean
+        << ", \"min_ms\": " << samples.front()
+        << ", \"max_ms\": " << samples.back() << "}";
+}
+
+void writeCurve(std::ostream& out, const std::vector<float>& curve) {
+    out << "[";
+    for (size_t i = 0; i < curve.size(); ++i) {
+        out << (i > 0 ? ", " : "") << curve[i];
+    }
+    out << "]";
+}
+
+const char* compilerName() {
+#if defined(__clang__)
+    return "clang " __clang_version__;
+#elif defined(__GNUC__)
+    return "gcc " __VERSION__;
+#elif defined(_MSC_VER)
+    return "msvc";
+#else
+    return "unknown";
+#endif
+}
+
+void writeJson(std::ostream& out, const Options& options, unsigned int threads, const std::vector<CaseResult>& results) {
+    out << "{\n";
+    out << "  \"benchmark\": \"pbf_bench\",\n";
+    out << "  \"backend\": \"cpu\",\n";
+    out << "  \"compiler\": \"" << compilerName() << "\",\n";
+    out << "  \"threads\": " << threads << ",\n";
+    out << "  \"grain_size\": " << options.grain << ",\n";
+    out << "  \"pinned\": " << (options.pin ? "true" : "false") << ",\n";
+    out << "  \"frames\": " << options.frames << ",\n";
+    out << "  \"warmup\": " << options.warmup << ",\n";
+    out << "  \"seed\": " << options.seed << ",\n";
+    out << "  \"neighbor_list_capacity\": " << options.neighborListCapacity << ",\n";
+    out << "  \"simd\": \"" << simdLevelName(getSphKernels(options.simd).level) << "\",\n";
+    const DensitySolverSettings& solver = options.solver;
+    out << "  \"solver\": {\"name\": \"" << constraintSolverName(solver.solver) << "\""
+        << ", \"min_iterations\": " << solver.minIterations
+        << ", \"max_iterations\": " << solver.maxIterations
+        << ", \"tolerance\": " << solver.tolerance
+        << ", \"max_error_tolerance\": " << solver.maxErrorTolerance
+        << ", \"warm_start\": " << solver.lambdaWarmStart
+        << ", \"chebyshev\": " << (solver.chebyshev ? "true" : "false")
+        << ", \"spectral_radius\": " << solver.spectralRadius
+        << ", \"chebyshev_delay\": " << solver.chebyshevDelay
+        << ", \"multigrid_cycles\": " << solver.multigridCycles
+        << ", \"coarse_cell\": " << solver.coarseCellSize
+        << ", \"max_coarse_move\": " << solver.maxCoarseDisplacement << "},\n";
+    out << "  \"cases\": [\n";
+
+    for (size_t i = 0; i < results.size(); ++i) {
+        const CaseResult& r = results[i];
+        out << "    {\n";
+        out << "      \"scene\": \"" << sceneName(r.scene) << "\",\n";
+        out << "      \"requested_particles\": " << r.requestedParticles << ",\n";
+        out << "      \"reorder_interval\": " << r.reorderInterval << ",\n";
+        out << "      \"particles\": " << r.particles << ",\n";
+        out << "      \"particle_radius\": " << r.particleRadius << ",\n";
+        out << "      \"neighbor_list_overflows\": " << r.neighborListOverflows << ",\n";
+        //the step only measures what its settings use
+        out << "      \"solver_stats\": {\"mean_iterations\": " << r.meanIterations;
+        if (solver.tolerance > 0.0f) {
+            out << ", \"mean_error\": " << r.solverStats.averageError << ", \"max_error\": " << r.solverStats.maxError;
+        }
+        if (solver.chebyshev) out << ", \"spectral_radius\": " << r.solverStats.spectralRadius;
+        if (solver.multigridCycles > 0) out << ", \"coarse_residual\": " << r.solverStats.coarseResidual;
+        out << "},\n";
+        out << "      \"bytes_per_step\": {\"soa\": " << r.traffic.soaBytes
+            << ", \"aos\": " << r.traffic.aosBytes << "},\n";
+        out << "      \"thread_pool\": {\"utilisation\": " << r.pool.utilisation(threads)
+            << ", \"steals\": " << r.pool.steals << ", \"chunks\": " << r.pool.chunks
+            << ", \"jobs\": " << r.pool.jobs << "},\n";
+        if (options.errorCurveIterations > 0) {
+            out << "      \"error_curves\": {";
+            for (int s = 0; s < CURVE_SOLVER_COUNT; ++s) {
+                out << (s > 0 ? ", " : "") << "\"" << constraintSolverName(CURVE_SOLVERS[s]) << "\": ";
+                writeCurve(out, r.errorCurves[s]);
+            }
+            out << "},\n";
+        }
+        out << "      \"stages\": {\n";
+        for (int stage = 0; stage < STAGE_COUNT; ++stage) {
+            out << "        \"" << STAGE_NAMES[stage] << "\": ";
+            writeStageStats(out, r.samples[stage]);
+            out << (stage + 1 < STAGE_COUNT ? ",\n" : "\n");
+        }
+        out << "      }\n";
+        out << "    }" << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+
+    out << "  ]\n";
+    out << "}\n";
+}
+
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseArgs(argc, argv, options)) {
+        printUsage();
+        return 1;
+    }
+
+    std::vector<CaseResult> results;
+    unsigned int threads = 0;   //what the solver actually used
+
+    for (SceneType scene : options.scenes) {
+        for (unsigned int count : options.counts) {
+            for (unsigned int reorderInterval : options.reorderIntervals) {
+                std::cout << "[pbf_bench] " << sceneName(scene) << " @ " << count << " particles, reorder every " << reorderInterval << "\n";
+                CaseResult result = runCase(options, scene, count, reorderInterval, threads);
+
+                std::vector<double> total = result.samples[STAGE_TOTAL];
+                std::sort(total.begin(), total.end());
+                std::cout << "[pbf_bench]   " << result.particles << " particles, median frame "
+                    << percentile(total, 50.0) << " ms, p95 " << percentile(total, 95.0) << " ms, "
+                    << result.meanIterations << " density iterations per frame\n";
+                for (int s = 0; s < CURVE_SOLVER_COUNT && options.errorCurveIterations > 0; ++s) {
+                    std::cout << "[pbf_bench]   " << constraintSolverName(CURVE_SOLVERS[s]) << " density error by iteration:";
+                    for (float error : result.errorCurves[s]) std::cout << " " << error;
+                    std::cout << "\n";
+                }
+
+                results.push_back(std::move(result));
+            }
+        }
+    }
+
+    std::ofstream file(options.jsonPath);
+    if (!file.is_open()) {
+        std::cerr << "[pbf_bench] Failed to open " << options.jsonPath << "\n";
+        return 1;
+    }
+    writeJson(file, options, threads, results);
+    std::cout << "[pbf_bench] Wrote " << options.jsonPath << "\n";
+
+    return 0;
+}
@@ -0,0 +1,394 @@
+// Headless batch driver: runs PBFSystem::step as fast as possible on the CPU
+// backend, without a window, VSync or a GL context.
+//
+//   pbf_headless --scene DamBreak --frames 2000 --dt 0.016 --threads 0 --out runs/dam
+//
+// With --checkpoint-every the full state is saved to <out>/checkpoint.pbfck, and a
+// preempted run continues with --resume runs/dam/checkpoint.pbfck.
+//
+#include "PBFSystem.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+namespace {
+
+struct Options {
+    SceneType scene = SceneType::DamBreak;
+    unsigned int seed = 0;
+    int frames = 1000;
+    float dt = 0.016f;
+    float cfl = 0.0f;
+    float minDt = 0.001f;
+    float maxDt = 0.016f;
+    DensitySolverSettings solver;
+    unsigned int threads = 0;
+    unsigned int grain = 0;
+    bool pin = false;
+    std::string outputDir = "pbf_output";
+    int dumpEvery = 0;
+    unsigned int reorderEvery = 25;
+    unsigned int neighborList = 48;
+    GridMode grid = GridMode::Dense;
+    bool gridClear = false;
+    SimdLevel simd = preferredSimdLevel();
+    std::string timingsPath;
+    int checkpointEvery = 0;
+    std::string resumePath;
+    std::string cachePath;
+    bool cacheVelocities = false;
+};
+
+void printUsage() {
+    std::cout << "Usage: pbf_headless [options]\n"
+        << "  --scene <DamBreak|WaterContainer|DropBlock>  scene to simulate (default DamBreak)\n"
+        << "  --seed <n>          scene jitter seed, 0 = random (default 0)\n"
+        << "  --frames <n>        number of simulation steps (default 1000)\n"
+        << "  --dt <seconds>      time step (default 0.016)\n"
+        << "  --cfl <c>           adaptive substeps, a particle moves at most c radii per substep, 0 = one step per frame (default 0)\n"
+        << "  --min-dt <seconds>  shortest adaptive substep (default 0.001)\n"
+        << "  --max-dt <seconds>  longest adaptive substep (default 0.016)\n"
+        << "  --iterations <n>    most density constraint iterations per step (default 4)\n"
+        << "  --min-iterations <n>  fewest iterations before the tolerance may stop the loop (default 1)\n"
+        << "  --tolerance <e>     stop once the mean compression error rho/rho0 - 1 is below e, 0 = always --iterations (default 0)\n"
+        << "  --max-error <e>     with --tolerance, also require the largest compression error below e (default off)\n"
+        << "  --solver <name>     jacobi|gauss-seidel position updates, gauss-seidel sweeps the grid cells by colour (default jacobi)\n"
+        << "  --warm-start <w>    add w times each particle's lambda of the last step to its first iteration, 0 = off (default 0)\n"
+        << "  --chebyshev         Chebyshev acceleration of the density iterations, jacobi only\n"
+        << "  --spectral-radius <r>  for --chebyshev, 0 = estimated while running (default 0)\n"
+        << "  --chebyshev-delay <n>  plain iterations per step before the acceleration starts, at least 1 (default 2)\n"
+        << "  --multigrid <n>     replace the first iteration with a coarse-grid correction of n V-cycles, 0 = off (default 0)\n"
+        << "  --coarse-cell <s>   coarse lattice cell in smoothing lengths (default 2)\n"
+        << "  --max-coarse-move <r>  largest coarse correction of a particle in radii (default 1)\n"
+        << "  --threads <n>       worker threads, 0 = all cores (default 0)\n"
+        << "  --grain <n>         particles per work-stealing chunk, 0 = automatic (default 0)\n"
+        << "  --pin               pin worker threads to cores\n"
+        << "  --out <dir>         output directory (default pbf_output)\n"
+        << "  --dump-every <n>    write a particle snapshot every n frames (default 0 = final only)\n"
+        << "  --reorder-every <n> Morton reorder of the particle storage every n frames, 0 = off (default 25)\n"
+        << "  --neighbor-list <n> neighbours cached per particle each step, 0 = walk the grid (default 48)\n"
+        << "  --grid <mode>       dense (whole box), hashed (cells sized to the particles) or fitted (box around the particles) (default dense)\n"
+        << "  --grid-clear        clear every grid cell each build instead of stamping counts with the build epoch\n"
+        << "  --simd <level>      auto|scalar|avx2|avx512 kernels, clamped to the CPU (default auto)\n"
+        << "  --timings <path>    per-stage timings of every step, .json or CSV (default off)\n"
+        << "  --checkpoint-every <n>  save the full state to <out>/checkpoint.pbfck every n frames, 0 = off (default 0)\n"
+        << "  --resume <path>     continue from a checkpoint instead of a scene, --frames more steps\n"
+        << "  --cache <path>      record every frame to a compressed frame cache (default off)\n"
+        << "  --cache-velocities  store quantised velocities in the frame cache too\n";
+}
+
+bool parseScene(const char* name, SceneType& scene) {
+    if (std::strcmp(name, "DamBreak") == 0) scene = SceneType::DamBreak;
+    else if (std::strcmp(name, "WaterContainer") == 0) scene = SceneType::WaterContainer;
+    else if (std::strcmp(name, "DropBlock") == 0) scene = SceneType::DropBlock;
+    else return false;
+    return true;
+}
+
+bool parseArgs(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (std::strcmp(arg, "--help") == 0 || std::strcmp(arg, "-h") == 0) {
+            return false;
+        }
+        else if (std::strcmp(arg, "--scene") == 0 && hasValue) {
+            if (!parseScene(argv[++i], options.scene)) {
+                std::cerr << "Unknown scene: " << argv[i] << "\n";
+                return false;
+            }
+        }
+        else if (std::strcmp(arg, "--seed") == 0 && hasValue) options.seed = (unsigned int)std::strtoul(argv[++i], nullptr, 10);
+        else if (std::strcmp(arg, "--frames") == 0 && hasValue) options.frames = std::atoi(argv[++i]);
+        else if (std::strcmp(arg, "--dt") == 0 && hasValue) options.dt = (float)std::atof(argv[++i]);
+        else if (std::strcmp(arg, "--cfl") == 0 && hasValue) options.cfl = (float)std::atof(argv[++i]);
+        else if (std::strcmp(arg, "--min-dt") == 0 && hasValue) options.minDt = (float)std::atof(argv[++i]);
+        else if (std::strcmp(arg, "--max-dt") == 0 && hasValue) options.maxDt = (float)std::atof(argv[++i]);
+        else if (std::strcmp(arg, "--iterations") == 0 && hasValue) options.solver.maxIterations = (unsigned int)std::atoi(argv[++i]);
+        else if (std::strcmp(arg, "--min-iterations") == 0 && hasValue) options.solver.minIterations = (unsigned int)std::atoi(argv[++i]);
+        else if (std::strcmp(arg, "--tolerance") == 0 && hasValue) options.solver.tolerance = (float)std::atof(argv[++i]);
+        else if (std::strcmp(arg, "--max-error") == 0 && hasValue) options.solver.maxErrorTolerance = (float)std::atof(argv[++i]);
+        else if (std::strcmp(arg, "--solver") == 0 && hasValue) {
+            if (!parseConstraintSolver(argv[++i], options.solver.solver)) {
+                std::cerr << "Unknown solver: " << argv[i] << "\n";
+                return false;
+            }
+        }
+        else if (std::strcmp(arg, "--warm-start") == 0 && hasValue) options.solver.lambdaWarmStart = (float)std::atof(argv[++i]);
+        else if (std::strcmp(arg, "--chebyshev") == 0) options.solver.chebyshev = true;
+        else if (std::strcmp(arg, "--spectral-radius") == 0 && hasValue) options.solver.spectralRadius = (float)std::atof(argv[++i]);
+        else if (std::strcmp(arg, "--chebyshev-delay") == 0 && hasValue) options.solver.chebyshevDelay = (unsigned int)std::atoi(argv[++i]);
+        else if (std::strcmp(arg, "--multigrid") == 0 && hasValue) options.solver.multigridCycles = (unsigned int)std::atoi(argv[++i]);
+        else if (std::strcmp(arg, "--coarse-cell") == 0 && hasValue) options.solver.coarseCellSize = (float)std::atof(argv[++i]);
+        else if (std::strcmp(arg, "--max-coarse-move") == 0 && hasValue) options.solver.maxCoarseDisplacement = (float)std::atof(argv[++i]);
+        else if (std::strcmp(arg, "--threads") == 0 && hasValue) options.threads = (unsigned int)std::atoi(argv[++i]);
+        else if (std::strcmp(arg, "--grain") == 0 && hasValue) options.grain = (unsigned int)std::atoi(argv[++i]);
+        else if (std::strcmp(arg, "--pin") == 0) options.pin = true;
+        else if (std::strcmp(arg, "--out") == 0 && hasValue) options.outputDir = argv[++i];
+        else if (std::strcmp(arg, "--dump-every") == 0 && hasValue) options.dumpEvery = std::atoi(argv[++i]);
+        else if (std::strcmp(arg, "--reorder-every") == 0 && hasValue) options.reorderEvery = (unsigned int)std::atoi(argv[++i]);
+        else if (std::strcmp(arg, "--neighbor-list") == 0 && hasValue) options.neighborList = (unsigned int)std::atoi(argv[++i]);
+        else if (std::strcmp(arg, "--grid") == 0 && hasValue) {
+            if (!parseGridMode(argv[++i], options.grid)) {
+                std::cerr << "Unknown grid mode: " << argv[i] << "\n";
+                return false;
+            }
+        }
+        else if (std::strcmp(arg, "--grid-clear") == 0) options.gridClear = true;
+        else if (std::strcmp(arg, "--simd") == 0 && hasValue) {
+            if (!parseSimdLevel(argv[++i], options.simd)) {
+                std::cerr << "Unknown SIMD level: " << argv[i] << "\n";
+                return false;
+            }
+        }
+        else if (std::strcmp(arg, "--timings") == 0 && hasValue) options.timingsPath = argv[++i];
+        else if (std::strcmp(arg, "--checkpoint-every") == 0 && hasValue) options.checkpointEvery = std::atoi(argv[++i]);
+        else if (std::strcmp(arg, "--resume") == 0 && hasValue) options.resumePath = argv[++i];
+        else if (std::strcmp(arg, "--cache") == 0 && hasValue) options.cachePath = argv[++i];
+        else if (std::strcmp(arg, "--cache-velocities") == 0) options.cacheVelocities = true;
+        else {
+            std::cerr << "Unknown or incomplete argument: " << arg << "\n";
+            return false;
+        }
+    }
+
+    if (options.frames <= 0 || options.dt <= 0.0f) {
+        std::cerr << "--frames and --dt must be positive\n";
+        return false;
+    }
+    if (options.cfl < 0.0f || options.minDt <= 0.0f || options.maxDt < options.minDt) {
+        std::cerr << "--cfl must not be negative and 0 < --min-dt <= --max-dt\n";
+        return false;
+    }
+    if (options.solver.maxIterations == 0 || options.solver.minIterations > options.solver.maxIterations) {
+        std::cerr << "--iterations must be positive and at least --min-iterations\n";
+        return false;
+    }
+    if (options.solver.lambdaWarmStart < 0.0f || options.solver.lambdaWarmStart >= 1.0f) {
+        std::cerr << "--warm-start must be in [0, 1)\n";
+        return false;
+    }
+    if (options.solver.chebyshev && options.solver.solver != ConstraintSolver::Jacobi) {
+        std::cerr << "--chebyshev needs --solver jacobi\n";
+        return false;
+    }
+    if (options.solver.spectralRadius < 0.0f || options.solver.spectralRadius >= 1.0f) {
+        std::cerr << "--spectral-radius must be in [0, 1)\n";
+        return false;
+    }
+    if (options.solver.chebyshevDelay < 1) {
+        std::cerr << "--chebyshev-delay must be at least 1\n";
+        return false;
+    }
+    if (options.solver.coarseCellSize <= 0.0f || options.solver.maxCoarseDisplacement <= 0.0f) {
+        std::cerr << "--coarse-cell and --max-coarse-move must be positive\n";
+        return false;
+    }
+    return true;
+}
+
+// Raw Particle records, same layout as the particle SSBO, in scene order even after reordering
+bool writeSnapshot(const std::string& path, const std::vector<Particle>& particles) {
+    std::ofstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "[pbf_headless] Failed to open " << path << "\n";
+        return false;
+    }
+    file.write(reinterpret_cast<const char*>(particles.data()), particles.size() * sizeof(Particle));
+    return true;
+}
+
+std::string snapshotPath(const std::string& dir, int frame) {
+    char name[64];
+    std::snprintf(name, sizeof(name), "frame_%06d.bin", frame);
+    return (std::filesystem::path(dir) / name).string();
+}
+
+const char* sceneName(SceneType scene) {
+    switch (scene) {
+    case SceneType::DamBreak: return "DamBreak";
+    case SceneType::WaterContainer: return "WaterContainer";
+    case SceneType::DropBlock: return "DropBlock";
+    }
+    return "Unknown";
+}
+
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseArgs(argc, argv, options)) {
+        printUsage();
+        return 1;
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(options.outputDir, ec);
+    if (ec) {
+        std::cerr << "[pbf_headless] Cannot create output directory " << options.outputDir << ": " << ec.message() << "\n";
+        return 1;
+    }
+
+    PBFSystem pbf;
+    pbf.randomSeed = options.seed;
+    pbf.dt = options.dt;
+    pbf.cflNumber = options.cfl;
+    pbf.minSubstepDt = options.minDt;
+    pbf.maxSubstepDt = options.maxDt;
+    pbf.solverSettings = options.solver;
+    pbf.solverBackend = SolverBackend::CPU;
+    pbf.solverThreads = options.threads;
+    pbf.solverPinThreads = options.pin;
+    pbf.solverGrainSize = options.grain;
+    pbf.reorderInterval = options.reorderEvery;
+    pbf.neighborListCapacity = options.neighborList;
+    pbf.gridMode = options.grid;
+    pbf.gridEpochStamping = !options.gridClear;
+    pbf.cpuSimdLevel = options.simd;
+    pbf.timingLogPath = options.timingsPath;
+
+    if (!options.resumePath.empty()) {
+        //dt and the solver settings come from the checkpoint
+        if (!pbf.loadCheckpoint(options.resumePath)) {
+            std::cerr << "[pbf_headless] Cannot resume from " << options.resumePath << "\n";
+            return 1;
+        }
+
+        //solver and substep flags given with --resume still apply, parsed again over the restored settings
+        Options resumed;
+        resumed.cfl = pbf.cflNumber;
+        resumed.minDt = pbf.minSubstepDt;
+        resumed.maxDt = pbf.maxSubstepDt;
+        resumed.solver = pbf.solverSettings;
+        resumed.gridClear = !pbf.gridEpochStamping;
+        if (!parseArgs(argc, argv, resumed)) {
+            std::cerr << "[pbf_headless] The flags do not fit the settings of " << options.resumePath << "\n";
+            return 1;
+        }
+        pbf.cflNumber = resumed.cfl;
+        pbf.minSubstepDt = resumed.minDt;
+        pbf.maxSubstepDt = resumed.maxDt;
+        pbf.solverSettings = resumed.solver;
+        pbf.gridEpochStamping = !resumed.gridClear;
+        pbf.computeSystem->setSolverSettings(pbf.solverSettings);
+        pbf.computeSystem->setGridEpochStamping(pbf.gridEpochStamping);
+    }
+    else {
+        //DropBlock adds a block on top of the resting container, like pressing 2 then 3 in the viewer
+        if (options.scene == SceneType::DropBlock) {
+            pbf.initScene(SceneType::WaterContainer);
+        }
+        pbf.initScene(options.scene);
+    }
+
+    if (!pbf.computeSystemInitialized) {
+        std::cerr << "[pbf_headless] Compute system failed to initialize\n";
+        return 1;
+    }
+
+    if (!options.cachePath.empty()) {
+        FrameCacheOptions cacheOptions;
+        cacheOptions.velocities = options.cacheVelocities;
+        if (!pbf.openFrameCache(options.cachePath, cacheOptions)) return 1;
+    }
+
+    const int firstFrame = pbf.getFrameCount();
+    const int lastFrame = firstFrame + options.frames;
+    const std::string checkpointPath = (std::filesystem::path(options.outputDir) / "checkpoint.pbfck").string();
+
+    unsigned int numParticles = pbf.computeSystem->getNumParticles();
+    std::cout << "[pbf_headless] " << sceneName(pbf.currentScene) << ": " << numParticles << " particles, "
+        << options.frames << " frames from frame " << firstFrame << ", dt=" << pbf.dt << "\n";
+
+    std::vector<Particle> snapshot;
+    double snapshotSeconds = 0.0;
+    long long totalSubsteps = 0;
+    int maxSubsteps = 0;
+    int maxSubstepsFrame = 0;
+    long long totalIterations = 0;
+    unsigned int maxIterations = 0;
+    pbf.computeSystem->resetThreadPoolStats();
+
+    auto start = std::chrono::steady_clock::now();
+    for (int frame = firstFrame + 1; frame <= lastFrame; ++frame) {
+        pbf.step();
+
+        totalSubsteps += pbf.getLastSubsteps();
+        if (pbf.getLastSubsteps() > maxSubsteps) {
+            maxSubsteps = pbf.getLastSubsteps();
+            maxSubstepsFrame = frame;
+        }
+        totalIterations += pbf.getLastSolverIterations();
+        maxIterations = std::max(maxIterations, pbf.getLastSolverIterations());
+
+        if (options.dumpEvery > 0 && frame % options.dumpEvery == 0) {
+            auto dumpStart = std::chrono::steady_clock::now();
+            pbf.computeSystem->downloadParticles(snapshot);
+            writeSnapshot(snapshotPath(options.outputDir, frame), snapshot);
+            snapshotSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - dumpStart).count();
+        }
+        if (options.checkpointEvery > 0 && frame % options.checkpointEvery == 0 && frame != lastFrame) {
+            auto checkpointStart = std::chrono::steady_clock::now();
+            pbf.saveCheckpoint(checkpointPath);
+            snapshotSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - checkpointStart).count();
+        }
+    }
+    double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    pbf.computeSystem->downloadParticles(snapshot);
+    writeSnapshot(snapshotPath(options.outputDir, lastFrame), snapshot);
+    if (options.checkpointEvery > 0) {
+        pbf.saveCheckpoint(checkpointPath);
+    }
+
+    if (!options.cachePath.empty()) {
+        bool complete = pbf.closeFrameCache();
+        const FrameCacheWriter& cache = pbf.getFrameCache();
+        std::cout << "[pbf_headless] Frame cache: " << cache.getFramesWritten() << " frames, " << cache.getBytesWritten() / (1024.0 * 1024.0)
+            << " MB (" << (double)cache.getRawBytes() / std::max<uint64_t>(cache.getBytesWritten(), 1) << "x smaller than Particle records), "
+            << cache.getStalls() << " stalls" << (complete ? "\n" : ", INCOMPLETE\n");
+    }
+
+    double simSeconds = wallSeconds - snapshotSeconds;
+    std::cout << "[pbf_headless] Total wall time: " << wallSeconds << " s ("
+        << snapshotSeconds << " s writing snapshots and checkpoints)\n";
+    std::cout << "[pbf_headless] Steps/second: " << (options.frames / simSeconds) << "\n";
+    if (pbf.cflNumber > 0.0f) {
+        std::cout << "[pbf_headless] Substeps: " << (double)totalSubsteps / options.frames << " per frame on average, "
+            << maxSubsteps << " at most (frame " << maxSubstepsFrame << "), cfl " << pbf.cflNumber << "\n";
+    }
+    if (pbf.solverSettings.tolerance > 0.0f) {
+        const DensitySolverStats& solverStats = pbf.computeSystem->getSolverStats();
+        std::cout << "[pbf_headless] Solver iterations: " << (double)totalIterations / options.frames << " per frame on average, "
+            << maxIterations << " at most, last density error " << solverStats.averageError << " mean / " << solverStats.maxError << " max\n";
+    }
+    if (pbf.solverSettings.chebyshev) {
+        std::cout << "[pbf_headless] Chebyshev acceleration: spectral radius " << pbf.computeSystem->getSolverStats().spectralRadius
+            << (pbf.solverSettings.spectralRadius > 0.0f ? "\n" : " (estimated)\n");
+    }
+    if (pbf.solverSettings.multigridCycles > 0) {
+        std::cout << "[pbf_headless] Coarse correction: " << pbf.solverSettings.multigridCycles << " V-cycles, last relative residual "
+            << pbf.computeSystem->getSolverStats().coarseResidual << "\n";
+    }
+
+    ThreadPoolStats pool = pbf.computeSystem->getThreadPoolStats();
+    std::cout << "[pbf_headless] Thread pool: " << pbf.computeSystem->getNumThreads() << " threads, "
+        << 100.0 * pool.utilisation(pbf.computeSystem->getNumThreads()) << "% utilisation, "
+        << pool.steals << " steals / " << pool.chunks << " chunks\n";
+
+    if (!options.timingsPath.empty()) {
+        pbf.computeSystem->closeTimingLog();
+        const TimingLog& timings = pbf.computeSystem->getTimingLog();
+        std::cout << "[pbf_headless] Stage timings: " << timings.getWritten() << " samples in " << options.timingsPath
+            << " (" << timings.getDropped() << " dropped)\n";
+    }
+
+    return 0;
+}
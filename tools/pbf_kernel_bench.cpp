@@ -0,0 +1,254 @@
+// Microbenchmark of the batched SPH kernels behind calculateDensity and
+// applyPositionUpdate, one thread, for every SIMD level the CPU supports.
+//
+// A scene is stepped on the CPU backend until it has settled into realistic
+// neighbourhoods, its neighbour lists are built once, and then only the inner
+// loops (kernels->densityTerms / positionDelta over every particle) are timed.
+//
+//   pbf_kernel_bench --scene DamBreak --steps 30 --repeat 20 --json kernels.json
+//
+#include "PBFSystem.h"
+#include "SphKernels.h"
+#include "UniformGrid.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    SceneType scene = SceneType::DamBreak;
+    int steps = 30;
+    int repeat = 20;
+    unsigned int seed = 1;
+    std::string jsonPath = "pbf_kernel_bench.json";
+};
+
+// Settled particles and their neighbours (CSR), same 1.1h lists as the solver
+struct Workload {
+    float h;
+    std::vector<glm::vec3> positions;
+    std::vector<float> lambda;
+    std::vector<unsigned int> offsets;
+    std::vector<unsigned int> ids;
+};
+
+struct LevelResult {
+    SimdLevel level;
+    double densityMs;           //median of one pass over every particle
+    double positionUpdateMs;
+    double densityMaxError;     //against the scalar kernels, relative to the largest value
+    double positionMaxError;
+};
+
+void printUsage() {
+    std::cout << "Usage: pbf_kernel_bench [options]\n"
+        << "  --scene <DamBreak|WaterContainer>  scene to settle (default DamBreak)\n"
+        << "  --steps <n>         solver steps before measuring (default 30)\n"
+        << "  --repeat <n>        timed passes per kernel (default 20)\n"
+        << "  --seed <n>          scene jitter seed (default 1)\n"
+        << "  --json <path>       output file (default pbf_kernel_bench.json)\n";
+}
+
+bool parseArgs(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (std::strcmp(arg, "--help") == 0 || std::strcmp(arg, "-h") == 0) {
+            return false;
+        }
+        else if (std::strcmp(arg, "--scene") == 0 && hasValue) {
+            const char* name = argv[++i];
+            if (std::strcmp(name, "DamBreak") == 0) options.scene = SceneType::DamBreak;
+            else if (std::strcmp(name, "WaterContainer") == 0) options.scene = SceneType::WaterContainer;
+            else {
+                std::cerr << "Unknown scene: " << name << "\n";
+                return false;
+            }
+        }
+        else if (std::strcmp(arg, "--steps") == 0 && hasValue) options.steps = std::atoi(argv[++i]);
+        else if (std::strcmp(arg, "--repeat") == 0 && hasValue) options.repeat = std::atoi(argv[++i]);
+        else if (std::strcmp(arg, "--seed") == 0 && hasValue) options.seed = (unsigned int)std::strtoul(argv[++i], nullptr, 10);
+        else if (std::strcmp(arg, "--json") == 0 && hasValue) options.jsonPath = argv[++i];
+        else {
+            std::cerr << "Unknown or incomplete argument: " << arg << "\n";
+            return false;
+        }
+    }
+
+    if (options.steps < 0 || options.repeat <= 0) {
+        std::cerr << "--steps must be non-negative and --repeat positive\n";
+        return false;
+    }
+    return true;
+}
+
+bool buildWorkload(const Options& options, Workload& workload) {
+    PBFSystem pbf;
+    pbf.solverBackend = SolverBackend::CPU;
+    pbf.randomSeed = options.seed;
+    pbf.initScene(options.scene);
+    if (!pbf.computeSystemInitialized) return false;
+
+    for (int step = 0; step < options.steps; ++step) {
+        pbf.step();
+    }
+
+    std::vector<Particle> particles;
+    pbf.computeSystem->downloadParticles(particles);
+
+    workload.h = pbf.h;
+    workload.positions.resize(particles.size());
+    workload.lambda.resize(particles.size());
+    for (size_t i = 0; i < particles.size(); ++i) {
+        workload.positions[i] = particles[i].predictedPosition;
+        workload.lambda[i] = particles[i].lambda;
+    }
+
+    glm::vec3 origin(pbf.minBoundary);
+    glm::vec3 domain = glm::vec3(pbf.maxBoundary) - origin;
+    UniformGrid grid;
+    grid.configure(origin, glm::ivec3(glm::ceil(domain / pbf.cellSize)), pbf.cellSize);
+
+    ThreadPool pool(1);
+    grid.build(pool, workload.positions.size(), [&](size_t id) { return workload.positions[id]; });
+
+    const float radius = pbf.h * 1.1f;
+    workload.offsets.assign(1, 0);
+    for (size_t id = 0; id < workload.positions.size(); ++id) {
+        const glm::vec3 pos = workload.positions[id];
+        grid.forEachCandidate(pos, [&](unsigned int neighborId) {
+            glm::vec3 diff = pos - workload.positions[neighborId];
+            if (neighborId != id && glm::dot(diff, diff) < radius * radius) workload.ids.push_back(neighborId);
+        });
+        workload.offsets.push_back((unsigned int)workload.ids.size());
+    }
+    return true;
+}
+
+NeighborBatch batchFor(const Workload& workload, size_t id) {
+    NeighborBatch batch;
+    batch.positions = &workload.positions[0].x;
+    batch.lambda = workload.lambda.data();
+    batch.ids = workload.ids.data() + workload.offsets[id];
+    batch.count = workload.offsets[id + 1] - workload.offsets[id];
+    return batch;
+}
+
+void runDensity(const SphKernelTable& kernels, const SphKernelConstants& kernel, const Workload& workload, std::vector<float>& out) {
+    for (size_t id = 0; id < workload.positions.size(); ++id) {
+        kernels.densityTerms(kernel, &workload.positions[id].x, batchFor(workload, id), &out[2 * id], &out[2 * id + 1]);
+    }
+}
+
+void runPositionUpdate(const SphKernelTable& kernels, const SphKernelConstants& kernel, const Workload& workload, std::vector<float>& out) {
+    for (size_t id = 0; id < workload.positions.size(); ++id) {
+        kernels.positionDelta(kernel, &workload.positions[id].x, workload.lambda[id], batchFor(workload, id), &out[3 * id]);
+    }
+}
+
+template <typename Fn>
+double medianMs(int repeat, Fn&& fn) {
+    std::vector<double> samples;
+    for (int r = 0; r < repeat; ++r) {
+        auto start = Clock::now();
+        fn();
+        samples.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+    }
+    std::sort(samples.begin(), samples.end());
+    return samples[samples.size() / 2];
+}
+
+double maxRelativeError(const std::vector<float>& reference, const std::vector<float>& values) {
+    double scale = 0.0, error = 0.0;
+    for (size_t i = 0; i < reference.size(); ++i) {
+        scale = std::max(scale, (double)std::abs(reference[i]));
+        error = std::max(error, (double)std::abs(reference[i] - values[i]));
+    }
+    return scale > 0.0 ? error / scale : error;
+}
+
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseArgs(argc, argv, options)) {
+        printUsage();
+        return 1;
+    }
+
+    Workload workload;
+    if (!buildWorkload(options, workload)) {
+        std::cerr << "[pbf_kernel_bench] Compute system failed to initialize\n";
+        return 1;
+    }
+
+    const size_t count = workload.positions.size();
+    const double pairs = (double)workload.ids.size();
+    std::cout << "[pbf_kernel_bench] " << count << " particles, " << pairs / std::max<size_t>(1, count) << " neighbours per particle\n";
+
+    const SphKernelConstants kernel(workload.h);
+    std::vector<float> referenceDensity(2 * count), referenceDelta(3 * count);
+    std::vector<float> density(2 * count), delta(3 * count);
+    runDensity(getSphKernels(SimdLevel::Scalar), kernel, workload, referenceDensity);
+    runPositionUpdate(getSphKernels(SimdLevel::Scalar), kernel, workload, referenceDelta);
+
+    std::vector<LevelResult> results;
+    const SimdLevel supported = detectSimdLevel();
+    for (SimdLevel level : { SimdLevel::Scalar, SimdLevel::AVX2, SimdLevel::AVX512 }) {
+        if (level > supported) break;
+        const SphKernelTable& kernels = getSphKernels(level);
+
+        LevelResult result;
+        result.level = level;
+        result.densityMs = medianMs(options.repeat, [&]() { runDensity(kernels, kernel, workload, density); });
+        result.positionUpdateMs = medianMs(options.repeat, [&]() { runPositionUpdate(kernels, kernel, workload, delta); });
+        result.densityMaxError = maxRelativeError(referenceDensity, density);
+        result.positionMaxError = maxRelativeError(referenceDelta, delta);
+        results.push_back(result);
+
+        std::cout << "[pbf_kernel_bench] " << simdLevelName(level)
+            << ": density " << result.densityMs << " ms (" << results[0].densityMs / result.densityMs << "x)"
+            << ", position update " << result.positionUpdateMs << " ms (" << results[0].positionUpdateMs / result.positionUpdateMs << "x)\n";
+    }
+
+    std::ofstream out(options.jsonPath);
+    if (!out.is_open()) {
+        std::cerr << "[pbf_kernel_bench] Failed to open " << options.jsonPath << "\n";
+        return 1;
+    }
+
+    out << "{\n";
+    out << "  \"benchmark\": \"pbf_kernel_bench\",\n";
+    out << "  \"particles\": " << count << ",\n";
+    out << "  \"neighbor_pairs\": " << (size_t)pairs << ",\n";
+    out << "  \"repeat\": " << options.repeat << ",\n";
+    out << "  \"levels\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const LevelResult& r = results[i];
+        out << "    {\"simd\": \"" << simdLevelName(r.level) << "\""
+            << ", \"density_ms\": " << r.densityMs
+            << ", \"density_ns_per_pair\": " << r.densityMs * 1e6 / pairs
+            << ", \"density_speedup\": " << results[0].densityMs / r.densityMs
+            << ", \"density_max_rel_error\": " << r.densityMaxError
+            << ", \"position_update_ms\": " << r.positionUpdateMs
+            << ", \"position_update_ns_per_pair\": " << r.positionUpdateMs * 1e6 / pairs
+            << ", \"position_update_speedup\": " << results[0].positionUpdateMs / r.positionUpdateMs
+            << ", \"position_update_max_rel_error\": " << r.positionMaxError << "}"
+            << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n";
+    out << "}\n";
+    std::cout << "[pbf_kernel_bench] Wrote " << options.jsonPath << "\n";
+
+    return 0;
+}
@@ -0,0 +1,363 @@
+// Offline surface passes of the water renderer on the CPU: settles a scene, or
+// loads a pbf_headless snapshot, and runs the grid-accelerated surface detection,
+// Laplacian smoothing and WPCA anisotropy on every core, then optionally meshes the
+// anisotropic splats with marching cubes. Surface flags are checked against the
+// brute-force O(N^2) test on a sample of particles.
+//
+//   pbf_surface --scene DamBreak --steps 30 --check 2000 --flags surface.bin
+//   pbf_surface --input runs/dam/frame_002000.bin --particle-radius 0.2 --anisotropy aniso.bin
+//   pbf_surface --input runs/dam/frame_002000.bin --particle-radius 0.2 --check 0 --mesh frame_002000.ply
+//
+#include "PBFSystem.h"
+#include "ParticleSurface.h"
+#include "SurfaceMesher.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    SceneType scene = SceneType::DamBreak;
+    int steps = 30;
+    unsigned int threads = 0;
+    unsigned int seed = 1;
+    float radiusScale = 2.0f;       //neighbour radius in particle radii, as WaterRenderer
+    int threshold = 25;
+    unsigned int check = 1000;      //particles compared with the brute-force scan
+    std::string inputPath;          //pbf_headless snapshot instead of a scene
+    float particleRadius = 0.2f;    //of the snapshot, the scene knows its own
+    std::string flagsPath;
+    std::string anisotropyPath;
+    std::string meshPath;
+    float voxelScale = 0.5f;        //marching cubes voxel in particle radii
+    float isoValue = 0.5f;
+    bool isotropic = false;         //plain splats around the positions
+    bool narrowBand = true;         //only sample the blocks the surface particles reach
+};
+
+void printUsage() {
+    std::cout << "Usage: pbf_surface [options]\n"
+        << "  --scene <DamBreak|WaterContainer>  scene to settle (default DamBreak)\n"
+        << "  --steps <n>         CPU solver steps before the surface passes (default 30)\n"
+        << "  --threads <n>       worker threads, 0 = all cores (default 0)\n"
+        << "  --seed <n>          scene jitter seed (default 1)\n"
+        << "  --radius <r>        surface neighbour radius in particle radii (default 2)\n"
+        << "  --threshold <n>     fewer neighbours than this marks a surface particle (default 25)\n"
+        << "  --check <n>         particles verified against the O(N^2) scan, 0 = none (default 1000)\n"
+        << "  --input <path>      raw Particle snapshot written by pbf_headless, instead of --scene\n"
+        << "  --particle-radius <r>  particle radius of the snapshot (default 0.2)\n"
+        << "  --flags <path>      write the flags as one int32 per particle, scene order\n"
+        << "  --anisotropy <path> write the smoothed center (3 floats) and kernel matrix G\n"
+        << "                      (xx xy xz yy yz zz) of every particle, 9 float32 each\n"
+        << "  --mesh <path>       marching cubes surface as binary PLY (.ply) or OBJ (otherwise)\n"
+        << "  --voxel <v>         mesh voxel size in particle radii (default 0.5)\n"
+        << "  --iso <d>           iso value of the splatted density, 1 at a lone particle (default 0.5)\n"
+        << "  --isotropic         mesh spherical splats around the positions, not the anisotropic kernels\n"
+        << "  --no-band           sample every occupied block, not just those near surface particles\n";
+}
+
+bool parseArgs(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (std::strcmp(arg, "--help") == 0 || std::strcmp(arg, "-h") == 0) {
+            return false;
+        }
+        else if (std::strcmp(arg, "--scene") == 0 && hasValue) {
+            const char* name = argv[++i];
+            if (std::strcmp(name, "DamBreak") == 0) options.scene = SceneType::DamBreak;
+            else if (std::strcmp(name, "WaterContainer") == 0) options.scene = SceneType::WaterContainer;
+            else {
+                std::cerr << "Unknown scene: " << name << "\n";
+                return false;
+            }
+        }
+        else if (std::strcmp(arg, "--steps") == 0 && hasValue) options.steps = std::atoi(argv[++i]);
+        else if (std::strcmp(arg, "--threads") == 0 && hasValue) options.threads = (unsigned int)std::atoi(argv[++i]);
+        else if (std::strcmp(arg, "--seed") == 0 && hasValue) options.seed = (unsigned int)std::strtoul(argv[++i], nullptr, 10);
+        else if (std::strcmp(arg, "--radius") == 0 && hasValue) options.radiusScale = (float)std::atof(argv[++i]);
+        else if (std::strcmp(arg, "--threshold") == 0 && hasValue) options.threshold = std::atoi(argv[++i]);
+        else if (std::strcmp(arg, "--check") == 0 && hasValue) options.check = (unsigned int)std::atoi(argv[++i]);
+        else if (std::strcmp(arg, "--input") == 0 && hasValue) options.inputPath = argv[++i];
+        else if (std::strcmp(arg, "--particle-radius") == 0 && hasValue) options.particleRadius = (float)std::atof(argv[++i]);
+        else if (std::strcmp(arg, "--flags") == 0 && hasValue) options.flagsPath = argv[++i];
+        else if (std::strcmp(arg, "--anisotropy") == 0 && hasValue) options.anisotropyPath = argv[++i];
+        else if (std::strcmp(arg, "--mesh") == 0 && hasValue) options.meshPath = argv[++i];
+        else if (std::strcmp(arg, "--voxel") == 0 && hasValue) options.voxelScale = (float)std::atof(argv[++i]);
+        else if (std::strcmp(arg, "--iso") == 0 && hasValue) options.isoValue = (float)std::atof(argv[++i]);
+        else if (std::strcmp(arg, "--isotropic") == 0) options.isotropic = true;
+        else if (std::strcmp(arg, "--no-band") == 0) options.narrowBand = false;
+        else {
+            std::cerr << "Unknown or incomplete argument: " << arg << "\n";
+            return false;
+        }
+    }
+
+    if (options.steps < 0 || options.radiusScale <= 0.0f || options.particleRadius <= 0.0f || options.voxelScale <= 0.0f || options.isoValue <= 0.0f) {
+        std::cerr << "--steps must be non-negative, --radius, --particle-radius, --voxel and --iso positive\n";
+        return false;
+    }
+    return true;
+}
+
+// The definition the shader used before the grid: every other particle is tested
+int bruteForceFlag(const std::vector<glm::vec3>& positions, size_t id, float radius, int threshold) {
+    int neighborCount = 0;
+    for (size_t j = 0; j < positions.size(); ++j) {
+        if (j == id) continue;
+        glm::vec3 diff = positions[id] - positions[j];
+        if (glm::dot(diff, diff) < radius * radius) neighborCount++;
+    }
+    return neighborCount < threshold ? 1 : 0;
+}
+
+double msSince(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+bool readSnapshot(const std::string& path, std::vector<glm::vec3>& positions) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+        std::cerr << "[pbf_surface] Failed to open " << path << "\n";
+        return false;
+    }
+
+    std::streamoff bytes = file.tellg();
+    if (bytes % sizeof(Particle) != 0) {
+        std::cerr << "[pbf_surface] " << path << " is not a whole number of Particle records\n";
+        return false;
+    }
+
+    std::vector<Particle> particles((size_t)(bytes / sizeof(Particle)));
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(particles.data()), bytes);
+
+    positions.resize(particles.size());
+    for (size_t i = 0; i < particles.size(); ++i) {
+        positions[i] = particles[i].position;
+    }
+    return true;
+}
+
+// Settles the scene on the CPU backend, returns its particle radius and cell size
+bool settleScene(const Options& options, std::vector<glm::vec3>& positions, float& particleRadius, float& cellSize) {
+    PBFSystem pbf;
+    pbf.solverBackend = SolverBackend::CPU;
+    pbf.solverThreads = options.threads;
+    pbf.randomSeed = options.seed;
+    pbf.initScene(options.scene);
+    if (!pbf.computeSystemInitialized) {
+        std::cerr << "[pbf_surface] Compute system failed to initialize\n";
+        return false;
+    }
+
+    for (int step = 0; step < options.steps; ++step) {
+        pbf.step();
+    }
+
+    std::vector<Particle> particles;
+    pbf.computeSystem->downloadParticles(particles);
+    positions.resize(particles.size());
+    for (size_t i = 0; i < particles.size(); ++i) {
+        positions[i] = particles[i].position;
+    }
+
+    particleRadius = pbf.particleRadius;
+    cellSize = pbf.cellSize;
+    return true;
+}
+
+bool writeAnisotropy(const std::string& path, const std::vector<glm::vec3>& centers, const std::vector<glm::mat3>& matrices) {
+    std::ofstream out(path, std::ios::binary);
+    if (!out.is_open()) {
+        std::cerr << "[pbf_surface] Failed to open " << path << "\n";
+        return false;
+    }
+
+    std::vector<float> records(centers.size() * 9);
+    for (size_t i = 0; i < centers.size(); ++i) {
+        const glm::mat3& g = matrices[i];
+        float* r = &records[i * 9];
+        r[0] = centers[i].x; r[1] = centers[i].y; r[2] = centers[i].z;
+        r[3] = g[0][0]; r[4] = g[1][0]; r[5] = g[2][0];
+        r[6] = g[1][1]; r[7] = g[2][1]; r[8] = g[2][2];
+    }
+    out.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(float));
+    return true;
+}
+
+bool hasExtension(const std::string& path, const char* extension) {
+    size_t length = std::strlen(extension);
+    return path.size() >= length && path.compare(path.size() - length, length, extension) == 0;
+}
+
+// Binary little-endian PLY with normals, or OBJ for anything else
+bool writeMesh(const std::string& path, const SurfaceMesh& mesh) {
+    std::ofstream out(path, std::ios::binary);
+    if (!out.is_open()) {
+        std::cerr << "[pbf_surface] Failed to open " << path << "\n";
+        return false;
+    }
+
+    if (hasExtension(path, ".ply")) {
+        out << "ply\nformat binary_little_endian 1.0\n"
+            << "element vertex " << mesh.vertices.size() << "\n"
+            << "property float x\nproperty float y\nproperty float z\n"
+            << "property float nx\nproperty float ny\nproperty float nz\n"
+            << "element face " << mesh.indices.size() / 3 << "\n"
+            << "property list uchar uint vertex_indices\nend_header\n";
+
+        std::vector<float> vertices(mesh.vertices.size() * 6);
+        for (size_t i = 0; i < mesh.vertices.size(); ++i) {
+            float* v = &vertices[i * 6];
+            v[0] = mesh.vertices[i].x; v[1] = mesh.vertices[i].y; v[2] = mesh.vertices[i].z;
+            v[3] = mesh.normals[i].x; v[4] = mesh.normals[i].y; v[5] = mesh.normals[i].z;
+        }
+        out.write(reinterpret_cast<const char*>(vertices.data()), vertices.size() * sizeof(float));
+
+        //count byte followed by three indices
+        std::vector<char> faces(mesh.indices.size() / 3 * 13);
+        for (size_t t = 0; t < mesh.indices.size() / 3; ++t) {
+            faces[t * 13] = 3;
+            std::memcpy(&faces[t * 13 + 1], &mesh.indices[t * 3], 3 * sizeof(unsigned int));
+        }
+        out.write(faces.data(), faces.size());
+        return true;
+    }
+
+    for (size_t i = 0; i < mesh.vertices.size(); ++i) {
+        out << "v " << mesh.vertices[i].x << " " << mesh.vertices[i].y << " " << mesh.vertices[i].z << "\n";
+    }
+    for (size_t i = 0; i < mesh.normals.size(); ++i) {
+        out << "vn " << mesh.normals[i].x << " " << mesh.normals[i].y << " " << mesh.normals[i].z << "\n";
+    }
+    for (size_t t = 0; t + 2 < mesh.indices.size(); t += 3) {
+        out << "f";
+        for (int k = 0; k < 3; ++k) {
+            unsigned int v = mesh.indices[t + k] + 1;
+            out << " " << v << "//" << v;
+        }
+        out << "\n";
+    }
+    return true;
+}
+
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseArgs(argc, argv, options)) {
+        printUsage();
+        return 1;
+    }
+
+    std::vector<glm::vec3> positions;
+    float particleRadius = options.particleRadius;
+    float solverCellSize = 2.5f * particleRadius;
+    if (!options.inputPath.empty()) {
+        if (!readSnapshot(options.inputPath, positions)) return 1;
+    }
+    else if (!settleScene(options, positions, particleRadius, solverCellSize)) {
+        return 1;
+    }
+
+    ThreadPool pool(options.threads);
+    const float radius = options.radiusScale * particleRadius;
+    const AnisotropyParams anisotropy(particleRadius);
+    const float cellSize = std::max({ radius, anisotropy.smoothingRadius, solverCellSize });
+
+    auto start = Clock::now();
+    UniformGrid grid;
+    buildSurfaceGrid(pool, positions, cellSize, grid);
+    double gridMs = msSince(start);
+
+    start = Clock::now();
+    std::vector<int> flags;
+    if (!detectSurfaceParticles(pool, grid, positions, radius, options.threshold, flags)) {
+        return 1;
+    }
+    double detectMs = msSince(start);
+
+    size_t surfaceCount = std::count(flags.begin(), flags.end(), 1);
+    std::cout << "[pbf_surface] " << positions.size() << " particles on " << pool.getNumThreads() << " threads: grid "
+        << gridMs << " ms, surface detection " << detectMs << " ms, " << surfaceCount << " surface particles\n";
+
+    if (options.check > 0 && !positions.empty()) {
+        size_t samples = std::min<size_t>(options.check, positions.size());
+        size_t mismatches = 0;
+        for (size_t s = 0; s < samples; ++s) {
+            size_t id = s * positions.size() / samples;
+            if (bruteForceFlag(positions, id, radius, options.threshold) != flags[id]) mismatches++;
+        }
+        std::cout << "[pbf_surface] Brute-force check: " << mismatches << " of " << samples << " sampled flags differ\n";
+        if (mismatches > 0) return 1;
+    }
+
+    start = Clock::now();
+    std::vector<glm::vec3> centers;
+    std::vector<glm::mat3> matrices;
+    if (!smoothParticleCenters(pool, grid, positions, flags, anisotropy, centers)) {
+        return 1;
+    }
+    double smoothMs = msSince(start);
+
+    //anisotropy queries around the smoothed centers, which the grid of the positions still covers
+    start = Clock::now();
+    if (!computeAnisotropyMatrices(pool, grid, positions, flags, centers, anisotropy, matrices)) {
+        return 1;
+    }
+    double anisotropyMs = msSince(start);
+
+    std::cout << "[pbf_surface] Smoothing " << smoothMs << " ms, anisotropy " << anisotropyMs << " ms\n";
+
+    if (!options.flagsPath.empty()) {
+        std::ofstream out(options.flagsPath, std::ios::binary);
+        if (!out.is_open()) {
+            std::cerr << "[pbf_surface] Failed to open " << options.flagsPath << "\n";
+            return 1;
+        }
+        out.write(reinterpret_cast<const char*>(flags.data()), flags.size() * sizeof(int));
+        std::cout << "[pbf_surface] Wrote " << options.flagsPath << "\n";
+    }
+
+    if (!options.anisotropyPath.empty()) {
+        if (!writeAnisotropy(options.anisotropyPath, centers, matrices)) return 1;
+        std::cout << "[pbf_surface] Wrote " << options.anisotropyPath << "\n";
+    }
+
+    if (!options.meshPath.empty()) {
+        SurfaceMesherParams meshParams(particleRadius);
+        meshParams.voxelSize = options.voxelScale * particleRadius;
+        meshParams.kernelRadius = anisotropy.smoothingRadius;
+        meshParams.isoValue = options.isoValue;
+
+        SurfaceMesher mesher(meshParams);
+        SurfaceMesh mesh;
+        const std::vector<glm::vec3> noCenters;
+        const std::vector<glm::mat3> noMatrices;
+        const std::vector<int> noFlags;
+        if (!mesher.extract(pool, positions, options.isotropic ? noCenters : centers, options.isotropic ? noMatrices : matrices,
+            options.narrowBand ? flags : noFlags, mesh)) {
+            return 1;
+        }
+
+        const SurfaceMesherStats& stats = mesher.getStats();
+        std::cout << "[pbf_surface] Mesh: " << mesh.vertices.size() << " vertices, " << mesh.indices.size() / 3 << " triangles from "
+            << stats.activeBlocks << " of " << stats.occupiedBlocks << " blocks; setup " << stats.setupMs << " ms, splat + marching cubes "
+            << stats.meshMs << " ms, stitch " << stats.stitchMs << " ms\n";
+
+        if (!writeMesh(options.meshPath, mesh)) return 1;
+        std::cout << "[pbf_surface] Wrote " << options.meshPath << "\n";
+    }
+
+    return 0;
+}